@@ -0,0 +1,910 @@
+#include "DownloadManager.h"
+#include "StateStream.h"
+
+#include "utility/Clock.h"
+#include "utility/FairShare.h"
+#include "utility/HostBuckets.h"
+#include "utility/HostLimiter.h"
+#include "utility/TokenBucket.h"
+
+#include <string.h>
+
+#include <vector>
+#include <deque>
+#include <string>
+#include <algorithm>
+
+using Utility::Clock;
+using Utility::FairShare;
+
+// KiB per second a task wants beyond twice what it got, so a new or idle one can start.
+static const int minShare = 64;
+
+struct TaskEntry
+{
+    TaskBase* task;
+    DownloadManager::Priority priority;
+    size_t received; // since speed was shared last.
+
+    TaskEntry(TaskBase* t, DownloadManager::Priority p)
+        : task(t),
+          priority(p),
+          received(0)
+        {}
+};
+
+/**
+ * A task waiting in queue. All strings are packed in one buffer seperated by '\0', so
+ * it costs one allocation of the strings' length and a few words. A task from the state
+ * file keeps only its index there, and is decoded when it's admitted.
+ */
+class QueuedTask
+{
+public:
+    enum Field
+    {
+        QT_URI,
+        QT_OUTPUT_DIR,
+        QT_OUTPUT_NAME,
+        QT_OPTIONS,
+        QT_COMMENT,
+    };
+
+    QueuedTask(ProtocolBase* protocol,
+               const char* uri,
+               const char* outputDir,
+               const char* outputName,
+               const char* options,
+               const char* comment)
+        : protocol_(protocol),
+          stored_(npos)
+        {
+            const char* fields[] = { uri, outputDir, outputName, options, comment };
+            for (size_t i=0; i<sizeof(fields)/sizeof(fields[0]); ++i)
+            {
+                if (fields[i] != NULL)
+                    data_.append(fields[i]);
+                data_.push_back('\0');
+            }
+        }
+
+    QueuedTask(ProtocolBase* protocol, size_t stored)
+        : protocol_(protocol),
+          stored_(stored)
+        {}
+
+    static const size_t npos = size_t(-1);
+
+    ProtocolBase* protocol() { return protocol_; }
+    size_t stored()          { return stored_; }
+
+    const char* get(Field field)
+        {
+            const char* p = data_.c_str();
+            for (int i=0; i<field; ++i)
+                p += strlen(p) + 1;
+            return p;
+        }
+
+private:
+    ProtocolBase* protocol_;
+    size_t stored_;
+    std::string data_;
+};
+
+typedef std::vector<ProtocolBase*> Protocols;
+typedef std::vector<TaskEntry> Tasks;
+typedef std::deque<QueuedTask> Queue;
+
+struct DownloadManagerData
+{
+    Protocols protocols;
+    Tasks tasks;
+    Queue queues[DownloadManager::PRIORITY_INTERACTIVE + 1];
+
+    int maxConnections;
+    int maxActiveTasks;
+    int maxOpenFiles;
+    size_t maxDownloadSpeed;
+    bool needBalance;
+
+    Clock::Ms sharedTime;
+
+    // enforce max download speed in tasks' receive path.
+    Utility::TokenBucket bucket;
+
+    // state file opened by DownloadManager::open(), and which stored tasks are made.
+    StateIndex stored;
+    std::vector<bool> hydrated;
+
+    // finished tasks restored by load(), saved again as they are.
+    std::vector<TaskRecord> finished;
+
+    DownloadManagerData()
+        : maxConnections(FairShare::noLimited),
+          maxActiveTasks(FairShare::noLimited),
+          maxOpenFiles(FairShare::noLimited),
+          maxDownloadSpeed(0),
+          needBalance(false),
+          sharedTime(0)
+        {}
+
+    Tasks::iterator find(TaskBase* task);
+    ProtocolBase* protocol(const char* uri);
+    std::auto_ptr<TaskBase> makeTask(QueuedTask& q);
+    int activeTasks();
+    int openFiles();
+    void admit(DownloadManager* manager);
+    void balance();
+    void shareSpeed();
+
+    static int weight(DownloadManager::Priority priority);
+};
+
+int DownloadManagerData::weight(DownloadManager::Priority priority)
+{
+    switch (priority)
+    {
+    case DownloadManager::PRIORITY_BACKGROUND:
+        return 1;
+    case DownloadManager::PRIORITY_INTERACTIVE:
+        return 16;
+    case DownloadManager::PRIORITY_NORMAL:
+    default:
+        return 4;
+    }
+}
+
+Tasks::iterator DownloadManagerData::find(TaskBase* task)
+{
+    Tasks::iterator it = tasks.begin();
+    for (; it != tasks.end(); ++it)
+    {
+        if (it->task == task)
+            break;
+    }
+
+    return it;
+}
+
+ProtocolBase* DownloadManagerData::protocol(const char* uri)
+{
+    for (Protocols::iterator it = protocols.begin(); it != protocols.end(); ++it)
+    {
+        if ((*it)->canProcess(uri))
+            return *it;
+    }
+
+    return NULL;
+}
+
+std::auto_ptr<TaskBase> DownloadManagerData::makeTask(QueuedTask& q)
+{
+    if (q.stored() == QueuedTask::npos)
+        return q.protocol()->getTask(q.get(QueuedTask::QT_URI),
+                                     q.get(QueuedTask::QT_OUTPUT_DIR),
+                                     q.get(QueuedTask::QT_OUTPUT_NAME),
+                                     q.get(QueuedTask::QT_OPTIONS),
+                                     q.get(QueuedTask::QT_COMMENT));
+
+    TaskRecord r;
+    if (!stored.record(q.stored(), r))
+        return std::auto_ptr<TaskBase>();
+
+    hydrated[q.stored()] = true;
+    return q.protocol()->getTask(r.uri.c_str(),
+                                 r.outputDir.c_str(),
+                                 r.outputName.c_str(),
+                                 r.options.c_str(),
+                                 r.comment.c_str());
+}
+
+int DownloadManagerData::activeTasks()
+{
+    int ret = 0;
+    for (Tasks::iterator it = tasks.begin(); it != tasks.end(); ++it)
+    {
+        TaskBase::TaskState state = it->task->state();
+        if (state == TaskBase::TASK_DOWNLOAD || state == TaskBase::TASK_UPLOAD)
+            ++ret;
+    }
+
+    return ret;
+}
+
+/**
+ * A running task will open its output file, it's counted before the task does.
+ */
+int DownloadManagerData::openFiles()
+{
+    int ret = 0;
+    for (Tasks::iterator it = tasks.begin(); it != tasks.end(); ++it)
+    {
+        TaskBase::TaskState state = it->task->state();
+        int files = it->task->openFiles();
+        if (state == TaskBase::TASK_DOWNLOAD || state == TaskBase::TASK_UPLOAD)
+            files = std::max(files, 1);
+        ret += files;
+    }
+
+    return ret;
+}
+
+/**
+ * Make tasks from queue while there are free slots, higher priority first.
+ */
+void DownloadManagerData::admit(DownloadManager* manager)
+{
+    int active = activeTasks();
+    int files = openFiles();
+    for (int p=DownloadManager::PRIORITY_INTERACTIVE; p>=DownloadManager::PRIORITY_BACKGROUND; --p)
+    {
+        Queue& queue = queues[p];
+        while (queue.size() > 0 &&
+               (maxActiveTasks == FairShare::noLimited || active < maxActiveTasks) &&
+               (maxOpenFiles == FairShare::noLimited || files < maxOpenFiles))
+        {
+            std::auto_ptr<TaskBase> task = makeTask(queue.front());
+            queue.pop_front();
+            if (task.get() == NULL)
+                continue;
+
+            TaskBase* t = task.release();
+            tasks.push_back(TaskEntry(t, DownloadManager::Priority(p)));
+            t->setSpeedLimiter(&bucket);
+            needBalance = true;
+
+            if (!t->start())
+            {
+                LOG(0, "start queued task %p fail\n", t);
+                continue;
+            }
+
+            ++active;
+            files += std::max(t->openFiles(), 1);
+            manager->taskAdmitted(t);
+        }
+    }
+}
+
+/**
+ * Divide connections between downloading tasks by weight.
+ */
+void DownloadManagerData::balance()
+{
+    needBalance = false;
+
+    std::vector<TaskBase*> running;
+    std::vector<int> weights;
+    std::vector<int> demands;
+    for (Tasks::iterator it = tasks.begin(); it != tasks.end(); ++it)
+    {
+        if (it->task->state() != TaskBase::TASK_DOWNLOAD)
+            continue;
+
+        running.push_back(it->task);
+        weights.push_back(weight(it->priority));
+        demands.push_back(it->task->connectionDemand());
+    }
+
+    std::vector<int> shares;
+    FairShare::allocate(weights, demands, maxConnections, shares);
+
+    for (size_t i=0; i<running.size(); ++i)
+    {
+        LOG(0, "task %p get %d/%d connections\n", running[i], shares[i], demands[i]);
+        running[i]->setConnectionLimit(maxConnections == FairShare::noLimited ? -1 : shares[i]);
+    }
+}
+
+/**
+ * Once a second, divide max download speed between downloading tasks by weight, through
+ * rate of their own buckets. A task wants twice what it got in last second, so it can grow,
+ * and what's left by tasks under their share is given to all by weight.
+ */
+void DownloadManagerData::shareSpeed()
+{
+    Clock::Ms now = Clock::now();
+    if (sharedTime != 0 && now >= sharedTime && now - sharedTime < 1000)
+        return;
+
+    Clock::Ms passed = (sharedTime != 0 && now > sharedTime) ? now - sharedTime : 1000;
+    sharedTime = now;
+
+    std::vector<TaskEntry*> running;
+    std::vector<int> weights;
+    std::vector<int> demands;
+    long long sumWeight = 0;
+    for (Tasks::iterator it = tasks.begin(); it != tasks.end(); ++it)
+    {
+        size_t received = it->received;
+        it->received = 0;
+        if (it->task->state() != TaskBase::TASK_DOWNLOAD)
+            continue;
+
+        // in KiB per second, to fit in int.
+        running.push_back(&*it);
+        weights.push_back(weight(it->priority));
+        demands.push_back(int(received * 1000 / passed / 1024 * 2) + minShare);
+        sumWeight += weights.back();
+    }
+
+    if (maxDownloadSpeed == 0)
+    {
+        for (size_t i=0; i<running.size(); ++i)
+            running[i]->task->setSpeedShare(0);
+        return;
+    }
+
+    int capacity = int(std::max(maxDownloadSpeed / 1024, size_t(1)));
+    std::vector<int> shares;
+    FairShare::allocate(weights, demands, capacity, shares);
+
+    int left = capacity;
+    for (size_t i=0; i<shares.size(); ++i)
+        left -= shares[i];
+
+    for (size_t i=0; i<running.size(); ++i)
+    {
+        long long share = shares[i];
+        if (left > 0)
+            share += (long long)left * weights[i] / sumWeight;
+        running[i]->task->setSpeedShare(size_t(std::max(share, 1LL)) * 1024);
+    }
+}
+
+DownloadManager::DownloadManager()
+    : d(new DownloadManagerData)
+{}
+
+DownloadManager::~DownloadManager()
+{
+    for (Tasks::iterator it = d->tasks.begin(); it != d->tasks.end(); ++it)
+    {
+        it->task->setSpeedLimiter(NULL);
+        delete it->task;
+    }
+
+    for (Protocols::iterator it = d->protocols.begin(); it != d->protocols.end(); ++it)
+    {
+        delete *it;
+    }
+}
+
+void DownloadManager::addProtocol(std::auto_ptr<ProtocolBase> protocol)
+{
+    d->protocols.push_back(protocol.release());
+}
+
+TaskBase* DownloadManager::addTask(const char* uri,
+                                   const char* outputDir,
+                                   const char* outputName,
+                                   const char* options,
+                                   const char* comment,
+                                   Priority priority)
+{
+    LOG(0, "enter DownloadManager::addTask, uri = %s\n", (uri == NULL) ? "NULL" : uri);
+
+    if (uri == NULL || outputDir == NULL)
+        return NULL;
+
+    ProtocolBase* p = d->protocol(uri);
+    if (p == NULL)
+    {
+        LOG(0, "don't know how to download %s\n", uri);
+        return NULL;
+    }
+
+    std::auto_ptr<TaskBase> task = p->getTask(uri, outputDir, outputName, options, comment);
+    if (task.get() == NULL)
+        return NULL;
+
+    d->tasks.push_back(TaskEntry(task.get(), priority));
+    task->setSpeedLimiter(&d->bucket);
+    return task.release();
+}
+
+bool DownloadManager::enqueueTask(const char* uri,
+                                  const char* outputDir,
+                                  const char* outputName,
+                                  const char* options,
+                                  const char* comment,
+                                  Priority priority)
+{
+    if (uri == NULL || outputDir == NULL)
+        return false;
+
+    ProtocolBase* p = d->protocol(uri);
+    if (p == NULL)
+    {
+        LOG(0, "don't know how to download %s\n", uri);
+        return false;
+    }
+
+    d->queues[priority].push_back(QueuedTask(p, uri, outputDir, outputName, options, comment));
+    return true;
+}
+
+size_t DownloadManager::queuedTasks()
+{
+    size_t ret = 0;
+    for (int p=PRIORITY_BACKGROUND; p<=PRIORITY_INTERACTIVE; ++p)
+    {
+        ret += d->queues[p].size();
+    }
+
+    return ret;
+}
+
+bool DownloadManager::hasTask(TaskBase* task)
+{
+    return d->find(task) != d->tasks.end();
+}
+
+bool DownloadManager::removeTask(TaskBase* task)
+{
+    Tasks::iterator it = d->find(task);
+    if (it == d->tasks.end())
+        return false;
+
+    d->tasks.erase(it);
+    delete task;
+    d->needBalance = true;
+
+    return true;
+}
+
+bool DownloadManager::startTask(TaskBase* task)
+{
+    Tasks::iterator it = d->find(task);
+    if (it == d->tasks.end())
+        return false;
+
+    if (!task->start())
+        return false;
+
+    d->needBalance = true;
+    return true;
+}
+
+bool DownloadManager::stopTask(TaskBase* task)
+{
+    Tasks::iterator it = d->find(task);
+    if (it == d->tasks.end())
+        return false;
+
+    if (!task->stop())
+        return false;
+
+    d->needBalance = true;
+    return true;
+}
+
+bool DownloadManager::setPriority(TaskBase* task, Priority priority)
+{
+    Tasks::iterator it = d->find(task);
+    if (it == d->tasks.end())
+        return false;
+
+    if (it->priority != priority)
+    {
+        it->priority = priority;
+        d->needBalance = true;
+    }
+
+    return true;
+}
+
+DownloadManager::Priority DownloadManager::priority(TaskBase* task)
+{
+    Tasks::iterator it = d->find(task);
+    if (it == d->tasks.end())
+        return PRIORITY_NORMAL;
+
+    return it->priority;
+}
+
+void DownloadManager::setMaxConnections(int max)
+{
+    d->maxConnections = (max < 0) ? FairShare::noLimited : max;
+    d->needBalance = true;
+}
+
+void DownloadManager::setMaxConnectionsPerHost(int max)
+{
+    Utility::HostLimiter::hosts().setMaxPerHost(max);
+}
+
+void DownloadManager::setMaxConnectionsPerAddress(int max)
+{
+    Utility::HostLimiter::addresses().setMaxPerHost(max);
+}
+
+void DownloadManager::setMaxDownloadSpeed(size_t bytesPerSecond)
+{
+    d->maxDownloadSpeed = bytesPerSecond;
+    d->bucket.setRate(bytesPerSecond);
+
+    // share it at next perform.
+    d->sharedTime = 0;
+}
+
+void DownloadManager::setMaxHostSpeed(size_t bytesPerSecond)
+{
+    Utility::HostBuckets::hosts().setRate(bytesPerSecond);
+}
+
+bool DownloadManager::setMaxDownloadSpeed(TaskBase* task, size_t bytesPerSecond)
+{
+    Tasks::iterator it = d->find(task);
+    if (it == d->tasks.end())
+        return false;
+
+    task->setMaxDownloadSpeed(bytesPerSecond);
+    return true;
+}
+
+void DownloadManager::setMaxActiveTasks(int max)
+{
+    d->maxActiveTasks = (max < 0) ? FairShare::noLimited : max;
+}
+
+void DownloadManager::setMaxOpenFiles(int max)
+{
+    d->maxOpenFiles = (max < 0) ? FairShare::noLimited : max;
+}
+
+static DownloadManager::Priority storedPriority(uint8_t priority)
+{
+    return (priority > DownloadManager::PRIORITY_INTERACTIVE)
+        ? DownloadManager::PRIORITY_NORMAL : DownloadManager::Priority(priority);
+}
+
+static bool queuedState(uint8_t state)
+{
+    return state == TaskRecord::RS_QUEUED || state == TaskRecord::RS_DOWNLOAD;
+}
+
+bool DownloadManager::load(std::istream& in)
+{
+    LOG(0, "enter DownloadManager::load\n");
+
+    StateReader reader(in);
+    StateSettings settings;
+    if (!reader.readHeader(settings))
+        return false;
+
+    setMaxConnections(settings.maxConnections);
+    setMaxDownloadSpeed(size_t(settings.maxDownloadSpeed));
+    setMaxActiveTasks(settings.maxActiveTasks);
+    setMaxOpenFiles(settings.maxOpenFiles);
+    setMaxConnectionsPerHost(settings.maxConnectionsPerHost);
+    setMaxConnectionsPerAddress(settings.maxConnectionsPerAddress);
+    setMaxHostSpeed(size_t(settings.maxHostSpeed));
+
+    std::vector<TaskRecord> records;
+    while (reader.read(records))
+    {
+        for (size_t i=0; i<records.size(); ++i)
+        {
+            TaskRecord& r = records[i];
+            ProtocolBase* p = d->protocol(r.uri.c_str());
+            if (p == NULL)
+            {
+                LOG(0, "don't know how to download %s\n", r.uri.c_str());
+                continue;
+            }
+
+            if (r.state == TaskRecord::RS_FINISH)
+            {
+                d->finished.push_back(r);
+                continue;
+            }
+
+            Priority priority = storedPriority(r.priority);
+            if (queuedState(r.state))
+            {
+                d->queues[priority].push_back(QueuedTask(p,
+                                                         r.uri.c_str(),
+                                                         r.outputDir.c_str(),
+                                                         r.outputName.c_str(),
+                                                         r.options.c_str(),
+                                                         r.comment.c_str()));
+                continue;
+            }
+
+            std::auto_ptr<TaskBase> task = p->getTask(r.uri.c_str(),
+                                                      r.outputDir.c_str(),
+                                                      r.outputName.c_str(),
+                                                      r.options.c_str(),
+                                                      r.comment.c_str());
+            if (task.get() == NULL)
+                continue;
+
+            TaskBase* t = task.release();
+            d->tasks.push_back(TaskEntry(t, priority));
+            t->setSpeedLimiter(&d->bucket);
+            taskLoaded(t);
+        }
+    }
+
+    return reader.complete();
+}
+
+static void queuedRecord(QueuedTask& q, int priority, TaskRecord& r)
+{
+    r.uri = q.get(QueuedTask::QT_URI);
+    r.outputDir = q.get(QueuedTask::QT_OUTPUT_DIR);
+    r.outputName = q.get(QueuedTask::QT_OUTPUT_NAME);
+    r.options = q.get(QueuedTask::QT_OPTIONS);
+    r.comment = q.get(QueuedTask::QT_COMMENT);
+    r.priority = priority;
+    r.state = TaskRecord::RS_QUEUED;
+    r.totalSize = 0;
+    r.downloadSize = 0;
+}
+
+static void taskRecord(const TaskEntry& entry, TaskRecord& r)
+{
+    TaskBase* task = entry.task;
+    r.uri = task->uri();
+    r.outputDir = task->outputDir();
+    r.outputName = (task->outputName() == NULL) ? "" : task->outputName();
+    r.options = (task->options() == NULL) ? "" : task->options();
+    r.comment = (task->comment() == NULL) ? "" : task->comment();
+    r.priority = entry.priority;
+    r.totalSize = task->totalSize();
+    r.downloadSize = task->downloadSize();
+
+    switch (task->state())
+    {
+    case TaskBase::TASK_DOWNLOAD:
+    case TaskBase::TASK_UPLOAD:
+        r.state = TaskRecord::RS_DOWNLOAD;
+        break;
+    case TaskBase::TASK_ERROR:
+        r.state = TaskRecord::RS_ERROR;
+        break;
+    case TaskBase::TASK_FINISH:
+        r.state = TaskRecord::RS_FINISH;
+        break;
+    default:
+        r.state = TaskRecord::RS_WAIT;
+        break;
+    }
+}
+
+bool DownloadManager::save(std::ostream& out)
+{
+    LOG(0, "enter DownloadManager::save\n");
+
+    StateSettings settings;
+    settings.maxConnections = d->maxConnections;
+    settings.maxActiveTasks = d->maxActiveTasks;
+    settings.maxOpenFiles = d->maxOpenFiles;
+    settings.maxDownloadSpeed = d->maxDownloadSpeed;
+    settings.maxConnectionsPerHost = Utility::HostLimiter::hosts().maxPerHost();
+    settings.maxConnectionsPerAddress = Utility::HostLimiter::addresses().maxPerHost();
+    settings.maxHostSpeed = Utility::HostBuckets::hosts().rate();
+
+    StateWriter writer(out);
+    if (!writer.writeHeader(settings))
+        return false;
+
+    // one record at a time, the state is never built in memory.
+    TaskRecord record;
+    for (Tasks::iterator it = d->tasks.begin(); it != d->tasks.end(); ++it)
+    {
+        taskRecord(*it, record);
+        if (!writer.write(record))
+            return false;
+    }
+
+    for (size_t i=0; i<d->finished.size(); ++i)
+    {
+        if (!writer.write(d->finished[i]))
+            return false;
+    }
+
+    for (int p=PRIORITY_INTERACTIVE; p>=PRIORITY_BACKGROUND; --p)
+    {
+        Queue& queue = d->queues[p];
+        for (Queue::iterator it = queue.begin(); it != queue.end(); ++it)
+        {
+            if (it->stored() == QueuedTask::npos)
+                queuedRecord(*it, p, record);
+            else if (d->stored.record(it->stored(), record))
+                record.priority = p;
+            else
+                continue;
+
+            if (!writer.write(record))
+                return false;
+        }
+    }
+
+    // stopped and finished tasks of the state file which are never made.
+    TaskSummary summary;
+    for (size_t i=0; i<d->hydrated.size(); ++i)
+    {
+        if (d->hydrated[i] || !d->stored.summary(i, summary) || queuedState(summary.state))
+            continue;
+
+        if (d->stored.record(i, record) && !writer.write(record))
+            return false;
+    }
+
+    return writer.finish();
+}
+
+bool DownloadManager::open(const char* path)
+{
+    LOG(0, "enter DownloadManager::open, path = %s\n", (path == NULL) ? "NULL" : path);
+
+    if (path == NULL || d->stored.isOpen())
+        return false;
+
+    StateSettings settings;
+    if (!d->stored.open(path, settings))
+        return false;
+
+    setMaxConnections(settings.maxConnections);
+    setMaxDownloadSpeed(size_t(settings.maxDownloadSpeed));
+    setMaxActiveTasks(settings.maxActiveTasks);
+    setMaxOpenFiles(settings.maxOpenFiles);
+    setMaxConnectionsPerHost(settings.maxConnectionsPerHost);
+    setMaxConnectionsPerAddress(settings.maxConnectionsPerAddress);
+    setMaxHostSpeed(size_t(settings.maxHostSpeed));
+
+    d->hydrated.assign(d->stored.size(), false);
+
+    // only index entries are read, records are decoded when tasks are made.
+    TaskSummary summary;
+    for (size_t i=0; i<d->stored.size(); ++i)
+    {
+        if (!d->stored.summary(i, summary))
+        {
+            d->hydrated[i] = true;
+            continue;
+        }
+
+        if (!queuedState(summary.state))
+            continue;
+
+        ProtocolBase* p = d->protocol(summary.uri);
+        if (p == NULL)
+        {
+            LOG(0, "don't know how to download %s\n", summary.uri);
+            d->hydrated[i] = true;
+            continue;
+        }
+
+        d->queues[storedPriority(summary.priority)].push_back(QueuedTask(p, i));
+    }
+
+    return true;
+}
+
+size_t DownloadManager::storedTasks()
+{
+    return d->stored.size();
+}
+
+bool DownloadManager::storedTask(size_t index, TaskSummary& summary)
+{
+    if (index >= d->hydrated.size() || d->hydrated[index])
+        return false;
+
+    return d->stored.summary(index, summary);
+}
+
+TaskBase* DownloadManager::startStoredTask(size_t index)
+{
+    TaskSummary summary;
+    if (!storedTask(index, summary) || queuedState(summary.state) ||
+        summary.state == TaskRecord::RS_FINISH)
+        return NULL;
+
+    TaskRecord r;
+    if (!d->stored.record(index, r))
+        return NULL;
+
+    ProtocolBase* p = d->protocol(r.uri.c_str());
+    if (p == NULL)
+        return NULL;
+
+    std::auto_ptr<TaskBase> task = p->getTask(r.uri.c_str(),
+                                              r.outputDir.c_str(),
+                                              r.outputName.c_str(),
+                                              r.options.c_str(),
+                                              r.comment.c_str());
+    if (task.get() == NULL)
+        return NULL;
+
+    d->hydrated[index] = true;
+
+    TaskBase* t = task.release();
+    d->tasks.push_back(TaskEntry(t, storedPriority(r.priority)));
+    t->setSpeedLimiter(&d->bucket);
+    if (t->start())
+        d->needBalance = true;
+    else
+        LOG(0, "start stored task %p fail\n", t);
+
+    return t;
+}
+
+bool DownloadManager::removeStoredTask(size_t index)
+{
+    TaskSummary summary;
+    if (!storedTask(index, summary) || queuedState(summary.state))
+        return false;
+
+    d->hydrated[index] = true;
+    return true;
+}
+
+bool DownloadManager::fdSet(fd_set* read, fd_set* write, fd_set* exc, int* max)
+{
+    bool ret = true;
+    for (Tasks::iterator it = d->tasks.begin(); it != d->tasks.end(); ++it)
+    {
+        if (it->task->state() != TaskBase::TASK_DOWNLOAD)
+            continue;
+
+        if (!it->task->fdSet(read, write, exc, max))
+            ret = false;
+    }
+
+    return ret;
+}
+
+long DownloadManager::timeout()
+{
+    long ms = -1;
+    for (Tasks::iterator it = d->tasks.begin(); it != d->tasks.end(); ++it)
+    {
+        if (it->task->state() != TaskBase::TASK_DOWNLOAD)
+            continue;
+
+        long t = it->task->timeout();
+        if (t >= 0 && (ms < 0 || t < ms))
+            ms = t;
+    }
+
+    return ms;
+}
+
+int DownloadManager::perform(size_t* download, size_t* upload)
+{
+    d->shareSpeed();
+    d->admit(this);
+
+    int running = 0;
+    for (Tasks::iterator it = d->tasks.begin(); it != d->tasks.end(); ++it)
+    {
+        TaskBase* task = it->task;
+        TaskBase::TaskState old = task->state();
+        if (old != TaskBase::TASK_DOWNLOAD && old != TaskBase::TASK_UPLOAD)
+            continue;
+
+        size_t size = task->performDownload();
+        it->received += size;
+        if (download != NULL)
+            *download += size;
+
+        size = task->performUpload();
+        if (upload != NULL)
+            *upload += size;
+
+        if (task->state() != old)
+            d->needBalance = true;
+        else
+            ++running;
+    }
+
+    if (d->needBalance)
+        d->balance();
+
+    return running + queuedTasks();
+}
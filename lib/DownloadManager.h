@@ -0,0 +1,198 @@
+#ifndef DOWNLOAD_MANAGER_HEADER
+#define DOWNLOAD_MANAGER_HEADER
+
+#include "protocols/ProtocolBase.h"
+#include "protocols/TaskBase.h"
+#include "StateStream.h"
+
+#include <boost/signals.hpp>
+
+#include <memory>
+#include <istream>
+#include <ostream>
+
+struct DownloadManagerData;
+
+/**
+ * Normal usage:
+ * DownloadManager manager;
+ * manager.addProtocol(std::auto_ptr<ProtocolBase>(new HttpProtocol));
+ *
+ * TaskBase* task = manager.addTask(uri, outputDir, outputName, options, comment,
+ *                                  DownloadManager::PRIORITY_INTERACTIVE);
+ * manager.startTask(task);
+ *
+ * while (manager.perform(&download, &upload) > 0) { select on manager.fdSet(), for at most manager.timeout() }
+ *
+ * manager.removeTask(task);
+ *
+ * Connections and receive bandwidth are shared between downloading tasks by weight of
+ * their priority. A task takes what it needs if it's under its share, what it leaves is
+ * divided by the others. Priority can be changed at any time.
+ *
+ * For a lot of tasks, use enqueueTask() instead. Queued tasks are kept as compact
+ * descriptors, and are made into TaskBase and started in perform() when the number of
+ * active tasks and open files allows, higher priority first.
+ *
+ * State is saved by save(), and restored at once by load() or lazily by open().
+ */
+class DownloadManager : private Noncopiable
+{
+public:
+    enum Priority
+    {
+        PRIORITY_BACKGROUND,
+        PRIORITY_NORMAL,
+        PRIORITY_INTERACTIVE,
+    };
+
+    /**
+     * \brief Callback when a queued task is made and started.
+     */
+    boost::signal<void (TaskBase* task)> taskAdmitted;
+
+    /**
+     * \brief Callback when load() makes a task which isn't queued.
+     */
+    boost::signal<void (TaskBase* task)> taskLoaded;
+
+    DownloadManager();
+    ~DownloadManager();
+
+    void addProtocol(std::auto_ptr<ProtocolBase> protocol);
+
+    TaskBase* addTask(const char* uri,
+                      const char* outputDir,
+                      const char* outputName,
+                      const char* options,
+                      const char* comment,
+                      Priority priority = PRIORITY_NORMAL);
+    bool enqueueTask(const char* uri,
+                     const char* outputDir,
+                     const char* outputName,
+                     const char* options,
+                     const char* comment,
+                     Priority priority = PRIORITY_NORMAL);
+    size_t queuedTasks();
+
+    bool hasTask   (TaskBase* task);
+    bool removeTask(TaskBase* task);
+    bool startTask (TaskBase* task);
+    bool stopTask  (TaskBase* task);
+
+    bool     setPriority(TaskBase* task, Priority priority);
+    Priority priority   (TaskBase* task);
+
+    /**
+     * \brief Limit the total connections of all tasks, -1 means no limit.
+     */
+    void setMaxConnections(int max);
+
+    /**
+     * \brief Limit connections to one host, of all tasks, -1 means no limit.
+     *
+     * It's process wide, shared with other managers. A session for a busy host waits
+     * until a connection to it is done, and so does one for a busy IP address when a task
+     * spreads its sessions over the addresses of its host.
+     */
+    void setMaxConnectionsPerHost(int max);
+    void setMaxConnectionsPerAddress(int max);
+
+    /**
+     * \brief Limit the total receive speed in bytes per second, 0 means no limit.
+     */
+    void setMaxDownloadSpeed(size_t bytesPerSecond);
+
+    /**
+     * \brief Limit receive speed from one host, of all tasks, 0 means no limit.
+     *
+     * It's process wide like connections per host. Bytes from a mirror are charged to the
+     * mirror's host.
+     */
+    void setMaxHostSpeed(size_t bytesPerSecond);
+
+    /**
+     * \brief Limit receive speed of one task, 0 means no limit.
+     *
+     * The task still gets no more than its share of the total speed. Returns false if the
+     * task isn't of this manager.
+     */
+    bool setMaxDownloadSpeed(TaskBase* task, size_t bytesPerSecond);
+
+    /**
+     * \brief Limit the tasks admitted from queue, -1 means no limit.
+     *
+     * Every downloading task is counted as one active task.
+     */
+    void setMaxActiveTasks(int max);
+
+    /**
+     * \brief Stop admitting tasks from queue while tasks hold this many files, -1 means no limit.
+     *
+     * Files are counted by TaskBase::openFiles(), with files read to verify or hash a
+     * download, and a downloading task is counted as one file at least.
+     */
+    void setMaxOpenFiles(int max);
+
+    /**
+     * \brief Restore tasks and limits saved by save(), in addition to current ones.
+     *
+     * Tasks which were downloading and queued tasks go to queue, to be admitted again by
+     * perform(). Finished tasks aren't made, their records are kept and saved again.
+     * Others are made stopped, and reported by taskLoaded.
+     * Returns false if the stream is bad or truncated, tasks before that are still loaded.
+     */
+    bool load(std::istream& in);
+
+    /**
+     * \brief Write all tasks and limits in binary, see StateStream.h.
+     *
+     * Finished tasks are written with state RS_FINISH, so the index lists them too.
+     */
+    bool save(std::ostream& out);
+
+    /**
+     * \brief Restore from a file written by save(), decoding tasks only when they're made.
+     *
+     * Limits are set and queued tasks are queued by their index entry. Other tasks stay in
+     * the file, listed by storedTask(), until startStoredTask(). Finished tasks are only
+     * listed, until removeStoredTask(). Startup time and memory
+     * don't grow with stopped tasks. The file is mapped while the manager lives, so save to
+     * another file and rename it over. Only one file can be opened.
+     */
+    bool open(const char* path);
+
+    size_t storedTasks();
+
+    /**
+     * \brief Summary of a task in the opened file, false if it's out of range or already made.
+     */
+    bool storedTask(size_t index, TaskSummary& summary);
+
+    /**
+     * \brief Make and start a stopped task of the opened file, NULL on fail.
+     *
+     * Queued tasks of the file are made by perform() instead, finished ones are never made.
+     */
+    TaskBase* startStoredTask(size_t index);
+
+    /**
+     * \brief Forget a stopped or finished task of the opened file, it's not saved again.
+     */
+    bool removeStoredTask(size_t index);
+
+    bool fdSet(fd_set* read, fd_set* write, fd_set* exc, int* max);
+
+    /**
+     * \brief Most milliseconds select may wait on fdSet(), -1 means no limit.
+     *
+     * It's 0 while a task checks a file, fd set has nothing of it.
+     */
+    long timeout();
+    int perform(size_t* download, size_t* upload);
+
+private:
+    std::auto_ptr<DownloadManagerData> d;
+};
+
+#endif
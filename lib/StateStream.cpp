@@ -0,0 +1,531 @@
+#include "StateStream.h"
+
+#include "utility/Crc32c.h"
+#include "utility/Utility.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace
+{
+
+const char magic[4] = { 'D', 'M', 'S', '1' };
+const char indexMagic[4] = { 'D', 'M', 'S', 'X' };
+const size_t oldHeaderSize = 32;    // of version 1 and 2.
+const uint32_t endMark = 0xffffffff;
+const uint32_t maxRecord = 16 * 1024 * 1024;
+const size_t endSize = 12;
+
+void put32(unsigned char* p, uint32_t v)
+{
+    for (int i=0; i<4; ++i)
+        p[i] = (v >> (i * 8)) & 0xff;
+}
+
+void put64(unsigned char* p, uint64_t v)
+{
+    for (int i=0; i<8; ++i)
+        p[i] = (v >> (i * 8)) & 0xff;
+}
+
+uint32_t get32(const unsigned char* p)
+{
+    uint32_t v = 0;
+    for (int i=3; i>=0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+uint64_t get64(const unsigned char* p)
+{
+    uint64_t v = 0;
+    for (int i=7; i>=0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+void putString(std::vector<unsigned char>& buffer, const std::string& s)
+{
+    size_t pos = buffer.size();
+    buffer.resize(pos + 4 + s.length());
+    put32(&buffer[pos], uint32_t(s.length()));
+    if (s.length() > 0)
+        memcpy(&buffer[pos + 4], s.data(), s.length());
+}
+
+bool getString(const unsigned char*& p, const unsigned char* end, std::string& s)
+{
+    if (end - p < 4)
+        return false;
+
+    size_t length = get32(p);
+    p += 4;
+    if (size_t(end - p) < length)
+        return false;
+
+    s.assign(reinterpret_cast<const char*>(p), length);
+    p += length;
+    return true;
+}
+
+/**
+ * Length of the header, by the version in its first 8 bytes, 0 if it's not supported.
+ */
+size_t headerLength(const unsigned char* header)
+{
+    if (memcmp(header, magic, sizeof(magic)) != 0)
+    {
+        LOG(0, "bad state header\n");
+        return 0;
+    }
+
+    uint32_t version = get32(header + 4);
+    if (version == 0 || version > StateWriter::version)
+    {
+        LOG(0, "state version %u is not supported\n", version);
+        return 0;
+    }
+
+    return (version < 3) ? oldHeaderSize : StateWriter::headerSize;
+}
+
+/**
+ * Header of length from headerLength(), settings it doesn't have keep their defaults.
+ */
+bool readHeader(const unsigned char* header, size_t length, StateSettings& settings)
+{
+    if (get32(header + length - 4) != Utility::Crc32c::compute(header, length - 4))
+    {
+        LOG(0, "bad state header\n");
+        return false;
+    }
+
+    settings = StateSettings();
+    settings.maxConnections = int32_t(get32(header + 8));
+    settings.maxActiveTasks = int32_t(get32(header + 12));
+    settings.maxOpenFiles = int32_t(get32(header + 16));
+    settings.maxDownloadSpeed = get64(header + 20);
+    if (length > oldHeaderSize)
+    {
+        settings.maxConnectionsPerHost = int32_t(get32(header + 28));
+        settings.maxConnectionsPerAddress = int32_t(get32(header + 32));
+        settings.maxHostSpeed = get64(header + 36);
+    }
+
+    return true;
+}
+
+/**
+ * Record is [length, body, crc of body].
+ */
+bool decode(const unsigned char* record, TaskRecord& task)
+{
+    size_t length = get32(record);
+    const unsigned char* p = record + 4;
+    const unsigned char* end = p + length;
+    if (get32(end) != Utility::Crc32c::compute(p, length) || length < 18)
+        return false;
+
+    task.priority = p[0];
+    task.state = p[1];
+    task.totalSize = get64(p + 2);
+    task.downloadSize = get64(p + 10);
+    p += 18;
+
+    return getString(p, end, task.uri) &&
+        getString(p, end, task.outputDir) &&
+        getString(p, end, task.outputName) &&
+        getString(p, end, task.options) &&
+        getString(p, end, task.comment) &&
+        p == end;
+}
+
+}
+
+const uint32_t StateWriter::version;
+const size_t StateWriter::headerSize;
+const size_t StateWriter::entrySize;
+const size_t StateWriter::footerSize;
+const size_t StateReader::batchSize;
+
+StateWriter::StateWriter(std::ostream& out)
+    : out_(out),
+      offset_(0),
+      records_(0)
+{}
+
+bool StateWriter::writeHeader(const StateSettings& settings)
+{
+    unsigned char header[headerSize];
+    memset(header, 0, sizeof(header));
+    memcpy(header, magic, sizeof(magic));
+    put32(header + 4, version);
+    put32(header + 8, uint32_t(settings.maxConnections));
+    put32(header + 12, uint32_t(settings.maxActiveTasks));
+    put32(header + 16, uint32_t(settings.maxOpenFiles));
+    put64(header + 20, settings.maxDownloadSpeed);
+    put32(header + 28, uint32_t(settings.maxConnectionsPerHost));
+    put32(header + 32, uint32_t(settings.maxConnectionsPerAddress));
+    put64(header + 36, settings.maxHostSpeed);
+    put32(header + headerSize - 4, Utility::Crc32c::compute(header, headerSize - 4));
+
+    out_.write(reinterpret_cast<char*>(header), headerSize);
+    offset_ = headerSize;
+    return out_.good();
+}
+
+bool StateWriter::write(const TaskRecord& record)
+{
+    buffer_.resize(22);
+    buffer_[4] = record.priority;
+    buffer_[5] = record.state;
+    put64(&buffer_[6], record.totalSize);
+    put64(&buffer_[14], record.downloadSize);
+    putString(buffer_, record.uri);
+    putString(buffer_, record.outputDir);
+    putString(buffer_, record.outputName);
+    putString(buffer_, record.options);
+    putString(buffer_, record.comment);
+
+    size_t length = buffer_.size() - 4;
+    if (length > maxRecord)
+    {
+        LOG(0, "task record of %s is too long\n", record.uri.c_str());
+        return false;
+    }
+
+    put32(&buffer_[0], uint32_t(length));
+    buffer_.resize(buffer_.size() + 4);
+    put32(&buffer_[4 + length], Utility::Crc32c::compute(&buffer_[4], length));
+
+    out_.write(reinterpret_cast<char*>(&buffer_[0]), buffer_.size());
+
+    size_t pos = index_.size();
+    index_.resize(pos + entrySize);
+    unsigned char* entry = &index_[pos];
+    put64(entry, offset_);
+    put64(entry + 8, record.totalSize);
+    put64(entry + 16, record.downloadSize);
+    put32(entry + 24, uint32_t(uris_.length()));
+    entry[28] = record.priority;
+    entry[29] = record.state;
+    entry[30] = entry[31] = 0;
+    uris_.append(record.uri.c_str(), record.uri.length() + 1);
+
+    offset_ += buffer_.size();
+    ++records_;
+
+    return out_.good();
+}
+
+bool StateWriter::finish()
+{
+    unsigned char mark[4 + endSize];
+    put32(mark, endMark);
+    put64(mark + 4, records_);
+    put32(mark + 12, Utility::Crc32c::compute(mark + 4, 8));
+
+    out_.write(reinterpret_cast<char*>(mark), sizeof(mark));
+    offset_ += sizeof(mark);
+
+    uint32_t crc = 0;
+    if (index_.size() > 0)
+    {
+        out_.write(reinterpret_cast<char*>(&index_[0]), index_.size());
+        crc = Utility::Crc32c::compute(&index_[0], index_.size());
+    }
+    out_.write(uris_.data(), uris_.length());
+    crc = Utility::Crc32c::update(crc, uris_.data(), uris_.length());
+
+    unsigned char footer[footerSize];
+    put64(footer, offset_);
+    put64(footer + 8, offset_ + index_.size());
+    put64(footer + 16, records_);
+    put32(footer + 24, crc);
+    memcpy(footer + 28, indexMagic, sizeof(indexMagic));
+    put32(footer + 32, Utility::Crc32c::compute(footer, 32));
+    out_.write(reinterpret_cast<char*>(footer), footerSize);
+
+    offset_ += index_.size() + uris_.length() + footerSize;
+    index_.clear();
+    uris_.clear();
+
+    out_.flush();
+    return out_.good();
+}
+
+/**
+ * Decode a slice of a batch.
+ */
+class StateReader::DecodeJob : public Utility::ThreadPool::Job
+{
+public:
+    DecodeJob(const std::vector<unsigned char>& buffer,
+              const std::vector<size_t>& offsets,
+              std::vector<TaskRecord>& records,
+              size_t slices)
+        : buffer_(buffer),
+          offsets_(offsets),
+          records_(records),
+          slices_(slices),
+          good_(slices, 1)
+        {}
+
+    void run(size_t index)
+        {
+            size_t begin = offsets_.size() * index / slices_;
+            size_t end = offsets_.size() * (index + 1) / slices_;
+            for (size_t i=begin; i<end; ++i)
+            {
+                if (!decode(&buffer_[offsets_[i]], records_[i]))
+                {
+                    good_[index] = 0;
+                    return;
+                }
+            }
+        }
+
+    bool good()
+        {
+            return std::find(good_.begin(), good_.end(), 0) == good_.end();
+        }
+
+private:
+    const std::vector<unsigned char>& buffer_;
+    const std::vector<size_t>& offsets_;
+    std::vector<TaskRecord>& records_;
+    size_t slices_;
+    std::vector<char> good_;
+};
+
+StateReader::StateReader(std::istream& in, size_t threads)
+    : in_(in),
+      pool_(threads),
+      records_(0),
+      end_(false),
+      complete_(false)
+{}
+
+bool StateReader::readHeader(StateSettings& settings)
+{
+    unsigned char header[StateWriter::headerSize];
+    in_.read(reinterpret_cast<char*>(header), 8);
+    size_t length = (in_.gcount() == 8) ? headerLength(header) : 0;
+    if (length > 0)
+        in_.read(reinterpret_cast<char*>(header + 8), length - 8);
+
+    if (length == 0 || in_.gcount() != std::streamsize(length - 8) ||
+        !::readHeader(header, length, settings))
+    {
+        end_ = true;
+        return false;
+    }
+
+    return true;
+}
+
+bool StateReader::read(std::vector<TaskRecord>& records)
+{
+    records.clear();
+    if (end_)
+        return false;
+
+    buffer_.clear();
+    offsets_.clear();
+    while (offsets_.size() < batchSize)
+    {
+        unsigned char prefix[4];
+        in_.read(reinterpret_cast<char*>(prefix), sizeof(prefix));
+        if (in_.gcount() != std::streamsize(sizeof(prefix)))
+        {
+            LOG(0, "state stream is truncated after %lu records\n", records_ + offsets_.size());
+            end_ = true;
+            break;
+        }
+
+        uint32_t length = get32(prefix);
+        if (length == endMark)
+        {
+            unsigned char mark[endSize];
+            in_.read(reinterpret_cast<char*>(mark), sizeof(mark));
+            end_ = true;
+            complete_ = (in_.gcount() == std::streamsize(sizeof(mark)) &&
+                         get32(mark + 8) == Utility::Crc32c::compute(mark, 8) &&
+                         get64(mark) == records_ + offsets_.size());
+            break;
+        }
+
+        if (length > maxRecord)
+        {
+            LOG(0, "bad state record length %u\n", length);
+            end_ = true;
+            break;
+        }
+
+        size_t pos = buffer_.size();
+        buffer_.resize(pos + 4 + length + 4);
+        memcpy(&buffer_[pos], prefix, sizeof(prefix));
+        in_.read(reinterpret_cast<char*>(&buffer_[pos + 4]), length + 4);
+        if (in_.gcount() != std::streamsize(length + 4))
+        {
+            LOG(0, "state stream is truncated after %lu records\n", records_ + offsets_.size());
+            end_ = true;
+            break;
+        }
+        offsets_.push_back(pos);
+    }
+
+    // whole records before a torn end are still good.
+    if (offsets_.size() == 0)
+        return false;
+
+    records.resize(offsets_.size());
+    size_t slices = std::min(offsets_.size(), pool_.threads() * 4);
+    DecodeJob job(buffer_, offsets_, records, slices);
+    pool_.run(job, slices);
+    if (!job.good())
+    {
+        LOG(0, "bad state record in batch after %lu records\n", records_);
+        records.clear();
+        end_ = true;
+        complete_ = false;
+        return false;
+    }
+
+    records_ += records.size();
+    return true;
+}
+
+StateIndex::StateIndex()
+    : map_(NULL),
+      length_(0),
+      indexOffset_(0),
+      urisOffset_(0),
+      urisEnd_(0),
+      recordsEnd_(0),
+      headerEnd_(0),
+      count_(0)
+{}
+
+StateIndex::~StateIndex()
+{
+    close();
+}
+
+bool StateIndex::open(const std::string& path, StateSettings& settings)
+{
+    close();
+
+    int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd == -1)
+    {
+        LOG(0, "open state %s fail: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0 ||
+        size_t(st.st_size) < oldHeaderSize + StateWriter::footerSize)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    map_ = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd);
+    if (map_ == MAP_FAILED)
+    {
+        LOG(0, "map state %s fail: %s\n", path.c_str(), strerror(errno));
+        map_ = NULL;
+        return false;
+    }
+    length_ = st.st_size;
+
+    const unsigned char* footer = data() + length_ - StateWriter::footerSize;
+    headerEnd_ = headerLength(data());
+    if (headerEnd_ == 0 || headerEnd_ + StateWriter::footerSize > length_ ||
+        !::readHeader(data(), headerEnd_, settings) ||
+        memcmp(footer + 28, indexMagic, sizeof(indexMagic)) != 0 ||
+        get32(footer + 32) != Utility::Crc32c::compute(footer, 32))
+    {
+        LOG(0, "state %s has no index\n", path.c_str());
+        close();
+        return false;
+    }
+
+    uint64_t indexOffset = get64(footer);
+    uint64_t urisOffset = get64(footer + 8);
+    uint64_t count = get64(footer + 16);
+    size_t urisEnd = length_ - StateWriter::footerSize;
+    if (indexOffset < headerEnd_ + 16 ||
+        urisOffset < indexOffset || urisOffset > urisEnd ||
+        (urisOffset - indexOffset) / StateWriter::entrySize != count ||
+        (urisOffset - indexOffset) % StateWriter::entrySize != 0 ||
+        get32(footer + 24) != Utility::Crc32c::compute(data() + indexOffset, urisEnd - indexOffset))
+    {
+        LOG(0, "bad index in state %s\n", path.c_str());
+        close();
+        return false;
+    }
+
+    indexOffset_ = size_t(indexOffset);
+    urisOffset_ = size_t(urisOffset);
+    urisEnd_ = urisEnd;
+    recordsEnd_ = indexOffset_ - 16;
+    count_ = size_t(count);
+
+    return true;
+}
+
+void StateIndex::close()
+{
+    if (map_ != NULL)
+        ::munmap(map_, length_);
+
+    map_ = NULL;
+    length_ = 0;
+    count_ = 0;
+}
+
+bool StateIndex::summary(size_t index, TaskSummary& summary)
+{
+    if (index >= count_)
+        return false;
+
+    const unsigned char* entry = data() + indexOffset_ + index * StateWriter::entrySize;
+    size_t uri = urisOffset_ + get32(entry + 24);
+    if (uri >= urisEnd_ || memchr(data() + uri, '\0', urisEnd_ - uri) == NULL)
+        return false;
+
+    summary.uri = reinterpret_cast<const char*>(data() + uri);
+    summary.totalSize = get64(entry + 8);
+    summary.downloadSize = get64(entry + 16);
+    summary.priority = entry[28];
+    summary.state = entry[29];
+
+    return true;
+}
+
+bool StateIndex::record(size_t index, TaskRecord& record)
+{
+    if (index >= count_)
+        return false;
+
+    const unsigned char* entry = data() + indexOffset_ + index * StateWriter::entrySize;
+    uint64_t offset = get64(entry);
+    if (offset < headerEnd_ || offset + 8 > recordsEnd_ ||
+        get32(data() + offset) > recordsEnd_ - offset - 8)
+    {
+        LOG(0, "bad offset of state record %lu\n", index);
+        return false;
+    }
+
+    return decode(data() + offset, record);
+}
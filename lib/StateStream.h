@@ -0,0 +1,210 @@
+#ifndef STATE_STREAM_CLASS_HEAD
+#define STATE_STREAM_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <istream>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#include "utility/ThreadPool.h"
+
+/**
+ * \brief Manager wide settings kept in the state stream header.
+ */
+struct StateSettings
+{
+    int32_t maxConnections;
+    int32_t maxActiveTasks;
+    int32_t maxOpenFiles;
+    uint64_t maxDownloadSpeed;
+    int32_t maxConnectionsPerHost;      // from version 3.
+    int32_t maxConnectionsPerAddress;
+    uint64_t maxHostSpeed;
+
+    StateSettings()
+        : maxConnections(-1),
+          maxActiveTasks(-1),
+          maxOpenFiles(-1),
+          maxDownloadSpeed(0),
+          maxConnectionsPerHost(-1),
+          maxConnectionsPerAddress(-1),
+          maxHostSpeed(0)
+        {}
+};
+
+/**
+ * \brief One task of the manager, as saved in the state stream.
+ */
+struct TaskRecord
+{
+    enum State
+    {
+        RS_QUEUED,
+        RS_WAIT,
+        RS_DOWNLOAD,
+        RS_ERROR,
+        RS_FINISH,              // kept as a summary, never made into a task again.
+    };
+
+    std::string uri;
+    std::string outputDir;
+    std::string outputName;
+    std::string options;
+    std::string comment;
+    uint8_t priority;
+    uint8_t state;
+    uint64_t totalSize;
+    uint64_t downloadSize;
+
+    TaskRecord()
+        : priority(0),
+          state(RS_QUEUED),
+          totalSize(0),
+          downloadSize(0)
+        {}
+};
+
+/**
+ * \brief What the index of a state file tells about a task, without decoding its record.
+ *
+ * uri points into the mapped file, valid while the StateIndex is open.
+ */
+struct TaskSummary
+{
+    const char* uri;
+    uint64_t totalSize;
+    uint64_t downloadSize;
+    uint8_t priority;
+    uint8_t state;
+};
+
+/**
+ * \brief Write manager state as a versioned binary stream.
+ *
+ * The stream is a header with settings, one length prefixed record per task, and an end
+ * mark with the number of records. Header and every record carry a CRC-32C. Records are
+ * written one by one through a reused buffer, so saving never holds the whole state.
+ *
+ * From version 2 an index follows the end mark: a fixed size entry per task (record offset,
+ * sizes, state, priority), the URIs, and a footer to find them from the end of file. Only
+ * the index is kept in memory until finish(), a few tens of bytes per task.
+ *
+ * From version 3 the header is headerSize bytes, with room for more settings. Earlier
+ * versions have a header of 32 bytes and are still read.
+ */
+class StateWriter
+{
+public:
+    static const uint32_t version = 3;
+    static const size_t headerSize = 64;
+    static const size_t entrySize = 32;
+    static const size_t footerSize = 36;
+
+    explicit StateWriter(std::ostream& out);
+
+    bool writeHeader(const StateSettings& settings);
+    bool write(const TaskRecord& record);
+
+    /**
+     * \brief Write the end mark and index, a stream without them is taken as truncated.
+     */
+    bool finish();
+
+    size_t records()             { return records_; }
+
+private:
+    StateWriter(const StateWriter &);
+    const StateWriter& operator=(const StateWriter &);
+
+    std::ostream& out_;
+    std::vector<unsigned char> buffer_;
+    std::vector<unsigned char> index_;
+    std::string uris_;
+    uint64_t offset_;
+    size_t records_;
+};
+
+/**
+ * \brief Read a stream written by StateWriter.
+ *
+ * Records are read from the stream in batches, and checked and decoded on a thread pool.
+ */
+class StateReader
+{
+public:
+    static const size_t batchSize = 4096;
+
+    /**
+     * \brief threads is passed to ThreadPool, 0 means one per processor.
+     */
+    explicit StateReader(std::istream& in, size_t threads = 0);
+
+    bool readHeader(StateSettings& settings);
+
+    /**
+     * \brief Read up to batchSize records into records, false at end of stream or on error.
+     */
+    bool read(std::vector<TaskRecord>& records);
+
+    /**
+     * \brief Whether the stream ended with a good end mark, check after read() fails.
+     */
+    bool complete()              { return complete_; }
+
+private:
+    StateReader(const StateReader &);
+    const StateReader& operator=(const StateReader &);
+
+    class DecodeJob;
+
+    std::istream& in_;
+    Utility::ThreadPool pool_;
+    std::vector<unsigned char> buffer_;
+    std::vector<size_t> offsets_;
+    size_t records_;
+    bool end_;
+    bool complete_;
+};
+
+/**
+ * \brief Random access to a state file through its index.
+ *
+ * The file is mapped read only. Opening checks only the header, footer and index, and a
+ * task's record is decoded when it's asked for, so a state of many tasks costs nothing
+ * until they are used. The file must not be rewritten in place while it's open, save to
+ * another file and rename it over.
+ */
+class StateIndex
+{
+public:
+    StateIndex();
+    ~StateIndex();
+
+    bool open(const std::string& path, StateSettings& settings);
+    bool isOpen()                { return map_ != NULL; }
+    void close();
+
+    size_t size()                { return count_; }
+    bool summary(size_t index, TaskSummary& summary);
+    bool record(size_t index, TaskRecord& record);
+
+private:
+    StateIndex(const StateIndex &);
+    const StateIndex& operator=(const StateIndex &);
+
+    const unsigned char* data()  { return static_cast<const unsigned char*>(map_); }
+
+    void* map_;
+    size_t length_;
+    size_t indexOffset_;
+    size_t urisOffset_;
+    size_t urisEnd_;
+    size_t recordsEnd_;
+    size_t headerEnd_;
+    size_t count_;
+};
+
+#endif
@@ -4,3 +4,4 @@ boost::signal<void (TaskBase* task)> TaskBase::downloadFinishSignal;
 boost::signal<void (TaskBase* task)> TaskBase::uploadFinishSignal;
 boost::signal<void (TaskBase* task, int error)> TaskBase::errorSignal;
 boost::signal<void (TaskBase* task, const char* log)> TaskBase::logSignal;
+boost::signal<void (TaskBase* task, size_t size)> TaskBase::readableSignal;
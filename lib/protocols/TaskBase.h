@@ -9,6 +9,11 @@
 
 class ProtocolBase;
 
+namespace Utility
+{
+class TokenBucket;
+}
+
 class TaskBase
 {
 public:
@@ -57,6 +62,16 @@ public:
      */
     static boost::signal<void (TaskBase* task, const char* log)> logSignal;
 
+    /**
+     * \brief Callback when readable size of task grows.
+     *
+     * When the contiguous downloaded bytes from file begin grows, call for noticing consumer.
+     * The bytes in [0, size) of output file can be read safely while task still running.
+     * \param info The task's info.
+     * \param size The readable size.
+     */
+    static boost::signal<void (TaskBase* task, size_t size)> readableSignal;
+
     void downloadFinish()
         {
             TaskBase::downloadFinishSignal(this);
@@ -77,6 +92,11 @@ public:
             TaskBase::logSignal(this, log);
         }
 
+    void readable(size_t size)
+        {
+            TaskBase::readableSignal(this, size);
+        }
+
     TaskBase() {}
     virtual ~TaskBase() {}
 
@@ -90,6 +110,7 @@ public:
     virtual size_t      totalSize() = 0;
     virtual size_t      downloadSize() = 0;
     virtual size_t      uploadSize() = 0;
+    virtual size_t      readableSize() = 0;
     virtual int         totalSource() = 0;
     virtual int         validSource() = 0;
     virtual std::vector<bool> validBitmap() = 0;
@@ -101,9 +122,55 @@ public:
     virtual bool stop() = 0;
 
     virtual bool fdSet(fd_set* read, fd_set* write, fd_set* exc, int* max) = 0;
+
+    /**
+     * \brief Most milliseconds to wait on fdSet() before next perform, -1 means no limit.
+     *
+     * A task with work of its own, like checking a file, has no fd to wake up on and
+     * returns 0.
+     */
+    virtual long timeout() = 0;
     virtual size_t performDownload() = 0;
     virtual size_t performUpload() = 0;
 
+    /**
+     * \brief How many connections the task want to use.
+     */
+    virtual int  connectionDemand() = 0;
+
+    /**
+     * \brief How many files the task holds open now, readers of its checks included.
+     *
+     * Called by manager to keep the total under its open files limit.
+     */
+    virtual int  openFiles() = 0;
+
+    /**
+     * \brief Limit connections of the task, -1 means no limit.
+     *
+     * Called by manager to share connections between tasks, it can be changed while task running.
+     */
+    virtual void setConnectionLimit(int limit) = 0;
+
+    /**
+     * \brief Chain task's speed limit under a manager wide one, NULL means no parent.
+     */
+    virtual void setSpeedLimiter(Utility::TokenBucket* parent) = 0;
+
+    /**
+     * \brief Rate of manager wide speed given to the task, 0 means no limit.
+     *
+     * Called by manager to share speed between tasks by weight, task's own limit still holds.
+     */
+    virtual void setSpeedShare(size_t bytesPerSecond) = 0;
+
+    /**
+     * \brief Task's own receive speed limit in bytes per second, 0 means no limit.
+     *
+     * Kept beside the share of manager wide speed, the lower one holds.
+     */
+    virtual void setMaxDownloadSpeed(size_t bytesPerSecond) = 0;
+
     virtual int error() = 0;
     virtual const char* strerror(int error) = 0;
 };
@@ -139,6 +139,32 @@ void BitMap::setRangeByLength(size_t begin, size_t end, BitMap::value_type v)
     setRange(begin / bytesPerBit_, end / bytesPerBit_, v);
 }
 
+void BitMap::coveredBlocks(size_t begin, size_t end, size_type& first, size_type& last)
+{
+    first = (begin + bytesPerBit_ - 1) / bytesPerBit_;
+    last = (end >= len_) ? map_.size() : end / bytesPerBit_;
+    if (last < first)
+        last = first;
+}
+
+void BitMap::setCovered(size_t begin, size_t end, BitMap::value_type v)
+{
+    size_type first, last;
+    coveredBlocks(begin, end, first, last);
+    for (size_type i=first; i<last; ++i)
+        map_[i] = v;
+}
+
+void BitMap::merge(BitMap &arg)
+{
+    size_type n = std::min(map_.size(), arg.map_.size());
+    for (size_type i=0; i<n; ++i)
+    {
+        if (arg.map_[i])
+            map_[i] = true;
+    }
+}
+
 std::vector<bool> BitMap::getVector()
 {
     return map_;
@@ -55,6 +55,22 @@ public:
     size_type getPositionByLength(size_t len);
     void setRangeByLength(size_t begin, size_t end, value_type v);
 
+    /**
+     * \brief Blocks [first, last) which are all in bytes [begin, end). The last block of
+     * file is all in if end reaches file end.
+     */
+    void coveredBlocks(size_t begin, size_t end, size_type& first, size_type& last);
+
+    /**
+     * \brief Set only blocks all in bytes [begin, end), unlike setRangeByLength().
+     */
+    void setCovered(size_t begin, size_t end, value_type v);
+
+    /**
+     * \brief Set every bit which is set in arg, both are of the same file.
+     */
+    void merge(BitMap &arg);
+
     std::vector<bool> getVector();
 
 private:
@@ -0,0 +1,211 @@
+/**
+ * \file ByteRangesParser.cpp
+ *       ByteRangesParser class implementaion.
+ */
+
+#include "ByteRangesParser.h"
+
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+
+ByteRangesParser::ByteRangesParser(const std::string& boundary)
+    : delimiter_("--" + boundary),
+      state_(BRP_DELIMITER),
+      hasRange_(false),
+      begin_(0),
+      end_(0),
+      remain_(0),
+      error_(NULL)
+{}
+
+ByteRangesParser::~ByteRangesParser()
+{}
+
+bool ByteRangesParser::feed(const char* buffer, size_t len)
+{
+    while (len > 0)
+    {
+        switch (state_)
+        {
+        case BRP_END:
+            // ignore epilogue.
+            return true;
+        case BRP_ERROR:
+            return false;
+        case BRP_BODY:
+        {
+            size_t n = (len < remain_) ? len : remain_;
+            if (!data(buffer, n))
+                return setError("stopped by data().");
+            buffer += n;
+            len -= n;
+            remain_ -= n;
+            if (remain_ == 0)
+                state_ = BRP_DELIMITER;
+            break;
+        }
+        default:
+        {
+            char c = *buffer++;
+            --len;
+            if (c != '\n')
+            {
+                if (line_.length() >= MAX_LINE_LEN)
+                    return setError("line too long.");
+                line_ += c;
+                break;
+            }
+
+            if (!parseLine())
+                return false;
+            line_.clear();
+            break;
+        }
+        }
+    }
+
+    return state_ != BRP_ERROR;
+}
+
+bool ByteRangesParser::finished()
+{
+    return state_ == BRP_END;
+}
+
+const char* ByteRangesParser::getError()
+{
+    return error_;
+}
+
+bool ByteRangesParser::parseLine()
+{
+    if (line_.length() > 0 && line_[line_.length() - 1] == '\r')
+        line_.erase(line_.length() - 1);
+
+    if (state_ == BRP_DELIMITER)
+    {
+        // preamble and the CRLF after part body are skipped here.
+        if (line_ == delimiter_)
+        {
+            state_ = BRP_HEADER;
+            hasRange_ = false;
+        }
+        else if (line_ == delimiter_ + "--")
+        {
+            state_ = BRP_END;
+        }
+        return true;
+    }
+
+    // state_ == BRP_HEADER
+    if (line_.length() == 0)
+    {
+        if (!hasRange_)
+            return setError("part without Content-Range.");
+
+        if (!part(begin_, end_))
+            return setError("stopped by part().");
+
+        remain_ = end_ - begin_ + 1;
+        state_ = BRP_BODY;
+        return true;
+    }
+
+    static const char contentRange[] = "Content-Range:";
+    if (strncasecmp(line_.c_str(), contentRange, sizeof(contentRange) - 1) == 0)
+    {
+        size_t total;
+        if (!parseContentRange(line_.c_str() + sizeof(contentRange) - 1, begin_, end_, total))
+            return setError("bad Content-Range.");
+        hasRange_ = true;
+    }
+
+    return true;
+}
+
+bool ByteRangesParser::setError(const char* error)
+{
+    state_ = BRP_ERROR;
+    error_ = error;
+    return false;
+}
+
+/**
+ * \brief Get the boundary from a Content-Type value.
+ *
+ * \param contentType Like "multipart/byteranges; boundary=THIS_STRING_SEPARATES".
+ * \return false if it isn't a multipart/byteranges type.
+ */
+bool ByteRangesParser::parseBoundary(const char* contentType, std::string& boundary)
+{
+    static const char multipart[] = "multipart/byteranges";
+    static const char key[] = "boundary=";
+
+    if (contentType == NULL)
+        return false;
+
+    while (*contentType == ' ')
+        ++contentType;
+
+    if (strncasecmp(contentType, multipart, sizeof(multipart) - 1) != 0)
+        return false;
+
+    const char* p = contentType + sizeof(multipart) - 1;
+    for (; *p != '\0'; ++p)
+    {
+        if (strncasecmp(p, key, sizeof(key) - 1) == 0)
+            break;
+    }
+    if (*p == '\0')
+        return false;
+    p += sizeof(key) - 1;
+
+    const char* end = NULL;
+    if (*p == '"')
+    {
+        ++p;
+        end = strchr(p, '"');
+    }
+    else
+    {
+        end = p + strcspn(p, "; \r\n");
+    }
+    if (end == NULL || end == p)
+        return false;
+
+    boundary.assign(p, end - p);
+    return true;
+}
+
+/**
+ * \brief Parse the value of Content-Range header.
+ *
+ * \param value Like "bytes 500-999/1234", total will be 0 if it's "*".
+ */
+bool ByteRangesParser::parseContentRange(const char* value, size_t& begin, size_t& end, size_t& total)
+{
+    static const char unit[] = "bytes";
+
+    while (*value == ' ')
+        ++value;
+
+    if (strncasecmp(value, unit, sizeof(unit) - 1) != 0)
+        return false;
+    value += sizeof(unit) - 1;
+
+    char* next = NULL;
+    begin = strtoul(value, &next, 10);
+    if (next == value || *next != '-')
+        return false;
+
+    value = next + 1;
+    end = strtoul(value, &next, 10);
+    if (next == value || *next != '/' || end < begin)
+        return false;
+
+    value = next + 1;
+    total = (*value == '*') ? 0 : strtoul(value, NULL, 10);
+
+    return true;
+}
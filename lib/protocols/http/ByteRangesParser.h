@@ -0,0 +1,80 @@
+/**
+ * \file ByteRangesParser.h
+ *       ByteRangesParser class. A streaming parser of multipart/byteranges response body.
+ */
+
+#ifndef BYTE_RANGES_PARSER_CLASS_HEAD
+#define BYTE_RANGES_PARSER_CLASS_HEAD
+
+#include <stddef.h>
+
+#include <string>
+
+/**
+ * \brief Parse a multipart/byteranges body which comes in pieces.
+ *
+ * When a request carries several intervals in the Range header, a server which supports it
+ * replies 206 with a multipart/byteranges body, each part has its own Content-Range header.
+ * Feed the body to this parser piece by piece as it arrives, part() will be called when a
+ * part header is finished and data() will be called with the part body.
+ *
+ * The body length of a part is taken from its Content-Range, so the parser never need to
+ * search the boundary inside the body.
+ *
+ * \example ../../unittest/protocols/ByteRangesParser_unittest.cpp
+ */
+class ByteRangesParser
+{
+public:
+    explicit ByteRangesParser(const std::string& boundary);
+    virtual ~ByteRangesParser();
+
+    /**
+     * \brief Called when a part header finished.
+     *
+     * \param begin The first byte position of the part, include.
+     * \param end   The last byte position of the part, include.
+     * \return false to stop parsing.
+     */
+    virtual bool part(size_t begin, size_t end) = 0;
+
+    /**
+     * \brief Called for the body of current part.
+     *
+     * \return false to stop parsing.
+     */
+    virtual bool data(const char* buffer, size_t len) = 0;
+
+    bool feed(const char* buffer, size_t len);
+    bool finished();
+    const char* getError();
+
+    static bool parseBoundary(const char* contentType, std::string& boundary);
+    static bool parseContentRange(const char* value, size_t& begin, size_t& end, size_t& total);
+
+private:
+    enum State
+    {
+        BRP_DELIMITER,
+        BRP_HEADER,
+        BRP_BODY,
+        BRP_END,
+        BRP_ERROR,
+    };
+
+    bool parseLine();
+    bool setError(const char* error);
+
+    static const size_t MAX_LINE_LEN = 1024;
+
+    std::string delimiter_;
+    std::string line_;
+    State state_;
+    bool hasRange_;
+    size_t begin_;
+    size_t end_;
+    size_t remain_;
+    const char* error_;
+};
+
+#endif
@@ -0,0 +1,50 @@
+#include "CurlShare.h"
+#include "utility/Utility.h"
+
+CurlShare& CurlShare::instance()
+{
+    static CurlShare share;
+    return share;
+}
+
+CurlShare::CurlShare()
+    : handle_(curl_share_init())
+{
+    if (handle_ == NULL)
+    {
+        LOG(0, "curl_share_init fail.");
+        return;
+    }
+
+    curl_share_setopt(handle_, CURLSHOPT_LOCKFUNC, &CurlShare::lock);
+    curl_share_setopt(handle_, CURLSHOPT_UNLOCKFUNC, &CurlShare::unlock);
+    curl_share_setopt(handle_, CURLSHOPT_USERDATA, this);
+
+    curl_share_setopt(handle_, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+    curl_share_setopt(handle_, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#if LIBCURL_VERSION_NUM >= 0x073900
+    curl_share_setopt(handle_, CURLSHOPT_SHARE, CURL_LOCK_DATA_CONNECT);
+#endif
+}
+
+CurlShare::~CurlShare()
+{
+    if (handle_ != NULL)
+    {
+        CURLSHcode ret = curl_share_cleanup(handle_);
+        if (ret != CURLSHE_OK)
+        {
+            LOG(0, "clean up share handle fail: %s.", curl_share_strerror(ret));
+        }
+    }
+}
+
+void CurlShare::lock(CURL* /*handle*/, curl_lock_data data, curl_lock_access /*access*/, void* userp)
+{
+    static_cast<CurlShare*>(userp)->mutex_[data].lock();
+}
+
+void CurlShare::unlock(CURL* /*handle*/, curl_lock_data data, void* userp)
+{
+    static_cast<CurlShare*>(userp)->mutex_[data].unlock();
+}
@@ -0,0 +1,35 @@
+#ifndef CURL_SHARE_CLASS_HEAD
+#define CURL_SHARE_CLASS_HEAD
+
+#include <curl/curl.h>
+
+#include "utility/Mutex.h"
+
+/**
+ * \brief Engine-wide curl share handle.
+ *
+ * Every easy handle is attached to it, so sessions of all tasks share DNS cache, TLS
+ * session ids and, with libcurl 7.57 or later, the connection cache. Each kind of data has
+ * its own lock, curl calls back lock() and unlock() around the access.
+ */
+class CurlShare
+{
+public:
+    static CurlShare& instance();
+
+    CURLSH* handle() { return handle_; }
+
+private:
+    CurlShare();
+    ~CurlShare();
+    CurlShare(const CurlShare &);
+    const CurlShare& operator=(const CurlShare &);
+
+    static void lock(CURL* handle, curl_lock_data data, curl_lock_access access, void* userp);
+    static void unlock(CURL* handle, curl_lock_data data, void* userp);
+
+    Utility::Mutex mutex_[CURL_LOCK_DATA_LAST];
+    CURLSH* handle_;
+};
+
+#endif
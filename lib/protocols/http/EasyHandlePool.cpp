@@ -0,0 +1,119 @@
+#include "EasyHandlePool.h"
+
+EasyHandlePool& EasyHandlePool::instance()
+{
+    static EasyHandlePool pool;
+    return pool;
+}
+
+EasyHandlePool::EasyHandlePool()
+    : maxIdle_(64),
+      owners_(0),
+      hits_(0),
+      misses_(0)
+{}
+
+EasyHandlePool::~EasyHandlePool()
+{
+    for (size_t i=0; i<handles_.size(); ++i)
+    {
+        curl_easy_cleanup(handles_[i].handle);
+    }
+}
+
+unsigned long EasyHandlePool::newOwner()
+{
+    Utility::ScopedLock lock(mutex_);
+    return ++owners_;
+}
+
+CURL* EasyHandlePool::get(unsigned long owner, bool& kept)
+{
+    CURL* handle = NULL;
+    kept = false;
+    {
+        Utility::ScopedLock lock(mutex_);
+        if (handles_.size() == 0)
+        {
+            ++misses_;
+            return NULL;
+        }
+
+        size_t index = handles_.size() - 1;
+        for (size_t i=handles_.size(); i>0; --i)
+        {
+            if (handles_[i - 1].owner == owner)
+            {
+                index = i - 1;
+                kept = true;
+                break;
+            }
+        }
+
+        handle = handles_[index].handle;
+        handles_.erase(handles_.begin() + index);
+        ++hits_;
+    }
+
+    if (!kept)
+        curl_easy_reset(handle);
+
+    return handle;
+}
+
+void EasyHandlePool::put(CURL* handle, unsigned long owner)
+{
+    if (handle == NULL)
+        return;
+
+    {
+        Utility::ScopedLock lock(mutex_);
+        if (handles_.size() < maxIdle_)
+        {
+            Idle idle;
+            idle.handle = handle;
+            idle.owner = owner;
+            handles_.push_back(idle);
+            return;
+        }
+    }
+
+    curl_easy_cleanup(handle);
+}
+
+void EasyHandlePool::setMaxIdle(size_t max)
+{
+    std::vector<CURL*> drop;
+    {
+        Utility::ScopedLock lock(mutex_);
+        maxIdle_ = max;
+        while (handles_.size() > maxIdle_)
+        {
+            drop.push_back(handles_.back().handle);
+            handles_.pop_back();
+        }
+    }
+
+    for (size_t i=0; i<drop.size(); ++i)
+    {
+        curl_easy_cleanup(drop[i]);
+    }
+}
+
+size_t EasyHandlePool::idle()
+{
+    Utility::ScopedLock lock(mutex_);
+    return handles_.size();
+}
+
+unsigned long EasyHandlePool::hits()
+{
+    Utility::ScopedLock lock(mutex_);
+    return hits_;
+}
+
+unsigned long EasyHandlePool::misses()
+{
+    Utility::ScopedLock lock(mutex_);
+    return misses_;
+}
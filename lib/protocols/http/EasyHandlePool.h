@@ -0,0 +1,64 @@
+#ifndef EASY_HANDLE_POOL_CLASS_HEAD
+#define EASY_HANDLE_POOL_CLASS_HEAD
+
+#include <curl/curl.h>
+
+#include <vector>
+
+#include "utility/Mutex.h"
+
+/**
+ * \brief Engine-wide pool of curl easy handles.
+ *
+ * A session puts its handle back when it's destroyed, tagged with the owner whose options
+ * it has. A new session of the same owner takes it with those options kept. A handle of
+ * another owner is cleaned by curl_easy_reset() before it's given out, so its options are
+ * set again. Either way no handle is allocated with curl_easy_init(). Connections are
+ * kept by multi and share handles, not here. Handles put back must have been removed from
+ * their multi handle.
+ */
+class EasyHandlePool
+{
+public:
+    static EasyHandlePool& instance();
+
+    /**
+     * \brief A key for handles of one owner, never given twice.
+     */
+    unsigned long newOwner();
+
+    /**
+     * \brief Take a handle from pool, one of owner first.
+     *
+     * \param kept set true if handle has options of owner, false if it's reset.
+     * \return NULL if pool is empty, caller should make a new one.
+     */
+    CURL* get(unsigned long owner, bool& kept);
+    void put(CURL* handle, unsigned long owner);
+
+    void setMaxIdle(size_t max);
+    size_t idle();
+    unsigned long hits();
+    unsigned long misses();
+
+private:
+    EasyHandlePool();
+    ~EasyHandlePool();
+    EasyHandlePool(const EasyHandlePool &);
+    const EasyHandlePool& operator=(const EasyHandlePool &);
+
+    struct Idle
+    {
+        CURL* handle;
+        unsigned long owner;
+    };
+
+    Utility::Mutex mutex_;
+    std::vector<Idle> handles_;
+    size_t maxIdle_;
+    unsigned long owners_;
+    unsigned long hits_;
+    unsigned long misses_;
+};
+
+#endif
@@ -0,0 +1,199 @@
+#include "FileVerifier.h"
+
+#include "utility/Crc32c.h"
+#include "utility/Digest.h"
+#include "utility/ThreadPool.h"
+#include "utility/Utility.h"
+
+#include <algorithm>
+#include <memory>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdio.h>
+#include <string.h>
+
+const size_t FileVerifier::defaultChunkSize;
+
+/**
+ * Index i < chunks checks chunk i of the step, index chunks feeds the whole file hash.
+ */
+class FileVerifier::StepJob : public Utility::ThreadPool::Job
+{
+public:
+    StepJob(FileVerifier& verifier, size_t begin, size_t end, size_t chunks)
+        : verifier_(verifier),
+          begin_(begin),
+          end_(end),
+          chunks_(chunks)
+        {}
+
+    void run(size_t index)
+        {
+            const unsigned char* data = verifier_.map_.data();
+            if (index == chunks_)
+            {
+                verifier_.digest_->update(data + begin_, end_ - begin_);
+                return;
+            }
+
+            size_t unit = verifier_.unitLength();
+            size_t begin = begin_ + index * unit;
+            size_t end = std::min(begin + unit, end_);
+
+            if (verifier_.pieceLength_ == 0)
+            {
+                verifier_.crcs_[index] = Utility::Crc32c::compute(data + begin, end - begin);
+                return;
+            }
+
+            std::auto_ptr<Utility::Digest> digest(Utility::Digest::create(verifier_.pieceType_));
+            size_t length = verifier_.pieceLength_;
+            for (size_t p = begin / length; p * length < end; ++p)
+            {
+                size_t b = p * length;
+                digest->init();
+                digest->update(data + b, std::min(b + length, end) - b);
+                if (digest->hexFinal() != verifier_.pieceHashes_[p])
+                    verifier_.bad_[p] = 1;
+            }
+        }
+
+private:
+    FileVerifier& verifier_;
+    size_t begin_;
+    size_t end_;
+    size_t chunks_;
+};
+
+FileVerifier::FileVerifier(size_t chunkSize)
+    : chunkSize_(chunkSize),
+      pos_(0),
+      pieceLength_(0),
+      crc_(0),
+      digest_(NULL)
+{}
+
+FileVerifier::~FileVerifier()
+{
+    close();
+}
+
+bool FileVerifier::open(const std::string& path)
+{
+    close();
+
+    if (!map_.open(path.c_str()))
+    {
+        LOG(0, "map %s to verify fail: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    return true;
+}
+
+void FileVerifier::close()
+{
+    map_.close();
+    pos_ = 0;
+    pieceHashes_.clear();
+    pieceLength_ = 0;
+    bad_.clear();
+    badPieces_.clear();
+    crc_ = 0;
+    delete digest_;
+    digest_ = NULL;
+    digestHex_.clear();
+}
+
+bool FileVerifier::setPieces(const std::string& type, size_t pieceLength,
+                             const std::vector<std::string>& hashes)
+{
+    std::auto_ptr<Utility::Digest> probe(Utility::Digest::create(type));
+    if (probe.get() == NULL || pieceLength == 0 ||
+        hashes.size() != (map_.size() + pieceLength - 1) / pieceLength)
+        return false;
+
+    pieceType_ = type;
+    pieceHashes_ = hashes;
+    for (size_t i=0; i<pieceHashes_.size(); ++i)
+    {
+        for (size_t k=0; k<pieceHashes_[i].length(); ++k)
+            pieceHashes_[i][k] = char(tolower(pieceHashes_[i][k]));
+    }
+    pieceLength_ = pieceLength;
+    bad_.assign(pieceHashes_.size(), 0);
+
+    return true;
+}
+
+bool FileVerifier::setDigest(const std::string& type)
+{
+    delete digest_;
+    digest_ = Utility::Digest::create(type);
+    return digest_ != NULL;
+}
+
+/**
+ * A chunk is whole pieces with piece hashes, at least one.
+ */
+size_t FileVerifier::unitLength()
+{
+    if (pieceLength_ == 0)
+        return chunkSize_;
+
+    return std::max(chunkSize_ / pieceLength_, size_t(1)) * pieceLength_;
+}
+
+bool FileVerifier::step(Utility::ThreadPool& pool)
+{
+    size_t size = map_.size();
+    if (pos_ < size)
+    {
+        size_t unit = unitLength();
+        size_t end = std::min(pos_ + pool.threads() * unit, size);
+        size_t chunks = (end - pos_ + unit - 1) / unit;
+
+        // pages of the next step come in while this one is checked.
+        map_.willNeed(end, end - pos_);
+
+        crcs_.assign(chunks, 0);
+        StepJob job(*this, pos_, end, chunks);
+        pool.run(job, (digest_ != NULL) ? chunks + 1 : chunks);
+
+        if (pieceLength_ == 0)
+        {
+            for (size_t i=0; i<chunks; ++i)
+            {
+                size_t begin = pos_ + i * unit;
+                crc_ = Utility::Crc32c::combine(crc_, crcs_[i], std::min(begin + unit, end) - begin);
+            }
+        }
+        else
+        {
+            for (size_t p = pos_ / pieceLength_; p * pieceLength_ < end; ++p)
+            {
+                if (bad_[p])
+                    badPieces_.push_back(p);
+            }
+        }
+
+        pos_ = end;
+    }
+
+    if (pos_ < size)
+        return true;
+
+    if (digest_ != NULL && digestHex_.length() == 0)
+        digestHex_ = digest_->hexFinal();
+
+    return false;
+}
+
+size_t FileVerifier::goodSize()
+{
+    if (badPieces_.size() == 0)
+        return pos_;
+
+    return badPieces_[0] * pieceLength_;
+}
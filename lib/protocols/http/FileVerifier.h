@@ -0,0 +1,91 @@
+#ifndef FILE_VERIFIER_CLASS_HEAD
+#define FILE_VERIFIER_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+#include "utility/MappedFile.h"
+
+namespace Utility
+{
+class Digest;
+class ThreadPool;
+}
+
+/**
+ * \brief Check a whole file on a thread pool, a step at a time.
+ *
+ * The file is mapped and every step gives each thread of the pool a chunk of it. With
+ * piece hashes a chunk is whole pieces, each checked with its hash. Without them a chunk
+ * gets a CRC-32C, and the chunk CRCs are combined in order into the CRC of the file. A
+ * whole file hash can't be split, it's fed one step at a time beside the chunks.
+ */
+class FileVerifier
+{
+public:
+    static const size_t defaultChunkSize = 8 * 1024 * 1024;
+
+    explicit FileVerifier(size_t chunkSize = defaultChunkSize);
+    ~FileVerifier();
+
+    bool open(const std::string& path);
+    void close();
+    size_t size()                               { return map_.size(); }
+
+    /**
+     * \brief Check pieces of pieceLength with hashes, false if they don't fit the file.
+     */
+    bool setPieces(const std::string& type, size_t pieceLength,
+                   const std::vector<std::string>& hashes);
+
+    /**
+     * \brief Hash the whole file with type, false if type is not known.
+     */
+    bool setDigest(const std::string& type);
+
+    /**
+     * \brief Check the next chunks, \return false when the whole file is checked.
+     */
+    bool step(Utility::ThreadPool& pool);
+
+    size_t position()                           { return pos_; }
+    bool done()                                 { return pos_ >= map_.size(); }
+
+    /**
+     * \brief Bytes from file begin in good pieces, or checked bytes without pieces.
+     */
+    size_t goodSize();
+
+    uint32_t crc()                              { return crc_; }
+    const std::string& digest()                 { return digestHex_; }
+    const std::vector<size_t>& badPieces()      { return badPieces_; }
+
+private:
+    FileVerifier(const FileVerifier &);
+    const FileVerifier& operator=(const FileVerifier &);
+
+    class StepJob;
+
+    size_t unitLength();
+
+    size_t chunkSize_;
+    Utility::MappedFile map_;
+    size_t pos_;
+
+    std::string pieceType_;
+    std::vector<std::string> pieceHashes_;
+    size_t pieceLength_;
+    std::vector<unsigned char> bad_;            // per piece, set by jobs.
+    std::vector<size_t> badPieces_;
+
+    std::vector<uint32_t> crcs_;                // per chunk of a step.
+    uint32_t crc_;
+
+    Utility::Digest* digest_;
+    std::string digestHex_;
+};
+
+#endif
@@ -12,6 +12,27 @@ struct HttpConfigure
     std::string userAgent;
     int retryCount;
     long connectingTimeout;
+    bool multiRange;
+    int maxRangesPerRequest;
+    bool sequential;
+    int readAheadBlocks;
+    bool http2;
+    int http2Connections;
+    bool spreadAddresses;
+    long maxDownloadSpeed;
+    long bufferSize;
+    int receiveBuffer;
+    bool tcpNoDelay;
+    bool tcpKeepAlive;
+    bool probeRange;
+    bool resumeJournal;
+    long checkpointInterval;
+    bool partFile;
+    long checkpointBytes;
+    std::string hashType;
+    std::string hash;
+    bool verifyExisting;
+    bool blockCrc;
 
     HttpConfigure()
         : sessionNumber(5),
@@ -20,7 +41,28 @@ struct HttpConfigure
           referer(""),
           userAgent(""),
           retryCount(-1),
-          connectingTimeout(-1)
+          connectingTimeout(-1),
+          multiRange(true),
+          maxRangesPerRequest(16),
+          sequential(false),
+          readAheadBlocks(4096),
+          http2(false),
+          http2Connections(1),
+          spreadAddresses(false),
+          maxDownloadSpeed(0),
+          bufferSize(0),
+          receiveBuffer(0),
+          tcpNoDelay(true),
+          tcpKeepAlive(false),
+          probeRange(false),
+          resumeJournal(true),
+          checkpointInterval(5000),
+          partFile(false),
+          checkpointBytes(64 * 1024 * 1024),
+          hashType(""),
+          hash(""),
+          verifyExisting(false),
+          blockCrc(true)
         {}
 
     HttpConfigure(const HttpConfigure& arg)
@@ -30,7 +72,28 @@ struct HttpConfigure
           referer(arg.referer),
           userAgent(arg.userAgent),
           retryCount(arg.retryCount),
-          connectingTimeout(arg.connectingTimeout)
+          connectingTimeout(arg.connectingTimeout),
+          multiRange(arg.multiRange),
+          maxRangesPerRequest(arg.maxRangesPerRequest),
+          sequential(arg.sequential),
+          readAheadBlocks(arg.readAheadBlocks),
+          http2(arg.http2),
+          http2Connections(arg.http2Connections),
+          spreadAddresses(arg.spreadAddresses),
+          maxDownloadSpeed(arg.maxDownloadSpeed),
+          bufferSize(arg.bufferSize),
+          receiveBuffer(arg.receiveBuffer),
+          tcpNoDelay(arg.tcpNoDelay),
+          tcpKeepAlive(arg.tcpKeepAlive),
+          probeRange(arg.probeRange),
+          resumeJournal(arg.resumeJournal),
+          checkpointInterval(arg.checkpointInterval),
+          partFile(arg.partFile),
+          checkpointBytes(arg.checkpointBytes),
+          hashType(arg.hashType),
+          hash(arg.hash),
+          verifyExisting(arg.verifyExisting),
+          blockCrc(arg.blockCrc)
         {}
 
     const HttpConfigure& operator=(const HttpConfigure& arg)
@@ -44,6 +107,27 @@ struct HttpConfigure
                 userAgent = arg.userAgent;
                 retryCount = arg.retryCount;
                 connectingTimeout = arg.connectingTimeout;
+                multiRange = arg.multiRange;
+                maxRangesPerRequest = arg.maxRangesPerRequest;
+                sequential = arg.sequential;
+                readAheadBlocks = arg.readAheadBlocks;
+                http2 = arg.http2;
+                http2Connections = arg.http2Connections;
+                spreadAddresses = arg.spreadAddresses;
+                maxDownloadSpeed = arg.maxDownloadSpeed;
+                bufferSize = arg.bufferSize;
+                receiveBuffer = arg.receiveBuffer;
+                tcpNoDelay = arg.tcpNoDelay;
+                tcpKeepAlive = arg.tcpKeepAlive;
+                probeRange = arg.probeRange;
+                resumeJournal = arg.resumeJournal;
+                checkpointInterval = arg.checkpointInterval;
+                partFile = arg.partFile;
+                checkpointBytes = arg.checkpointBytes;
+                hashType = arg.hashType;
+                hash = arg.hash;
+                verifyExisting = arg.verifyExisting;
+                blockCrc = arg.blockCrc;
             }
 
             return *this;
@@ -0,0 +1,110 @@
+#ifndef HTTP_METRICS_CLASS_HEAD
+#define HTTP_METRICS_CLASS_HEAD
+
+#include "utility/Clock.h"
+
+#include <stdint.h>
+
+#include <string>
+#include <vector>
+
+struct AddressMetrics
+{
+    std::string address;
+    int sessions;                       // sessions pinned to it now.
+    size_t bytes;
+    double seconds;                     // transfer time of finished sessions.
+    int failures;
+    bool demoted;
+
+    explicit AddressMetrics(const std::string& addr)
+        : address(addr),
+          sessions(0),
+          bytes(0),
+          seconds(0),
+          failures(0),
+          demoted(false)
+        {}
+
+    double speed() const
+        {
+            return (seconds > 0) ? bytes / seconds : 0;
+        }
+};
+
+struct SourceMetrics
+{
+    std::string uri;
+    bool valid;                         // false if it's dropped.
+    int sessions;
+    size_t bytes;
+    double seconds;
+    int failures;
+
+    explicit SourceMetrics(const std::string& u)
+        : uri(u),
+          valid(true),
+          sessions(0),
+          bytes(0),
+          seconds(0),
+          failures(0)
+        {}
+
+    double speed() const
+        {
+            return (seconds > 0) ? bytes / seconds : 0;
+        }
+};
+
+struct HttpMetrics
+{
+    int sessionCreated;
+    int sessionReused;
+    long connects;                      // new connections, each one cost a TCP(+TLS) handshake.
+    long tlsConnects;                   // new connections with TLS, full or resumed handshake.
+    Utility::Clock::Ms rangeLatency;    // total time from range assigned to its first byte.
+    int rangeCount;
+    int poolHit;                        // easy handle taken from pool, see EasyHandlePool.
+    int poolMiss;                       // easy handle duplicated from task template.
+    int piecesVerified;
+    int pieceFailures;                  // pieces downloaded again for bad hash.
+    int checkpoints;                    // resume state saved after data is flushed.
+    size_t hashReadBack;                // bytes read back from file for whole file hash.
+    size_t crcReadBack;                 // bytes read back for CRCs of blocks written out of order.
+    int blockCrcFailures;               // check blocks downloaded again for bad CRC on resume.
+    std::string digest;                 // whole file hash in hex, set when task finishes.
+    uint32_t crc;                       // CRC-32C of file, set by verify() without piece hashes.
+    Utility::Clock::Ms startTime;       // task started.
+    Utility::Clock::Ms parallelTime;    // from start to all ranges running.
+    bool parallel;                      // parallelTime is set.
+    std::vector<AddressMetrics> addresses;
+    std::vector<SourceMetrics> sources;  // empty if task has no mirror.
+
+    HttpMetrics()
+        : sessionCreated(0),
+          sessionReused(0),
+          connects(0),
+          tlsConnects(0),
+          rangeLatency(0),
+          rangeCount(0),
+          poolHit(0),
+          poolMiss(0),
+          piecesVerified(0),
+          pieceFailures(0),
+          checkpoints(0),
+          hashReadBack(0),
+          crcReadBack(0),
+          blockCrcFailures(0),
+          crc(0),
+          startTime(0),
+          parallelTime(0),
+          parallel(false)
+        {}
+
+    Utility::Clock::Ms averageRangeLatency() const
+        {
+            return (rangeCount == 0) ? 0 : rangeLatency / rangeCount;
+        }
+};
+
+#endif
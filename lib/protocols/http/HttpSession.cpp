@@ -1,21 +1,214 @@
 #include "HttpSession.h"
 #include "HttpTask.h"
+#include "ByteRangesParser.h"
+#include "CurlShare.h"
+#include "EasyHandlePool.h"
 #include "utility/Utility.h"
 
+#include <errno.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/socket.h>
+
+class SessionRangesParser : public ByteRangesParser
+{
+public:
+    SessionRangesParser(HttpSession& ses, const std::string& boundary)
+        : ByteRangesParser(boundary),
+          ses_(ses)
+        {}
+
+    virtual bool part(size_t begin, size_t end)
+        {
+            return ses_.startPart(begin, end);
+        }
+
+    virtual bool data(const char* buffer, size_t len)
+        {
+            return ses_.write(const_cast<char*>(buffer), len);
+        }
+
+private:
+    HttpSession& ses_;
+};
+
 HttpSession::HttpSession(HttpTask& task, size_t pos, long length)
     : task_(task),
-      handle_(curl_easy_init()),
+      handle_(makeHandle(task)),
       pos_(pos),
-      length_(length)
+      length_(length),
+      multiRange_(false),
+      bodyStarted_(false),
+      skip_(0),
+      parser_(NULL),
+      startTime_(Utility::Clock::now()),
+      address_(-1),
+      connectTo_(NULL),
+      source_(0),
+      rangesRefused_(false)
+{
+    init();
+}
+
+HttpSession::HttpSession(HttpTask& task, const Ranges& ranges)
+    : task_(task),
+      handle_(makeHandle(task)),
+      pos_(ranges.front().pos),
+      length_(ranges.front().length),
+      ranges_(ranges.begin() + 1, ranges.end()),
+      multiRange_(ranges.size() > 1),
+      bodyStarted_(false),
+      skip_(0),
+      parser_(NULL),
+      startTime_(Utility::Clock::now()),
+      address_(-1),
+      connectTo_(NULL),
+      source_(0),
+      rangesRefused_(false)
+{
+    init();
+}
+
+HttpSession::~HttpSession()
+{
+    delete parser_;
+    if (connectTo_ != NULL)
+    {
+        curl_easy_setopt(handle_, CURLOPT_CONNECT_TO, NULL);
+        curl_slist_free_all(connectTo_);
+    }
+    EasyHandlePool::instance().put(handle_, task_.handleOwner());
+}
+
+/**
+ * \brief Pin session to an address, connectTo is in CURLOPT_CONNECT_TO format.
+ */
+bool HttpSession::setAddress(int index, const std::string& connectTo)
+{
+    if (connectTo.length() == 0)
+    {
+        // not pinned, or pinned by the connection it already has.
+        if (connectTo_ != NULL)
+        {
+            curl_easy_setopt(handle_, CURLOPT_CONNECT_TO, NULL);
+            curl_slist_free_all(connectTo_);
+            connectTo_ = NULL;
+        }
+        address_ = index;
+        return true;
+    }
+
+    curl_slist* list = curl_slist_append(NULL, connectTo.c_str());
+    if (list == NULL)
+    {
+        task_.setError(HttpTask::OUT_OF_MEMORY, "alloc connect to list fail.");
+        return false;
+    }
+
+    CURLcode rete = curl_easy_setopt(handle_, CURLOPT_CONNECT_TO, list);
+    if (rete != CURLE_OK)
+    {
+        curl_slist_free_all(list);
+        task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));
+        return false;
+    }
+
+    if (connectTo_ != NULL)
+        curl_slist_free_all(connectTo_);
+    connectTo_ = list;
+    address_ = index;
+
+    return true;
+}
+
+/**
+ * \brief Download from a mirror of task, call it before the handle is added to multi handle.
+ */
+bool HttpSession::setSource(int index, const std::string& uri)
+{
+    CURLcode rete = curl_easy_setopt(handle_, CURLOPT_URL, uri.c_str());
+    if (rete != CURLE_OK)
+    {
+        task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));
+        return false;
+    }
+
+    source_ = index;
+
+    return setHeaders();
+}
+
+/**
+ * \brief Server sent the whole file for the range, take it from pos as one range.
+ */
+void HttpSession::restart(size_t pos, long length)
+{
+    pos_ = pos;
+    length_ = length;
+    ranges_.clear();
+    multiRange_ = false;
+    skip_ = 0;
+}
+
+/**
+ * \brief Ask the whole file as range "0-", so a 206 tells server supports range.
+ */
+bool HttpSession::probeRange()
+{
+    CURLcode rete = curl_easy_setopt(handle_, CURLOPT_RANGE, "0-");
+    if (rete != CURLE_OK)
+    {
+        task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Take a handle from pool, or duplicate task's template handle which has task options set.
+ * A handle the task put back has its options, only what the last session changed is set
+ * back. One of another task is reset, it gets task options again.
+ */
+CURL* HttpSession::makeHandle(HttpTask& task)
+{
+    bool kept = false;
+    CURL* handle = EasyHandlePool::instance().get(task.handleOwner(), kept);
+    if (handle != NULL)
+    {
+        ++task.metrics().poolHit;
+        bool ok = kept
+            ? (curl_easy_pause(handle, CURLPAUSE_CONT) == CURLE_OK &&
+               curl_easy_setopt(handle, CURLOPT_URL, task.uri()) == CURLE_OK &&
+               curl_easy_setopt(handle, CURLOPT_RANGE, NULL) == CURLE_OK)
+            : setTaskOptions(task, handle);
+        if (!ok)
+        {
+            curl_easy_cleanup(handle);
+            return NULL;
+        }
+        return handle;
+    }
+
+    ++task.metrics().poolMiss;
+    CURL* temp = task.handleTemplate();
+    if (temp == NULL)
+        return NULL;
+
+    return curl_easy_duphandle(temp);
+}
+
+void HttpSession::init()
 {
-    LOG(0, "make task %p session from %lu, len %ld\n", &task_, pos, length);
+    LOG(0, "make task %p session from %lu, len %ld, %lu more ranges\n",
+        &task_, pos_, length_, ranges_.size());
     {
         char logBuffer[64] = {0};
-        snprintf(logBuffer, 63, "make new session from %lu, len %lu", pos, length);
+        snprintf(logBuffer, 63, "make new session from %lu, len %ld", pos_, length_);
         task_.log(logBuffer);
     }
 
-    if (length == 0)
+    if (length_ == 0)
     {
         task_.setError(HttpTask::OTHER, "download length can't be 0.");
         return;
@@ -30,26 +223,47 @@ HttpSession::HttpSession(HttpTask& task, size_t pos, long length)
     initCurlHandle();
 }
 
-HttpSession::~HttpSession()
+/**
+ * Point the session to new ranges, keep the easy handle with all options. The caller
+ * should remove it from multi handle before and add it back after, so the connection
+ * in multi handle's cache can be used again.
+ */
+bool HttpSession::reset(const Ranges& ranges)
 {
-    curl_easy_cleanup(handle_);
-}
+    pos_ = ranges.front().pos;
+    length_ = ranges.front().length;
+    ranges_.assign(ranges.begin() + 1, ranges.end());
+    multiRange_ = (ranges.size() > 1);
+    bodyStarted_ = false;
+    skip_ = 0;
+    contentRange_.clear();
+    delete parser_;
+    parser_ = NULL;
+    startTime_ = Utility::Clock::now();
 
-// void HttpSession::reset(size_t pos, int length)
-// {
-//     if (length == 0)
-//     {
-//         task_.setError(HttpTask::OTHER, "download length can't be 0.");
-//         return;
-//     }
+    LOG(0, "reset task %p session %p to %lu, len %ld, %lu more ranges\n",
+        &task_, this, pos_, length_, ranges_.size());
 
-//     pos_ = pos;
-//     length_ = length;
+    if (length_ == 0)
+    {
+        task_.setError(HttpTask::OTHER, "download length can't be 0.");
+        return false;
+    }
 
-//     curl_easy_reset(handle_);
+    // a finished session was paused, resume it before reuse.
+    CURLcode rete = curl_easy_pause(handle_, CURLPAUSE_CONT);
+    if (rete != CURLE_OK)
+    {
+        task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));
+        return false;
+    }
+
+    // validators may have changed since the handle was used.
+    if (!setHeaders())
+        return false;
 
-//     initCurlHandle();
-// }
+    return setRange();
+}
 
 bool HttpSession::checkFinish()
 {
@@ -61,6 +275,11 @@ bool HttpSession::checkFinish()
         return false;
     }
 
+    if (ranges_.size() > 0)
+    {
+        return false;
+    }
+
     return true;
 }
 
@@ -77,89 +296,413 @@ long HttpSession::getResponseCode()
     return ret;
 }
 
-bool HttpSession::initCurlHandle()
+/**
+ * \brief Content-Length of response, -1 if it's not known.
+ */
+double HttpSession::contentLength()
 {
+    double length = -1;
+    if (curl_easy_getinfo(handle_, CURLINFO_CONTENT_LENGTH_DOWNLOAD, &length) != CURLE_OK)
+        return -1;
+
+    return length;
+}
+
 #define CHECK_CURLE(rete)                                               \
     {                                                                   \
         if (rete != CURLE_OK)                                           \
         {                                                               \
-            task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));  \
+            task.setError(HttpTask::OTHER, curl_easy_strerror(rete));   \
             return false;                                               \
         }                                                               \
     }
 
-    CURLcode rete = curl_easy_setopt(handle_, CURLOPT_URL, task_.uri());
+/**
+ * Set the options shared by all sessions of a task.
+ */
+bool HttpSession::setTaskOptions(HttpTask& task, CURL* handle)
+{
+    CURLcode rete = curl_easy_setopt(handle, CURLOPT_URL, task.uri());
     CHECK_CURLE(rete);
 
-    rete = curl_easy_setopt(handle_, CURLOPT_WRITEFUNCTION, &HttpSession::writeCallback);
-    CHECK_CURLE(rete);
+    if (CurlShare::instance().handle() != NULL)
+    {
+        rete = curl_easy_setopt(handle, CURLOPT_SHARE, CurlShare::instance().handle());
+        CHECK_CURLE(rete);
+    }
 
-    rete = curl_easy_setopt(handle_, CURLOPT_WRITEDATA, this);
+    rete = curl_easy_setopt(handle, CURLOPT_WRITEFUNCTION, &HttpSession::writeCallback);
     CHECK_CURLE(rete);
 
-    rete = curl_easy_setopt(handle_, CURLOPT_PRIVATE, this);
+    rete = curl_easy_setopt(handle, CURLOPT_HEADERFUNCTION, &HttpSession::headerCallback);
     CHECK_CURLE(rete);
 
-    if (task_.configure().referer.length() != 0)
+    if (task.configure().referer.length() != 0)
     {
-        rete = curl_easy_setopt(handle_, CURLOPT_REFERER, task_.configure().referer.c_str());
+        rete = curl_easy_setopt(handle, CURLOPT_REFERER, task.configure().referer.c_str());
         CHECK_CURLE(rete);
     }
 
-    if (task_.configure().userAgent.length() != 0)
+    if (task.configure().userAgent.length() != 0)
     {
-        rete = curl_easy_setopt(handle_, CURLOPT_USERAGENT, task_.configure().userAgent.c_str());
+        rete = curl_easy_setopt(handle, CURLOPT_USERAGENT, task.configure().userAgent.c_str());
         CHECK_CURLE(rete);
     }
 
-    if (task_.configure().connectingTimeout > 0)
+    if (task.configure().connectingTimeout > 0)
     {
-        rete = curl_easy_setopt(handle_, CURLOPT_CONNECTTIMEOUT, task_.configure().connectingTimeout);
+        rete = curl_easy_setopt(handle, CURLOPT_CONNECTTIMEOUT, task.configure().connectingTimeout);
         CHECK_CURLE(rete);
     }
 
-    if (length_ != UNKNOWN_LEN)
+    // curl takes 16 KiB a time by default, bigger buffer means fewer callbacks on fast links.
+    if (task.configure().bufferSize > 0)
+    {
+        rete = curl_easy_setopt(handle, CURLOPT_BUFFERSIZE, task.configure().bufferSize);
+        CHECK_CURLE(rete);
+    }
+
+    rete = curl_easy_setopt(handle, CURLOPT_TCP_NODELAY, long(task.configure().tcpNoDelay));
+    CHECK_CURLE(rete);
+
+    rete = curl_easy_setopt(handle, CURLOPT_TCP_KEEPALIVE, long(task.configure().tcpKeepAlive));
+    CHECK_CURLE(rete);
+
+    rete = curl_easy_setopt(handle, CURLOPT_SOCKOPTFUNCTION, &HttpSession::sockoptCallback);
+    CHECK_CURLE(rete);
+
+    rete = curl_easy_setopt(handle, CURLOPT_SOCKOPTDATA, &task);
+    CHECK_CURLE(rete);
+
+#if LIBCURL_VERSION_NUM >= 0x072f00
+    if (task.configure().http2)
     {
-        char range[128] = {0};
-        sprintf(range, "%lu-%lu", pos_, pos_ + length_ - 1);
-        rete = curl_easy_setopt(handle_, CURLOPT_RANGE, range);
+        rete = curl_easy_setopt(handle, CURLOPT_HTTP_VERSION, long(CURL_HTTP_VERSION_2TLS));
+        CHECK_CURLE(rete);
+
+        // wait for the connection to tell if it can multiplex, instead of opening another.
+        rete = curl_easy_setopt(handle, CURLOPT_PIPEWAIT, 1L);
         CHECK_CURLE(rete);
     }
+#endif
 
     return true;
+}
+
+#undef CHECK_CURLE
+
+bool HttpSession::initCurlHandle()
+{
+#define CHECK_CURLE(rete)                                               \
+    {                                                                   \
+        if (rete != CURLE_OK)                                           \
+        {                                                               \
+            task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));  \
+            return false;                                               \
+        }                                                               \
+    }
+
+    CURLcode rete = curl_easy_setopt(handle_, CURLOPT_WRITEDATA, this);
+    CHECK_CURLE(rete);
+
+    rete = curl_easy_setopt(handle_, CURLOPT_HEADERDATA, this);
+    CHECK_CURLE(rete);
+
+    rete = curl_easy_setopt(handle_, CURLOPT_PRIVATE, this);
+    CHECK_CURLE(rete);
+
+    if (!setHeaders())
+        return false;
+
+    return setRange();
 #undef CHECK_CURLE
 }
 
-size_t HttpSession::writeCallback(void *buffer, size_t size, size_t nmemb, HttpSession* ses)
+/**
+ * If-Range of task, so a changed file answers 200 with the new one instead of a part of it.
+ * A mirror has its own validators, it doesn't send them.
+ */
+bool HttpSession::setHeaders()
 {
-    if (ses->task_.internalState() == HttpTask::HT_PREPARE)
+    curl_slist* headers = (source_ == 0) ? task_.requestHeaders() : NULL;
+    CURLcode rete = curl_easy_setopt(handle_, CURLOPT_HTTPHEADER, headers);
+    if (rete != CURLE_OK)
     {
-        ses->task_.initTask();
+        task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));
+        return false;
+    }
+
+    return true;
+}
+
+bool HttpSession::setRange()
+{
+    if (length_ == UNKNOWN_LEN)
+    {
+        return true;
+    }
+
+    char range[128] = {0};
+    sprintf(range, "%lu-%lu", pos_, pos_ + length_ - 1);
+    rangeString_ = range;
+    for (Ranges::iterator it = ranges_.begin(); it != ranges_.end(); ++it)
+    {
+        sprintf(range, ",%lu-%lu", it->pos, it->pos + it->length - 1);
+        rangeString_ += range;
+    }
+
+    CURLcode rete = curl_easy_setopt(handle_, CURLOPT_RANGE, rangeString_.c_str());
+    if (rete != CURLE_OK)
+    {
+        task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Check the first response of a multi-range request. Server may answer 206 with
+ * multipart/byteranges, 206 with only one range, or 200 with the whole file. The
+ * last two mean server doesn't support multi-range, so tell task to fall back.
+ */
+bool HttpSession::checkMultiRange()
+{
+    long respCode = getResponseCode();
+    if (respCode / 100 != 2)
+    {
+        return false;
+    }
+
+    if (respCode == 206)
+    {
+        char* contentType = NULL;
+        CURLcode rete = curl_easy_getinfo(handle_, CURLINFO_CONTENT_TYPE, &contentType);
+        if (rete != CURLE_OK)
+        {
+            task_.setError(HttpTask::OTHER, curl_easy_strerror(rete));
+            return false;
+        }
+
+        std::string boundary;
+        if (ByteRangesParser::parseBoundary(contentType, boundary))
+        {
+            parser_ = new SessionRangesParser(*this, boundary);
+            return true;
+        }
+
+        size_t begin, end, total;
+        if (!ByteRangesParser::parseContentRange(contentRange_.c_str(), begin, end, total))
+        {
+            task_.setError(HttpTask::OTHER, "bad Content-Range in response.");
+            return false;
+        }
+
+        LOG(0, "server only send range %lu-%lu\n", begin, end);
+        pos_ = begin;
+        length_ = end - begin + 1;
+    }
+    else
+    {
+        LOG(0, "server ignore range, response %ld\n", respCode);
+        skip_ = pos_;
+    }
+
+    ranges_.clear();
+    task_.rejectMultiRange();
+
+    return true;
+}
+
+bool HttpSession::startPart(size_t begin, size_t end)
+{
+    pos_ = begin;
+    length_ = end - begin + 1;
+
+    Ranges::iterator it = ranges_.begin();
+    while (it != ranges_.end())
+    {
+        if (begin <= it->pos && it->pos <= end)
+            it = ranges_.erase(it);
+        else
+            ++it;
+    }
+
+    return true;
+}
+
+bool HttpSession::write(void *buffer, size_t size)
+{
+    if (length_ == 0)
+    {
+        // current range has finished, drop the rest.
+        return true;
     }
 
-    ssize_t shouldWrite = size * nmemb;
-    if (ses->length_ > 0)
+    size_t shouldWrite = size;
+    if (length_ > 0)
     {
         // got the file size from server.
-        if (shouldWrite > ses->length_)
-            shouldWrite = ses->length_;
+        if (shouldWrite > size_t(length_))
+            shouldWrite = length_;
     }
 
-    if (!ses->task_.writeFile(ses->pos_, buffer, shouldWrite))
+    if (!task_.writeFile(pos_, buffer, shouldWrite))
     {
         //HttpTask should change state to error in writeFile if fail.
         LOG(0, "write fail\n");
-        return 0;
+        return false;
     }
 
-    if (ses->length_ > 0)
+    if (length_ > 0)
     {
-        ses->length_ -= shouldWrite;
-        ses->pos_ += shouldWrite;
+        length_ -= shouldWrite;
+        pos_ += shouldWrite;
+    }
+
+    return true;
+}
+
+size_t HttpSession::writeCallback(void *buffer, size_t size, size_t nmemb, HttpSession* ses)
+{
+    if (!ses->task_.mayReceive(ses))
+        return CURL_WRITEFUNC_PAUSE;
+
+    if (ses->task_.internalState() == HttpTask::HT_PREPARE)
+    {
+        // headers didn't end with a 2xx response line we know, init here.
+        ses->task_.initTask();
+    }
+
+    size_t total = size * nmemb;
+
+    if (!ses->bodyStarted_)
+    {
+        ses->bodyStarted_ = true;
+
+        HttpMetrics& metrics = ses->task_.metrics();
+        metrics.rangeLatency += Utility::Clock::now() - ses->startTime_;
+        ++metrics.rangeCount;
+
+        if (!ses->task_.checkSource(ses))
+            return 0;
+
+        if (ses->multiRange_ && !ses->checkMultiRange())
+            return 0;
+    }
+
+    if (ses->parser_ != NULL)
+    {
+        if (!ses->parser_->feed(static_cast<char*>(buffer), total))
+        {
+            LOG(0, "parse multipart/byteranges fail: %s\n", ses->parser_->getError());
+            return 0;
+        }
+    }
+    else
+    {
+        char* data = static_cast<char*>(buffer);
+        size_t len = total;
+        if (ses->skip_ > 0)
+        {
+            size_t n = (len < ses->skip_) ? len : ses->skip_;
+            data += n;
+            len -= n;
+            ses->skip_ -= n;
+        }
+
+        if (len > 0 && !ses->write(data, len))
+            return 0;
     }
 
+    ses->task_.consume(ses, total);
+
     if (ses->checkFinish())
         ses->task_.sessionFinish(ses);
 
-    return size * nmemb;
+    return total;
+}
+
+/**
+ * Set socket options curl has no option for, before the socket connects.
+ */
+int HttpSession::sockoptCallback(HttpTask* task, curl_socket_t fd, curlsocktype purpose)
+{
+    if (purpose != CURLSOCKTYPE_IPCXN)
+        return CURL_SOCKOPT_OK;
+
+    // kernel default receive window caps a session on long fat network.
+    int size = task->configure().receiveBuffer;
+    if (size > 0 && setsockopt(fd, SOL_SOCKET, SO_RCVBUF, &size, sizeof(size)) != 0)
+    {
+        LOG(0, "set SO_RCVBUF to %d fail: %s\n", size, strerror(errno));
+    }
+
+    return CURL_SOCKOPT_OK;
+}
+
+size_t HttpSession::headerCallback(void *buffer, size_t size, size_t nmemb, HttpSession* ses)
+{
+    static const char contentRange[] = "Content-Range:";
+    static const char etag[] = "ETag:";
+    static const char lastModified[] = "Last-Modified:";
+    static const char acceptRanges[] = "Accept-Ranges:";
+
+    size_t total = size * nmemb;
+    const char* line = static_cast<const char*>(buffer);
+
+    if (total > 5 && strncmp(line, "HTTP/", 5) == 0)
+    {
+        // a new response, maybe after redirect.
+        ses->contentRange_.clear();
+        ses->etag_.clear();
+        ses->lastModified_.clear();
+        ses->rangesRefused_ = false;
+    }
+    else if (total <= 2 && (line[0] == '\r' || line[0] == '\n'))
+    {
+        // end of headers, length is known now. Split before the first body byte.
+        long respCode = ses->getResponseCode();
+        if ((respCode == 200 || respCode == 206) &&
+            ses->task_.internalState() == HttpTask::HT_PREPARE)
+        {
+            ses->task_.initTask();
+        }
+    }
+    else if (total > sizeof(acceptRanges) - 1 &&
+             strncasecmp(line, acceptRanges, sizeof(acceptRanges) - 1) == 0)
+    {
+        std::string value(line + sizeof(acceptRanges) - 1, total - (sizeof(acceptRanges) - 1));
+        ses->rangesRefused_ = (value.find("none") != std::string::npos);
+    }
+    else if (total > sizeof(etag) - 1 &&
+             strncasecmp(line, etag, sizeof(etag) - 1) == 0)
+    {
+        headerValue(line, total, sizeof(etag) - 1, ses->etag_);
+    }
+    else if (total > sizeof(lastModified) - 1 &&
+             strncasecmp(line, lastModified, sizeof(lastModified) - 1) == 0)
+    {
+        headerValue(line, total, sizeof(lastModified) - 1, ses->lastModified_);
+    }
+    else if (total > sizeof(contentRange) - 1 &&
+             strncasecmp(line, contentRange, sizeof(contentRange) - 1) == 0)
+    {
+        ses->contentRange_.assign(line + sizeof(contentRange) - 1,
+                                  total - (sizeof(contentRange) - 1));
+    }
+
+    return total;
+}
+
+void HttpSession::headerValue(const char* line, size_t total, size_t nameLength, std::string& value)
+{
+    value.assign(line + nameLength, total - nameLength);
+
+    size_t begin = value.find_first_not_of(" \t");
+    size_t end = value.find_last_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+        value.clear();
+    else
+        value = value.substr(begin, end - begin + 1);
 }
@@ -3,29 +3,74 @@
 
 #include <curl/curl.h>
 
+#include "utility/Clock.h"
+
+#include <string>
+#include <vector>
+
 class HttpTask;
+class SessionRangesParser;
 
 class HttpSession
 {
 public:
+    struct Range
+    {
+        size_t pos;
+        long length;
+
+        Range(size_t p, long len) : pos(p), length(len) {}
+    };
+    typedef std::vector<Range> Ranges;
+
     HttpSession(HttpTask& task, size_t pos = 0, long length = UNKNOWN_LEN);
+    HttpSession(HttpTask& task, const Ranges& ranges);
     ~HttpSession();
 
-//     void reset(size_t pos, int length);
+    bool reset(const Ranges& ranges);
     bool checkFinish();
     long getResponseCode();
+    double contentLength();
 
     HttpTask& task() { return task_; }
     CURL* handle()   { return handle_; }
     size_t pos()     { return pos_; }
     long length()    { return length_; }
+    bool isMultiRange()       { return multiRange_; }
+    const Ranges& ranges()    { return ranges_; }
+    int address()             { return address_; }
+    int source()              { return source_; }
+    const std::string& etag()         { return etag_; }
+    const std::string& lastModified() { return lastModified_; }
+    const std::string& contentRange() { return contentRange_; }
+    bool rangesRefused()              { return rangesRefused_; }
+    bool ranged()                     { return rangeString_.length() > 0; }
 
     void setLength(long length) { length_ = length; }
+    bool probeRange();
+    void restart(size_t pos, long length);
+    bool setAddress(int index, const std::string& connectTo);
+    bool setSource(int index, const std::string& uri);
+
+    static bool setTaskOptions(HttpTask& task, CURL* handle);
 
 private:
+    friend class SessionRangesParser;
+
+    static CURL* makeHandle(HttpTask& task);
+
+    void init();
     bool initCurlHandle();
+    bool setRange();
+    bool setHeaders();
+    bool checkMultiRange();
+    bool startPart(size_t begin, size_t end);
+    bool write(void *buffer, size_t size);
 
     static size_t writeCallback(void *buffer, size_t size, size_t nmemb, HttpSession* ses);
+    static size_t headerCallback(void *buffer, size_t size, size_t nmemb, HttpSession* ses);
+    static int sockoptCallback(HttpTask* task, curl_socket_t fd, curlsocktype purpose);
+    static void headerValue(const char* line, size_t total, size_t nameLength, std::string& value);
 
     static const long UNKNOWN_LEN = -1;
 
@@ -33,6 +78,26 @@ private:
     CURL* handle_;  // a reference.
     size_t pos_;
     long length_;  // -1 mean unknow length.
+
+    // pending ranges after [pos_, pos_ + length_) in a multi-range request.
+    Ranges ranges_;
+    bool multiRange_;
+    bool bodyStarted_;
+    size_t skip_;
+    std::string rangeString_;
+    std::string contentRange_;
+    SessionRangesParser* parser_;
+    Utility::Clock::Ms startTime_;
+
+    // index in task's addresses, -1 if not pinned.
+    int address_;
+    curl_slist* connectTo_;
+
+    // index in task's sources, 0 is the task uri.
+    int source_;
+    std::string etag_;
+    std::string lastModified_;
+    bool rangesRefused_;            // server sent "Accept-Ranges: none".
 };
 
 #endif
@@ -2,7 +2,40 @@
 
 #include <boost/format.hpp>
 
+#include <algorithm>
+#include <limits>
+#include <map>
+#include <memory>
+
+#include <ctype.h>
+#include <errno.h>
+#include <stdlib.h>
+#include <string.h>
+
 #include "HttpSession.h"
+#include "ByteRangesParser.h"
+#include "EasyHandlePool.h"
+#include "FileVerifier.h"
+#include "Metalink.h"
+#include "PieceHasher.h"
+#include "lib/utility/HostBuckets.h"
+#include "lib/utility/HostLimiter.h"
+#include "lib/utility/ThreadPool.h"
+
+static std::string hostOf(const std::string& uri);
+static std::string lowerCase(const std::string& str);
+
+// most bytes read back for whole file hash in one write, the rest waits for next writes.
+static const size_t hashCatchUp = 4 * 1024 * 1024;
+
+// milliseconds between checks of paused sessions, bucket burst is refilled in a tenth second.
+static const long pausedPoll = 100;
+
+// milliseconds between checks of pieces hashed in background.
+static const long hashPoll = 10;
+
+// blocks made to divide pieces are not smaller, unless blocks are configured smaller.
+static const size_t minPieceBlock = 512;
 
 HttpTask::HttpTask()
     : totalSize_(0),
@@ -13,30 +46,70 @@ HttpTask::HttpTask()
       protocol_(NULL),
       err_(OTHER),
       internalState_(HT_INVALID),
-      handle_(curl_multi_init()),
+      handle_(NULL),
+      template_(NULL),
+      handleOwner_(EasyHandlePool::instance().newOwner()),
+      speedShare_(0),
       writeLength_(0),
-      lastRunningHandle_(0)
+      lastRunningHandle_(0),
+      multiRangeRejected_(false),
+      readableSize_(0),
+      connectionLimit_(-1),
+      headers_(NULL),
+      deferred_(false),
+      rangesRefused_(false),
+      pieceLength_(0),
+      verifiedPieces_(0),
+      digest_(NULL),
+      hashedSize_(0),
+      verifier_(NULL),
+      verifyProgress_(0),
+      resumeVerified_(false),
+      pendingBytes_(0),
+      checkpointTime_(0),
+      blocksToCheck_(false),
+      checkingFrom_(0)
+{}
+
+HttpTask::~HttpTask()
 {
-    if (handle_ == NULL)
+    if (internalState_ == HT_DOWNLOAD)
+        checkpoint(true);
+
+    while (sessions_.size() > 0)
     {
-        setError(CURLM_BAD_ALLOC);
-        LOG(0, "create multi handle faile.\n");
-        return;
+        sessionFinish(sessions_.back());
     }
-}
 
-HttpTask::~HttpTask()
-{
-    for (int i=0, n=sessions_.size(); i<n; ++i)
+    for (int i=0, n=finishedSessions_.size(); i<n; ++i)
     {
-        sessionFinish(sessions_[i]);
+        removeSession(finishedSessions_[i]);
+        delete finishedSessions_[i];
     }
+    finishedSessions_.clear();
+    deleteIdleSessions();
 
-    CURLMcode retm =  curl_multi_cleanup(handle_);
-    if (retm != CURLM_OK)
+    if (template_ != NULL)
+    {
+        curl_easy_cleanup(template_);
+    }
+
+    if (handle_ != NULL)
     {
-        LOG(0, "clean up multi handle fail: %s.", curl_multi_strerror(retm));
+        CURLMcode retm =  curl_multi_cleanup(handle_);
+        if (retm != CURLM_OK)
+        {
+            LOG(0, "clean up multi handle fail: %s.", curl_multi_strerror(retm));
+        }
     }
+
+    curl_slist_free_all(headers_);
+    for (size_t i=0; i<oldHeaders_.size(); ++i)
+        curl_slist_free_all(oldHeaders_[i]);
+
+    delete digest_;
+    delete verifier_;
+    clearPieces();
 }
 
 const char* HttpTask::options()
@@ -51,6 +124,27 @@ const char* HttpTask::options()
                       "<UserAgent>%s</UserAgent>"
                       "<RetryCount>%d</RetryCount>"
                       "<ConnectingTimeOut>%ld</ConnectingTimeOut>"
+                      "<MultiRange>%d</MultiRange>"
+                      "<MaxRangesPerRequest>%d</MaxRangesPerRequest>"
+                      "<Sequential>%d</Sequential>"
+                      "<ReadAheadBlocks>%d</ReadAheadBlocks>"
+                      "<Http2>%d</Http2>"
+                      "<Http2Connections>%d</Http2Connections>"
+                      "<SpreadAddresses>%d</SpreadAddresses>"
+                      "<MaxDownloadSpeed>%ld</MaxDownloadSpeed>"
+                      "<BufferSize>%ld</BufferSize>"
+                      "<ReceiveBuffer>%d</ReceiveBuffer>"
+                      "<TcpNoDelay>%d</TcpNoDelay>"
+                      "<TcpKeepAlive>%d</TcpKeepAlive>"
+                      "<ProbeRange>%d</ProbeRange>"
+                      "<ResumeJournal>%d</ResumeJournal>"
+                      "<CheckpointInterval>%ld</CheckpointInterval>"
+                      "<PartFile>%d</PartFile>"
+                      "<CheckpointBytes>%ld</CheckpointBytes>"
+                      "<HashType>%s</HashType>"
+                      "<Hash>%s</Hash>"
+                      "<VerifyExisting>%d</VerifyExisting>"
+                      "<BlockCrc>%d</BlockCrc>"
             )
         % config_.sessionNumber
         % config_.minSessionBlocks
@@ -58,31 +152,140 @@ const char* HttpTask::options()
         % config_.referer
         % config_.userAgent
         % config_.retryCount
-        % config_.connectingTimeout);
+        % config_.connectingTimeout
+        % config_.multiRange
+        % config_.maxRangesPerRequest
+        % config_.sequential
+        % config_.readAheadBlocks
+        % config_.http2
+        % config_.http2Connections
+        % config_.spreadAddresses
+        % config_.maxDownloadSpeed
+        % config_.bufferSize
+        % config_.receiveBuffer
+        % config_.tcpNoDelay
+        % config_.tcpKeepAlive
+        % config_.probeRange
+        % config_.resumeJournal
+        % config_.checkpointInterval
+        % config_.partFile
+        % config_.checkpointBytes
+        % config_.hashType
+        % config_.hash
+        % config_.verifyExisting
+        % config_.blockCrc);
 
     return buffer.c_str(); // buffer is static varable, so it should be OK.
 }
 
 bool HttpTask::start()
 {
-    HttpSession* ses = new HttpSession(*this);
+    // a file left by last run is checked first, it's downloaded only where it's bad.
+    if (config_.verifyExisting && internalState_ == HT_INVALID && verify())
+        return true;
+
+    // a waiting task holds no curl handle.
+    if (handle_ == NULL)
+    {
+        handle_ = curl_multi_init();
+        if (handle_ == NULL)
+        {
+            setError(CURLM_BAD_ALLOC);
+            LOG(0, "create multi handle faile.\n");
+            return false;
+        }
+    }
+
+    if (!setMultiplex())
+        return false;
+
+    if (host_.length() == 0)
+        host_ = hostOf(uri_);
+    bucket_.setRate(speedLimit());
+    if (metrics_.startTime == 0)
+        metrics_.startTime = Utility::Clock::now();
+
+    // the first session is of task uri, it tells size and validators mirrors are checked with.
+    if (!acquireSource(0))
+    {
+        // host is busy, perform starts it when a connection is released.
+        deferred_ = true;
+        setInternalState(HT_PREPARE);
+        return true;
+    }
+
+    // resume state left by last run tells the size and what is downloaded.
+    if (config_.partFile)
+    {
+        if (!part_.isOpen() &&
+            part_.open(filePath() + ".part", totalSize_, config_.bytesPerBlock))
+        {
+            totalSize_ = part_.totalSize();
+            setValidators(part_.etag(), part_.lastModified());
+        }
+    }
+    else if (config_.resumeJournal && !journal_.isOpen() &&
+             journal_.open(filePath() + ".journal", totalSize_, config_.bytesPerBlock))
+    {
+        totalSize_ = journal_.totalSize();
+        setValidators(journal_.etag(), journal_.lastModified());
+    }
+
+    resetDigest();
+
+    // size is known from metalink or resume state, no need to wait for the first response.
+    bool knownSize = (totalSize_ > 0);
+
+    size_t pos = 0;
+    long length = long(totalSize_);
+    if (knownSize)
+        firstHole(pos, length);
+
+    HttpSession* ses = knownSize
+        ? new HttpSession(*this, pos, length)
+        : new HttpSession(*this);
     if (ses == NULL)
     {
         LOG(0, "create easy handle faile.\n");
+        releaseSource(0);
+        return false;
+    }
+    ++metrics_.sessionCreated;
+
+    if (!knownSize && config_.probeRange && !ses->probeRange())
+    {
+        delete ses;
+        releaseSource(0);
         return false;
     }
 
-    sessions_.push_back(ses);
     CURLMcode retm = curl_multi_add_handle(handle_, ses->handle());
     if (retm != CURLM_OK)
     {
+        delete ses;
+        releaseSource(0);
         setError(OTHER, curl_multi_strerror(retm));
         LOG(0, "add easy handle to multi handle fail: %s.\n", curl_multi_strerror(retm));
         return false;
     }
+    sessions_.push_back(ses);
 
     setInternalState(HT_PREPARE);
 
+    if (knownSize)
+    {
+        if (!openFile())
+        {
+            sessions_.pop_back();
+            curl_multi_remove_handle(handle_, ses->handle());
+            delete ses;
+            releaseSource(0);
+            return false;
+        }
+
+        startDownload(ses);
+    }
+
     return true;
 }
 
@@ -93,6 +296,10 @@ bool HttpTask::stop()
 
 bool HttpTask::fdSet(fd_set* read, fd_set* write, fd_set* exc, int* max)
 {
+    // verify has no connection.
+    if (handle_ == NULL)
+        return true;
+
     CURLMcode ret = curl_multi_fdset(handle_, read, write, exc, max);
     if (ret != CURLM_OK)
     {
@@ -103,9 +310,42 @@ bool HttpTask::fdSet(fd_set* read, fd_set* write, fd_set* exc, int* max)
     return true;
 }
 
+long HttpTask::timeout()
+{
+    // verify reads file in perform, nothing in fd set wakes it.
+    if (internalState_ == HT_VERIFY)
+        return 0;
+
+    if (handle_ == NULL)
+        return -1;
+
+    long ms = -1;
+    if (curl_multi_timeout(handle_, &ms) != CURLM_OK)
+        ms = -1;
+
+    // pieces and check blocks hashed on pool wake nothing in fd set.
+    if (pieceHasher_.started() || verifyQueue_.size() > 0 || blockHasher_.started() ||
+        blocksToCheck_ || crcHasher_.started())
+        ms = (ms < 0) ? hashPoll : std::min(ms, hashPoll);
+
+    // sessions paused by speed limit wait for tokens, not for a fd.
+    if (pausedSessions_.size() > 0 && (ms < 0 || ms > pausedPoll))
+        ms = pausedPoll;
+
+    return ms;
+}
+
 size_t HttpTask::performDownload()
 {
+    if (internalState_ == HT_VERIFY)
+    {
+        verifyStep();
+        return 0;
+    }
+
     writeLength_ = 0;
+    resumePaused();
+
     CURLMcode ret;
     int running = 0;
     while ((ret = curl_multi_perform(handle_, &running)) == CURLM_CALL_MULTI_PERFORM)
@@ -118,6 +358,14 @@ size_t HttpTask::performDownload()
     lastRunningHandle_ = running;
 
     clearSessions();
+    checkpoint(false);
+    takeAddresses();
+
+    if (deferred_)
+    {
+        resumeDeferred();
+        checkParallel();
+    }
 
     return writeLength_;
 }
@@ -146,6 +394,7 @@ void HttpTask::setInternalState(InternalState state)
     case HT_PREPARE:
     case HT_DOWNLOAD:
     case HT_DOWNLOAD_WITHOUT_LENGTH:
+    case HT_VERIFY:
         state_ = TASK_DOWNLOAD;
         break;
     case HT_FINISH:
@@ -161,7 +410,7 @@ void HttpTask::setError(Error error, const char* errstr)
 {
     setInternalState(HT_ERROR);
     err_ = error;
-    errstr_ = errstr;
+    errstr_ = (errstr == NULL) ? "" : errstr;
 }
 
 static std::string guessFileName(const std::string uri)
@@ -170,16 +419,33 @@ static std::string guessFileName(const std::string uri)
     return uri.substr(p);
 }
 
-void HttpTask::initTask()
+std::string HttpTask::filePath()
 {
-    std::string filename = outputDir_;
     if (outputName_.length() == 0)
     {
         outputName_ = guessFileName(uri_);
     }
-    filename += outputName_;
 
-    file_.open(filename.c_str(), Utility::FileManager::OF_Write | Utility::FileManager::OF_Create);
+    return outputDir_ + outputName_;
+}
+
+bool HttpTask::openFile()
+{
+    std::string filename = filePath();
+
+    // pieces may be read back to verify.
+    if (!file_.open(filename.c_str(), Utility::FileManager::OF_RW | Utility::FileManager::OF_Create))
+    {
+        setError(FAIL_OPEN_FILE);
+        return false;
+    }
+
+    return true;
+}
+
+void HttpTask::initTask()
+{
+    openFile();
 
     HttpSession* ses = sessions_[0];
 
@@ -208,173 +474,2426 @@ void HttpTask::initTask()
             mimeType_ = std::string(contentType, split - contentType);
     }
 
-    validSource_ = totalSource_ = 1;
+#if LIBCURL_VERSION_NUM >= 0x073200
+    long version = 0;
+    if (config_.http2 &&
+        curl_easy_getinfo(ehandle, CURLINFO_HTTP_VERSION, &version) == CURLE_OK &&
+        version != CURL_HTTP_VERSION_2_0)
+    {
+        log("server doesn't support HTTP/2, sessions use their own connections.");
+    }
+#endif
+
+    setValidators(ses->etag(), ses->lastModified());
+
+    if (config_.spreadAddresses)
+        resolveAddresses();
+
+    // probe asked "0-", server ignore it if it answers 200.
+    if (ses->rangesRefused() || (config_.probeRange && ses->getResponseCode() != 206))
+    {
+        log("server doesn't support range, download in one session.");
+        rangesRefused_ = true;
+    }
 
     if (length > 0)
     {
-        ses->setLength(long(length));
-        setInternalState(HT_DOWNLOAD);
         totalSize_ = size_t(length);
-        downloadBitmap_ = validBitmap_ = BitMap(totalSize_, config_.bytesPerBlock);
-        validBitmap_.setAll(true);
-        downloadBitmap_.setAll(false);
-
-        separateSession();
+        startDownload(ses);
     }
     else
     {
         setInternalState(HT_DOWNLOAD_WITHOUT_LENGTH);
+        updateSources();
+    }
+}
+
+/**
+ * Total size is known, make bitmaps and give the file to sessions.
+ */
+void HttpTask::startDownload(HttpSession* first)
+{
+    if (first->length() < 0)
+        first->setLength(long(totalSize_));
+    setInternalState(HT_DOWNLOAD);
+    downloadBitmap_ = validBitmap_ = BitMap(totalSize_, config_.bytesPerBlock);
+    validBitmap_.setAll(true);
+    downloadBitmap_.setAll(false);
+    written_.clear();
+    for (size_t i=0; i<sources_.size(); ++i)
+        sources_[i].blocks = BitMap();
+    updateSources();
+
+    clearPieces();
+    pieces_.assign(pieceHashes_.size(), Piece());
+    verifiedPieces_ = 0;
+    resetDigest();
+    clearCheckBlocks();
+
+    openResume();
+
+    if (rangesRefused_)
+    {
+        // first session takes the whole file.
+    }
+    else if (config_.sequential)
+    {
+        // first session only take the first piece, others follow it in order.
+        long pieceLength = long(config_.minSessionBlocks) * config_.bytesPerBlock;
+        if (first->length() > pieceLength)
+            first->setLength(pieceLength);
+        fillHoles();
+    }
+    else
+    {
+        if (downloadSize_ > 0)
+            fillHoles();
+        separateSession();
     }
+
+    checkParallel();
+}
+
+/**
+ * Record the time from start to all ranges running, once.
+ */
+void HttpTask::checkParallel()
+{
+    if (metrics_.parallel || internalState_ != HT_DOWNLOAD || deferred_)
+        return;
+
+    metrics_.parallel = true;
+    metrics_.parallelTime = Utility::Clock::now() - metrics_.startTime;
+    LOG(0, "task %p runs %lu sessions after %llu ms\n",
+        this, sessions_.size(), metrics_.parallelTime);
 }
 
 void HttpTask::separateSession()
 {
-    while (int(sessions_.size()) < config_.sessionNumber)
+    if (rangesRefused_)
+        return;
+
+    while (int(sessions_.size()) < sessionLimit())
     {
-        int maxLength = 0;
-        for (int i=1, n=sessions_.size(); i<n; ++i)
+        // multi-range session can't be split by length.
+        int maxLength = -1;
+        for (int i=0, n=sessions_.size(); i<n; ++i)
         {
-            if (sessions_[i]->length() > sessions_[maxLength]->length())
+            if (sessions_[i]->isMultiRange())
+                continue;
+            if (maxLength == -1 || sessions_[i]->length() > sessions_[maxLength]->length())
                 maxLength = i;
         }
+        if (maxLength == -1)
+            return;
 
-        int splitNum = config_.sessionNumber - sessions_.size();
-        while ((splitNum * config_.minSessionBlocks * config_.bytesPerBlock)
-               > sessions_[maxLength]->length())
+        // every part, the one kept too, has at least minSessionBlocks whole blocks.
+        long minLength = long(std::max(config_.minSessionBlocks, 1) * downloadBitmap_.bytesPerBit());
+        int splitNum = sessionLimit() - sessions_.size();
+        while (splitNum > 0 && (splitNum + 1) * minLength > sessions_[maxLength]->length())
             --splitNum;
 
         if (splitNum <= 0)
             return;
 
+        // new sessions take the tail of the range, sources are picked for it.
+        size_t end = sessions_[maxLength]->pos() + sessions_[maxLength]->length();
+        std::vector<int> reserved;
+        while (int(reserved.size()) < splitNum)
+        {
+            int index = reserveSource(end - 1);
+            if (index < 0)
+                break;
+            reserved.push_back(index);
+        }
+        if (int(reserved.size()) < splitNum)
+        {
+            // split the rest when a host has free connection.
+            deferred_ = true;
+            splitNum = int(reserved.size());
+            if (splitNum == 0)
+                return;
+        }
+
         LOG(0, "will split to %d\n", splitNum);
 
-        long targetLen = sessions_[maxLength]->length() / (splitNum + 1);
-        size_t pos = sessions_[maxLength]->pos()
-            + (sessions_[maxLength]->length() - splitNum * targetLen);
+        // new sessions start on block boundaries, so no block is shared by two sessions,
+        // the last one takes the tail to session end.
+        size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+        long targetLen = long(sessions_[maxLength]->length() / (splitNum + 1)
+                              / bytesPerBlock * bytesPerBlock);
+        size_t pos = end / bytesPerBlock * bytesPerBlock - splitNum * targetLen;
+        sessions_[maxLength]->setLength(long(pos - sessions_[maxLength]->pos()));
 
-        for (int i=0; i<splitNum; ++i)
+        int made = 0;
+        for (; made<splitNum; ++made)
         {
-            HttpSession* ses = new HttpSession(*this, pos, targetLen);
+            long length = (made + 1 < splitNum) ? targetLen : long(end - pos);
+            HttpSession* ses = new HttpSession(*this, pos, length);
             if (ses == NULL)
             {
                 setError(OUT_OF_MEMORY, "alloc new sessions fail.");
-                for (int j=0; j<i; ++j)
-                {
-                    delete sessions_[maxLength + 1 + j];
-                    sessions_.erase(sessions_.begin() + maxLength + 1 + j);
-                }
-                return;
+                break;
+            }
+
+            ++metrics_.sessionCreated;
+            if (!pinSource(ses, reserved[made]))
+            {
+                delete ses;
+                break;
+            }
+            if (!pinSession(ses))
+            {
+                // split the rest when an address has free connection.
+                delete ses;
+                deferred_ = true;
+                break;
             }
 
             CURLMcode retm = curl_multi_add_handle(handle_, ses->handle());
             if (retm != CURLM_OK)
             {
+                unpinSession(ses);
                 delete ses;
                 setError(OTHER, curl_multi_strerror(retm));
                 LOG(0, "add easy handle to multi handle fail: %s.\n", curl_multi_strerror(retm));
-                for (int j=0; j<i; ++j)
-                {
-                    delete sessions_[maxLength + 1 + j];
-                    sessions_.erase(sessions_.begin() + maxLength + 1 + j);
-                }
-                return;
+                break;
             }
 
-            sessions_.insert(sessions_.begin() + maxLength + 1 + i, ses);
-
-            pos += targetLen;
+            sessions_.insert(sessions_.begin() + maxLength + 1 + made, ses);
+            pos += length;
         }
 
-        sessions_[maxLength]->setLength(sessions_[maxLength]->length() - splitNum * targetLen);
+        if (made < splitNum)
+        {
+            // sessions made keep running, the one before the failed one takes its range to
+            // session end, and connections not used go back.
+            HttpSession* last = sessions_[maxLength + made];
+            last->setLength(long(end - last->pos()));
+            for (int i=made; i<splitNum; ++i)
+                releaseSource(reserved[i]);
+            return;
+        }
     }
 }
 
 void HttpTask::sessionFinish(HttpSession* ses)
 {
+    // a session which has not begun its transfer can't be paused, removing its handle
+    // later stops it all the same.
     CURLcode rete = curl_easy_pause(ses->handle(), CURLPAUSE_ALL);
     if (rete != CURLE_OK)
     {
-        setError(HttpTask::OTHER, curl_easy_strerror(rete));
-        LOG(0, "can't paush easy handle: %s", curl_easy_strerror(rete));
+        LOG(0, "can't pause easy handle: %s", curl_easy_strerror(rete));
     }
 
     Sessions::iterator it = std::find(sessions_.begin(), sessions_.end(), ses);
     if (it == sessions_.end())
     {
+        if (std::find(finishedSessions_.begin(), finishedSessions_.end(), ses)
+            != finishedSessions_.end())
+        {
+            // finished in writeCallback, and curl report it done again.
+            return;
+        }
+
         setError(HttpTask::OTHER, "can't find session.");
         LOG(0, "can't find session: %p.", ses);
+        return;
     }
     sessions_.erase(it);
 
     finishedSessions_.push_back(ses);
 }
 
-void HttpTask::clearSessions()
+/**
+ * The handle with task options set, new sessions duplicate it when pool is empty.
+ */
+CURL* HttpTask::handleTemplate()
 {
-    for (int i=0, n=finishedSessions_.size(); i<n; ++i)
+    if (template_ != NULL)
+        return template_;
+
+    template_ = curl_easy_init();
+    if (template_ == NULL)
     {
-        HttpSession* ses = finishedSessions_[i];
+        setError(CURL_BAD_ALLOC);
+        return NULL;
+    }
 
-        CURLMcode retm = curl_multi_remove_handle(handle_, ses->handle());
-        if (retm != CURLM_OK)
+    if (!HttpSession::setTaskOptions(*this, template_))
+    {
+        curl_easy_cleanup(template_);
+        template_ = NULL;
+    }
+
+    return template_;
+}
+
+void HttpTask::setSpeedLimiter(Utility::TokenBucket* parent)
+{
+    bucket_.setParent(parent);
+}
+
+void HttpTask::setMaxDownloadSpeed(size_t bytesPerSecond)
+{
+    config_.maxDownloadSpeed = long(bytesPerSecond);
+    bucket_.setRate(speedLimit());
+}
+
+void HttpTask::setSpeedShare(size_t bytesPerSecond)
+{
+    speedShare_ = bytesPerSecond;
+    bucket_.setRate(speedLimit());
+}
+
+/**
+ * The lower of task's own limit and its share of manager's.
+ */
+size_t HttpTask::speedLimit()
+{
+    size_t limit = size_t(std::max(config_.maxDownloadSpeed, 0L));
+    if (limit == Utility::TokenBucket::noLimited ||
+        (speedShare_ != Utility::TokenBucket::noLimited && speedShare_ < limit))
+        limit = speedShare_;
+
+    return limit;
+}
+
+/**
+ * Called by session before taking data. If task, the manager or the host of session's
+ * source is out of tokens, the session is paused and resumed in perform when tokens are
+ * refilled.
+ */
+bool HttpTask::mayReceive(HttpSession* ses)
+{
+    Utility::TokenBucket* host = source(ses->source()).bucket;
+    if (!bucket_.limited() && !host->limited())
+        return true;
+
+    Utility::Clock::Ms now = Utility::Clock::now();
+    bool task = bucket_.mayReceive(now);
+    if (host->mayReceive(now) && task)
+        return true;
+
+    pausedSessions_.push_back(ses);
+    return false;
+}
+
+void HttpTask::consume(HttpSession* ses, size_t bytes)
+{
+    bucket_.consume(bytes);
+    source(ses->source()).bucket->consume(bytes);
+}
+
+void HttpTask::resumePaused()
+{
+    if (pausedSessions_.size() == 0)
+        return;
+
+    Utility::Clock::Ms now = Utility::Clock::now();
+    if (!bucket_.mayReceive(now))
+        return;
+
+    // sessions may be paused again while resuming, the ones whose host is still out of
+    // tokens wait.
+    Sessions paused;
+    paused.swap(pausedSessions_);
+    for (Sessions::iterator it = paused.begin(); it != paused.end(); ++it)
+    {
+        if (!source((*it)->source()).bucket->mayReceive(now))
         {
-            setError(HttpTask::OTHER, curl_multi_strerror(retm));
-            LOG(0, "can't remove easy handle: %s", curl_multi_strerror(retm));
+            pausedSessions_.push_back(*it);
+            continue;
         }
 
-        delete ses;
+        CURLcode rete = curl_easy_pause((*it)->handle(), CURLPAUSE_CONT);
+        if (rete != CURLE_OK)
+        {
+            setError(OTHER, curl_easy_strerror(rete));
+            LOG(0, "can't resume easy handle: %s", curl_easy_strerror(rete));
+        }
     }
+}
 
-    finishedSessions_.clear();
+int HttpTask::connectionDemand()
+{
+    return config_.sessionNumber;
+}
+
+/**
+ * Output file, resume journal or part file, and files read by verifier and hashers.
+ */
+int HttpTask::openFiles()
+{
+    int files = 0;
+    if (file_.isOpen())
+        ++files;
+    if (journal_.isOpen() || part_.isOpen())
+        ++files;
+    if (verifier_ != NULL)
+        ++files;
+    if (pieceHasher_.started())
+        ++files;
+    if (blockHasher_.started())
+        ++files;
+    if (crcHasher_.started())
+        ++files;
 
-    if (checkFinish())
+    return files;
+}
+
+/**
+ * Set by manager to share connections between tasks. Sessions over a lower limit run
+ * till finish and are not replaced, a higher limit split sessions at once.
+ */
+void HttpTask::setConnectionLimit(int limit)
+{
+    int old = sessionLimit();
+    connectionLimit_ = limit;
+
+    if (handle_ != NULL && sessionLimit() != old)
+        setMultiplex();
+
+    if (sessionLimit() > old && internalState_ == HT_DOWNLOAD)
     {
-        setInternalState(HT_FINISH);
-        file_.close();
+        fillHoles();
+        if (!config_.sequential)
+            separateSession();
     }
 }
 
-bool HttpTask::writeFile(size_t pos, void *buffer, size_t size)
+/**
+ * With HTTP/2, sessions run as streams over Http2Connections connections. When a
+ * connection has as many streams as we or the server's max concurrent streams allow,
+ * curl opens another one, so more connections help when one is the bottleneck.
+ */
+bool HttpTask::setMultiplex()
 {
-    if (internalState_ == HT_DOWNLOAD)
+    if (!config_.http2)
+        return true;
+
+#if LIBCURL_VERSION_NUM >= 0x072b00
+    CURLMcode retm = curl_multi_setopt(handle_, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+    if (retm != CURLM_OK)
     {
-        if (!file_.seek(pos, Utility::FileManager::SF_FromBegin))
-        {
-            setError(FAIL_FILE_IO);
-            return false;
-        }
+        setError(OTHER, curl_multi_strerror(retm));
+        return false;
     }
+#endif
 
-    ssize_t ret = file_.write(buffer, size);
-    if (ret == -1)
+#if LIBCURL_VERSION_NUM >= 0x074300
+    long connections = std::max(config_.http2Connections, 1);
+    long streams = std::max((sessionLimit() + connections - 1) / connections, 1L);
+    retm = curl_multi_setopt(handle_, CURLMOPT_MAX_CONCURRENT_STREAMS, streams);
+    if (retm != CURLM_OK)
     {
-        setError(FAIL_FILE_IO);
+        setError(OTHER, curl_multi_strerror(retm));
         return false;
     }
+#endif
 
-    downloadSize_ += size;
+    return true;
+}
 
-    if (internalState_ == HT_DOWNLOAD)
+int HttpTask::sessionLimit()
+{
+    if (connectionLimit_ < 0)
+        return config_.sessionNumber;
+
+    return std::min(connectionLimit_, config_.sessionNumber);
+}
+
+void HttpTask::rejectMultiRange()
+{
+    if (!multiRangeRejected_)
     {
-        printf("write: %lu-%lu\n", pos, pos+size);
-        downloadBitmap_.setRangeByLength(pos, pos + size, true);
+        multiRangeRejected_ = true;
+        log("server doesn't support multi-range request, fall back to single range.");
     }
-
-    return true;
 }
 
-void HttpTask::hasSessionFinish()
+/**
+ * Start a session on ranges. An idle session is reused if there is one, so its
+ * connection kept in multi handle can serve the new ranges without handshake.
+ */
+bool HttpTask::startSession(const HttpSession::Ranges& ranges)
 {
-    // check task status.
-    CURLMsg *msg = NULL;
-    int msgsInQueue;
-    while ( (msg = curl_multi_info_read(handle_, &msgsInQueue)) != NULL)
+    int index = reserveSource(ranges.size() > 0 ? ranges[0].pos : 0);
+    if (index < 0)
     {
-        HttpSession *ses = NULL;
-        CURLcode rete = curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &ses);
-        if (rete != CURLE_OK)
+        deferred_ = true;
+        return false;
+    }
+
+    HttpSession* ses = NULL;
+    if (idleSessions_.size() > 0)
+    {
+        ses = idleSessions_.back();
+        idleSessions_.pop_back();
+        if (!ses->reset(ranges))
         {
-            setError(HttpTask::OTHER, curl_easy_strerror(rete));
+            delete ses;
+            releaseSource(index);
+            return false;
+        }
+        ++metrics_.sessionReused;
+    }
+    else
+    {
+        ses = new HttpSession(*this, ranges);
+        if (ses == NULL)
+        {
+            setError(OUT_OF_MEMORY, "alloc new sessions fail.");
+            releaseSource(index);
+            return false;
+        }
+        ++metrics_.sessionCreated;
+    }
+    if (!pinSource(ses, index))
+    {
+        delete ses;
+        releaseSource(index);
+        return false;
+    }
+    if (!pinSession(ses))
+    {
+        // start it when an address of host has free connection.
+        delete ses;
+        releaseSource(index);
+        deferred_ = true;
+        return false;
+    }
+
+    CURLMcode retm = curl_multi_add_handle(handle_, ses->handle());
+    if (retm != CURLM_OK)
+    {
+        unpinSession(ses);
+        delete ses;
+        releaseSource(index);
+        setError(OTHER, curl_multi_strerror(retm));
+        LOG(0, "add easy handle to multi handle fail: %s.\n", curl_multi_strerror(retm));
+        return false;
+    }
+
+    sessions_.push_back(ses);
+
+    return true;
+}
+
+void HttpTask::removeSession(HttpSession* ses)
+{
+    long connects = 0;
+    CURLcode rete = curl_easy_getinfo(ses->handle(), CURLINFO_NUM_CONNECTS, &connects);
+    if (rete == CURLE_OK)
+    {
+        metrics_.connects += connects;
+    }
+
+    // a reused connection makes no handshake. curl doesn't tell a resumed TLS session
+    // from a full handshake, so both are counted.
+    double appconnect = 0;
+    rete = curl_easy_getinfo(ses->handle(), CURLINFO_APPCONNECT_TIME, &appconnect);
+    if (rete == CURLE_OK && connects > 0 && appconnect > 0)
+    {
+        ++metrics_.tlsConnects;
+    }
+
+    double bytes = 0;
+    double seconds = 0;
+    if (curl_easy_getinfo(ses->handle(), CURLINFO_SIZE_DOWNLOAD, &bytes) != CURLE_OK ||
+        curl_easy_getinfo(ses->handle(), CURLINFO_TOTAL_TIME, &seconds) != CURLE_OK)
+    {
+        bytes = seconds = 0;
+    }
+
+    int index = ses->address();
+    if (index >= 0 && index < int(metrics_.addresses.size()))
+    {
+        AddressMetrics& address = metrics_.addresses[index];
+        addressLimiter().release(address.address);
+        --address.sessions;
+        address.bytes += size_t(bytes);
+        address.seconds += seconds;
+        demoteAddresses();
+    }
+
+    index = ses->source();
+    if (index >= 0 && index < int(metrics_.sources.size()))
+    {
+        SourceMetrics& source = metrics_.sources[index];
+        source.bytes += size_t(bytes);
+        source.seconds += seconds;
+    }
+
+    CURLMcode retm = curl_multi_remove_handle(handle_, ses->handle());
+    if (retm != CURLM_OK)
+    {
+        setError(HttpTask::OTHER, curl_multi_strerror(retm));
+        LOG(0, "can't remove easy handle: %s", curl_multi_strerror(retm));
+    }
+
+    Sessions::iterator paused = std::find(pausedSessions_.begin(), pausedSessions_.end(), ses);
+    if (paused != pausedSessions_.end())
+        pausedSessions_.erase(paused);
+
+    releaseSource(ses->source());
+}
+
+/**
+ * Uncount address of a pinned session which never ran.
+ */
+void HttpTask::unpinSession(HttpSession* ses)
+{
+    int index = ses->address();
+    if (index >= 0 && index < int(metrics_.addresses.size()))
+    {
+        addressLimiter().release(metrics_.addresses[index].address);
+        --metrics_.addresses[index].sessions;
+    }
+}
+
+Utility::HostLimiter& HttpTask::hostLimiter()
+{
+    return Utility::HostLimiter::hosts();
+}
+
+Utility::HostLimiter& HttpTask::addressLimiter()
+{
+    return Utility::HostLimiter::addresses();
+}
+
+Utility::ThreadPool& HttpTask::hashPool()
+{
+    static Utility::ThreadPool pool;
+    return pool;
+}
+
+static std::string lowerCase(const std::string& str)
+{
+    std::string lower;
+    for (size_t i=0; i<str.length(); ++i)
+        lower += char(tolower(str[i]));
+    return lower;
+}
+
+static std::string hostOf(const std::string& uri)
+{
+    size_t begin = uri.find("://");
+    begin = (begin == std::string::npos) ? 0 : begin + 3;
+    size_t end = uri.find_first_of("/?#", begin);
+    std::string host = uri.substr(begin, (end == std::string::npos) ? end : end - begin);
+
+    size_t at = host.rfind('@');
+    if (at != std::string::npos)
+        host.erase(0, at + 1);
+
+    return host;
+}
+
+/**
+ * Source of index, task uri if it's out of range. Entries are made for mirrors added since.
+ */
+HttpTask::Source& HttpTask::source(int index)
+{
+    size_t count = std::max(metrics_.sources.size(), size_t(1));
+    while (sources_.size() < count)
+    {
+        Source source;
+        if (sources_.size() == 0)
+        {
+            if (host_.length() == 0)
+                host_ = hostOf(uri_);
+            source.host = host_;
+        }
+        else
+        {
+            source.host = hostOf(metrics_.sources[sources_.size()].uri);
+        }
+        source.bucket = Utility::HostBuckets::hosts().bucket(source.host);
+        sources_.push_back(source);
+    }
+
+    if (index < 0 || index >= int(sources_.size()))
+        index = 0;
+
+    return sources_[index];
+}
+
+/**
+ * Pick a source for a session from pos and take a connection of its host. Sources not
+ * tried come first, then the best speed per session, a source whose host is busy is
+ * passed over. Sources without the block at pos are picked only if no source has it.
+ * \return index of source, -1 if no host of them has a free connection.
+ */
+int HttpTask::reserveSource(size_t pos)
+{
+    if (metrics_.sources.size() == 0)
+        return acquireSource(0) ? 0 : -1;
+
+    std::vector<std::pair<double, int> > order;
+    for (int pass=0; pass<2 && order.size() == 0; ++pass)
+    {
+        for (int i=0, n=metrics_.sources.size(); i<n; ++i)
+        {
+            const SourceMetrics& metrics = metrics_.sources[i];
+            if (!metrics.valid)
+                continue;
+
+            BitMap& blocks = source(i).blocks;
+            if (pass == 0 && blocks.size() > 0 &&
+                !blocks.get(std::min(blocks.getPositionByLength(pos), blocks.size() - 1)))
+                continue;
+
+            double score = (metrics.seconds == 0 && metrics.sessions == 0)
+                ? std::numeric_limits<double>::max()
+                : (metrics.speed() + 1) / (metrics.sessions + 1);
+            order.push_back(std::make_pair(-score, i));
+        }
+    }
+
+    // best score first, lower index first on same score.
+    std::sort(order.begin(), order.end());
+    for (size_t i=0; i<order.size(); ++i)
+    {
+        if (acquireSource(order[i].second))
+            return order[i].second;
+    }
+
+    return -1;
+}
+
+bool HttpTask::acquireSource(int index)
+{
+    if (!hostLimiter().acquire(source(index).host))
+        return false;
+
+    if (index >= 0 && index < int(metrics_.sources.size()))
+        ++metrics_.sources[index].sessions;
+
+    return true;
+}
+
+void HttpTask::releaseSource(int index)
+{
+    if (index >= 0 && index < int(metrics_.sources.size()))
+        --metrics_.sources[index].sessions;
+
+    hostLimiter().release(source(index).host);
+}
+
+/**
+ * Start sessions put off by host limit. They are deferred again if host is still busy.
+ */
+void HttpTask::resumeDeferred()
+{
+    deferred_ = false;
+
+    if (internalState_ == HT_PREPARE && sessions_.size() == 0)
+    {
+        start();
+    }
+    else if (internalState_ == HT_DOWNLOAD)
+    {
+        fillHoles();
+        if (!config_.sequential)
+            separateSession();
+    }
+}
+
+/**
+ * Look up host of task once on a thread of resolver, the engine thread doesn't wait on DNS.
+ */
+void HttpTask::resolveAddresses()
+{
+    if (resolver_.started())
+        return;
+
+    if (host_.length() == 0)
+        host_ = hostOf(uri_);
+
+    std::string name = host_;
+    if (name.length() > 0 && name[0] == '[')
+        name = name.substr(1, name.find(']') - 1);
+    else if (name.find(':') != std::string::npos)
+        name.erase(name.find(':'));
+
+    if (!resolver_.start(name))
+        LOG(0, "can't start resolving %s.\n", name.c_str());
+}
+
+/**
+ * Take addresses when lookup is done. Sessions started before are counted by the address
+ * curl connected them to, sessions after are spread over all.
+ */
+void HttpTask::takeAddresses()
+{
+    if (!resolver_.done())
+        return;
+
+    std::vector<std::string> addresses;
+    std::string error;
+    bool resolved = resolver_.addresses(addresses, error);
+    resolver_.cancel();
+    if (!resolved)
+    {
+        LOG(0, "resolve %s fail: %s.\n", host_.c_str(), error.c_str());
+        return;
+    }
+
+    metrics_.addresses.clear();
+    for (size_t i=0; i<addresses.size(); ++i)
+        metrics_.addresses.push_back(AddressMetrics(addresses[i]));
+
+    for (Sessions::iterator it = sessions_.begin(); it != sessions_.end(); ++it)
+    {
+        char* primary = NULL;
+        if ((*it)->source() > 0 ||
+            curl_easy_getinfo((*it)->handle(), CURLINFO_PRIMARY_IP, &primary) != CURLE_OK ||
+            primary == NULL)
+            continue;
+
+        for (size_t i=0; i<metrics_.addresses.size(); ++i)
+        {
+            // already connected, only count it if address has room.
+            if (metrics_.addresses[i].address == primary &&
+                addressLimiter().acquire(metrics_.addresses[i].address))
+            {
+                (*it)->setAddress(i, "");
+                ++metrics_.addresses[i].sessions;
+                break;
+            }
+        }
+    }
+}
+
+/**
+ * Pin a new session to the address with fewest sessions and a free connection of
+ * addressLimiter(), demoted addresses are used only when no other one has room.
+ * \return false if no address has room, or the session can't be pinned.
+ */
+bool HttpTask::pinSession(HttpSession* ses)
+{
+    // addresses are of task uri's host.
+    if (metrics_.addresses.size() == 0 || ses->source() > 0)
+        return true;
+
+    int best = -1;
+    for (int pass=0; pass<2 && best == -1; ++pass)
+    {
+        std::vector<std::pair<int, int> > order;
+        for (int i=0, n=metrics_.addresses.size(); i<n; ++i)
+        {
+            if (pass == 0 && metrics_.addresses[i].demoted)
+                continue;
+            order.push_back(std::make_pair(metrics_.addresses[i].sessions, i));
+        }
+
+        std::sort(order.begin(), order.end());
+        for (size_t i=0; i<order.size() && best == -1; ++i)
+        {
+            if (addressLimiter().acquire(metrics_.addresses[order[i].second].address))
+                best = order[i].second;
+        }
+    }
+    if (best == -1)
+        return false;
+
+    const std::string& ip = metrics_.addresses[best].address;
+    std::string connectTo = "::";
+    connectTo += (ip.find(':') != std::string::npos) ? "[" + ip + "]" : ip;
+    connectTo += ":";
+
+    if (!ses->setAddress(best, connectTo))
+    {
+        addressLimiter().release(ip);
+        return false;
+    }
+
+    ++metrics_.addresses[best].sessions;
+    return true;
+}
+
+void HttpTask::addressFailed(HttpSession* ses)
+{
+    if (ses == NULL)
+        return;
+
+    int index = ses->address();
+    if (index >= 0 && index < int(metrics_.addresses.size()))
+    {
+        ++metrics_.addresses[index].failures;
+        demoteAddresses();
+    }
+}
+
+/**
+ * An address is demoted when it failed twice or is much slower than the fastest one.
+ */
+void HttpTask::demoteAddresses()
+{
+    double fastest = 0;
+    for (size_t i=0; i<metrics_.addresses.size(); ++i)
+        fastest = std::max(fastest, metrics_.addresses[i].speed());
+
+    for (size_t i=0; i<metrics_.addresses.size(); ++i)
+    {
+        AddressMetrics& address = metrics_.addresses[i];
+        address.demoted = (address.failures >= 2)
+            || (address.seconds > 0 && address.speed() * 4 < fastest);
+    }
+}
+
+/**
+ * \brief Add a mirror of task uri, sessions are given to the fastest sources.
+ *
+ * A mirror is dropped if its length or ETag is different from the task uri's.
+ */
+bool HttpTask::addMirror(const char* uri)
+{
+    if (uri == NULL || uri[0] == '\0')
+        return false;
+
+    if (metrics_.sources.size() == 0)
+    {
+        // sessions already started are all of task uri.
+        metrics_.sources.push_back(SourceMetrics(uri_));
+        metrics_.sources[0].sessions = sessions_.size() + finishedSessions_.size();
+    }
+
+    for (size_t i=0; i<metrics_.sources.size(); ++i)
+    {
+        if (metrics_.sources[i].uri == uri)
+            return false;
+    }
+
+    metrics_.sources.push_back(SourceMetrics(uri));
+    updateSources();
+
+    return true;
+}
+
+/**
+ * Validators of the file from the first response, or from resume state. Sessions send
+ * a strong ETag, or Last-Modified, as If-Range.
+ */
+void HttpTask::setValidators(const std::string& etag, const std::string& lastModified)
+{
+    etag_ = etag;
+    lastModified_ = lastModified;
+
+    std::string value;
+    if (etag_.length() > 0 && etag_.compare(0, 2, "W/") != 0)
+        value = etag_;
+    else
+        value = lastModified_;
+
+    if (headers_ != NULL)
+        oldHeaders_.push_back(headers_);
+    headers_ = NULL;
+    if (value.length() > 0)
+        headers_ = curl_slist_append(NULL, ("If-Range: " + value).c_str());
+}
+
+/**
+ * A range answered with 200 means file changed and If-Range failed, or server ignores
+ * range. Both send the whole file. Only a changed file is taken as a new download, a file
+ * of the same length and validators, or no validators stored, keeps what's written.
+ */
+bool HttpTask::checkValidators(HttpSession* ses)
+{
+    if (internalState_ != HT_DOWNLOAD || !ses->ranged() || ses->getResponseCode() != 200)
+        return true;
+
+    double length = ses->contentLength();
+    bool changed = (length > 0 && size_t(length) != totalSize_);
+    if (etag_.length() > 0)
+        changed = changed || (ses->etag() != etag_);
+    else if (lastModified_.length() > 0)
+        changed = changed || (ses->lastModified() != lastModified_);
+
+    if (changed)
+    {
+        log("remote file changed, download it again.");
+        if (pieceHashes_.size() > 0)
+        {
+            setError(OTHER, "remote file doesn't match metalink.");
+            return false;
+        }
+
+        return restartDownload(ses);
+    }
+
+    log("server doesn't support range, download in one session.");
+    rangesRefused_ = true;
+    finishOthers(ses);
+
+    // writeFile skips the bytes already written as the whole file passes.
+    ses->restart(0, long(totalSize_));
+    return true;
+}
+
+void HttpTask::finishOthers(HttpSession* ses)
+{
+    Sessions others;
+    for (Sessions::iterator it = sessions_.begin(); it != sessions_.end(); ++it)
+    {
+        if (*it != ses)
+            others.push_back(*it);
+    }
+    for (Sessions::iterator it = others.begin(); it != others.end(); ++it)
+        sessionFinish(*it);
+}
+
+/**
+ * Drop downloaded data and resume state, and let ses download the whole file from 0.
+ */
+bool HttpTask::restartDownload(HttpSession* ses)
+{
+    double length = ses->contentLength();
+    if (length <= 0)
+    {
+        setError(OTHER, "remote file changed, and its length is unknown.");
+        return false;
+    }
+
+    finishOthers(ses);
+
+    pending_.clear();
+    pendingBytes_ = 0;
+    journal_.remove();
+    part_.remove();
+
+    setValidators(ses->etag(), ses->lastModified());
+    totalSize_ = size_t(length);
+    Utility::File::resize(filePath().c_str(), totalSize_);
+    downloadSize_ = 0;
+    readableSize_ = 0;
+
+    ses->restart(0, long(totalSize_));
+    startDownload(ses);
+
+    return internalState_ == HT_DOWNLOAD;
+}
+
+/**
+ * Check the first response of a mirror session against the task uri's.
+ */
+bool HttpTask::checkSource(HttpSession* ses)
+{
+    int index = ses->source();
+    if (index <= 0)
+        return checkValidators(ses);
+    if (index >= int(metrics_.sources.size()))
+        return true;
+
+    size_t total = totalSize_;
+    size_t begin, end;
+    if (ses->contentRange().length() > 0)
+    {
+        if (!ByteRangesParser::parseContentRange(ses->contentRange().c_str(), begin, end, total))
+            total = 0;
+    }
+    else if (ses->getResponseCode() == 200)
+    {
+        double length = ses->contentLength();
+        total = (length > 0) ? size_t(length) : 0;
+    }
+
+    bool sameEtag = etag_.length() == 0 || ses->etag().length() == 0 || etag_ == ses->etag();
+    if (total != totalSize_ || !sameEtag)
+    {
+        LOG(0, "mirror %s differs, length %lu etag %s\n",
+            metrics_.sources[index].uri.c_str(), total, ses->etag().c_str());
+        dropSource(index);
+        return false;
+    }
+
+    return true;
+}
+
+/**
+ * Send a session to the source reserved for it, a mirror is connected by its own name.
+ */
+bool HttpTask::pinSource(HttpSession* ses, int index)
+{
+    if (metrics_.sources.size() == 0)
+        return true;
+
+    if (!ses->setSource(index, metrics_.sources[index].uri))
+        return false;
+
+    if (index > 0 && !ses->setAddress(-1, ""))
+        return false;
+
+    return true;
+}
+
+void HttpTask::sourceFailed(HttpSession* ses)
+{
+    int index = ses->source();
+    if (index < 0 || index >= int(metrics_.sources.size()))
+        return;
+
+    if (++metrics_.sources[index].failures >= 2 && validSource_ > 1)
+    {
+        dropSource(index);
+        return;
+    }
+
+    // the rest of its range is asked from other sources while any of them has it.
+    BitMap& blocks = source(index).blocks;
+    if (validSource_ > 1 && blocks.size() > 0 && ses->length() > 0)
+    {
+        size_t bytesPerBlock = blocks.bytesPerBit();
+        size_t first = ses->pos() / bytesPerBlock;
+        size_t last = std::min((ses->pos() + ses->length() + bytesPerBlock - 1) / bytesPerBlock,
+                               blocks.size());
+        if (first < last)
+            blocks.setRange(first, last, false);
+        updateSources();
+    }
+}
+
+void HttpTask::dropSource(int index)
+{
+    SourceMetrics& source = metrics_.sources[index];
+    if (!source.valid)
+        return;
+
+    source.valid = false;
+    std::string text = "drop source " + source.uri;
+    log(text.c_str());
+
+    updateSources();
+}
+
+void HttpTask::updateSources()
+{
+    if (metrics_.sources.size() == 0)
+    {
+        totalSource_ = validSource_ = 1;
+        return;
+    }
+
+    totalSource_ = metrics_.sources.size();
+    validSource_ = 0;
+    for (size_t i=0; i<metrics_.sources.size(); ++i)
+    {
+        if (metrics_.sources[i].valid)
+            ++validSource_;
+    }
+
+    // a source has the whole file until its blocks fail, a dropped one has none.
+    if (validBitmap_.size() > 0)
+    {
+        validBitmap_.setAll(false);
+        for (int i=0; i<totalSource_; ++i)
+        {
+            BitMap& blocks = source(i).blocks;
+            if (blocks.size() != validBitmap_.size())
+            {
+                blocks = BitMap(totalSize_, validBitmap_.bytesPerBit());
+                blocks.setAll(true);
+            }
+            if (!metrics_.sources[i].valid)
+                blocks.setAll(false);
+
+            validBitmap_.merge(blocks);
+        }
+    }
+}
+
+void HttpTask::deleteIdleSessions()
+{
+    for (int i=0, n=idleSessions_.size(); i<n; ++i)
+    {
+        delete idleSessions_[i];
+    }
+    idleSessions_.clear();
+}
+
+/**
+ * Give the holes in download bitmap which no session is working on to new sessions.
+ * Small holes are gathered into one multi-range request if server supports it.
+ *
+ * In sequential mode, holes are given in file order as pieces of MinSessionBlocks,
+ * and only inside the read ahead window after readable size.
+ */
+void HttpTask::fillHoles()
+{
+    if (internalState_ != HT_DOWNLOAD)
+        return;
+
+    typedef std::vector<std::pair<size_t, size_t> > Intervals;
+    Intervals busy;
+    for (Sessions::iterator it = sessions_.begin(); it != sessions_.end(); ++it)
+    {
+        HttpSession* ses = *it;
+        if (ses->length() > 0)
+            busy.push_back(std::make_pair(ses->pos(), ses->pos() + ses->length()));
+
+        const HttpSession::Ranges& ranges = ses->ranges();
+        for (HttpSession::Ranges::const_iterator r = ranges.begin(); r != ranges.end(); ++r)
+            busy.push_back(std::make_pair(r->pos, r->pos + r->length));
+    }
+    std::sort(busy.begin(), busy.end());
+
+    HttpSession::Ranges holes;
+    size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+    size_t windowEnd = totalSize_;
+    if (config_.sequential && config_.readAheadBlocks > 0)
+        windowEnd = std::min(windowEnd, readableSize_ + config_.readAheadBlocks * bytesPerBlock);
+
+    BitMap::size_type b = downloadBitmap_.find(false, readableSize_ / bytesPerBlock);
+    while (b < downloadBitmap_.size() && b * bytesPerBlock < windowEnd)
+    {
+        BitMap::size_type e = downloadBitmap_.find(true, b);
+        size_t begin = b * bytesPerBlock;
+        size_t end = std::min(e * bytesPerBlock, windowEnd);
+
+        for (Intervals::iterator it = busy.begin(); it != busy.end(); ++it)
+        {
+            if (it->second <= begin)
+                continue;
+            if (it->first >= end)
+                break;
+            if (it->first > begin)
+                holes.push_back(HttpSession::Range(begin, it->first - begin));
+            begin = std::max(begin, it->second);
+        }
+        if (begin < end)
+            holes.push_back(HttpSession::Range(begin, end - begin));
+
+        b = downloadBitmap_.find(false, e);
+    }
+
+    long minLength = config_.minSessionBlocks * bytesPerBlock;
+    HttpSession::Ranges::iterator it = holes.begin();
+    while (it != holes.end() && int(sessions_.size()) < sessionLimit())
+    {
+        HttpSession::Ranges ranges(1, *it);
+        if (config_.sequential && it->length > minLength)
+        {
+            ranges[0].length = minLength;
+            it->pos += minLength;
+            it->length -= minLength;
+        }
+        else
+        {
+            ++it;
+        }
+
+        if (config_.multiRange && !multiRangeRejected_ && ranges[0].length < minLength)
+        {
+            while (it != holes.end() &&
+                   int(ranges.size()) < config_.maxRangesPerRequest &&
+                   it->length < minLength)
+            {
+                ranges.push_back(*it++);
+            }
+        }
+
+        if (!startSession(ranges))
+            return;
+    }
+}
+
+void HttpTask::clearSessions()
+{
+    bool hasFinished = (finishedSessions_.size() > 0);
+
+    for (int i=0, n=finishedSessions_.size(); i<n; ++i)
+    {
+        HttpSession* ses = finishedSessions_[i];
+
+        removeSession(ses);
+
+        // keep it for next ranges, the connection stays in multi handle's cache.
+        idleSessions_.push_back(ses);
+    }
+
+    finishedSessions_.clear();
+
+    // blocks of bad pieces and resumed check blocks go back to sessions.
+    if (verifyPieces())
+        hasFinished = true;
+    if (checkedBlocks())
+        hasFinished = true;
+
+    if (hasFinished)
+        fillHoles();
+
+    // a failed task isn't finished when its last session is gone.
+    if (internalState_ != HT_ERROR && checkFinish())
+    {
+        deleteIdleSessions();
+        bool good = checkDigest();
+        if (good)
+            setInternalState(HT_FINISH);
+        file_.close();
+
+        pending_.clear();
+        pendingBytes_ = 0;
+        clearCheckBlocks();
+        journal_.remove();
+        part_.remove();
+
+        // nothing tells which part is bad, download all again next time.
+        if (!good)
+            setError(BAD_DIGEST, "file doesn't match its hash.");
+    }
+}
+
+bool HttpTask::writeFile(size_t pos, void *buffer, size_t size)
+{
+    // a server ignoring range sends the whole file again, bytes resumed aren't written twice.
+    if (internalState_ == HT_DOWNLOAD && rangesRefused_ && !written_.empty())
+    {
+        RangeSet::Ranges missing = written_.missing(pos, pos + size);
+        if (missing.size() != 1 || missing[0].first != pos || missing[0].second != pos + size)
+        {
+            char* data = static_cast<char*>(buffer);
+            for (size_t i=0; i<missing.size(); ++i)
+            {
+                size_t from = missing[i].first;
+                if (!writeFile(from, data + (from - pos), missing[i].second - from))
+                    return false;
+            }
+            return true;
+        }
+    }
+
+    if (internalState_ == HT_DOWNLOAD)
+    {
+        if (!file_.seek(pos, Utility::FileManager::SF_FromBegin))
+        {
+            setError(FAIL_FILE_IO);
+            return false;
+        }
+    }
+
+    ssize_t ret = file_.write(buffer, size);
+    if (ret == -1)
+    {
+        setError(FAIL_FILE_IO);
+        return false;
+    }
+
+    downloadSize_ += size;
+
+    if (internalState_ == HT_DOWNLOAD)
+    {
+        printf("write: %lu-%lu\n", pos, pos+size);
+
+        // a block is done only when all its bytes are written.
+        RangeSet::Range merged = written_.add(pos, pos + size);
+        downloadBitmap_.setCovered(merged.first, merged.second, true);
+        noteWritten(pos, pos + size);
+        if (config_.blockCrc && journal_.isOpen())
+            crcWritten(pos, buffer, size);
+
+        if (pieces_.size() > 0)
+            hashPieces(pos, buffer, size);
+    }
+
+    if (digest_ != NULL)
+        hashPrefix(pos, buffer, size);
+
+    updateReadable();
+
+    return true;
+}
+
+void HttpTask::clearPieces()
+{
+    pieceHasher_.cancel();
+    for (size_t i=0; i<pieces_.size(); ++i)
+        delete pieces_[i].digest;
+
+    pieces_.clear();
+    verifyQueue_.clear();
+}
+
+/**
+ * Hash data of pieces while it arrives in order, and verify a piece when all its blocks
+ * are downloaded. A piece whose data came out of order is hashed from file later.
+ */
+void HttpTask::hashPieces(size_t pos, const void* buffer, size_t size)
+{
+    const char* data = static_cast<const char*>(buffer);
+    size_t end = pos + size;
+    size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+
+    for (size_t i = pos / pieceLength_; i < pieces_.size() && i * pieceLength_ < end; ++i)
+    {
+        Piece& piece = pieces_[i];
+        if (piece.verified)
+            continue;
+
+        size_t begin = i * pieceLength_;
+        size_t pieceEnd = std::min(begin + pieceLength_, totalSize_);
+        size_t from = std::max(pos, begin);
+        size_t to = std::min(end, pieceEnd);
+
+        if (piece.inOrder && from == begin + piece.hashed)
+        {
+            if (piece.digest == NULL)
+                piece.digest = Utility::Digest::create(pieceType_);
+            piece.digest->update(data + (from - pos), to - from);
+            piece.hashed += to - from;
+        }
+        else
+        {
+            piece.inOrder = false;
+            delete piece.digest;
+            piece.digest = NULL;
+        }
+
+        BitMap::size_type last = (pieceEnd + bytesPerBlock - 1) / bytesPerBlock;
+        if (downloadBitmap_.find(false, begin / bytesPerBlock) < last)
+            continue;
+
+        if (piece.inOrder && piece.hashed == pieceEnd - begin)
+        {
+            std::string digest = piece.digest->hexFinal();
+            delete piece.digest;
+            piece.digest = NULL;
+            checkPiece(i, digest);
+        }
+        else
+        {
+            queuePiece(i);
+        }
+    }
+}
+
+void HttpTask::queuePiece(size_t index)
+{
+    Piece& piece = pieces_[index];
+    if (piece.queued || piece.verified)
+        return;
+
+    piece.queued = true;
+    verifyQueue_.push_back(index);
+}
+
+/**
+ * Take digests of pieces hashed in background, then start the queued ones.
+ * \return true if a piece is bad.
+ */
+bool HttpTask::verifyPieces()
+{
+    bool bad = false;
+    if (pieceHasher_.started())
+    {
+        if (!pieceHasher_.done())
+            return false;
+
+        PieceHasher::Pieces pieces;
+        pieceHasher_.take(pieces);
+        for (size_t i=0; i<pieces.size(); ++i)
+        {
+            pieces_[pieces[i].index].queued = false;
+            if (!checkPiece(pieces[i].index, pieces[i].digest))
+                bad = true;
+        }
+    }
+
+    // pool is shared by tasks, a busy one is tried again in next perform.
+    if (verifyQueue_.size() == 0 || hashPool().busy())
+        return bad;
+
+    PieceHasher::Pieces pieces;
+    for (size_t i=0; i<verifyQueue_.size(); ++i)
+    {
+        size_t index = verifyQueue_[i];
+        size_t begin = index * pieceLength_;
+        pieces.push_back(PieceHasher::Piece(index, begin,
+                                            std::min(begin + pieceLength_, totalSize_) - begin));
+    }
+    verifyQueue_.clear();
+
+    if (!pieceHasher_.start(filePath(), pieceType_, pieces, hashPool()))
+    {
+        // pieces that can't be read are taken as bad.
+        for (size_t i=0; i<pieces.size(); ++i)
+        {
+            pieces_[pieces[i].index].queued = false;
+            if (!checkPiece(pieces[i].index, ""))
+                bad = true;
+        }
+    }
+
+    return bad;
+}
+
+/**
+ * Check a downloaded piece with its hash. Only the blocks of a bad piece are cleared in
+ * download bitmap, so they will be given to a session again.
+ */
+bool HttpTask::checkPiece(size_t index, const std::string& digest)
+{
+    Piece& piece = pieces_[index];
+    size_t begin = index * pieceLength_;
+    size_t length = std::min(begin + pieceLength_, totalSize_) - begin;
+
+    if (digest == pieceHashes_[index])
+    {
+        piece.verified = true;
+        ++metrics_.piecesVerified;
+        return true;
+    }
+
+    char logBuffer[64] = {0};
+    snprintf(logBuffer, 63, "piece %lu is bad, download it again", index);
+    log(logBuffer);
+    ++metrics_.pieceFailures;
+
+    // save what's pending, then take the bad blocks out of resume state.
+    checkpoint(true);
+
+    delete piece.digest;
+    piece.digest = NULL;
+    piece.hashed = 0;
+    piece.inOrder = true;
+
+    size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+    BitMap::size_type first = begin / bytesPerBlock;
+    downloadBitmap_.setRange(first, (begin + length + bytesPerBlock - 1) / bytesPerBlock, false);
+    part_.setRange(first, (begin + length + bytesPerBlock - 1) / bytesPerBlock, false);
+    written_.remove(begin, begin + length);
+    downloadSize_ -= std::min(downloadSize_, length);
+    rewindDigest(begin);
+
+    compactJournal();
+
+    return false;
+}
+
+/**
+ * Start whole file hash from file begin, if a hash type is set.
+ */
+void HttpTask::resetDigest()
+{
+    hashedSize_ = 0;
+    if (digest_ == NULL && config_.hashType.length() > 0)
+    {
+        digest_ = Utility::Digest::create(config_.hashType);
+        if (digest_ == NULL)
+            log("hash type is not supported, file is not checked.");
+    }
+
+    if (digest_ != NULL)
+        digest_->init();
+}
+
+/**
+ * Data from pos will be downloaded again, hash again if it's hashed.
+ */
+void HttpTask::rewindDigest(size_t pos)
+{
+    if (digest_ != NULL && hashedSize_ > pos)
+        resetDigest();
+}
+
+/**
+ * Feed whole file hash with what's contiguous from file begin. Data in order is hashed from
+ * the write buffer, data which came before the prefix reached it is read back just behind
+ * the prefix, while it's still in page cache.
+ */
+void HttpTask::hashPrefix(size_t pos, const void* buffer, size_t size)
+{
+    size_t end = pos + size;
+    if (pos <= hashedSize_ && hashedSize_ < end)
+    {
+        digest_->update(static_cast<const char*>(buffer) + (hashedSize_ - pos), end - hashedSize_);
+        hashedSize_ = end;
+    }
+
+    // without length data only comes in order, and file position must stay at its end.
+    if (internalState_ != HT_DOWNLOAD)
+        return;
+
+    // only bytes all written from file begin, a block may be part written.
+    hashFile(std::min(written_.prefix(), totalSize_), hashCatchUp);
+}
+
+/**
+ * Hash file from hashedSize_ to end, read at most limit bytes.
+ */
+bool HttpTask::hashFile(size_t end, size_t limit)
+{
+    if (hashedSize_ >= end)
+        return true;
+
+    if (!file_.seek(hashedSize_, Utility::FileManager::SF_FromBegin))
+        return false;
+
+    char buffer[16 * 1024];
+    while (hashedSize_ < end && limit > 0)
+    {
+        size_t n = std::min(std::min(end - hashedSize_, sizeof(buffer)), limit);
+        ssize_t ret = file_.read(buffer, n);
+        if (ret <= 0)
+            return false;
+
+        digest_->update(buffer, ret);
+        hashedSize_ += ret;
+        limit -= ret;
+        metrics_.hashReadBack += ret;
+    }
+
+    return true;
+}
+
+/**
+ * Finish whole file hash when all is downloaded, and check it with the expected one.
+ */
+bool HttpTask::checkDigest()
+{
+    if (digest_ == NULL ||
+        (internalState_ != HT_DOWNLOAD && internalState_ != HT_DOWNLOAD_WITHOUT_LENGTH))
+        return true;
+
+    size_t total = (internalState_ == HT_DOWNLOAD) ? totalSize_ : downloadSize_;
+    if (internalState_ == HT_DOWNLOAD)
+        hashFile(total, total);
+
+    if (hashedSize_ != total)
+    {
+        log("can't read file back for its hash.");
+        return config_.hash.length() == 0;
+    }
+
+    metrics_.digest = digest_->hexFinal();
+    if (config_.hash.length() == 0)
+        return true;
+
+    if (metrics_.digest == lowerCase(config_.hash))
+        return true;
+
+    log("file doesn't match its hash.");
+    return false;
+}
+
+/**
+ * \brief Check a downloaded file on hashPool(), instead of downloading it.
+ *
+ * The file is mapped and performDownload() checks a step of it each time, downloadSize()
+ * tells how much is checked. Pieces are checked with their hashes, and the file with its
+ * hash if one is set. Only bad pieces are downloaded again, a bad file without pieces
+ * fails with BAD_DIGEST, and a good one finishes the task.
+ *
+ * \return false if the file can't be mapped, its size is not the known one, or it has
+ * resume state of an unfinished download, then the task is left as it was.
+ */
+bool HttpTask::verify()
+{
+    if (internalState_ != HT_INVALID && internalState_ != HT_ERROR &&
+        internalState_ != HT_FINISH)
+        return false;
+
+    // resume state is left only by an unfinished download, resume it instead.
+    std::string path = filePath();
+    if (Utility::File::exist((path + ".journal").c_str()) ||
+        Utility::File::exist((path + ".part").c_str()))
+        return false;
+
+    std::auto_ptr<FileVerifier> verifier(new FileVerifier);
+    if (!verifier->open(path) || verifier->size() == 0 ||
+        (totalSize_ > 0 && verifier->size() != totalSize_))
+        return false;
+
+    // a known size, piece hashes or file hash, else any file would pass.
+    bool compared = (totalSize_ > 0);
+    if (pieceLength_ > 0)
+    {
+        if (verifier->setPieces(pieceType_, pieceLength_, pieceHashes_))
+            compared = true;
+        else
+            log("piece hashes don't fit the file, pieces are not checked.");
+    }
+    if (config_.hashType.length() > 0)
+    {
+        if (verifier->setDigest(config_.hashType))
+            compared = compared || config_.hash.length() > 0;
+        else
+            log("hash type is not supported, file is not checked.");
+    }
+    if (!compared)
+    {
+        log("nothing to check file with, download it.");
+        return false;
+    }
+
+    totalSize_ = verifier->size();
+
+    delete verifier_;
+    verifier_ = verifier.release();
+    downloadSize_ = 0;
+    readableSize_ = 0;
+    verifyProgress_ = 0;
+    if (metrics_.startTime == 0)
+        metrics_.startTime = Utility::Clock::now();
+
+    setInternalState(HT_VERIFY);
+    log("verify file.");
+
+    return true;
+}
+
+void HttpTask::verifyStep()
+{
+    // pool is shared by tasks, a busy one is tried again in next perform.
+    if (hashPool().busy())
+        return;
+
+    bool more = verifier_->step(hashPool());
+    downloadSize_ = verifier_->position();
+
+    // only pieces tell a part is good before the whole file is checked.
+    if (pieceLength_ > 0 && verifier_->goodSize() > readableSize_)
+    {
+        readableSize_ = verifier_->goodSize();
+        readable(readableSize_);
+    }
+
+    int tenth = int(downloadSize_ * 10 / totalSize_);
+    if (tenth > verifyProgress_)
+    {
+        verifyProgress_ = tenth;
+        char logBuffer[64] = {0};
+        snprintf(logBuffer, 63, "verified %d%%", tenth * 10);
+        log(logBuffer);
+    }
+
+    if (!more)
+        finishVerify();
+}
+
+void HttpTask::finishVerify()
+{
+    metrics_.crc = verifier_->crc();
+    metrics_.digest = verifier_->digest();
+    std::vector<size_t> bad = verifier_->badPieces();
+    delete verifier_;
+    verifier_ = NULL;
+
+    if (bad.size() > 0)
+    {
+        refetchPieces(bad);
+        return;
+    }
+    metrics_.piecesVerified += pieceHashes_.size();
+
+    if (config_.hash.length() > 0 && metrics_.digest.length() > 0 &&
+        metrics_.digest != lowerCase(config_.hash))
+    {
+        log("file doesn't match its hash.");
+        setError(BAD_DIGEST, "file doesn't match its hash.");
+        return;
+    }
+
+    if (totalSize_ > readableSize_)
+    {
+        readableSize_ = totalSize_;
+        readable(readableSize_);
+    }
+    setInternalState(HT_FINISH);
+}
+
+/**
+ * Save good pieces of a verified file as resume state, and download the bad ones.
+ */
+void HttpTask::refetchPieces(const std::vector<size_t>& bad)
+{
+    metrics_.piecesVerified += pieceHashes_.size() - bad.size();
+    metrics_.pieceFailures += bad.size();
+
+    char logBuffer[64] = {0};
+    snprintf(logBuffer, 63, "%lu pieces are bad, download them again", bad.size());
+    log(logBuffer);
+
+    // file is all written but bad pieces, bitmap follows with blocks they leave whole.
+    written_.clear();
+    written_.add(0, totalSize_);
+    for (size_t i=0; i<bad.size(); ++i)
+    {
+        size_t begin = bad[i] * pieceLength_;
+        written_.remove(begin, std::min(begin + pieceLength_, totalSize_));
+    }
+
+    downloadBitmap_ = BitMap(totalSize_, config_.bytesPerBlock);
+    const RangeSet::Ranges& done = written_.ranges();
+    for (size_t i=0; i<done.size(); ++i)
+        downloadBitmap_.setCovered(done[i].first, done[i].second, true);
+
+    if (config_.partFile)
+        openPart();
+    else
+        openJournal();
+
+    if (part_.isOpen())
+    {
+        part_.setRange(0, part_.blocks(), false);
+        for (size_t i=0; i<done.size(); ++i)
+        {
+            BitMap::size_type first, last;
+            downloadBitmap_.coveredBlocks(done[i].first, done[i].second, first, last);
+            part_.setRange(first, last, true);
+        }
+        part_.sync();
+    }
+    else if (journal_.isOpen())
+    {
+        journal_.compact(done);
+    }
+    else
+    {
+        log("no resume state, download whole file again.");
+    }
+
+    resumeVerified_ = true;
+    setInternalState(HT_PREPARE);
+    start();
+}
+
+static size_t gcd(size_t a, size_t b)
+{
+    while (b != 0)
+    {
+        size_t t = a % b;
+        a = b;
+        b = t;
+    }
+    return a;
+}
+
+/**
+ * Block length dividing pieceLength, the largest not over bytesPerBlock, or the smallest
+ * over minimum if that's too small. \return 0 if piece is shorter than minimum.
+ */
+static size_t pieceBlock(size_t bytesPerBlock, size_t pieceLength, size_t minimum)
+{
+    if (pieceLength < minimum)
+        return 0;
+
+    size_t block = gcd(bytesPerBlock, pieceLength);
+    if (block >= minimum)
+        return block;
+
+    // the most blocks a piece is cut into, each of them at least minimum.
+    for (size_t count = pieceLength / minimum; count > 1; --count)
+    {
+        if (pieceLength % count == 0)
+            return pieceLength / count;
+    }
+
+    return pieceLength;
+}
+
+/**
+ * Range of the first session when size is known: the first block not resumed.
+ */
+void HttpTask::firstHole(size_t& pos, long& length)
+{
+    pos = 0;
+    length = long(totalSize_);
+    if (!part_.isOpen() && journal_.ranges().size() == 0)
+        return;
+
+    RangeSet resumed;
+    resumedRanges(resumed);
+    BitMap done(totalSize_, config_.bytesPerBlock);
+    done.setAll(false);
+    for (size_t i=0; i<resumed.ranges().size(); ++i)
+        done.setCovered(resumed.ranges()[i].first, resumed.ranges()[i].second, true);
+
+    // all done but not marked finish, fetch the last block again to finish.
+    BitMap::size_type b = std::min(done.find(false, 0), done.size() - 1);
+    BitMap::size_type e = done.find(true, b);
+    pos = b * done.bytesPerBit();
+    length = long(std::min(e * done.bytesPerBit(), totalSize_) - pos);
+}
+
+/**
+ * Bytes downloaded in last run, from part file or journal.
+ */
+void HttpTask::resumedRanges(RangeSet& ranges)
+{
+    ranges.clear();
+
+    if (part_.isOpen())
+    {
+        BitMap map(totalSize_, config_.bytesPerBlock);
+        map.setAll(false);
+        part_.load(map);
+
+        size_t bytesPerBlock = map.bytesPerBit();
+        BitMap::size_type b = map.find(true, 0);
+        while (b < map.size())
+        {
+            BitMap::size_type e = map.find(false, b);
+            ranges.add(b * bytesPerBlock, std::min(e * bytesPerBlock, totalSize_));
+            b = map.find(true, e);
+        }
+        return;
+    }
+
+    // a range may end or start inside a block, they are merged before blocks are set.
+    const ResumeJournal::Ranges& journal = journal_.ranges();
+    for (size_t i=0; i<journal.size(); ++i)
+        ranges.add(journal[i].first, journal[i].second);
+}
+
+/**
+ * Open resume state for the known size, and take what it has as downloaded.
+ */
+void HttpTask::openResume()
+{
+    bool verified = resumeVerified_;
+    resumeVerified_ = false;
+
+    bool resumed = config_.partFile ? openPart() : openJournal();
+    if (!resumed)
+        return;
+
+    resumedRanges(written_);
+    for (size_t i=0; i<written_.ranges().size(); ++i)
+        downloadBitmap_.setCovered(written_.ranges()[i].first, written_.ranges()[i].second, true);
+    if (config_.blockCrc && journal_.isOpen())
+        checkBlocks();
+
+    ResumeJournal::Ranges done;
+    doneRanges(done);
+    downloadSize_ = 0;
+    for (size_t i=0; i<done.size(); ++i)
+        downloadSize_ += done[i].second - done[i].first;
+    if (downloadSize_ == 0)
+        return;
+
+    char logBuffer[64] = {0};
+    snprintf(logBuffer, 63, "resume %lu bytes", downloadSize_);
+    log(logBuffer);
+
+    // pieces downloaded in last run are hashed from file in background.
+    size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+    for (size_t i=0; i<pieces_.size(); ++i)
+    {
+        size_t begin = i * pieceLength_;
+        BitMap::size_type last = (std::min(begin + pieceLength_, totalSize_) + bytesPerBlock - 1)
+            / bytesPerBlock;
+        if (downloadBitmap_.find(false, begin / bytesPerBlock) >= last)
+        {
+            pieces_[i].inOrder = false;
+            if (verified)
+                pieces_[i].verified = true;
+            else
+                queuePiece(i);
+        }
+    }
+    verifyPieces();
+
+    updateReadable();
+}
+
+/**
+ * \return true if journal has ranges of last run.
+ */
+bool HttpTask::openJournal()
+{
+    if (!config_.resumeJournal)
+        return false;
+
+    if (!journal_.isOpen() &&
+        !journal_.open(filePath() + ".journal", totalSize_, config_.bytesPerBlock))
+    {
+        log("can't open resume journal, task can't resume.");
+        return false;
+    }
+    checkpointTime_ = Utility::Clock::now();
+
+    if (journal_.etag() != etag_ || journal_.lastModified() != lastModified_)
+        journal_.setValidators(etag_, lastModified_);
+
+    return journal_.ranges().size() > 0;
+}
+
+/**
+ * \return true if part file has blocks of last run.
+ */
+bool HttpTask::openPart()
+{
+    checkpointTime_ = Utility::Clock::now();
+
+    if (!part_.isOpen() &&
+        !part_.open(filePath() + ".part", totalSize_, config_.bytesPerBlock))
+    {
+        log("can't open part file, task can't resume.");
+        return false;
+    }
+
+    if (part_.etag() != etag_ || part_.lastModified() != lastModified_)
+        part_.setValidators(etag_, lastModified_);
+
+    return true;
+}
+
+void HttpTask::noteWritten(size_t begin, size_t end)
+{
+    if (!journal_.isOpen() && !part_.isOpen())
+        return;
+    pendingBytes_ += end - begin;
+
+    // a session writes on from where it stopped.
+    for (ResumeJournal::Ranges::reverse_iterator it = pending_.rbegin();
+         it != pending_.rend(); ++it)
+    {
+        if (it->second == begin)
+        {
+            it->second = end;
+            return;
+        }
+    }
+    pending_.push_back(std::make_pair(begin, end));
+}
+
+/**
+ * Save written ranges to resume state every CheckpointInterval ms or CheckpointBytes, or
+ * now if forced. Data is flushed first, so resume state never claims what a crash lost.
+ */
+void HttpTask::checkpoint(bool force)
+{
+    // CRCs read back are saved even if nothing is written since.
+    if ((!journal_.isOpen() && !part_.isOpen()) ||
+        (pending_.size() == 0 && !crcHasher_.done()))
+        return;
+
+    Utility::Clock::Ms now = Utility::Clock::now();
+    if (!force &&
+        now - checkpointTime_ < Utility::Clock::Ms(config_.checkpointInterval) &&
+        pendingBytes_ < size_t(config_.checkpointBytes))
+    {
+        return;
+    }
+
+    if (!file_.sync())
+    {
+        LOG(0, "sync task %p file fail: %s\n", this, strerror(errno));
+        return;
+    }
+
+    if (part_.isOpen())
+    {
+        // part file keeps blocks, set only the ones all written.
+        for (size_t i=0; i<pending_.size(); ++i)
+        {
+            RangeSet::Range merged = written_.add(pending_[i].first, pending_[i].second);
+            BitMap::size_type first, last;
+            downloadBitmap_.coveredBlocks(merged.first, merged.second, first, last);
+            part_.setRange(first, last, true);
+        }
+        part_.sync();
+    }
+    else
+    {
+        ResumeJournal::Crcs crcs;
+        takeCrcs(crcs);
+        journal_.append(pending_, crcs);
+        journal_.sync();
+    }
+
+    pending_.clear();
+    pendingBytes_ = 0;
+    checkpointTime_ = now;
+    ++metrics_.checkpoints;
+
+    if (journal_.isOpen() && journal_.needCompact())
+        compactJournal();
+}
+
+/**
+ * Rewrite journal from download bitmap, which also drops ranges cleared from bitmap.
+ */
+void HttpTask::compactJournal()
+{
+    if (!journal_.isOpen())
+        return;
+
+    // journal will claim all written, it's synced from here.
+    if (!file_.sync())
+        return;
+
+    journal_.compact(written_.ranges());
+    pending_.clear();
+    pendingBytes_ = 0;
+
+    // CRCs of blocks done before, the compacted journal claims them now.
+    ResumeJournal::Crcs crcs;
+    takeCrcs(crcs);
+    if (crcs.size() > 0)
+        journal_.append(pending_, crcs);
+}
+
+/**
+ * Downloaded byte ranges in download bitmap, merged.
+ */
+void HttpTask::doneRanges(ResumeJournal::Ranges& ranges)
+{
+    ranges.clear();
+
+    size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+    BitMap::size_type b = downloadBitmap_.find(true, 0);
+    while (b < downloadBitmap_.size())
+    {
+        BitMap::size_type e = downloadBitmap_.find(false, b);
+        ranges.push_back(std::make_pair(b * bytesPerBlock,
+                                        std::min(e * bytesPerBlock, totalSize_)));
+        b = downloadBitmap_.find(true, e);
+    }
+}
+
+/**
+ * Whether all blocks of check block index are downloaded.
+ */
+bool HttpTask::checkBlockDone(size_t index)
+{
+    size_t span = journal_.crcBlockSize();
+    size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+    size_t begin = index * span;
+    if (begin >= totalSize_)
+        return false;
+
+    size_t end = std::min(begin + span, totalSize_);
+    return downloadBitmap_.find(false, begin / bytesPerBlock) >=
+        (end + bytesPerBlock - 1) / bytesPerBlock;
+}
+
+/**
+ * Feed CRCs of check blocks with data written in order, from the write buffer. A check
+ * block is done when all its blocks are downloaded, its CRC is saved at next checkpoint.
+ */
+void HttpTask::crcWritten(size_t pos, const void* buffer, size_t size)
+{
+    size_t span = journal_.crcBlockSize();
+    const char* data = static_cast<const char*>(buffer);
+    size_t end = pos + size;
+    while (pos < end)
+    {
+        size_t index = pos / span;
+        size_t begin = index * span;
+        size_t length = std::min(begin + span, totalSize_) - begin;
+        size_t n = std::min(end, begin + length) - pos;
+
+        // a block downloaded again starts from its begin, one with data out of order is
+        // read back anyway.
+        CheckBlock& block = checkBlocks_[index];
+        if (pos == begin && block.inOrder)
+            block = CheckBlock();
+        if (block.inOrder && pos == begin + block.filled)
+        {
+            block.crc = Utility::Crc32c::update(block.crc, data, n);
+            block.filled += n;
+        }
+        else
+        {
+            block.inOrder = false;
+        }
+
+        if ((block.filled == length || !block.inOrder) && checkBlockDone(index))
+        {
+            if (block.filled == length)
+                pendingCrcs_[index] = block.crc;
+            else
+                crcReadBack_.push_back(index);
+            checkBlocks_.erase(index);
+        }
+
+        data += n;
+        pos += n;
+    }
+}
+
+/**
+ * Move CRCs of done check blocks to crcs, and blocks cleared since they were done are
+ * dropped. Blocks written out of order are read back in background by readBackCrcs(),
+ * their CRCs are taken by a later checkpoint.
+ */
+void HttpTask::takeCrcs(ResumeJournal::Crcs& crcs)
+{
+    readBackCrcs();
+
+    for (ResumeJournal::Crcs::iterator it = pendingCrcs_.begin(); it != pendingCrcs_.end(); ++it)
+    {
+        if (checkBlockDone(it->first))
+            crcs.insert(crcs.end(), *it);
+    }
+    pendingCrcs_.clear();
+}
+
+/**
+ * Take CRCs of check blocks read back on hashPool(), and start reading back the ones
+ * written out of order since. CRCs still read back when the task goes are dropped, their
+ * blocks are resumed unchecked.
+ */
+void HttpTask::readBackCrcs()
+{
+    if (crcHasher_.started())
+    {
+        if (!crcHasher_.done())
+            return;
+
+        PieceHasher::Pieces blocks;
+        crcHasher_.take(blocks);
+        for (size_t i=0; i<blocks.size(); ++i)
+        {
+            if (blocks[i].digest.length() > 0)
+                pendingCrcs_[blocks[i].index] = uint32_t(strtoul(blocks[i].digest.c_str(), NULL, 16));
+        }
+    }
+
+    // pool is shared by tasks, a busy one is tried again at next checkpoint.
+    if (crcReadBack_.size() == 0 || hashPool().busy())
+        return;
+
+    size_t span = journal_.crcBlockSize();
+    PieceHasher::Pieces blocks;
+    for (size_t i=0; i<crcReadBack_.size(); ++i)
+    {
+        size_t begin = crcReadBack_[i] * span;
+        size_t length = std::min(begin + span, totalSize_) - begin;
+        blocks.push_back(PieceHasher::Piece(crcReadBack_[i], begin, length));
+        metrics_.crcReadBack += length;
+    }
+    crcReadBack_.clear();
+
+    // blocks that can't be read have no CRC, they aren't checked on resume.
+    crcHasher_.start(filePath(), "crc32c", blocks, hashPool());
+}
+
+/**
+ * Read back resumed check blocks which have a CRC in journal, in background on hashPool().
+ * Until checkedBlocks() takes them, nothing from the first one on is readable.
+ */
+void HttpTask::checkBlocks()
+{
+    blocksToCheck_ = false;
+
+    const ResumeJournal::Crcs& crcs = journal_.crcs();
+    size_t span = journal_.crcBlockSize();
+
+    PieceHasher::Pieces blocks;
+    for (ResumeJournal::Crcs::const_iterator it = crcs.begin(); it != crcs.end(); ++it)
+    {
+        if (!checkBlockDone(it->first))
+            continue;
+
+        size_t begin = it->first * span;
+        blocks.push_back(PieceHasher::Piece(it->first, begin,
+                                            std::min(begin + span, totalSize_) - begin));
+    }
+    if (blocks.size() == 0)
+        return;
+
+    checkingFrom_ = blocks[0].begin;
+
+    // pool is shared by tasks, a busy one is tried again in next perform.
+    if (hashPool().busy())
+    {
+        blocksToCheck_ = true;
+        return;
+    }
+
+    if (!blockHasher_.start(filePath(), "crc32c", blocks, hashPool()))
+    {
+        // blocks that can't be read are taken as bad.
+        checkedBlocks(blocks);
+    }
+}
+
+/**
+ * Take CRCs of resumed check blocks when they're read back. Blocks of a check block that
+ * doesn't match are taken out of download bitmap, so they are downloaded again.
+ * \return true if a check block is bad.
+ */
+bool HttpTask::checkedBlocks()
+{
+    if (blocksToCheck_)
+        checkBlocks();
+
+    if (!blockHasher_.started() || !blockHasher_.done())
+        return false;
+
+    PieceHasher::Pieces blocks;
+    blockHasher_.take(blocks);
+    return checkedBlocks(blocks);
+}
+
+bool HttpTask::checkedBlocks(const PieceHasher::Pieces& blocks)
+{
+    const ResumeJournal::Crcs& crcs = journal_.crcs();
+    size_t bytesPerBlock = downloadBitmap_.bytesPerBit();
+    size_t bad = 0;
+    for (size_t i=0; i<blocks.size(); ++i)
+    {
+        // journal compacted while blocks were read keeps CRCs of blocks it claims.
+        const PieceHasher::Piece& block = blocks[i];
+        ResumeJournal::Crcs::const_iterator crc = crcs.find(block.index);
+        if (crc == crcs.end() ||
+            (block.digest.length() > 0 &&
+             uint32_t(strtoul(block.digest.c_str(), NULL, 16)) == crc->second))
+            continue;
+
+        downloadBitmap_.setRange(block.begin / bytesPerBlock,
+                                 (block.begin + block.length + bytesPerBlock - 1) / bytesPerBlock,
+                                 false);
+        written_.remove(block.begin, block.begin + block.length);
+        downloadSize_ -= std::min(downloadSize_, block.length);
+        ++bad;
+    }
+    if (bad == 0)
+    {
+        updateReadable();
+        return false;
+    }
+
+    metrics_.blockCrcFailures += bad;
+    char logBuffer[64] = {0};
+    snprintf(logBuffer, 63, "%lu blocks fail CRC, download them again", bad);
+    log(logBuffer);
+
+    compactJournal();
+    updateReadable();
+
+    return true;
+}
+
+void HttpTask::clearCheckBlocks()
+{
+    blockHasher_.cancel();
+    blocksToCheck_ = false;
+    crcHasher_.cancel();
+    checkBlocks_.clear();
+    pendingCrcs_.clear();
+    crcReadBack_.clear();
+}
+
+/**
+ * \brief Take uris, size and hashes from a metalink, call it before start().
+ *
+ * With size known the task splits at once, and each piece is checked with its hash
+ * when it's downloaded. The file hash is checked when task finishes.
+ */
+bool HttpTask::loadMetalink(const Metalink& metalink)
+{
+    if (metalink.uris.size() == 0)
+        return false;
+
+    uri_ = metalink.uris[0];
+    host_.clear();
+    metrics_.sources.clear();
+    sources_.clear();
+    for (size_t i=1; i<metalink.uris.size(); ++i)
+    {
+        addMirror(metalink.uris[i].c_str());
+    }
+
+    if (outputName_.length() == 0)
+        outputName_ = metalink.name;
+
+    if (config_.hashType.length() == 0 && metalink.hash.length() > 0)
+    {
+        config_.hashType = metalink.hashType;
+        config_.hash = metalink.hash;
+    }
+
+    totalSize_ = metalink.size;
+
+    if (!loadPieces(metalink.pieceType, metalink.pieceLength, metalink.pieces) &&
+        metalink.pieces.size() > 0)
+    {
+        log("piece hashes in metalink are not used.");
+    }
+
+    return true;
+}
+
+/**
+ * \brief Check every piece of pieceLength bytes with its hash, call it before start().
+ *
+ * Hashes come from a metalink or a manifest, type is a name known by Utility::Digest.
+ * Blocks are made to divide pieces, so a bad piece is fetched again alone. Total size
+ * must be known.
+ */
+bool HttpTask::loadPieces(const std::string& type, size_t pieceLength,
+                          const std::vector<std::string>& hashes)
+{
+    pieceHashes_.clear();
+    pieceLength_ = 0;
+
+    // a piece must be whole blocks, tiny ones would make a block of a few bytes.
+    size_t minimum = std::min(size_t(std::max(config_.bytesPerBlock, 1)), minPieceBlock);
+    size_t bytesPerBlock = pieceBlock(config_.bytesPerBlock, pieceLength, minimum);
+
+    std::auto_ptr<Utility::Digest> probe(Utility::Digest::create(type));
+    if (probe.get() == NULL || bytesPerBlock == 0 || totalSize_ == 0 ||
+        hashes.size() != (totalSize_ + pieceLength - 1) / pieceLength)
+        return false;
+
+    pieceType_ = type;
+    pieceHashes_ = hashes;
+    for (size_t i=0; i<pieceHashes_.size(); ++i)
+    {
+        for (size_t k=0; k<pieceHashes_[i].length(); ++k)
+            pieceHashes_[i][k] = char(tolower(pieceHashes_[i][k]));
+    }
+    pieceLength_ = pieceLength;
+    config_.bytesPerBlock = int(bytesPerBlock);
+
+    return true;
+}
+
+void HttpTask::updateReadable()
+{
+    size_t size = downloadSize_;
+    if (internalState_ == HT_DOWNLOAD)
+    {
+        // exact bytes written from file begin, not the blocks they touch.
+        size = std::min(written_.prefix(), totalSize_);
+
+        // none of resumed check blocks still read back.
+        if (blockHasher_.started() || blocksToCheck_)
+            size = std::min(size, checkingFrom_);
+
+        if (pieces_.size() > 0)
+        {
+            // only verified pieces are readable.
+            while (verifiedPieces_ < pieces_.size() && pieces_[verifiedPieces_].verified)
+                ++verifiedPieces_;
+            size = std::min(size, verifiedPieces_ * pieceLength_);
+        }
+    }
+
+    if (size > readableSize_)
+    {
+        readableSize_ = size;
+        readable(readableSize_);
+    }
+}
+
+void HttpTask::hasSessionFinish()
+{
+    // check task status.
+    CURLMsg *msg = NULL;
+    int msgsInQueue;
+    while ( (msg = curl_multi_info_read(handle_, &msgsInQueue)) != NULL)
+    {
+        HttpSession *ses = NULL;
+        CURLcode rete = curl_easy_getinfo(msg->easy_handle, CURLINFO_PRIVATE, &ses);
+        if (rete != CURLE_OK)
+        {
+            setError(HttpTask::OTHER, curl_easy_strerror(rete));
         }
 
         long respCode = 0;
@@ -387,6 +2906,29 @@ void HttpTask::hasSessionFinish()
         int topRespCode = respCode / 100;
         LOG(0, "top response code = %d\n", topRespCode);
 
+        if (msg->msg == CURLMSG_DONE && (msg->data.result != CURLE_OK || topRespCode != 2))
+        {
+            addressFailed(ses);
+
+            // with mirrors, give the rest of its range to another source.
+            if (ses != NULL && metrics_.sources.size() > 0)
+            {
+                sourceFailed(ses);
+                if (topRespCode != 2)
+                    sessionFinish(ses);
+            }
+            // nothing else has its ranges, asking the only source again gets the same answer.
+            else if (ses != NULL && topRespCode != 2)
+            {
+                sessionFinish(ses);
+                if (msg->data.result != CURLE_OK)
+                    setError(HttpTask::OTHER, curl_easy_strerror(msg->data.result));
+                else
+                    setError(HttpTask::OTHER,
+                             str(boost::format("server answered %ld.") % respCode).c_str());
+            }
+        }
+
         switch (msg->msg)
         {
         case CURLMSG_DONE:
@@ -408,5 +2950,8 @@ void HttpTask::hasSessionFinish()
 
 bool HttpTask::checkFinish()
 {
-    return sessions_.size() == 0;
+    // pieces still hashed may be bad and go back to sessions.
+    return sessions_.size() == 0 && !deferred_ &&
+        !pieceHasher_.started() && verifyQueue_.size() == 0 && !blockHasher_.started() &&
+        !blocksToCheck_;
 }
@@ -1,18 +1,36 @@
 #ifndef HTTP_TASK_HEADER
 #define HTTP_TASK_HEADER
 
+#include <map>
 #include <vector>
 #include <string>
 
+#include "lib/utility/AsyncResolver.h"
+#include "lib/utility/Digest.h"
 #include "lib/utility/FileManager.h"
+#include "lib/utility/Sha256.h"
+#include "lib/utility/TokenBucket.h"
 
 #include "lib/protocols/TaskBase.h"
 #include "lib/protocols/ProtocolBase.h"
 
 #include "BitMap.h"
 #include "HttpConfigure.h"
+#include "HttpMetrics.h"
+#include "HttpSession.h"
+#include "PartFile.h"
+#include "PieceHasher.h"
+#include "RangeSet.h"
+#include "ResumeJournal.h"
 
-class HttpSession;
+namespace Utility
+{
+class HostLimiter;
+class ThreadPool;
+}
+
+class FileVerifier;
+struct Metalink;
 
 class HttpTask : public TaskBase
 {
@@ -27,6 +45,7 @@ public:
         FAIL_OPEN_FILE,
         FAIL_FILE_IO,
         XML_PARSE_ERROR,
+        BAD_DIGEST,
         OTHER,
     };
 
@@ -43,6 +62,7 @@ public:
     virtual size_t      totalSize()            { return totalSize_; }
     virtual size_t      downloadSize()         { return downloadSize_; }
     virtual size_t      uploadSize()           { return 0; }
+    virtual size_t      readableSize()         { return readableSize_; }
     virtual int         totalSource()          { return totalSource_; }
     virtual int         validSource()          { return validSource_; }
     virtual std::vector<bool> validBitmap()    { return validBitmap_.getVector(); }
@@ -54,9 +74,17 @@ public:
     virtual bool stop();
 
     virtual bool fdSet(fd_set* read, fd_set* write, fd_set* exc, int* max);
+    virtual long timeout();
     virtual size_t performDownload();
     virtual size_t performUpload();
 
+    virtual int  connectionDemand();
+    virtual int  openFiles();
+    virtual void setConnectionLimit(int limit);
+    virtual void setSpeedLimiter(Utility::TokenBucket* parent);
+    virtual void setSpeedShare(size_t bytesPerSecond);
+    virtual void setMaxDownloadSpeed(size_t bytesPerSecond);
+
     virtual int error()                        { return err_; }
     virtual const char* strerror(int error);
 
@@ -66,6 +94,7 @@ public:
         HT_PREPARE,
         HT_DOWNLOAD,
         HT_DOWNLOAD_WITHOUT_LENGTH,
+        HT_VERIFY,
         HT_ERROR,
         HT_FINISH,
     };
@@ -76,7 +105,37 @@ public:
 
     void initTask();
     void sessionFinish(HttpSession* ses);
+    void rejectMultiRange();
+    bool addMirror(const char* uri);
+    bool loadMetalink(const Metalink& metalink);
+    bool loadPieces(const std::string& type, size_t pieceLength,
+                    const std::vector<std::string>& hashes);
+    bool checkSource(HttpSession* ses);
+    bool verify();
+    curl_slist* requestHeaders()               { return headers_; }
     const HttpConfigure& configure()           { return config_; }
+    HttpMetrics& metrics()                     { return metrics_; }
+    CURL* handleTemplate();
+    unsigned long handleOwner()                { return handleOwner_; }
+
+    /**
+     * \brief Connection budget per host shared by all http tasks.
+     */
+    static Utility::HostLimiter& hostLimiter();
+
+    /**
+     * \brief Connection budget per IP address, for sessions spread over resolved addresses.
+     */
+    static Utility::HostLimiter& addressLimiter();
+
+    /**
+     * \brief Threads hashing pieces from file, shared by all http tasks.
+     */
+    static Utility::ThreadPool& hashPool();
+
+    bool mayReceive(HttpSession* ses);
+    size_t speedLimit();
+    void consume(HttpSession* ses, size_t bytes);
 
     bool writeFile(size_t pos, void *buffer, size_t size);
 
@@ -84,7 +143,76 @@ private:
     friend class HttpProtocol;
     friend struct HttpTaskUnitTest;
 
+    struct Source
+    {
+        std::string host;
+        Utility::TokenBucket* bucket;   // of host, shared by all tasks.
+        BitMap blocks;                  // blocks it may serve, empty until size is known.
+    };
+    typedef std::vector<Source> Sources;
+
+    int sessionLimit();
+    bool setMultiplex();
     void separateSession();
+    bool startSession(const HttpSession::Ranges& ranges);
+    void removeSession(HttpSession* ses);
+    void unpinSession(HttpSession* ses);
+    void deleteIdleSessions();
+    void resolveAddresses();
+    void takeAddresses();
+    bool pinSession(HttpSession* ses);
+    void addressFailed(HttpSession* ses);
+    void demoteAddresses();
+    Source& source(int index);
+    int reserveSource(size_t pos);
+    bool acquireSource(int index);
+    void releaseSource(int index);
+    bool pinSource(HttpSession* ses, int index);
+    void sourceFailed(HttpSession* ses);
+    void dropSource(int index);
+    void updateSources();
+    void setValidators(const std::string& etag, const std::string& lastModified);
+    bool checkValidators(HttpSession* ses);
+    bool restartDownload(HttpSession* ses);
+    void finishOthers(HttpSession* ses);
+    std::string filePath();
+    bool openFile();
+    void firstHole(size_t& pos, long& length);
+    void resumedRanges(RangeSet& ranges);
+    void openResume();
+    bool openJournal();
+    bool openPart();
+    void noteWritten(size_t begin, size_t end);
+    void checkpoint(bool force);
+    void compactJournal();
+    void doneRanges(ResumeJournal::Ranges& ranges);
+    bool checkBlockDone(size_t index);
+    void crcWritten(size_t pos, const void* buffer, size_t size);
+    void takeCrcs(ResumeJournal::Crcs& crcs);
+    void readBackCrcs();
+    void checkBlocks();
+    bool checkedBlocks();
+    bool checkedBlocks(const PieceHasher::Pieces& blocks);
+    void clearCheckBlocks();
+    void startDownload(HttpSession* first);
+    void checkParallel();
+    void clearPieces();
+    void hashPieces(size_t pos, const void* buffer, size_t size);
+    void queuePiece(size_t index);
+    bool verifyPieces();
+    bool checkPiece(size_t index, const std::string& digest);
+    void resetDigest();
+    void rewindDigest(size_t pos);
+    void hashPrefix(size_t pos, const void* buffer, size_t size);
+    bool hashFile(size_t end, size_t limit);
+    bool checkDigest();
+    void verifyStep();
+    void finishVerify();
+    void refetchPieces(const std::vector<size_t>& bad);
+    void resumeDeferred();
+    void resumePaused();
+    void fillHoles();
+    void updateReadable();
     void hasSessionFinish();
     bool checkFinish();
     void clearSessions();
@@ -100,8 +228,9 @@ private:
     size_t downloadSize_;
     int totalSource_;
     int validSource_;
-    BitMap validBitmap_;
+    BitMap validBitmap_;                // blocks any valid source has.
     BitMap downloadBitmap_;
+    RangeSet written_;                  // bytes written, blocks of download bitmap are rounded.
     TaskState state_;
     ProtocolBase* protocol_;
 
@@ -111,13 +240,79 @@ private:
     InternalState internalState_;
 
     CURLM* handle_;
+    CURL* template_;
+    unsigned long handleOwner_;         // pooled handles with options of task.
     Utility::FileManager file_;
     typedef std::vector<HttpSession*> Sessions;
     Sessions sessions_;
     Sessions finishedSessions_;
+    Sessions idleSessions_;
+    Sessions pausedSessions_;       // paused by speed limit.
+    Utility::TokenBucket bucket_;   // of task, manager's bucket is its parent.
+    size_t speedShare_;             // given by manager, bucket_ takes it if under task's limit.
+    HttpMetrics metrics_;
 
     size_t writeLength_;
     int lastRunningHandle_;
+    bool multiRangeRejected_;
+    size_t readableSize_;
+    int connectionLimit_;
+    std::string host_;
+    Sources sources_;                   // by index of metrics_.sources, 0 is task uri.
+    std::string etag_;
+    std::string lastModified_;
+    curl_slist* headers_;                   // If-Range for sessions from task uri.
+    std::vector<curl_slist*> oldHeaders_;   // may still be used by running sessions.
+    bool deferred_;
+    bool rangesRefused_;
+    Utility::AsyncResolver resolver_;   // addresses of host, while spreadAddresses looks them up.
+
+    struct Piece
+    {
+        Utility::Digest* digest;        // owned by task, only while data arrives in order.
+        size_t hashed;                  // bytes hashed from piece begin, while data arrives.
+        bool inOrder;                   // false if data came out of order, hash from file.
+        bool queued;                    // in verifyQueue_.
+        bool verified;
+
+        Piece() : digest(NULL), hashed(0), inOrder(true), queued(false), verified(false) {}
+    };
+    std::string pieceType_;
+    std::vector<std::string> pieceHashes_;
+    std::vector<Piece> pieces_;
+    size_t pieceLength_;
+    size_t verifiedPieces_;             // pieces verified from file begin.
+    std::vector<size_t> verifyQueue_;   // downloaded pieces to hash from file on hashPool().
+    PieceHasher pieceHasher_;           // pieces of verifyQueue_ taken, while they're hashed.
+
+    Utility::Digest* digest_;           // whole file hash, fed as the prefix from file begin grows.
+    size_t hashedSize_;
+
+    FileVerifier* verifier_;            // while file is verified.
+    int verifyProgress_;                // tenths of file verified, as logged.
+    bool resumeVerified_;               // resumed pieces are just verified, don't hash them.
+
+    ResumeJournal journal_;
+    ResumeJournal::Ranges pending_;         // written but not checkpointed yet.
+    size_t pendingBytes_;
+    Utility::Clock::Ms checkpointTime_;
+    PartFile part_;                         // used instead of journal if PartFile is set.
+
+    struct CheckBlock
+    {
+        uint32_t crc;
+        size_t filled;                  // bytes in crc from block begin.
+        bool inOrder;                   // false if data came out of order, read it back.
+
+        CheckBlock() : crc(0), filled(0), inOrder(true) {}
+    };
+    std::map<size_t, CheckBlock> checkBlocks_;  // check blocks of journal being written.
+    ResumeJournal::Crcs pendingCrcs_;           // of done check blocks, saved at checkpoint.
+    std::vector<size_t> crcReadBack_;           // done check blocks written out of order.
+    PieceHasher crcHasher_;                     // check blocks of crcReadBack_ taken, while read back.
+    PieceHasher blockHasher_;                   // resumed check blocks, while read back.
+    bool blocksToCheck_;                        // resumed check blocks wait for a free pool.
+    size_t checkingFrom_;                       // begin of first check block read back.
 };
 
 #endif
@@ -0,0 +1,31 @@
+#ifndef METALINK_CLASS_HEAD
+#define METALINK_CLASS_HEAD
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+/**
+ * \brief What a download needs from a Metalink 4 (RFC 5854) file.
+ *
+ * Only the first <file> is taken. Hashes are lower case hex, uris are sorted by priority.
+ */
+struct Metalink
+{
+    std::string name;
+    size_t size;                        // 0 if unknown.
+    std::string hashType;               // whole file hash, e.g. "sha-256".
+    std::string hash;
+    std::string pieceType;
+    size_t pieceLength;
+    std::vector<std::string> pieces;
+    std::vector<std::string> uris;
+
+    Metalink()
+        : size(0),
+          pieceLength(0)
+        {}
+};
+
+#endif
@@ -0,0 +1,166 @@
+#include "MetalinkParser.h"
+#include "utility/Utility.h"
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+static const char* localName(const char* name)
+{
+    const char* colon = strrchr(name, ':');
+    return (colon == NULL) ? name : colon + 1;
+}
+
+static const char* attribute(const char** names, const char** values, const char* name)
+{
+    for (int i=0; names[i] != NULL; ++i)
+    {
+        if (strcmp(localName(names[i]), name) == 0)
+            return values[i];
+    }
+
+    return NULL;
+}
+
+static std::string trim(const std::string& text)
+{
+    size_t begin = text.find_first_not_of(" \t\r\n");
+    if (begin == std::string::npos)
+        return "";
+
+    size_t end = text.find_last_not_of(" \t\r\n");
+    return text.substr(begin, end - begin + 1);
+}
+
+static std::string lower(const std::string& text)
+{
+    std::string ret(text);
+    for (size_t i=0; i<ret.length(); ++i)
+    {
+        if (ret[i] >= 'A' && ret[i] <= 'Z')
+            ret[i] = ret[i] - 'A' + 'a';
+    }
+
+    return ret;
+}
+
+MetalinkParser::MetalinkParser()
+    : files_(0),
+      inFile_(false),
+      inPieces_(false)
+{}
+
+bool MetalinkParser::parse(const char* text, int len)
+{
+    if (!feed(text, len) || !finish())
+        return false;
+
+    return metalink_.uris.size() > 0;
+}
+
+void MetalinkParser::startElement(const char*  elementName,
+                                  const char** attributeNames,
+                                  const char** attributeValues)
+{
+    const char* name = localName(elementName);
+    text_.clear();
+    attribute_.clear();
+
+    if (strcmp(name, "file") == 0)
+    {
+        inFile_ = (++files_ == 1);
+        const char* fileName = attribute(attributeNames, attributeValues, "name");
+        if (inFile_ && fileName != NULL)
+        {
+            // never write out of output dir.
+            const char* base = strrchr(fileName, '/');
+            metalink_.name = (base == NULL) ? fileName : base + 1;
+        }
+        return;
+    }
+
+    if (!inFile_)
+        return;
+
+    const char* value = NULL;
+    if (strcmp(name, "pieces") == 0)
+    {
+        inPieces_ = true;
+        value = attribute(attributeNames, attributeValues, "length");
+        metalink_.pieceLength = (value == NULL) ? 0 : strtoul(value, NULL, 10);
+        value = attribute(attributeNames, attributeValues, "type");
+        metalink_.pieceType = (value == NULL) ? "" : lower(value);
+    }
+    else if (strcmp(name, "hash") == 0)
+    {
+        value = attribute(attributeNames, attributeValues, "type");
+    }
+    else if (strcmp(name, "url") == 0)
+    {
+        value = attribute(attributeNames, attributeValues, "priority");
+    }
+
+    if (value != NULL)
+        attribute_ = value;
+}
+
+void MetalinkParser::endElement(const char* elementName)
+{
+    const char* name = localName(elementName);
+    if (strcmp(name, "file") == 0)
+    {
+        inFile_ = false;
+        return;
+    }
+
+    if (!inFile_)
+        return;
+
+    std::string value = trim(text_);
+    if (strcmp(name, "size") == 0)
+    {
+        metalink_.size = strtoul(value.c_str(), NULL, 10);
+    }
+    else if (strcmp(name, "pieces") == 0)
+    {
+        inPieces_ = false;
+    }
+    else if (strcmp(name, "hash") == 0)
+    {
+        if (inPieces_)
+        {
+            metalink_.pieces.push_back(lower(value));
+        }
+        else if (metalink_.hash.length() == 0 || lower(attribute_) == "sha-256")
+        {
+            metalink_.hashType = lower(attribute_);
+            metalink_.hash = lower(value);
+        }
+    }
+    else if (strcmp(name, "url") == 0 && value.length() > 0)
+    {
+        // lower value is higher priority, no priority comes last.
+        int priority = (attribute_.length() == 0) ? 1000000 : atoi(attribute_.c_str());
+        std::vector<int>::iterator it = priorities_.begin();
+        while (it != priorities_.end() && *it <= priority)
+            ++it;
+
+        metalink_.uris.insert(metalink_.uris.begin() + (it - priorities_.begin()), value);
+        priorities_.insert(it, priority);
+    }
+
+    text_.clear();
+}
+
+void MetalinkParser::text(const char* text, size_t textLen)
+{
+    text_.append(text, textLen);
+}
+
+void MetalinkParser::passthrough(const char* /*text*/, size_t /*textLen*/)
+{}
+
+void MetalinkParser::error(int /*err*/, const char* errorstr)
+{
+    LOG(0, "parse metalink fail: %s\n", errorstr);
+}
@@ -0,0 +1,36 @@
+#ifndef METALINK_PARSER_CLASS_HEAD
+#define METALINK_PARSER_CLASS_HEAD
+
+#include "utility/SimpleXmlParser.h"
+#include "Metalink.h"
+
+#include <string>
+#include <vector>
+
+class MetalinkParser : public Utility::SimpleXmlParser
+{
+public:
+    MetalinkParser();
+
+    bool parse(const char* text, int len = -1);
+    const Metalink& metalink() { return metalink_; }
+
+private:
+    virtual void startElement(const char*  elementName,
+                              const char** attributeNames,
+                              const char** attributeValues);
+    virtual void endElement(const char* elementName);
+    virtual void text(const char* text, size_t textLen);
+    virtual void passthrough(const char* text, size_t textLen);
+    virtual void error(int err, const char* errorstr);
+
+    Metalink metalink_;
+    std::vector<int> priorities_;
+    int files_;                         // <file> seen, only the first is taken.
+    bool inFile_;
+    bool inPieces_;
+    std::string attribute_;             // type or priority of current element.
+    std::string text_;
+};
+
+#endif
@@ -0,0 +1,218 @@
+#include "PartFile.h"
+
+#include "utility/Crc32c.h"
+#include "utility/Utility.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+
+namespace
+{
+
+const char magic[4] = { 'H', 'T', 'P', '1' };
+
+}
+
+PartFile::PartFile()
+    : map_(NULL),
+      length_(0),
+      totalSize_(0),
+      bytesPerBlock_(0),
+      blocks_(0)
+{}
+
+PartFile::~PartFile()
+{
+    close();
+}
+
+bool PartFile::open(const std::string& path, size_t totalSize, size_t bytesPerBlock)
+{
+    close();
+    path_ = path;
+
+    int fd = ::open(path_.c_str(), O_RDWR);
+    if (fd != -1)
+    {
+        struct stat st;
+        if (::fstat(fd, &st) == 0 && size_t(st.st_size) > headerSize &&
+            map(fd, st.st_size))
+        {
+            Header* h = header();
+            size_t blocks = (h->bytesPerBlock == 0)
+                ? 0 : size_t((h->totalSize + h->bytesPerBlock - 1) / h->bytesPerBlock);
+            if (memcmp(h->magic, magic, sizeof(magic)) == 0 &&
+                h->version == version &&
+                h->crc == headerCrc(h) &&
+                h->bytesPerBlock == bytesPerBlock &&
+                (totalSize == 0 || h->totalSize == totalSize) &&
+                h->etagLength <= maxEtag &&
+                h->modifiedLength <= maxModified &&
+                length_ == headerSize + (blocks + 7) / 8)
+            {
+                ::close(fd);
+                totalSize_ = size_t(h->totalSize);
+                bytesPerBlock_ = bytesPerBlock;
+                blocks_ = blocks;
+                return true;
+            }
+
+            LOG(0, "part file %s is for another file, start again\n", path_.c_str());
+            close();
+        }
+        ::close(fd);
+    }
+
+    if (totalSize == 0)
+        return false;
+
+    fd = ::open(path_.c_str(), O_RDWR | O_CREAT | O_TRUNC, 0666);
+    if (fd == -1)
+    {
+        LOG(0, "create part file %s fail: %s\n", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    blocks_ = (totalSize + bytesPerBlock - 1) / bytesPerBlock;
+    size_t length = headerSize + (blocks_ + 7) / 8;
+    if (::ftruncate(fd, length) != 0 || !map(fd, length))
+    {
+        LOG(0, "map part file %s fail: %s\n", path_.c_str(), strerror(errno));
+        ::close(fd);
+        return false;
+    }
+    ::close(fd);
+
+    // bits are zero from ftruncate.
+    totalSize_ = totalSize;
+    bytesPerBlock_ = bytesPerBlock;
+    Header* h = header();
+    h->version = version;
+    h->totalSize = totalSize_;
+    h->bytesPerBlock = uint32_t(bytesPerBlock_);
+    memcpy(h->magic, magic, sizeof(magic));
+    h->crc = headerCrc(h);
+
+    return true;
+}
+
+uint32_t PartFile::headerCrc(const Header* h)
+{
+    return Utility::Crc32c::compute(h, offsetof(Header, crc));
+}
+
+bool PartFile::map(int fd, size_t length)
+{
+    void* p = ::mmap(NULL, length, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED)
+        return false;
+
+    map_ = p;
+    length_ = length;
+
+    return true;
+}
+
+void PartFile::close()
+{
+    if (map_ != NULL)
+    {
+        ::munmap(map_, length_);
+        map_ = NULL;
+        length_ = 0;
+    }
+}
+
+bool PartFile::remove()
+{
+    close();
+
+    return path_.length() == 0 || ::unlink(path_.c_str()) == 0;
+}
+
+std::string PartFile::etag()
+{
+    if (map_ == NULL)
+        return "";
+
+    return std::string(header()->etag, header()->etagLength);
+}
+
+std::string PartFile::lastModified()
+{
+    if (map_ == NULL)
+        return "";
+
+    return std::string(header()->modified, header()->modifiedLength);
+}
+
+void PartFile::setValidators(const std::string& etag, const std::string& lastModified)
+{
+    if (map_ == NULL)
+        return;
+
+    Header* h = header();
+    h->etagLength = (etag.length() <= maxEtag) ? uint32_t(etag.length()) : 0;
+    memcpy(h->etag, etag.data(), h->etagLength);
+    h->modifiedLength = (lastModified.length() <= maxModified) ? uint32_t(lastModified.length()) : 0;
+    memcpy(h->modified, lastModified.data(), h->modifiedLength);
+    h->crc = headerCrc(h);
+}
+
+void PartFile::setRange(size_t begin, size_t end, bool v)
+{
+    if (map_ == NULL)
+        return;
+
+    end = std::min(end, blocks_);
+    unsigned char* p = bits();
+    size_t i = begin;
+
+    for (; i < end && i % 8 != 0; ++i)
+        p[i / 8] = v ? (p[i / 8] | (1 << (i % 8))) : (p[i / 8] & ~(1 << (i % 8)));
+
+    if (i + 8 <= end)
+    {
+        size_t bytes = (end - i) / 8;
+        memset(p + i / 8, v ? 0xff : 0, bytes);
+        i += bytes * 8;
+    }
+
+    for (; i < end; ++i)
+        p[i / 8] = v ? (p[i / 8] | (1 << (i % 8))) : (p[i / 8] & ~(1 << (i % 8)));
+}
+
+bool PartFile::sync()
+{
+    return map_ != NULL && ::msync(map_, length_, MS_SYNC) == 0;
+}
+
+bool PartFile::load(BitMap& map)
+{
+    if (map_ == NULL || map.size() != blocks_)
+        return false;
+
+    const unsigned char* p = bits();
+    for (size_t i=0; i<blocks_; )
+    {
+        if (p[i / 8] == 0 && i % 8 == 0)
+        {
+            i += 8;
+            continue;
+        }
+
+        if ((p[i / 8] >> (i % 8)) & 1)
+            map.set(i, true);
+        ++i;
+    }
+
+    return true;
+}
@@ -0,0 +1,94 @@
+#ifndef PART_FILE_CLASS_HEAD
+#define PART_FILE_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+#include "BitMap.h"
+
+/**
+ * \brief Download bitmap kept in a small sidecar file mapped into memory.
+ *
+ * The file is a fixed header (total size, bytes per block, ETag and Last-Modified) and one
+ * bit per block. From version 3 the header carries a CRC-32C, so a sidecar with a torn or
+ * garbage header is started again, not taken as progress.
+ * Setting bits writes into the mapping, so state is saved with no serialization, and a
+ * killed process only loses what the page cache hasn't flushed.
+ */
+class PartFile
+{
+public:
+    static const uint32_t version = 3;
+    static const size_t headerSize = 256;
+    static const size_t maxEtag = 160;
+    static const size_t maxModified = 64;
+
+    PartFile();
+    ~PartFile();
+
+    /**
+     * \brief Map the sidecar, create it if it's missing or for another file.
+     *
+     * If totalSize is 0, total size is taken from an existing sidecar, and nothing is
+     * created without one.
+     */
+    bool open(const std::string& path, size_t totalSize, size_t bytesPerBlock);
+    bool isOpen()                { return map_ != NULL; }
+    void close();
+    bool remove();
+
+    size_t totalSize()           { return totalSize_; }
+    size_t blocks()              { return blocks_; }
+    std::string etag();
+    std::string lastModified();
+
+    /**
+     * \brief Keep validators of the file in header. Too long ones are not kept.
+     */
+    void setValidators(const std::string& etag, const std::string& lastModified);
+
+    void setRange(size_t begin, size_t end, bool v);
+
+    /**
+     * \brief Set downloaded blocks in map, which must have the same size.
+     */
+    bool load(BitMap& map);
+
+    /**
+     * \brief Wait until the mapping is written back.
+     */
+    bool sync();
+
+private:
+    struct Header
+    {
+        char magic[4];
+        uint32_t version;
+        uint64_t totalSize;
+        uint32_t bytesPerBlock;
+        uint32_t etagLength;
+        char etag[maxEtag];
+        uint32_t modifiedLength;
+        char modified[maxModified];
+        uint32_t crc;                   // of the fields above.
+    };
+
+    PartFile(const PartFile &);
+    const PartFile& operator=(const PartFile &);
+
+    bool map(int fd, size_t length);
+    static uint32_t headerCrc(const Header* h);
+    Header* header()             { return static_cast<Header*>(map_); }
+    unsigned char* bits()        { return static_cast<unsigned char*>(map_) + headerSize; }
+
+    std::string path_;
+    void* map_;
+    size_t length_;
+    size_t totalSize_;
+    size_t bytesPerBlock_;
+    size_t blocks_;
+};
+
+#endif
@@ -0,0 +1,139 @@
+#include "PieceHasher.h"
+
+#include "utility/Digest.h"
+#include "utility/File.h"
+#include "utility/ThreadPool.h"
+#include "utility/Utility.h"
+
+#include <algorithm>
+#include <memory>
+
+class PieceHasher::HashJob : public Utility::ThreadPool::Job
+{
+public:
+    HashJob(Utility::File& file, const std::string& type, PieceHasher::Pieces& pieces)
+        : file_(file),
+          type_(type),
+          pieces_(pieces)
+        {}
+
+    void run(size_t index)
+        {
+            PieceHasher::Piece& piece = pieces_[index];
+            piece.digest.clear();
+
+            std::auto_ptr<Utility::Digest> digest(Utility::Digest::create(type_));
+            if (digest.get() == NULL)
+                return;
+
+            char buffer[64 * 1024];
+            size_t done = 0;
+            while (done < piece.length)
+            {
+                ssize_t ret = file_.readAt(buffer,
+                                           std::min(piece.length - done, sizeof(buffer)),
+                                           piece.begin + done);
+                if (ret <= 0)
+                    return;
+
+                digest->update(buffer, ret);
+                done += ret;
+            }
+
+            piece.digest = digest->hexFinal();
+        }
+
+private:
+    Utility::File& file_;
+    const std::string& type_;
+    PieceHasher::Pieces& pieces_;
+};
+
+bool PieceHasher::hash(const std::string& path,
+                       const std::string& type,
+                       Pieces& pieces,
+                       Utility::ThreadPool& pool)
+{
+    std::auto_ptr<Utility::Digest> probe(Utility::Digest::create(type));
+    if (probe.get() == NULL)
+        return false;
+
+    Utility::File file;
+    if (!file.open(path.c_str(), Utility::File::OF_Read))
+    {
+        LOG(0, "open %s for hash fail: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    HashJob job(file, type, pieces);
+    pool.run(job, pieces.size());
+    file.close();
+
+    return true;
+}
+
+PieceHasher::PieceHasher()
+    : job_(NULL),
+      pool_(NULL)
+{}
+
+PieceHasher::~PieceHasher()
+{
+    cancel();
+}
+
+bool PieceHasher::start(const std::string& path,
+                        const std::string& type,
+                        const Pieces& pieces,
+                        Utility::ThreadPool& pool)
+{
+    cancel();
+
+    std::auto_ptr<Utility::Digest> probe(Utility::Digest::create(type));
+    if (probe.get() == NULL)
+        return false;
+
+    if (!file_.open(path.c_str(), Utility::File::OF_Read))
+    {
+        LOG(0, "open %s for hash fail: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    type_ = type;
+    pieces_ = pieces;
+    pool_ = &pool;
+    job_ = new HashJob(file_, type_, pieces_);
+    pool.start(*job_, pieces_.size());
+
+    return true;
+}
+
+bool PieceHasher::done()
+{
+    return job_ != NULL && pool_->done(*job_);
+}
+
+void PieceHasher::take(Pieces& pieces)
+{
+    pieces.clear();
+    if (job_ == NULL)
+        return;
+
+    pool_->wait(*job_);
+    pieces.swap(pieces_);
+    cancel();
+}
+
+void PieceHasher::cancel()
+{
+    if (job_ == NULL)
+        return;
+
+    // workers may still read pieces, let them finish.
+    pool_->wait(*job_);
+    delete job_;
+    job_ = NULL;
+    pool_ = NULL;
+    pieces_.clear();
+    file_.close();
+}
@@ -0,0 +1,84 @@
+#ifndef PIECE_HASHER_CLASS_HEAD
+#define PIECE_HASHER_CLASS_HEAD
+
+#include <stddef.h>
+
+#include <string>
+#include <vector>
+
+#include "utility/File.h"
+
+namespace Utility
+{
+class ThreadPool;
+}
+
+/**
+ * \brief Hash ranges of a file on a thread pool.
+ *
+ * Every range is read with its own positional reads and hashed by its own digest, so
+ * ranges are hashed in parallel while the file is still written by others.
+ *
+ * hash() waits for all of them. An instance hashes them in background instead, its owner
+ * polls done() and takes the digests.
+ */
+class PieceHasher
+{
+public:
+    struct Piece
+    {
+        size_t index;                   // caller's piece number.
+        size_t begin;
+        size_t length;
+        std::string digest;             // lower case hex, empty if it can't be read.
+
+        Piece(size_t i, size_t b, size_t l)
+            : index(i),
+              begin(b),
+              length(l)
+            {}
+    };
+    typedef std::vector<Piece> Pieces;
+
+    /**
+     * \brief Set digest of every piece, false if the file can't be opened or type is unknown.
+     */
+    static bool hash(const std::string& path,
+                     const std::string& type,
+                     Pieces& pieces,
+                     Utility::ThreadPool& pool);
+
+    PieceHasher();
+    ~PieceHasher();
+
+    /**
+     * \brief Start hashing pieces in background, false if the file can't be opened or type is unknown.
+     */
+    bool start(const std::string& path,
+               const std::string& type,
+               const Pieces& pieces,
+               Utility::ThreadPool& pool);
+
+    bool started()                      { return job_ != NULL; }
+    bool done();
+
+    /**
+     * \brief Wait for pieces started, and take them with their digests.
+     */
+    void take(Pieces& pieces);
+    void cancel();
+
+private:
+    PieceHasher(const PieceHasher &);
+    const PieceHasher& operator=(const PieceHasher &);
+
+    class HashJob;
+
+    Utility::File file_;
+    std::string type_;
+    Pieces pieces_;
+    HashJob* job_;
+    Utility::ThreadPool* pool_;
+};
+
+#endif
@@ -0,0 +1,95 @@
+#include "RangeSet.h"
+
+#include <algorithm>
+
+namespace
+{
+
+bool endsBefore(const RangeSet::Range& range, size_t pos)
+{
+    return range.second < pos;
+}
+
+}
+
+RangeSet::Range RangeSet::add(size_t begin, size_t end)
+{
+    if (begin >= end)
+        return Range(begin, begin);
+
+    // ranges which touch [begin, end) are merged into it.
+    Ranges::iterator first = std::lower_bound(ranges_.begin(), ranges_.end(), begin, endsBefore);
+    Ranges::iterator last = first;
+    while (last != ranges_.end() && last->first <= end)
+    {
+        begin = std::min(begin, last->first);
+        end = std::max(end, last->second);
+        ++last;
+    }
+
+    first = ranges_.erase(first, last);
+    ranges_.insert(first, Range(begin, end));
+
+    return Range(begin, end);
+}
+
+void RangeSet::remove(size_t begin, size_t end)
+{
+    if (begin >= end)
+        return;
+
+    Ranges::iterator first = std::lower_bound(ranges_.begin(), ranges_.end(), begin + 1, endsBefore);
+    Ranges::iterator last = first;
+    Ranges kept;
+    while (last != ranges_.end() && last->first < end)
+    {
+        if (last->first < begin)
+            kept.push_back(Range(last->first, begin));
+        if (last->second > end)
+            kept.push_back(Range(end, last->second));
+        ++last;
+    }
+
+    first = ranges_.erase(first, last);
+    ranges_.insert(first, kept.begin(), kept.end());
+}
+
+bool RangeSet::contains(size_t begin, size_t end) const
+{
+    Ranges::const_iterator it = std::lower_bound(ranges_.begin(), ranges_.end(), begin + 1, endsBefore);
+    return it != ranges_.end() && it->first <= begin && end <= it->second;
+}
+
+RangeSet::Ranges RangeSet::missing(size_t begin, size_t end) const
+{
+    Ranges ret;
+    Ranges::const_iterator it = std::lower_bound(ranges_.begin(), ranges_.end(), begin + 1, endsBefore);
+    while (begin < end)
+    {
+        if (it == ranges_.end() || it->first >= end)
+        {
+            ret.push_back(Range(begin, end));
+            break;
+        }
+
+        if (it->first > begin)
+            ret.push_back(Range(begin, it->first));
+        begin = std::max(begin, it->second);
+        ++it;
+    }
+
+    return ret;
+}
+
+size_t RangeSet::prefix() const
+{
+    return (ranges_.size() > 0 && ranges_[0].first == 0) ? ranges_[0].second : 0;
+}
+
+size_t RangeSet::bytes() const
+{
+    size_t n = 0;
+    for (size_t i=0; i<ranges_.size(); ++i)
+        n += ranges_[i].second - ranges_[i].first;
+    return n;
+}
@@ -0,0 +1,48 @@
+#ifndef RANGE_SET_CLASS_HEAD
+#define RANGE_SET_CLASS_HEAD
+
+#include <stddef.h>
+
+#include <utility>
+#include <vector>
+
+/**
+ * \brief Sorted and merged byte ranges [begin, end) of a file.
+ *
+ * BitMap rounds a range to blocks, this keeps bytes exactly, so a block which is only
+ * partly written is never taken as done.
+ */
+class RangeSet
+{
+public:
+    typedef std::pair<size_t, size_t> Range;
+    typedef std::vector<Range> Ranges;
+
+    const Ranges& ranges() const        { return ranges_; }
+    bool empty() const                  { return ranges_.empty(); }
+    void clear()                        { ranges_.clear(); }
+
+    /**
+     * \brief Add [begin, end), \return the merged range which holds it now.
+     */
+    Range add(size_t begin, size_t end);
+    void remove(size_t begin, size_t end);
+
+    bool contains(size_t begin, size_t end) const;
+
+    /**
+     * \brief Parts of [begin, end) which are not in the set, in order.
+     */
+    Ranges missing(size_t begin, size_t end) const;
+
+    /**
+     * \brief End of the range from byte 0, 0 if byte 0 is not in.
+     */
+    size_t prefix() const;
+    size_t bytes() const;
+
+private:
+    Ranges ranges_;
+};
+
+#endif
@@ -0,0 +1,369 @@
+#include "ResumeJournal.h"
+
+#include "utility/Crc32c.h"
+#include "utility/Utility.h"
+
+#include <stdio.h>
+#include <string.h>
+
+#include <algorithm>
+
+namespace
+{
+
+const char magic[4] = { 'H', 'T', 'J', '1' };
+const size_t minCompact = 1024;
+
+// what a record keeps.
+enum RecordKind
+{
+    RK_RANGE,               // [begin, end) downloaded.
+    RK_CRC,                 // check block index and its CRC.
+};
+
+void put32(unsigned char* p, uint32_t v)
+{
+    for (int i=0; i<4; ++i)
+        p[i] = (v >> (i * 8)) & 0xff;
+}
+
+void put64(unsigned char* p, uint64_t v)
+{
+    for (int i=0; i<8; ++i)
+        p[i] = (v >> (i * 8)) & 0xff;
+}
+
+uint32_t get32(const unsigned char* p)
+{
+    uint32_t v = 0;
+    for (int i=3; i>=0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+uint64_t get64(const unsigned char* p)
+{
+    uint64_t v = 0;
+    for (int i=7; i>=0; --i)
+        v = (v << 8) | p[i];
+    return v;
+}
+
+/**
+ * Whether [begin, end) is in one of sorted, merged ranges.
+ */
+bool covered(const ResumeJournal::Ranges& ranges, size_t begin, size_t end)
+{
+    ResumeJournal::Ranges::const_iterator it =
+        std::upper_bound(ranges.begin(), ranges.end(), std::make_pair(begin, size_t(-1)));
+    if (it == ranges.begin())
+        return false;
+
+    --it;
+    return it->first <= begin && end <= it->second;
+}
+
+/**
+ * Ranges sorted and merged, as records in the log may overlap.
+ */
+ResumeJournal::Ranges merged(ResumeJournal::Ranges ranges)
+{
+    std::sort(ranges.begin(), ranges.end());
+
+    ResumeJournal::Ranges ret;
+    for (size_t i=0; i<ranges.size(); ++i)
+    {
+        if (ret.size() > 0 && ranges[i].first <= ret.back().second)
+            ret.back().second = std::max(ret.back().second, ranges[i].second);
+        else
+            ret.push_back(ranges[i]);
+    }
+
+    return ret;
+}
+
+}
+
+ResumeJournal::ResumeJournal()
+    : totalSize_(0),
+      bytesPerBlock_(0),
+      records_(0),
+      compactAt_(minCompact)
+{}
+
+ResumeJournal::~ResumeJournal()
+{
+    close();
+}
+
+bool ResumeJournal::open(const std::string& path, size_t totalSize, size_t bytesPerBlock)
+{
+    close();
+    path_ = path;
+
+    if (replay(totalSize, bytesPerBlock))
+        return openAppend();
+
+    ranges_.clear();
+    crcs_.clear();
+    if (totalSize == 0)
+        return false;
+
+    totalSize_ = totalSize;
+    bytesPerBlock_ = bytesPerBlock;
+    etag_.clear();
+    lastModified_.clear();
+    return create(path_, ranges_, crcs_) && openAppend();
+}
+
+void ResumeJournal::close()
+{
+    if (file_.isOpen())
+        file_.close();
+}
+
+bool ResumeJournal::remove()
+{
+    close();
+    ranges_.clear();
+    crcs_.clear();
+    records_ = 0;
+
+    return path_.length() == 0 || Utility::File::remove(path_.c_str());
+}
+
+/**
+ * Read the journal into ranges_, and cut off a torn record at its end.
+ */
+bool ResumeJournal::replay(size_t totalSize, size_t bytesPerBlock)
+{
+    ranges_.clear();
+    crcs_.clear();
+    records_ = 0;
+
+    Utility::File in;
+    if (!in.open(path_.c_str(), Utility::File::OF_Read))
+        return false;
+
+    unsigned char header[headerSize];
+    if (in.read(header, headerSize) != ssize_t(headerSize) ||
+        memcmp(header, magic, sizeof(magic)) != 0 ||
+        get32(header + 4) != version ||
+        get32(header + 252) != Utility::Crc32c::compute(header, 252))
+    {
+        LOG(0, "bad journal header in %s\n", path_.c_str());
+        return false;
+    }
+
+    size_t total = size_t(get64(header + 8));
+    if ((totalSize != 0 && total != totalSize) || get32(header + 16) != bytesPerBlock)
+    {
+        LOG(0, "journal %s is for another file, start again\n", path_.c_str());
+        return false;
+    }
+    totalSize_ = total;
+    bytesPerBlock_ = bytesPerBlock;
+
+    size_t etagLength = header[20] | (header[21] << 8);
+    size_t modifiedLength = header[22] | (header[23] << 8);
+    if (etagLength + modifiedLength > maxValidators)
+        etagLength = modifiedLength = 0;
+    etag_.assign(reinterpret_cast<char*>(header + 24), etagLength);
+    lastModified_.assign(reinterpret_cast<char*>(header + 24 + etagLength), modifiedLength);
+
+    size_t valid = headerSize;
+    unsigned char buffer[recordSize * 256];
+    ssize_t got;
+    bool torn = false;
+    while (!torn && (got = in.read(buffer, sizeof(buffer))) > 0)
+    {
+        for (ssize_t off = 0; off < got; off += recordSize)
+        {
+            const unsigned char* record = buffer + off;
+            if (got - off < ssize_t(recordSize) ||
+                get32(record + 20) != Utility::Crc32c::compute(record, 20))
+            {
+                torn = true;
+                break;
+            }
+
+            uint32_t kind = get32(record);
+            uint64_t a = get64(record + 4);
+            uint64_t b = get64(record + 12);
+            if (kind == RK_RANGE && a < b && b <= totalSize_)
+                ranges_.push_back(std::make_pair(size_t(a), size_t(b)));
+            else if (kind == RK_CRC)
+                crcs_[size_t(a)] = uint32_t(b);      // a block downloaded again has a newer one.
+            ++records_;
+            valid += recordSize;
+        }
+    }
+    in.close();
+
+    if (torn)
+    {
+        LOG(0, "journal %s has a torn record at %lu\n", path_.c_str(), valid);
+        Utility::File::resize(path_.c_str(), valid);
+    }
+
+    compactAt_ = std::max(minCompact, records_ * 2);
+
+    return true;
+}
+
+size_t ResumeJournal::crcBlockSize()
+{
+    if (bytesPerBlock_ == 0)
+        return crcSpan;
+
+    return (crcSpan + bytesPerBlock_ - 1) / bytesPerBlock_ * bytesPerBlock_;
+}
+
+bool ResumeJournal::append(const Ranges& ranges, const Crcs& crcs)
+{
+    if (!file_.isOpen() || ranges.size() + crcs.size() == 0)
+        return false;
+
+    // CRCs after ranges, a torn append never leaves a CRC of data it doesn't claim.
+    std::vector<unsigned char> buffer((ranges.size() + crcs.size()) * recordSize);
+    unsigned char* p = &buffer[0];
+    for (size_t i=0; i<ranges.size(); ++i, p += recordSize)
+        makeRecord(RK_RANGE, ranges[i].first, ranges[i].second, p);
+    for (Crcs::const_iterator it = crcs.begin(); it != crcs.end(); ++it, p += recordSize)
+        makeRecord(RK_CRC, it->first, it->second, p);
+
+    if (file_.write(&buffer[0], buffer.size()) != ssize_t(buffer.size()))
+    {
+        LOG(0, "append journal %s fail: %s\n", path_.c_str(), strerror(errno));
+        return false;
+    }
+
+    ranges_.insert(ranges_.end(), ranges.begin(), ranges.end());
+    for (Crcs::const_iterator it = crcs.begin(); it != crcs.end(); ++it)
+        crcs_[it->first] = it->second;
+    records_ += ranges.size() + crcs.size();
+
+    return true;
+}
+
+bool ResumeJournal::setValidators(const std::string& etag, const std::string& lastModified)
+{
+    etag_ = (etag.length() <= maxValidators) ? etag : "";
+    lastModified_ = (etag_.length() + lastModified.length() <= maxValidators) ? lastModified : "";
+
+    if (!file_.isOpen())
+        return false;
+
+    // header isn't written in place, a torn write would lose all ranges with it.
+    Crcs crcs(crcs_);
+    return replace(merged(ranges_), crcs);
+}
+
+bool ResumeJournal::compact(const Ranges& done)
+{
+    if (path_.length() == 0)
+        return false;
+
+    Crcs kept;
+    size_t span = crcBlockSize();
+    for (Crcs::const_iterator it = crcs_.begin(); it != crcs_.end(); ++it)
+    {
+        size_t begin = it->first * span;
+        if (covered(done, begin, std::min(begin + span, totalSize_)))
+            kept.insert(kept.end(), *it);
+    }
+
+    return replace(done, kept);
+}
+
+/**
+ * Write a new journal of ranges and crcs to a temporary file, and rename it over the old
+ * one. Either of them is found after a crash, never a mix.
+ */
+bool ResumeJournal::replace(const Ranges& ranges, Crcs& crcs)
+{
+    std::string temp = path_ + ".tmp";
+    if (!create(temp, ranges, crcs))
+        return false;
+
+    close();
+    if (::rename(temp.c_str(), path_.c_str()) != 0)
+    {
+        LOG(0, "rename journal %s fail: %s\n", temp.c_str(), strerror(errno));
+        Utility::File::remove(temp.c_str());
+        return openAppend();
+    }
+
+    // the rename itself is in the directory, it's lost in a crash until that is synced.
+    if (!Utility::File::syncDir(path_.c_str()))
+        LOG(0, "sync directory of journal %s fail: %s\n", path_.c_str(), strerror(errno));
+
+    ranges_ = ranges;
+    crcs_.swap(crcs);
+    records_ = ranges_.size() + crcs_.size();
+    compactAt_ = std::max(minCompact, records_ * 2);
+
+    return openAppend();
+}
+
+bool ResumeJournal::create(const std::string& path, const Ranges& ranges, const Crcs& crcs)
+{
+    Utility::File out;
+    if (!out.open(path.c_str(),
+                  Utility::File::OF_Write | Utility::File::OF_Create | Utility::File::OF_Truncate))
+    {
+        LOG(0, "create journal %s fail: %s\n", path.c_str(), strerror(errno));
+        return false;
+    }
+
+    std::vector<unsigned char> buffer(headerSize + (ranges.size() + crcs.size()) * recordSize);
+    makeHeader(&buffer[0]);
+    unsigned char* p = &buffer[headerSize];
+    for (size_t i=0; i<ranges.size(); ++i, p += recordSize)
+        makeRecord(RK_RANGE, ranges[i].first, ranges[i].second, p);
+    for (Crcs::const_iterator it = crcs.begin(); it != crcs.end(); ++it, p += recordSize)
+        makeRecord(RK_CRC, it->first, it->second, p);
+
+    // on disk before it's renamed over the old one.
+    bool ret = (out.write(&buffer[0], buffer.size()) == ssize_t(buffer.size())) && out.sync();
+    out.close();
+
+    return ret;
+}
+
+bool ResumeJournal::openAppend()
+{
+    if (!file_.open(path_.c_str(), Utility::File::OF_Write) ||
+        !file_.seek(0, Utility::File::SF_FromEnd))
+    {
+        LOG(0, "open journal %s fail: %s\n", path_.c_str(), strerror(errno));
+        close();
+        return false;
+    }
+
+    return true;
+}
+
+void ResumeJournal::makeHeader(unsigned char* buffer)
+{
+    memset(buffer, 0, headerSize);
+    memcpy(buffer, magic, sizeof(magic));
+    put32(buffer + 4, version);
+    put64(buffer + 8, totalSize_);
+    put32(buffer + 16, uint32_t(bytesPerBlock_));
+    buffer[20] = etag_.length() & 0xff;
+    buffer[21] = (etag_.length() >> 8) & 0xff;
+    buffer[22] = lastModified_.length() & 0xff;
+    buffer[23] = (lastModified_.length() >> 8) & 0xff;
+    memcpy(buffer + 24, etag_.data(), etag_.length());
+    memcpy(buffer + 24 + etag_.length(), lastModified_.data(), lastModified_.length());
+    put32(buffer + 252, Utility::Crc32c::compute(buffer, 252));
+}
+
+void ResumeJournal::makeRecord(uint32_t kind, uint64_t a, uint64_t b, unsigned char* buffer)
+{
+    put32(buffer, kind);
+    put64(buffer + 4, a);
+    put64(buffer + 12, b);
+    put32(buffer + 20, Utility::Crc32c::compute(buffer, 20));
+}
@@ -0,0 +1,105 @@
+#ifndef RESUME_JOURNAL_CLASS_HEAD
+#define RESUME_JOURNAL_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <map>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include "utility/File.h"
+
+/**
+ * \brief Append-only log of downloaded byte ranges of a task, for resume.
+ *
+ * The file is a header (magic, version, total size, bytes per block, ETag and Last-Modified
+ * of the file) followed by fixed size records of [begin, end). Header and every record carry a CRC-32C, so a record torn
+ * by a crash is found and cut off on open. Saving costs only the new ranges, and compact()
+ * rewrites the log from the merged ranges when records pile up.
+ *
+ * From version 3 a record may instead keep the CRC-32C of a check block, crcBlockSize()
+ * bytes of the file, so data which went bad on disk is found when the task resumes.
+ */
+class ResumeJournal
+{
+public:
+    typedef std::vector<std::pair<size_t, size_t> > Ranges;
+    typedef std::map<size_t, uint32_t> Crcs;     // check block index to its CRC-32C.
+
+    static const uint32_t version = 3;
+    static const size_t headerSize = 256;
+    static const size_t recordSize = 24;
+    static const size_t crcSpan = 1024 * 1024;
+    static const size_t maxValidators = 228;
+
+    ResumeJournal();
+    ~ResumeJournal();
+
+    /**
+     * \brief Open journal for append, and replay ranges in it.
+     *
+     * A journal of other total size or block size is started again. If totalSize is 0,
+     * total size is taken from an existing journal, and nothing is created without one.
+     */
+    bool open(const std::string& path, size_t totalSize, size_t bytesPerBlock);
+    bool isOpen()                { return file_.isOpen(); }
+    void close();
+    bool remove();
+
+    size_t totalSize()           { return totalSize_; }
+    const Ranges& ranges()       { return ranges_; }
+    const Crcs& crcs()           { return crcs_; }
+    size_t records()             { return records_; }
+    const std::string& etag()         { return etag_; }
+    const std::string& lastModified() { return lastModified_; }
+
+    /**
+     * \brief Keep validators of the file in header. Too long ones are not kept.
+     *
+     * The journal is rewritten with the new header like compact(), so a crash leaves the
+     * old journal or the new one.
+     */
+    bool setValidators(const std::string& etag, const std::string& lastModified);
+
+    /**
+     * \brief Bytes in a check block, crcSpan rounded up to whole blocks.
+     */
+    size_t crcBlockSize();
+
+    bool append(const Ranges& ranges, const Crcs& crcs = Crcs());
+    bool sync()                  { return file_.isOpen() && file_.sync(); }
+
+    /**
+     * \brief Rewrite journal as done ranges, through a temporary file and rename.
+     *
+     * done must be sorted. CRCs are kept for check blocks which are still all done.
+     */
+    bool compact(const Ranges& done);
+    bool needCompact()           { return records_ >= compactAt_; }
+
+private:
+    ResumeJournal(const ResumeJournal &);
+    const ResumeJournal& operator=(const ResumeJournal &);
+
+    bool replay(size_t totalSize, size_t bytesPerBlock);
+    bool create(const std::string& path, const Ranges& ranges, const Crcs& crcs);
+    bool replace(const Ranges& ranges, Crcs& crcs);
+    bool openAppend();
+    void makeHeader(unsigned char* buffer);
+    static void makeRecord(uint32_t kind, uint64_t a, uint64_t b, unsigned char* buffer);
+
+    Utility::File file_;
+    std::string path_;
+    size_t totalSize_;
+    size_t bytesPerBlock_;
+    std::string etag_;
+    std::string lastModified_;
+    Ranges ranges_;
+    Crcs crcs_;
+    size_t records_;
+    size_t compactAt_;
+};
+
+#endif
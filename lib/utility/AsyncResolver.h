@@ -0,0 +1,190 @@
+#ifndef ASYNC_RESOLVER_CLASS_HEAD
+#define ASYNC_RESOLVER_CLASS_HEAD
+
+#include <stddef.h>
+#include <string.h>
+#include <netdb.h>
+#include <pthread.h>
+#include <sys/socket.h>
+
+#include <string>
+#include <vector>
+
+namespace Utility
+{
+
+/**
+ * \brief Resolve a host name on a thread of its own, polled by the caller.
+ *
+ * getaddrinfo blocks as long as DNS takes, so it never runs on the caller's thread. A lookup
+ * dropped by cancel() or the destructor is left to its thread, which frees it when
+ * getaddrinfo returns.
+ */
+class AsyncResolver
+{
+public:
+    AsyncResolver()
+        : lookup_(NULL)
+        {}
+
+    ~AsyncResolver()                    { cancel(); }
+
+    /**
+     * \brief Start looking up name, false if no thread can be started.
+     */
+    bool start(const std::string& name);
+    void cancel();
+
+    bool started()                      { return lookup_ != NULL; }
+    bool done();
+
+    /**
+     * \brief Numeric addresses in resolver order, once done, \return false if lookup failed.
+     */
+    bool addresses(std::vector<std::string>& addresses, std::string& error);
+
+private:
+    AsyncResolver(const AsyncResolver &);
+    const AsyncResolver& operator=(const AsyncResolver &);
+
+    struct Lookup
+    {
+        pthread_mutex_t mutex;
+        std::string name;
+        std::vector<std::string> addresses;
+        int error;
+        bool done;
+        int refs;                       // resolver and thread.
+    };
+
+    static void* resolve(void* arg);
+    static void release(Lookup* lookup);
+
+    Lookup* lookup_;
+};
+
+inline bool AsyncResolver::start(const std::string& name)
+{
+    cancel();
+
+    Lookup* lookup = new Lookup;
+    ::pthread_mutex_init(&lookup->mutex, NULL);
+    lookup->name = name;
+    lookup->error = 0;
+    lookup->done = false;
+    lookup->refs = 2;
+
+    pthread_attr_t attr;
+    ::pthread_attr_init(&attr);
+    ::pthread_attr_setdetachstate(&attr, PTHREAD_CREATE_DETACHED);
+    pthread_t thread;
+    int ret = ::pthread_create(&thread, &attr, &AsyncResolver::resolve, lookup);
+    ::pthread_attr_destroy(&attr);
+    if (ret != 0)
+    {
+        ::pthread_mutex_destroy(&lookup->mutex);
+        delete lookup;
+        return false;
+    }
+
+    lookup_ = lookup;
+    return true;
+}
+
+inline void AsyncResolver::cancel()
+{
+    if (lookup_ == NULL)
+        return;
+
+    release(lookup_);
+    lookup_ = NULL;
+}
+
+inline bool AsyncResolver::done()
+{
+    if (lookup_ == NULL)
+        return false;
+
+    ::pthread_mutex_lock(&lookup_->mutex);
+    bool done = lookup_->done;
+    ::pthread_mutex_unlock(&lookup_->mutex);
+    return done;
+}
+
+inline bool AsyncResolver::addresses(std::vector<std::string>& addresses, std::string& error)
+{
+    addresses.clear();
+    error.clear();
+    if (!done())
+        return false;
+
+    // thread is done with the lookup, it's not changed any more.
+    if (lookup_->error != 0)
+    {
+        error = ::gai_strerror(lookup_->error);
+        return false;
+    }
+
+    addresses = lookup_->addresses;
+    return true;
+}
+
+inline void* AsyncResolver::resolve(void* arg)
+{
+    Lookup* lookup = static_cast<Lookup*>(arg);
+
+    struct addrinfo hints;
+    memset(&hints, 0, sizeof(hints));
+    hints.ai_family = AF_UNSPEC;
+    hints.ai_socktype = SOCK_STREAM;
+
+    std::vector<std::string> addresses;
+    struct addrinfo* result = NULL;
+    int ret = ::getaddrinfo(lookup->name.c_str(), NULL, &hints, &result);
+    if (ret == 0)
+    {
+        for (struct addrinfo* ai = result; ai != NULL; ai = ai->ai_next)
+        {
+            char ip[NI_MAXHOST];
+            if (::getnameinfo(ai->ai_addr, ai->ai_addrlen, ip, sizeof(ip), NULL, 0,
+                              NI_NUMERICHOST) != 0)
+                continue;
+
+            bool found = false;
+            for (size_t i=0; i<addresses.size(); ++i)
+            {
+                if (addresses[i] == ip)
+                    found = true;
+            }
+            if (!found)
+                addresses.push_back(ip);
+        }
+        ::freeaddrinfo(result);
+    }
+
+    ::pthread_mutex_lock(&lookup->mutex);
+    lookup->addresses.swap(addresses);
+    lookup->error = ret;
+    lookup->done = true;
+    ::pthread_mutex_unlock(&lookup->mutex);
+
+    release(lookup);
+    return NULL;
+}
+
+inline void AsyncResolver::release(Lookup* lookup)
+{
+    ::pthread_mutex_lock(&lookup->mutex);
+    bool last = (--lookup->refs == 0);
+    ::pthread_mutex_unlock(&lookup->mutex);
+
+    if (last)
+    {
+        ::pthread_mutex_destroy(&lookup->mutex);
+        delete lookup;
+    }
+}
+
+}
+
+#endif
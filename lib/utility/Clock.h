@@ -0,0 +1,30 @@
+#ifndef CLOCK_CLASS_HEAD
+#define CLOCK_CLASS_HEAD
+
+#include <time.h>
+
+namespace Utility
+{
+
+class Clock
+{
+public:
+    typedef unsigned long long Ms;
+
+    static Ms now();
+};
+
+/**
+ * \brief Milliseconds from an unspecified point, never goes back.
+ */
+inline Clock::Ms Clock::now()
+{
+    struct timespec ts;
+    ::clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return Ms(ts.tv_sec) * 1000 + ts.tv_nsec / 1000000;
+}
+
+}
+
+#endif
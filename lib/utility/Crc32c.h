@@ -0,0 +1,237 @@
+#ifndef CRC32C_CLASS_HEAD
+#define CRC32C_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+#include <string.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CRC32C_SSE42
+#include <nmmintrin.h>
+#endif
+
+namespace Utility
+{
+
+/**
+ * \brief CRC-32C (Castagnoli), the checksum of iSCSI and ext4.
+ *
+ * Chain calls by passing the last result as crc, start with 0. CRCs of adjacent parts
+ * computed apart are joined by combine().
+ *
+ * update() uses the SSE4.2 crc32 instruction when the processor has it, checked once at
+ * run time, and tables of slice-by-8 otherwise.
+ */
+class Crc32c
+{
+public:
+    static uint32_t compute(const void* data, size_t len);
+    static uint32_t update(uint32_t crc, const void* data, size_t len);
+
+    /**
+     * \brief Same as update(), always with tables.
+     */
+    static uint32_t updateTable(uint32_t crc, const void* data, size_t len);
+
+    /**
+     * \brief Whether update() uses the crc32 instruction.
+     */
+    static bool hardware();
+
+    /**
+     * \brief CRC of A followed by B, from crc1 of A, crc2 of B and len2 the length of B.
+     */
+    static uint32_t combine(uint32_t crc1, uint32_t crc2, uint64_t len2);
+
+private:
+    // t[k][b] is the CRC of byte b followed by k zero bytes.
+    struct Table
+    {
+        uint32_t t[8][256];
+
+        Table();
+    };
+
+    static const Table& table();
+
+#ifdef CRC32C_SSE42
+    static uint32_t updateSse42(uint32_t crc, const unsigned char* p, size_t len)
+        __attribute__((target("sse4.2")));
+#endif
+
+    static uint32_t gf2Times(const uint32_t* mat, uint32_t vec);
+    static void gf2Square(uint32_t* square, const uint32_t* mat);
+};
+
+inline Crc32c::Table::Table()
+{
+    for (uint32_t i=0; i<256; ++i)
+    {
+        uint32_t c = i;
+        for (int k=0; k<8; ++k)
+            c = (c & 1) ? (c >> 1) ^ 0x82F63B78 : (c >> 1);
+        t[0][i] = c;
+    }
+
+    for (int k=1; k<8; ++k)
+    {
+        for (uint32_t i=0; i<256; ++i)
+            t[k][i] = (t[k - 1][i] >> 8) ^ t[0][t[k - 1][i] & 0xff];
+    }
+}
+
+inline const Crc32c::Table& Crc32c::table()
+{
+    static Table table;
+    return table;
+}
+
+inline bool Crc32c::hardware()
+{
+#ifdef CRC32C_SSE42
+    static bool has = (__builtin_cpu_init(), __builtin_cpu_supports("sse4.2") != 0);
+    return has;
+#else
+    return false;
+#endif
+}
+
+inline uint32_t Crc32c::compute(const void* data, size_t len)
+{
+    return update(0, data, len);
+}
+
+inline uint32_t Crc32c::update(uint32_t crc, const void* data, size_t len)
+{
+#ifdef CRC32C_SSE42
+    if (hardware())
+        return ~updateSse42(~crc, static_cast<const unsigned char*>(data), len);
+#endif
+
+    return updateTable(crc, data, len);
+}
+
+/**
+ * Eight bytes a round, each looked up in its own table. Bytes are put together by
+ * shifts, so it doesn't matter how data is aligned or the byte order of the processor.
+ */
+inline uint32_t Crc32c::updateTable(uint32_t crc, const void* data, size_t len)
+{
+    const uint32_t (*t)[256] = table().t;
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+
+    crc = ~crc;
+    while (len >= 8)
+    {
+        uint32_t lo = crc ^ (p[0] | (p[1] << 8) | (p[2] << 16) | (uint32_t(p[3]) << 24));
+        crc = t[7][lo & 0xff] ^ t[6][(lo >> 8) & 0xff] ^
+            t[5][(lo >> 16) & 0xff] ^ t[4][lo >> 24] ^
+            t[3][p[4]] ^ t[2][p[5]] ^ t[1][p[6]] ^ t[0][p[7]];
+        p += 8;
+        len -= 8;
+    }
+
+    while (len-- > 0)
+        crc = t[0][(crc ^ *p++) & 0xff] ^ (crc >> 8);
+
+    return ~crc;
+}
+
+#ifdef CRC32C_SSE42
+inline uint32_t Crc32c::updateSse42(uint32_t crc, const unsigned char* p, size_t len)
+{
+#ifdef __x86_64__
+    uint64_t c = crc;
+    while (len >= 8)
+    {
+        uint64_t v;
+        memcpy(&v, p, 8);
+        c = _mm_crc32_u64(c, v);
+        p += 8;
+        len -= 8;
+    }
+    crc = uint32_t(c);
+#endif
+
+    while (len >= 4)
+    {
+        uint32_t v;
+        memcpy(&v, p, 4);
+        crc = _mm_crc32_u32(crc, v);
+        p += 4;
+        len -= 4;
+    }
+
+    while (len-- > 0)
+        crc = _mm_crc32_u8(crc, *p++);
+
+    return crc;
+}
+#endif
+
+inline uint32_t Crc32c::gf2Times(const uint32_t* mat, uint32_t vec)
+{
+    uint32_t sum = 0;
+    for (; vec != 0; vec >>= 1, ++mat)
+    {
+        if (vec & 1)
+            sum ^= *mat;
+    }
+    return sum;
+}
+
+inline void Crc32c::gf2Square(uint32_t* square, const uint32_t* mat)
+{
+    for (int n=0; n<32; ++n)
+        square[n] = gf2Times(mat, mat[n]);
+}
+
+/**
+ * Same as zlib's crc32_combine(): crc1 is shifted by len2 zero bytes with an operator
+ * squared for every bit of len2, so it costs O(log len2), not O(len2).
+ */
+inline uint32_t Crc32c::combine(uint32_t crc1, uint32_t crc2, uint64_t len2)
+{
+    if (len2 == 0)
+        return crc1;
+
+    uint32_t even[32];
+    uint32_t odd[32];
+
+    // operator for one zero bit.
+    odd[0] = 0x82F63B78;
+    uint32_t row = 1;
+    for (int n=1; n<32; ++n)
+    {
+        odd[n] = row;
+        row <<= 1;
+    }
+
+    // two, then four zero bits.
+    gf2Square(even, odd);
+    gf2Square(odd, even);
+
+    for (;;)
+    {
+        // first square gives the operator for one zero byte.
+        gf2Square(even, odd);
+        if (len2 & 1)
+            crc1 = gf2Times(even, crc1);
+        len2 >>= 1;
+        if (len2 == 0)
+            break;
+
+        gf2Square(odd, even);
+        if (len2 & 1)
+            crc1 = gf2Times(odd, crc1);
+        len2 >>= 1;
+        if (len2 == 0)
+            break;
+    }
+
+    return crc1 ^ crc2;
+}
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef DIGEST_CLASS_HEAD
+#define DIGEST_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include <string>
+
+#include "Crc32c.h"
+#include "Md5.h"
+#include "Sha1.h"
+#include "Sha256.h"
+
+namespace Utility
+{
+
+/**
+ * \brief A hash chosen at run time by its name in Metalink (RFC 5854) / IANA, e.g. "sha-256".
+ */
+class Digest
+{
+public:
+    virtual ~Digest() {}
+
+    virtual void init() = 0;
+    virtual void update(const void* data, size_t len) = 0;
+    virtual std::string hexFinal() = 0;
+
+    /**
+     * \brief Make a digest of type, NULL if it's not known. Names are case insensitive.
+     */
+    static Digest* create(const std::string& type);
+};
+
+template <class Hash>
+class DigestOf : public Digest
+{
+public:
+    virtual void init()                                 { hash_.init(); }
+    virtual void update(const void* data, size_t len)   { hash_.update(data, len); }
+    virtual std::string hexFinal()                      { return hash_.hexFinal(); }
+
+private:
+    Hash hash_;
+};
+
+/**
+ * \brief CRC-32C in the shape of a hash, "crc32c". It only finds accidents, never use it
+ * against a forged file.
+ */
+class Crc32cHash
+{
+public:
+    Crc32cHash() : crc_(0) {}
+
+    void init()                                         { crc_ = 0; }
+    void update(const void* data, size_t len)           { crc_ = Crc32c::update(crc_, data, len); }
+
+    std::string hexFinal()
+        {
+            char hex[9];
+            snprintf(hex, sizeof(hex), "%08x", crc_);
+            return hex;
+        }
+
+private:
+    uint32_t crc_;
+};
+
+inline Digest* Digest::create(const std::string& type)
+{
+    std::string name;
+    for (size_t i=0; i<type.length(); ++i)
+        name += char((type[i] >= 'A' && type[i] <= 'Z') ? type[i] - 'A' + 'a' : type[i]);
+
+    if (name == "sha-256")
+        return new DigestOf<Sha256>;
+    if (name == "sha-1")
+        return new DigestOf<Sha1>;
+    if (name == "md5")
+        return new DigestOf<Md5>;
+    if (name == "crc32c")
+        return new DigestOf<Crc32cHash>;
+
+    return NULL;
+}
+
+}
+
+#endif
@@ -0,0 +1,131 @@
+#ifndef FAIR_SHARE_CLASS_HEAD
+#define FAIR_SHARE_CLASS_HEAD
+
+#include <cstddef>
+#include <vector>
+
+namespace Utility
+{
+
+/**
+ * \brief Weighted max-min fair division of a capacity.
+ *
+ * Each user has a weight and a demand. Users whose demand is under their weighted share get
+ * all they want, the rest of capacity is divided among others by weight. If capacity is
+ * enough, every user with demand get at least 1.
+ */
+class FairShare
+{
+public:
+    static const int noLimited = -1;
+
+    static void allocate(const std::vector<int>& weights,
+                         const std::vector<int>& demands,
+                         int capacity,
+                         std::vector<int>& shares);
+};
+
+inline
+void FairShare::allocate(const std::vector<int>& weights,
+                         const std::vector<int>& demands,
+                         int capacity,
+                         std::vector<int>& shares)
+{
+    const size_t n = demands.size();
+    shares.assign(n, 0);
+
+    std::vector<size_t> active;
+    for (size_t i=0; i<n; ++i)
+    {
+        if (demands[i] > 0)
+            active.push_back(i);
+    }
+
+    if (capacity == noLimited)
+    {
+        shares = demands;
+        return;
+    }
+
+    int remain = capacity;
+    if (remain >= int(active.size()))
+    {
+        for (size_t i=0; i<active.size(); ++i)
+            shares[active[i]] = 1;
+        remain -= active.size();
+    }
+
+    for (size_t i=0; i<active.size(); )
+    {
+        if (shares[active[i]] >= demands[active[i]])
+            active.erase(active.begin() + i);
+        else
+            ++i;
+    }
+
+    while (remain > 0 && active.size() > 0)
+    {
+        long long sumWeight = 0;
+        for (size_t i=0; i<active.size(); ++i)
+            sumWeight += weights[active[i]];
+
+        // satisfy one user whose demand is under its share, then divide again.
+        bool satisfied = false;
+        for (size_t i=0; i<active.size(); ++i)
+        {
+            size_t u = active[i];
+            int need = demands[u] - shares[u];
+            if ((long long)need * sumWeight <= (long long)remain * weights[u])
+            {
+                shares[u] += need;
+                remain -= need;
+                active.erase(active.begin() + i);
+                satisfied = true;
+                break;
+            }
+        }
+        if (satisfied)
+            continue;
+
+        // everyone want more than its share.
+        int given = 0;
+        for (size_t i=0; i<active.size(); ++i)
+        {
+            size_t u = active[i];
+            int share = int((long long)remain * weights[u] / sumWeight);
+            shares[u] += share;
+            given += share;
+        }
+        remain -= given;
+
+        // give the rounding left to who has nothing first, then to heavier one.
+        for (int pass=0; pass<2 && remain > 0; ++pass)
+        {
+            std::vector<size_t> order(active);
+            for (size_t i=1; i<order.size(); ++i)
+            {
+                for (size_t j=i; j>0 && weights[order[j]] > weights[order[j-1]]; --j)
+                {
+                    size_t t = order[j];
+                    order[j] = order[j-1];
+                    order[j-1] = t;
+                }
+            }
+
+            for (size_t i=0; i<order.size() && remain > 0; ++i)
+            {
+                size_t u = order[i];
+                if ((pass == 0 && shares[u] == 0) || (pass == 1 && shares[u] < demands[u]))
+                {
+                    ++shares[u];
+                    --remain;
+                }
+            }
+        }
+        break;
+    }
+}
+
+}
+
+#endif
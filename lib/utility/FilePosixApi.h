@@ -8,6 +8,8 @@
 
 #include <stdio.h>
 
+#include <string>
+
 namespace Utility
 {
 
@@ -40,6 +42,11 @@ public:
     static bool remove(const char *name);
     static bool resize(const char *name, size_t len);
 
+    /**
+     * \brief Wait until the directory entry of name, after a create or rename, reaches the disk.
+     */
+    static bool syncDir(const char *name);
+
     File();
     ~File();
 
@@ -51,9 +58,19 @@ public:
     ssize_t read(void *buffer, size_t count);
     ssize_t write(const void *buffer, size_t count);
 
+    /**
+     * \brief Read at pos without moving file position, safe from several threads.
+     */
+    ssize_t readAt(void *buffer, size_t count, size_t pos);
+
     bool seek(size_t pos, int flag);
     ssize_t tell();
 
+    /**
+     * \brief Wait until written data reaches the disk.
+     */
+    bool sync();
+
 private:
     HANDLE handle_;
 };
@@ -92,6 +109,26 @@ inline bool File::resize(const char *name, size_t len)
     return (ret == 0);
 }
 
+inline bool File::syncDir(const char *name)
+{
+    std::string dir(name);
+    std::string::size_type slash = dir.rfind('/');
+    if (slash == std::string::npos)
+        dir = ".";
+    else
+        dir.erase((slash == 0) ? 1 : slash);
+
+    File d;
+    if (!d.open(dir.c_str(), OF_Read))
+        return false;
+
+    int ret = ::fsync(d.handle_);
+
+    d.close();
+
+    return (ret == 0);
+}
+
 inline File::File()
     : handle_(-1)
 {}
@@ -144,6 +181,11 @@ inline ssize_t File::read(void *buffer, size_t count)
     return ::read(handle_, buffer, count);
 }
 
+inline ssize_t File::readAt(void *buffer, size_t count, size_t pos)
+{
+    return ::pread(handle_, buffer, count, pos);
+}
+
 inline ssize_t File::write(const void *buffer, size_t count)
 {
     ssize_t got = 0, need = count;
@@ -168,6 +210,15 @@ inline ssize_t File::tell()
     return ::lseek(handle_, 0, SEEK_CUR);
 }
 
+inline bool File::sync()
+{
+#if defined(_POSIX_SYNCHRONIZED_IO) && _POSIX_SYNCHRONIZED_IO > 0
+    return (::fdatasync(handle_) == 0);
+#else
+    return (::fsync(handle_) == 0);
+#endif
+}
+
 }
 
 #endif
@@ -0,0 +1,102 @@
+#ifndef HOST_BUCKETS_CLASS_HEAD
+#define HOST_BUCKETS_CLASS_HEAD
+
+#include <map>
+#include <string>
+
+#include "Mutex.h"
+#include "TokenBucket.h"
+
+namespace Utility
+{
+
+/**
+ * \brief Speed limit per host, a TokenBucket for each host.
+ *
+ * A bucket is made on first use and lives as long as the registry, tasks keep pointers to
+ * it. A new rate applies to all buckets at once.
+ */
+class HostBuckets
+{
+public:
+    HostBuckets();
+    ~HostBuckets();
+
+    /**
+     * \brief Process wide buckets, by host name.
+     */
+    static HostBuckets& hosts();
+
+    void setRate(size_t bytesPerSecond);
+    size_t rate();
+
+    TokenBucket* bucket(const std::string& host);
+
+private:
+    HostBuckets(const HostBuckets &);
+    const HostBuckets& operator=(const HostBuckets &);
+
+    typedef std::map<std::string, TokenBucket*> Buckets;
+
+    Mutex mutex_;
+    Buckets buckets_;
+    size_t rate_;
+};
+
+inline
+HostBuckets::HostBuckets()
+    : rate_(TokenBucket::noLimited)
+{}
+
+inline
+HostBuckets::~HostBuckets()
+{
+    for (Buckets::iterator it = buckets_.begin(); it != buckets_.end(); ++it)
+    {
+        delete it->second;
+    }
+}
+
+inline
+HostBuckets& HostBuckets::hosts()
+{
+    static HostBuckets buckets;
+    return buckets;
+}
+
+inline
+void HostBuckets::setRate(size_t bytesPerSecond)
+{
+    ScopedLock lock(mutex_);
+    rate_ = bytesPerSecond;
+    for (Buckets::iterator it = buckets_.begin(); it != buckets_.end(); ++it)
+    {
+        it->second->setRate(bytesPerSecond);
+    }
+}
+
+inline
+size_t HostBuckets::rate()
+{
+    ScopedLock lock(mutex_);
+    return rate_;
+}
+
+inline
+TokenBucket* HostBuckets::bucket(const std::string& host)
+{
+    ScopedLock lock(mutex_);
+    Buckets::iterator it = buckets_.find(host);
+    if (it != buckets_.end())
+    {
+        return it->second;
+    }
+
+    TokenBucket* bucket = new TokenBucket(rate_);
+    buckets_.insert(std::make_pair(host, bucket));
+    return bucket;
+}
+
+}
+
+#endif
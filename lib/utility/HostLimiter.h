@@ -0,0 +1,151 @@
+#ifndef HOST_LIMITER_CLASS_HEAD
+#define HOST_LIMITER_CLASS_HEAD
+
+#include <map>
+#include <string>
+
+#include "Mutex.h"
+#include "SocketManager.h"
+
+namespace Utility
+{
+
+/**
+ * \brief Connection budget per host, each host is counted by a SocketManager.
+ *
+ * acquire() takes a slot before a connection is made, release() gives it back when the
+ * connection is done. A host is forgotten when it has no connection, so a new maximum
+ * applies to busy hosts after they are drained.
+ */
+class HostLimiter
+{
+public:
+    static const int noLimited = SocketManager::noLimited;
+
+    explicit HostLimiter(int maxPerHost = noLimited);
+    ~HostLimiter();
+
+    /**
+     * \brief Process wide budgets, by host name and by IP address.
+     */
+    static HostLimiter& hosts();
+    static HostLimiter& addresses();
+
+    void setMaxPerHost(int max);
+    int maxPerHost();
+
+    bool acquire(const std::string& host);
+    void release(const std::string& host);
+    int connections(const std::string& host);
+
+private:
+    HostLimiter(const HostLimiter &);
+    const HostLimiter& operator=(const HostLimiter &);
+
+    struct Host
+    {
+        SocketManager* manager;
+        int connections;
+    };
+    typedef std::map<std::string, Host> Hosts;
+
+    Mutex mutex_;
+    Hosts hosts_;
+    int maxPerHost_;
+};
+
+inline
+HostLimiter::HostLimiter(int maxPerHost)
+    : maxPerHost_(maxPerHost < 0 ? noLimited : maxPerHost)
+{}
+
+inline
+HostLimiter::~HostLimiter()
+{
+    for (Hosts::iterator it = hosts_.begin(); it != hosts_.end(); ++it)
+    {
+        delete it->second.manager;
+    }
+}
+
+inline
+HostLimiter& HostLimiter::hosts()
+{
+    static HostLimiter limiter;
+    return limiter;
+}
+
+inline
+HostLimiter& HostLimiter::addresses()
+{
+    static HostLimiter limiter;
+    return limiter;
+}
+
+inline
+void HostLimiter::setMaxPerHost(int max)
+{
+    ScopedLock lock(mutex_);
+    maxPerHost_ = (max < 0) ? noLimited : max;
+}
+
+inline
+int HostLimiter::maxPerHost()
+{
+    ScopedLock lock(mutex_);
+    return maxPerHost_;
+}
+
+inline
+bool HostLimiter::acquire(const std::string& host)
+{
+    ScopedLock lock(mutex_);
+    Hosts::iterator it = hosts_.find(host);
+    if (it == hosts_.end())
+    {
+        Host h;
+        h.manager = new SocketManager(maxPerHost_, maxPerHost_);
+        h.connections = 0;
+        it = hosts_.insert(std::make_pair(host, h)).first;
+    }
+
+    if (!it->second.manager->get())
+    {
+        return false;
+    }
+
+    it->second.manager->connect();
+    ++it->second.connections;
+
+    return true;
+}
+
+inline
+void HostLimiter::release(const std::string& host)
+{
+    ScopedLock lock(mutex_);
+    Hosts::iterator it = hosts_.find(host);
+    if (it == hosts_.end())
+    {
+        return;
+    }
+
+    it->second.manager->close();
+    if (--it->second.connections <= 0)
+    {
+        delete it->second.manager;
+        hosts_.erase(it);
+    }
+}
+
+inline
+int HostLimiter::connections(const std::string& host)
+{
+    ScopedLock lock(mutex_);
+    Hosts::iterator it = hosts_.find(host);
+    return (it == hosts_.end()) ? 0 : it->second.connections;
+}
+
+}
+
+#endif
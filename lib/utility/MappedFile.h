@@ -0,0 +1,108 @@
+#ifndef MAPPED_FILE_CLASS_HEAD
+#define MAPPED_FILE_CLASS_HEAD
+
+#include <stddef.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace Utility
+{
+
+/**
+ * \brief A whole file mapped read only.
+ *
+ * Threads may read any part of it at once without sharing a file position. An empty file
+ * opens with data() NULL.
+ */
+class MappedFile
+{
+public:
+    MappedFile()
+        : map_(NULL),
+          size_(0),
+          open_(false)
+        {}
+
+    ~MappedFile()                       { close(); }
+
+    bool open(const char* path);
+    void close();
+
+    bool isOpen()                       { return open_; }
+    size_t size()                       { return size_; }
+    const unsigned char* data()         { return static_cast<const unsigned char*>(map_); }
+
+    /**
+     * \brief Tell kernel a range will be read soon, so it reads ahead while others are used.
+     */
+    void willNeed(size_t pos, size_t length);
+
+private:
+    MappedFile(const MappedFile &);
+    const MappedFile& operator=(const MappedFile &);
+
+    void* map_;
+    size_t size_;
+    bool open_;
+};
+
+inline bool MappedFile::open(const char* path)
+{
+    close();
+
+    int fd = ::open(path, O_RDONLY);
+    if (fd == -1)
+        return false;
+
+    struct stat st;
+    if (::fstat(fd, &st) != 0)
+    {
+        ::close(fd);
+        return false;
+    }
+
+    if (st.st_size > 0)
+    {
+        map_ = ::mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+        if (map_ == MAP_FAILED)
+        {
+            map_ = NULL;
+            ::close(fd);
+            return false;
+        }
+        ::madvise(map_, st.st_size, MADV_SEQUENTIAL);
+    }
+    ::close(fd);
+
+    size_ = st.st_size;
+    open_ = true;
+    return true;
+}
+
+inline void MappedFile::close()
+{
+    if (map_ != NULL)
+        ::munmap(map_, size_);
+
+    map_ = NULL;
+    size_ = 0;
+    open_ = false;
+}
+
+inline void MappedFile::willNeed(size_t pos, size_t length)
+{
+    if (map_ == NULL || pos >= size_)
+        return;
+
+    // madvise wants a page aligned address.
+    size_t page = size_t(::sysconf(_SC_PAGESIZE));
+    size_t begin = pos / page * page;
+    size_t end = (length > size_ - pos) ? size_ : pos + length;
+    ::madvise(static_cast<char*>(map_) + begin, end - begin, MADV_WILLNEED);
+}
+
+}
+
+#endif
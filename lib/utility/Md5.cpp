@@ -0,0 +1,170 @@
+#include "Md5.h"
+
+#include <string.h>
+
+namespace Utility
+{
+
+static const uint32_t K[64] =
+{
+    0xd76aa478, 0xe8c7b756, 0x242070db, 0xc1bdceee, 0xf57c0faf, 0x4787c62a, 0xa8304613, 0xfd469501,
+    0x698098d8, 0x8b44f7af, 0xffff5bb1, 0x895cd7be, 0x6b901122, 0xfd987193, 0xa679438e, 0x49b40821,
+    0xf61e2562, 0xc040b340, 0x265e5a51, 0xe9b6c7aa, 0xd62f105d, 0x02441453, 0xd8a1e681, 0xe7d3fbc8,
+    0x21e1cde6, 0xc33707d6, 0xf4d50d87, 0x455a14ed, 0xa9e3e905, 0xfcefa3f8, 0x676f02d9, 0x8d2a4c8a,
+    0xfffa3942, 0x8771f681, 0x6d9d6122, 0xfde5380c, 0xa4beea44, 0x4bdecfa9, 0xf6bb4b60, 0xbebfbc70,
+    0x289b7ec6, 0xeaa127fa, 0xd4ef3085, 0x04881d05, 0xd9d4d039, 0xe6db99e5, 0x1fa27cf8, 0xc4ac5665,
+    0xf4292244, 0x432aff97, 0xab9423a7, 0xfc93a039, 0x655b59c3, 0x8f0ccc92, 0xffeff47d, 0x85845dd1,
+    0x6fa87e4f, 0xfe2ce6e0, 0xa3014314, 0x4e0811a1, 0xf7537e82, 0xbd3af235, 0x2ad7d2bb, 0xeb86d391,
+};
+
+static const int S[64] =
+{
+    7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22, 7, 12, 17, 22,
+    5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20, 5,  9, 14, 20,
+    4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23, 4, 11, 16, 23,
+    6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21, 6, 10, 15, 21,
+};
+
+static inline uint32_t rotl(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+Md5::Md5()
+{
+    init();
+}
+
+void Md5::init()
+{
+    state_[0] = 0x67452301;
+    state_[1] = 0xefcdab89;
+    state_[2] = 0x98badcfe;
+    state_[3] = 0x10325476;
+    length_ = 0;
+    used_ = 0;
+}
+
+void Md5::transform(const unsigned char block[64])
+{
+    uint32_t m[16];
+    for (int i=0; i<16; ++i)
+    {
+        m[i] = uint32_t(block[i * 4]) | (uint32_t(block[i * 4 + 1]) << 8)
+            | (uint32_t(block[i * 4 + 2]) << 16) | (uint32_t(block[i * 4 + 3]) << 24);
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3];
+
+    for (int i=0; i<64; ++i)
+    {
+        uint32_t f;
+        int g;
+        if (i < 16)
+        {
+            f = (b & c) | (~b & d);
+            g = i;
+        }
+        else if (i < 32)
+        {
+            f = (d & b) | (~d & c);
+            g = (5 * i + 1) % 16;
+        }
+        else if (i < 48)
+        {
+            f = b ^ c ^ d;
+            g = (3 * i + 5) % 16;
+        }
+        else
+        {
+            f = c ^ (b | ~d);
+            g = (7 * i) % 16;
+        }
+
+        uint32_t t = d;
+        d = c;
+        c = b;
+        b = b + rotl(a + f + K[i] + m[g], S[i]);
+        a = t;
+    }
+
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+}
+
+void Md5::update(const void* data, size_t len)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    length_ += len;
+
+    if (used_ > 0)
+    {
+        size_t n = (len < 64 - used_) ? len : 64 - used_;
+        memcpy(buffer_ + used_, p, n);
+        used_ += n;
+        p += n;
+        len -= n;
+
+        if (used_ < 64)
+            return;
+
+        transform(buffer_);
+        used_ = 0;
+    }
+
+    while (len >= 64)
+    {
+        transform(p);
+        p += 64;
+        len -= 64;
+    }
+
+    if (len > 0)
+    {
+        memcpy(buffer_, p, len);
+        used_ = len;
+    }
+}
+
+void Md5::final(unsigned char digest[digestSize])
+{
+    uint64_t bits = length_ * 8;
+
+    // length is little endian in md5.
+    unsigned char pad[72] = {0x80};
+    size_t padLen = (used_ < 56) ? (56 - used_) : (120 - used_);
+    for (int i=0; i<8; ++i)
+    {
+        pad[padLen + i] = (unsigned char)(bits >> (i * 8));
+    }
+    update(pad, padLen + 8);
+
+    for (int i=0; i<4; ++i)
+    {
+        digest[i * 4]     = (unsigned char)(state_[i]);
+        digest[i * 4 + 1] = (unsigned char)(state_[i] >> 8);
+        digest[i * 4 + 2] = (unsigned char)(state_[i] >> 16);
+        digest[i * 4 + 3] = (unsigned char)(state_[i] >> 24);
+    }
+}
+
+std::string Md5::hexFinal()
+{
+    static const char hex[] = "0123456789abcdef";
+
+    unsigned char digest[digestSize];
+    final(digest);
+
+    std::string ret;
+    for (size_t i=0; i<digestSize; ++i)
+    {
+        ret += hex[digest[i] >> 4];
+        ret += hex[digest[i] & 0x0f];
+    }
+
+    return ret;
+}
+
+}
@@ -0,0 +1,38 @@
+#ifndef MD5_CLASS_HEAD
+#define MD5_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace Utility
+{
+
+/**
+ * \brief Streaming MD5 (RFC 1321), same usage as Sha256.
+ */
+class Md5
+{
+public:
+    static const size_t digestSize = 16;
+
+    Md5();
+
+    void init();
+    void update(const void* data, size_t len);
+    void final(unsigned char digest[digestSize]);
+    std::string hexFinal();
+
+private:
+    void transform(const unsigned char block[64]);
+
+    uint32_t state_[4];
+    uint64_t length_;
+    unsigned char buffer_[64];
+    size_t used_;
+};
+
+}
+
+#endif
@@ -0,0 +1,71 @@
+#ifndef MUTEX_CLASS_HEAD
+#define MUTEX_CLASS_HEAD
+
+#include <pthread.h>
+
+namespace Utility
+{
+
+class Mutex
+{
+public:
+    Mutex();
+    ~Mutex();
+
+    void lock();
+    void unlock();
+
+private:
+    Mutex(const Mutex &);
+    const Mutex& operator=(const Mutex &);
+
+    pthread_mutex_t mutex_;
+};
+
+class ScopedLock
+{
+public:
+    explicit ScopedLock(Mutex& mutex);
+    ~ScopedLock();
+
+private:
+    ScopedLock(const ScopedLock &);
+    const ScopedLock& operator=(const ScopedLock &);
+
+    Mutex& mutex_;
+};
+
+inline Mutex::Mutex()
+{
+    ::pthread_mutex_init(&mutex_, NULL);
+}
+
+inline Mutex::~Mutex()
+{
+    ::pthread_mutex_destroy(&mutex_);
+}
+
+inline void Mutex::lock()
+{
+    ::pthread_mutex_lock(&mutex_);
+}
+
+inline void Mutex::unlock()
+{
+    ::pthread_mutex_unlock(&mutex_);
+}
+
+inline ScopedLock::ScopedLock(Mutex& mutex)
+    : mutex_(mutex)
+{
+    mutex_.lock();
+}
+
+inline ScopedLock::~ScopedLock()
+{
+    mutex_.unlock();
+}
+
+}
+
+#endif
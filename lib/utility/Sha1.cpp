@@ -0,0 +1,155 @@
+#include "Sha1.h"
+
+#include <string.h>
+
+namespace Utility
+{
+
+static inline uint32_t rotl(uint32_t x, int n)
+{
+    return (x << n) | (x >> (32 - n));
+}
+
+Sha1::Sha1()
+{
+    init();
+}
+
+void Sha1::init()
+{
+    state_[0] = 0x67452301;
+    state_[1] = 0xefcdab89;
+    state_[2] = 0x98badcfe;
+    state_[3] = 0x10325476;
+    state_[4] = 0xc3d2e1f0;
+    length_ = 0;
+    used_ = 0;
+}
+
+void Sha1::transform(const unsigned char block[64])
+{
+    uint32_t w[80];
+    for (int i=0; i<16; ++i)
+    {
+        w[i] = (uint32_t(block[i * 4]) << 24) | (uint32_t(block[i * 4 + 1]) << 16)
+            | (uint32_t(block[i * 4 + 2]) << 8) | uint32_t(block[i * 4 + 3]);
+    }
+    for (int i=16; i<80; ++i)
+    {
+        w[i] = rotl(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+
+    uint32_t a = state_[0], b = state_[1], c = state_[2], d = state_[3], e = state_[4];
+
+    for (int i=0; i<80; ++i)
+    {
+        uint32_t f, k;
+        if (i < 20)
+        {
+            f = (b & c) | (~b & d);
+            k = 0x5a827999;
+        }
+        else if (i < 40)
+        {
+            f = b ^ c ^ d;
+            k = 0x6ed9eba1;
+        }
+        else if (i < 60)
+        {
+            f = (b & c) | (b & d) | (c & d);
+            k = 0x8f1bbcdc;
+        }
+        else
+        {
+            f = b ^ c ^ d;
+            k = 0xca62c1d6;
+        }
+
+        uint32_t t = rotl(a, 5) + f + e + k + w[i];
+        e = d;
+        d = c;
+        c = rotl(b, 30);
+        b = a;
+        a = t;
+    }
+
+    state_[0] += a;
+    state_[1] += b;
+    state_[2] += c;
+    state_[3] += d;
+    state_[4] += e;
+}
+
+void Sha1::update(const void* data, size_t len)
+{
+    const unsigned char* p = static_cast<const unsigned char*>(data);
+    length_ += len;
+
+    if (used_ > 0)
+    {
+        size_t n = (len < 64 - used_) ? len : 64 - used_;
+        memcpy(buffer_ + used_, p, n);
+        used_ += n;
+        p += n;
+        len -= n;
+
+        if (used_ < 64)
+            return;
+
+        transform(buffer_);
+        used_ = 0;
+    }
+
+    while (len >= 64)
+    {
+        transform(p);
+        p += 64;
+        len -= 64;
+    }
+
+    if (len > 0)
+    {
+        memcpy(buffer_, p, len);
+        used_ = len;
+    }
+}
+
+void Sha1::final(unsigned char digest[digestSize])
+{
+    uint64_t bits = length_ * 8;
+
+    unsigned char pad[72] = {0x80};
+    size_t padLen = (used_ < 56) ? (56 - used_) : (120 - used_);
+    for (int i=0; i<8; ++i)
+    {
+        pad[padLen + i] = (unsigned char)(bits >> (56 - i * 8));
+    }
+    update(pad, padLen + 8);
+
+    for (int i=0; i<5; ++i)
+    {
+        digest[i * 4]     = (unsigned char)(state_[i] >> 24);
+        digest[i * 4 + 1] = (unsigned char)(state_[i] >> 16);
+        digest[i * 4 + 2] = (unsigned char)(state_[i] >> 8);
+        digest[i * 4 + 3] = (unsigned char)(state_[i]);
+    }
+}
+
+std::string Sha1::hexFinal()
+{
+    static const char hex[] = "0123456789abcdef";
+
+    unsigned char digest[digestSize];
+    final(digest);
+
+    std::string ret;
+    for (size_t i=0; i<digestSize; ++i)
+    {
+        ret += hex[digest[i] >> 4];
+        ret += hex[digest[i] & 0x0f];
+    }
+
+    return ret;
+}
+
+}
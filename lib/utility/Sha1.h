@@ -0,0 +1,38 @@
+#ifndef SHA1_CLASS_HEAD
+#define SHA1_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace Utility
+{
+
+/**
+ * \brief Streaming SHA-1 (FIPS 180-4), same usage as Sha256.
+ */
+class Sha1
+{
+public:
+    static const size_t digestSize = 20;
+
+    Sha1();
+
+    void init();
+    void update(const void* data, size_t len);
+    void final(unsigned char digest[digestSize]);
+    std::string hexFinal();
+
+private:
+    void transform(const unsigned char block[64]);
+
+    uint32_t state_[5];
+    uint64_t length_;
+    unsigned char buffer_[64];
+    size_t used_;
+};
+
+}
+
+#endif
@@ -0,0 +1,45 @@
+#ifndef SHA256_CLASS_HEAD
+#define SHA256_CLASS_HEAD
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include <string>
+
+namespace Utility
+{
+
+/**
+ * \brief Streaming SHA-256 (FIPS 180-4).
+ *
+ * Feed data with update() in any size, and get the digest with final(). Call init()
+ * before reuse.
+ */
+class Sha256
+{
+public:
+    static const size_t digestSize = 32;
+
+    Sha256();
+
+    void init();
+    void update(const void* data, size_t len);
+    void final(unsigned char digest[digestSize]);
+
+    /**
+     * \brief Final and return the digest in lower case hex.
+     */
+    std::string hexFinal();
+
+private:
+    void transform(const unsigned char block[64]);
+
+    uint32_t state_[8];
+    uint64_t length_;
+    unsigned char buffer_[64];
+    size_t used_;
+};
+
+}
+
+#endif
@@ -0,0 +1,229 @@
+#ifndef THREAD_POOL_CLASS_HEAD
+#define THREAD_POOL_CLASS_HEAD
+
+#include <stddef.h>
+#include <pthread.h>
+#include <unistd.h>
+
+#include <vector>
+
+namespace Utility
+{
+
+/**
+ * \brief A fixed set of worker threads running indexed jobs.
+ *
+ * run() hands out indices [0, count) of a job to the workers and the calling thread, and
+ * returns when all of them are done. Jobs of one run() must not depend on each other.
+ *
+ * start() hands them to the workers only and returns at once, the caller polls done().
+ * One job runs at a time, a job started while another runs waits for it first.
+ */
+class ThreadPool
+{
+public:
+    class Job
+    {
+    public:
+        virtual ~Job() {}
+        virtual void run(size_t index) = 0;
+    };
+
+    /**
+     * \brief threads counts the caller of run(), 0 means one per processor.
+     */
+    explicit ThreadPool(size_t threads = 0);
+    ~ThreadPool();
+
+    size_t threads()             { return workers_.size() + 1; }
+    void run(Job& job, size_t count);
+
+    /**
+     * \brief Run job on workers in background, without workers it's run here at once.
+     */
+    void start(Job& job, size_t count);
+
+    /**
+     * \brief True if a job is running, a new one would wait for it.
+     */
+    bool busy();
+    bool done(const Job& job);
+    void wait(const Job& job);
+
+    static size_t processors();
+
+private:
+    ThreadPool(const ThreadPool &);
+    const ThreadPool& operator=(const ThreadPool &);
+
+    static void* worker(void* arg);
+    void work(bool caller);
+    void hand(Job& job, size_t count);
+
+    pthread_mutex_t mutex_;
+    pthread_cond_t start_;
+    pthread_cond_t done_;
+    std::vector<pthread_t> workers_;
+
+    Job* job_;
+    size_t count_;
+    size_t next_;
+    size_t finished_;
+    bool quit_;
+};
+
+inline ThreadPool::ThreadPool(size_t threads)
+    : job_(NULL),
+      count_(0),
+      next_(0),
+      finished_(0),
+      quit_(false)
+{
+    ::pthread_mutex_init(&mutex_, NULL);
+    ::pthread_cond_init(&start_, NULL);
+    ::pthread_cond_init(&done_, NULL);
+
+    if (threads == 0)
+        threads = processors();
+
+    for (size_t i=1; i<threads; ++i)
+    {
+        pthread_t thread;
+        if (::pthread_create(&thread, NULL, &ThreadPool::worker, this) != 0)
+            break;
+        workers_.push_back(thread);
+    }
+}
+
+inline ThreadPool::~ThreadPool()
+{
+    ::pthread_mutex_lock(&mutex_);
+    quit_ = true;
+    ::pthread_cond_broadcast(&start_);
+    ::pthread_mutex_unlock(&mutex_);
+
+    for (size_t i=0; i<workers_.size(); ++i)
+        ::pthread_join(workers_[i], NULL);
+
+    ::pthread_cond_destroy(&done_);
+    ::pthread_cond_destroy(&start_);
+    ::pthread_mutex_destroy(&mutex_);
+}
+
+inline size_t ThreadPool::processors()
+{
+    long n = ::sysconf(_SC_NPROCESSORS_ONLN);
+    return (n > 0) ? size_t(n) : 1;
+}
+
+inline void ThreadPool::run(Job& job, size_t count)
+{
+    if (count == 0)
+        return;
+
+    hand(job, count);
+    work(true);
+    wait(job);
+}
+
+inline void ThreadPool::start(Job& job, size_t count)
+{
+    if (count == 0)
+        return;
+
+    if (workers_.size() == 0)
+    {
+        for (size_t i=0; i<count; ++i)
+            job.run(i);
+        return;
+    }
+
+    hand(job, count);
+}
+
+/**
+ * Wait for the job running, then make job the one workers take indices from.
+ */
+inline void ThreadPool::hand(Job& job, size_t count)
+{
+    ::pthread_mutex_lock(&mutex_);
+    while (job_ != NULL && finished_ < count_)
+        ::pthread_cond_wait(&done_, &mutex_);
+    job_ = &job;
+    count_ = count;
+    next_ = 0;
+    finished_ = 0;
+    ::pthread_cond_broadcast(&start_);
+    ::pthread_mutex_unlock(&mutex_);
+}
+
+inline bool ThreadPool::busy()
+{
+    ::pthread_mutex_lock(&mutex_);
+    bool busy = (job_ != NULL && finished_ < count_);
+    ::pthread_mutex_unlock(&mutex_);
+    return busy;
+}
+
+inline bool ThreadPool::done(const Job& job)
+{
+    ::pthread_mutex_lock(&mutex_);
+    bool running = (job_ == &job && finished_ < count_);
+    ::pthread_mutex_unlock(&mutex_);
+    return !running;
+}
+
+inline void ThreadPool::wait(const Job& job)
+{
+    ::pthread_mutex_lock(&mutex_);
+    while (job_ == &job && finished_ < count_)
+        ::pthread_cond_wait(&done_, &mutex_);
+    if (job_ == &job)
+        job_ = NULL;
+    ::pthread_mutex_unlock(&mutex_);
+}
+
+inline void* ThreadPool::worker(void* arg)
+{
+    static_cast<ThreadPool*>(arg)->work(false);
+    return NULL;
+}
+
+/**
+ * Take indices until the job runs out. Workers then sleep for the next job, the caller
+ * goes back to wait for the others.
+ */
+inline void ThreadPool::work(bool caller)
+{
+    ::pthread_mutex_lock(&mutex_);
+    for (;;)
+    {
+        while (!quit_ && (job_ == NULL || next_ >= count_))
+        {
+            if (caller)
+            {
+                ::pthread_mutex_unlock(&mutex_);
+                return;
+            }
+            ::pthread_cond_wait(&start_, &mutex_);
+        }
+
+        if (quit_)
+            break;
+
+        Job* job = job_;
+        size_t index = next_++;
+        ::pthread_mutex_unlock(&mutex_);
+
+        job->run(index);
+
+        ::pthread_mutex_lock(&mutex_);
+        if (++finished_ == count_)
+            ::pthread_cond_broadcast(&done_);
+    }
+    ::pthread_mutex_unlock(&mutex_);
+}
+
+}
+
+#endif
@@ -0,0 +1,136 @@
+#ifndef TOKEN_BUCKET_CLASS_HEAD
+#define TOKEN_BUCKET_CLASS_HEAD
+
+#include <stddef.h>
+
+#include "Clock.h"
+
+namespace Utility
+{
+
+/**
+ * \brief Token bucket limiting bytes per second, chained to a parent bucket.
+ *
+ * Tokens are refilled by the millisecond and capped to a tenth of a second of rate, so
+ * there is no burst after idle. A bucket starts full when it gets limited, so the first
+ * receive of a session doesn't wait a refill. Receiving is allowed while every limited bucket in the
+ * chain has tokens, and what's received is taken from all of them, maybe into debt.
+ * A chain without limited bucket costs only the walk over it.
+ */
+class TokenBucket
+{
+public:
+    static const size_t noLimited = 0;
+
+    explicit TokenBucket(size_t bytesPerSecond = noLimited, TokenBucket* parent = NULL);
+
+    void setRate(size_t bytesPerSecond);
+    size_t rate()                    { return rate_; }
+    void setParent(TokenBucket* parent) { parent_ = parent; }
+    TokenBucket* parent()            { return parent_; }
+
+    bool limited();
+    bool mayReceive(Clock::Ms now);
+    void consume(size_t bytes);
+
+    long long tokens()               { return tokens_; }
+
+private:
+    void refill(Clock::Ms now);
+
+    size_t rate_;
+    long long burst_;
+    long long tokens_;
+    Clock::Ms last_;
+    TokenBucket* parent_;
+};
+
+inline
+TokenBucket::TokenBucket(size_t bytesPerSecond, TokenBucket* parent)
+    : rate_(noLimited),
+      burst_(0),
+      tokens_(0),
+      last_(0),
+      parent_(parent)
+{
+    setRate(bytesPerSecond);
+}
+
+inline
+void TokenBucket::setRate(size_t bytesPerSecond)
+{
+    bool wasLimited = (rate_ != noLimited);
+    rate_ = bytesPerSecond;
+    burst_ = (long long)(rate_ / 10);
+    if (burst_ < 1)
+        burst_ = 1;
+    if (!wasLimited || tokens_ > burst_)
+        tokens_ = burst_;
+}
+
+inline
+bool TokenBucket::limited()
+{
+    for (TokenBucket* b = this; b != NULL; b = b->parent_)
+    {
+        if (b->rate_ != noLimited)
+            return true;
+    }
+
+    return false;
+}
+
+inline
+void TokenBucket::refill(Clock::Ms now)
+{
+    if (last_ == 0 || now < last_)
+    {
+        last_ = now;
+        return;
+    }
+
+    Clock::Ms passed = now - last_;
+    long long add = (long long)(rate_ * passed / 1000);
+    if (add == 0)
+        return;
+
+    // keep the rest of the millisecond which doesn't make a whole token.
+    last_ += (Clock::Ms)(add * 1000 / rate_);
+    tokens_ += add;
+    if (tokens_ > burst_)
+    {
+        tokens_ = burst_;
+        last_ = now;
+    }
+}
+
+inline
+bool TokenBucket::mayReceive(Clock::Ms now)
+{
+    bool ret = true;
+    for (TokenBucket* b = this; b != NULL; b = b->parent_)
+    {
+        if (b->rate_ == noLimited)
+            continue;
+
+        b->refill(now);
+        if (b->tokens_ <= 0)
+            ret = false;
+    }
+
+    return ret;
+}
+
+inline
+void TokenBucket::consume(size_t bytes)
+{
+    for (TokenBucket* b = this; b != NULL; b = b->parent_)
+    {
+        if (b->rate_ != noLimited)
+            b->tokens_ -= (long long)bytes;
+    }
+}
+
+}
+
+#endif
@@ -0,0 +1,542 @@
+#include "DownloadManager.h"
+#include "StateStream.h"
+#include "utility/HostBuckets.h"
+#include "utility/HostLimiter.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+#include <string.h>
+
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Tasks never connect, they only keep what they're made of and their state.
+class StubTask : public TaskBase
+{
+public:
+    StubTask(ProtocolBase* protocol,
+             const char* uri,
+             const char* outputDir,
+             const char* outputName,
+             const char* options,
+             const char* comment)
+        : protocol_(protocol),
+          uri_(uri),
+          outputDir_(outputDir),
+          outputName_((outputName == NULL) ? "" : outputName),
+          options_((options == NULL) ? "" : options),
+          comment_((comment == NULL) ? "" : comment),
+          state_(TASK_WAIT),
+          files_(0),
+          maxSpeed_(0)
+        {}
+
+    void setFiles(int files)                   { files_ = files; }
+    void setState(TaskState state)             { state_ = state; }
+    size_t maxSpeed()                          { return maxSpeed_; }
+
+    virtual const char* uri()                  { return uri_.c_str(); }
+    virtual const char* outputDir()            { return outputDir_.c_str(); }
+    virtual const char* outputName()           { return outputName_.c_str(); }
+    virtual const char* options()              { return options_.c_str(); }
+    virtual const char* mimeType()             { return ""; }
+    virtual const char* comment()              { return comment_.c_str(); }
+    virtual const char* notice()               { return ""; }
+    virtual size_t      totalSize()            { return 0; }
+    virtual size_t      downloadSize()         { return 0; }
+    virtual size_t      uploadSize()           { return 0; }
+    virtual size_t      readableSize()         { return 0; }
+    virtual int         totalSource()          { return 1; }
+    virtual int         validSource()          { return 1; }
+    virtual std::vector<bool> validBitmap()    { return std::vector<bool>(); }
+    virtual std::vector<bool> downloadBitmap() { return std::vector<bool>(); }
+    virtual TaskState   state()                { return state_; }
+    virtual ProtocolBase* protocol()           { return protocol_; }
+
+    virtual bool start()                       { state_ = TASK_DOWNLOAD; return true; }
+    virtual bool stop()                        { state_ = TASK_WAIT; return true; }
+
+    virtual bool fdSet(fd_set* /*read*/, fd_set* /*write*/, fd_set* /*exc*/, int* /*max*/) { return true; }
+    virtual long timeout()                     { return -1; }
+    virtual size_t performDownload()           { return 0; }
+    virtual size_t performUpload()             { return 0; }
+
+    virtual int  connectionDemand()            { return 1; }
+    virtual int  openFiles()                   { return files_; }
+    virtual void setConnectionLimit(int /*limit*/) {}
+    virtual void setSpeedLimiter(Utility::TokenBucket* /*parent*/) {}
+    virtual void setSpeedShare(size_t /*bytesPerSecond*/) {}
+    virtual void setMaxDownloadSpeed(size_t bytesPerSecond) { maxSpeed_ = bytesPerSecond; }
+
+    virtual int error()                        { return 0; }
+    virtual const char* strerror(int /*error*/) { return ""; }
+
+private:
+    ProtocolBase* protocol_;
+    std::string uri_;
+    std::string outputDir_;
+    std::string outputName_;
+    std::string options_;
+    std::string comment_;
+    TaskState state_;
+    int files_;
+    size_t maxSpeed_;
+};
+
+class StubProtocol : public ProtocolBase
+{
+public:
+    virtual const char* name()                 { return "stub"; }
+    virtual const char* getOptionsDetail()     { return ""; }
+    virtual const char* getOptions()           { return ""; }
+    virtual void setOptions(const char* /*options*/) {}
+    virtual bool canProcess(const char* uri)   { return strncmp(uri, "stub://", 7) == 0; }
+    virtual const char* getTaskOptions(const char* /*uri*/) { return ""; }
+
+    virtual std::auto_ptr<TaskBase> getTask(const char* uri,
+                                            const char* outputDir,
+                                            const char* outputName,
+                                            const char* options,
+                                            const char* comment)
+        {
+            return std::auto_ptr<TaskBase>(
+                new StubTask(this, uri, outputDir, outputName, options, comment));
+        }
+};
+
+// uris of tasks reported by manager's signals.
+static std::vector<std::string> reported;
+
+static void report(TaskBase* task)
+{
+    reported.push_back(task->uri());
+}
+
+static void addProtocol(DownloadManager& manager)
+{
+    manager.addProtocol(std::auto_ptr<ProtocolBase>(new StubProtocol));
+}
+
+/**
+ * A stopped task, a downloading one and a queued one, with limits.
+ */
+static void fill(DownloadManager& manager)
+{
+    addProtocol(manager);
+    manager.setMaxConnections(8);
+    manager.setMaxActiveTasks(2);
+    manager.setMaxDownloadSpeed(1024 * 1024);
+    manager.setMaxConnectionsPerHost(4);
+    manager.setMaxConnectionsPerAddress(2);
+    manager.setMaxHostSpeed(512 * 1024);
+
+    TaskBase* stopped = manager.addTask("stub://host/stopped", "/tmp/", "stopped.iso",
+                                        "<Options/>", "stopped task",
+                                        DownloadManager::PRIORITY_BACKGROUND);
+    ASSERT_TRUE(stopped != NULL);
+
+    TaskBase* running = manager.addTask("stub://host/running", "/tmp/", NULL, NULL, NULL,
+                                        DownloadManager::PRIORITY_INTERACTIVE);
+    ASSERT_TRUE(running != NULL);
+    ASSERT_TRUE(manager.startTask(running));
+
+    ASSERT_TRUE(manager.enqueueTask("stub://host/queued", "/tmp/", "queued.iso", NULL,
+                                    "queued task"));
+}
+
+/**
+ * Records of a stream saved by manager, by uri.
+ */
+static std::vector<TaskRecord> readRecords(std::istream& in, StateSettings& settings)
+{
+    std::vector<TaskRecord> all;
+    StateReader reader(in, 1);
+    if (!reader.readHeader(settings))
+        return all;
+
+    std::vector<TaskRecord> records;
+    while (reader.read(records))
+        all.insert(all.end(), records.begin(), records.end());
+    EXPECT_TRUE(reader.complete());
+    return all;
+}
+
+static const TaskRecord* findRecord(const std::vector<TaskRecord>& records, const char* uri)
+{
+    for (size_t i=0; i<records.size(); ++i)
+    {
+        if (records[i].uri == uri)
+            return &records[i];
+    }
+
+    return NULL;
+}
+
+class DownloadManagerStateTest : public ::testing::Test
+{
+protected:
+    void SetUp()
+        {
+            reported.clear();
+        }
+
+    void TearDown()
+        {
+            Utility::HostLimiter::hosts().setMaxPerHost(Utility::HostLimiter::noLimited);
+            Utility::HostLimiter::addresses().setMaxPerHost(Utility::HostLimiter::noLimited);
+            Utility::HostBuckets::hosts().setRate(Utility::TokenBucket::noLimited);
+            remove("./manager.state");
+        }
+};
+
+TEST_F(DownloadManagerStateTest, SaveRecords)
+{
+    DownloadManager manager;
+    fill(manager);
+
+    std::stringstream stream;
+    ASSERT_TRUE(manager.save(stream));
+
+    StateSettings settings;
+    std::vector<TaskRecord> records = readRecords(stream, settings);
+    EXPECT_EQ(settings.maxConnections, 8);
+    EXPECT_EQ(settings.maxActiveTasks, 2);
+    EXPECT_EQ(settings.maxOpenFiles, -1);
+    EXPECT_EQ(settings.maxDownloadSpeed, 1024u * 1024);
+    EXPECT_EQ(settings.maxConnectionsPerHost, 4);
+    EXPECT_EQ(settings.maxConnectionsPerAddress, 2);
+    EXPECT_EQ(settings.maxHostSpeed, 512u * 1024);
+    ASSERT_EQ(records.size(), 3u);
+
+    const TaskRecord* stopped = findRecord(records, "stub://host/stopped");
+    ASSERT_TRUE(stopped != NULL);
+    EXPECT_EQ(stopped->state, TaskRecord::RS_WAIT);
+    EXPECT_EQ(stopped->priority, DownloadManager::PRIORITY_BACKGROUND);
+    EXPECT_EQ(stopped->outputDir, "/tmp/");
+    EXPECT_EQ(stopped->outputName, "stopped.iso");
+    EXPECT_EQ(stopped->options, "<Options/>");
+    EXPECT_EQ(stopped->comment, "stopped task");
+
+    const TaskRecord* running = findRecord(records, "stub://host/running");
+    ASSERT_TRUE(running != NULL);
+    EXPECT_EQ(running->state, TaskRecord::RS_DOWNLOAD);
+    EXPECT_EQ(running->priority, DownloadManager::PRIORITY_INTERACTIVE);
+    EXPECT_EQ(running->outputName, "");
+
+    const TaskRecord* queued = findRecord(records, "stub://host/queued");
+    ASSERT_TRUE(queued != NULL);
+    EXPECT_EQ(queued->state, TaskRecord::RS_QUEUED);
+    EXPECT_EQ(queued->priority, DownloadManager::PRIORITY_NORMAL);
+    EXPECT_EQ(queued->comment, "queued task");
+}
+
+TEST_F(DownloadManagerStateTest, LoadRoundTrip)
+{
+    std::stringstream stream;
+    {
+        DownloadManager manager;
+        fill(manager);
+        ASSERT_TRUE(manager.save(stream));
+    }
+
+    // limits per host are process wide, they're set again by load.
+    Utility::HostLimiter::hosts().setMaxPerHost(Utility::HostLimiter::noLimited);
+    Utility::HostLimiter::addresses().setMaxPerHost(Utility::HostLimiter::noLimited);
+    Utility::HostBuckets::hosts().setRate(Utility::TokenBucket::noLimited);
+
+    DownloadManager manager;
+    addProtocol(manager);
+    manager.taskLoaded.connect(&report);
+    ASSERT_TRUE(manager.load(stream));
+    EXPECT_EQ(Utility::HostLimiter::hosts().maxPerHost(), 4);
+    EXPECT_EQ(Utility::HostLimiter::addresses().maxPerHost(), 2);
+    EXPECT_EQ(Utility::HostBuckets::hosts().rate(), 512u * 1024);
+
+    // stopped task is made at once, others wait in queue.
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(reported[0], "stub://host/stopped");
+    EXPECT_EQ(manager.queuedTasks(), 2u);
+
+    reported.clear();
+    manager.taskAdmitted.connect(&report);
+    EXPECT_EQ(manager.perform(NULL, NULL), 2);
+    ASSERT_EQ(reported.size(), 2u);
+    EXPECT_EQ(reported[0], "stub://host/running");
+    EXPECT_EQ(reported[1], "stub://host/queued");
+    EXPECT_EQ(manager.queuedTasks(), 0u);
+
+    // saved again, it's the same tasks and limits.
+    std::stringstream again;
+    ASSERT_TRUE(manager.save(again));
+    StateSettings settings;
+    std::vector<TaskRecord> records = readRecords(again, settings);
+    EXPECT_EQ(settings.maxConnections, 8);
+    EXPECT_EQ(settings.maxActiveTasks, 2);
+    EXPECT_EQ(settings.maxDownloadSpeed, 1024u * 1024);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(findRecord(records, "stub://host/stopped")->state, TaskRecord::RS_WAIT);
+    EXPECT_EQ(findRecord(records, "stub://host/running")->state, TaskRecord::RS_DOWNLOAD);
+    EXPECT_EQ(findRecord(records, "stub://host/running")->priority,
+              DownloadManager::PRIORITY_INTERACTIVE);
+    EXPECT_EQ(findRecord(records, "stub://host/queued")->state, TaskRecord::RS_DOWNLOAD);
+}
+
+TEST_F(DownloadManagerStateTest, LoadTruncated)
+{
+    std::stringstream stream;
+    {
+        DownloadManager manager;
+        fill(manager);
+        ASSERT_TRUE(manager.save(stream));
+    }
+
+    // cut in the second record, the first one is still loaded.
+    std::string data = stream.str();
+    const unsigned char* p = reinterpret_cast<const unsigned char*>(data.data()) +
+        StateWriter::headerSize;
+    size_t first = 4 + (p[0] | p[1] << 8 | p[2] << 16 | size_t(p[3]) << 24) + 4;
+    std::stringstream in(data.substr(0, StateWriter::headerSize + first + 10));
+
+    DownloadManager manager;
+    addProtocol(manager);
+    manager.taskLoaded.connect(&report);
+    EXPECT_FALSE(manager.load(in));
+    EXPECT_EQ(reported.size() + manager.queuedTasks(), 1u);
+
+    std::stringstream empty;
+    EXPECT_FALSE(manager.load(empty));
+}
+
+TEST_F(DownloadManagerStateTest, OpenRoundTrip)
+{
+    const char path[] = "./manager.state";
+    {
+        DownloadManager manager;
+        fill(manager);
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        ASSERT_TRUE(manager.save(out));
+    }
+
+    Utility::HostLimiter::hosts().setMaxPerHost(Utility::HostLimiter::noLimited);
+
+    DownloadManager manager;
+    addProtocol(manager);
+    ASSERT_TRUE(manager.open(path));
+    EXPECT_EQ(Utility::HostLimiter::hosts().maxPerHost(), 4);
+    EXPECT_FALSE(manager.open(path));
+    ASSERT_EQ(manager.storedTasks(), 3u);
+    EXPECT_EQ(manager.queuedTasks(), 2u);
+
+    size_t stopped = manager.storedTasks();
+    TaskSummary summary;
+    for (size_t i=0; i<manager.storedTasks(); ++i)
+    {
+        ASSERT_TRUE(manager.storedTask(i, summary));
+        if (strcmp(summary.uri, "stub://host/stopped") == 0)
+            stopped = i;
+    }
+    ASSERT_LT(stopped, manager.storedTasks());
+    EXPECT_FALSE(manager.storedTask(manager.storedTasks(), summary));
+
+    // queued tasks are made by perform only.
+    ASSERT_TRUE(manager.storedTask(stopped, summary));
+    EXPECT_EQ(summary.state, TaskRecord::RS_WAIT);
+    EXPECT_EQ(summary.priority, DownloadManager::PRIORITY_BACKGROUND);
+    EXPECT_TRUE(manager.startStoredTask((stopped + 1) % 3) == NULL);
+
+    TaskBase* task = manager.startStoredTask(stopped);
+    ASSERT_TRUE(task != NULL);
+    EXPECT_STREQ(task->outputName(), "stopped.iso");
+    EXPECT_STREQ(task->comment(), "stopped task");
+    EXPECT_EQ(task->state(), TaskBase::TASK_DOWNLOAD);
+    EXPECT_TRUE(manager.hasTask(task));
+    EXPECT_EQ(manager.priority(task), DownloadManager::PRIORITY_BACKGROUND);
+    EXPECT_FALSE(manager.storedTask(stopped, summary));
+    EXPECT_TRUE(manager.startStoredTask(stopped) == NULL);
+
+    // one slot is left of 2 active tasks.
+    manager.taskAdmitted.connect(&report);
+    EXPECT_EQ(manager.perform(NULL, NULL), 3);
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(reported[0], "stub://host/running");
+    EXPECT_EQ(manager.queuedTasks(), 1u);
+
+    // made tasks are saved from memory, queued one from the file.
+    std::stringstream stream;
+    ASSERT_TRUE(manager.save(stream));
+    StateSettings settings;
+    std::vector<TaskRecord> records = readRecords(stream, settings);
+    EXPECT_EQ(settings.maxActiveTasks, 2);
+    ASSERT_EQ(records.size(), 3u);
+    EXPECT_EQ(findRecord(records, "stub://host/stopped")->state, TaskRecord::RS_DOWNLOAD);
+    EXPECT_EQ(findRecord(records, "stub://host/running")->state, TaskRecord::RS_DOWNLOAD);
+    EXPECT_EQ(findRecord(records, "stub://host/queued")->state, TaskRecord::RS_QUEUED);
+    EXPECT_EQ(findRecord(records, "stub://host/queued")->comment, "queued task");
+}
+
+TEST_F(DownloadManagerStateTest, AdmitByOpenFiles)
+{
+    DownloadManager manager;
+    addProtocol(manager);
+    manager.setMaxOpenFiles(3);
+    manager.taskAdmitted.connect(&report);
+
+    // the output file and a reader verifying it.
+    TaskBase* busy = manager.addTask("stub://host/busy", "/tmp/", NULL, NULL, NULL);
+    ASSERT_TRUE(busy != NULL);
+    ASSERT_TRUE(manager.startTask(busy));
+    static_cast<StubTask*>(busy)->setFiles(2);
+
+    ASSERT_TRUE(manager.enqueueTask("stub://host/queued1", "/tmp/", NULL, NULL, NULL));
+    ASSERT_TRUE(manager.enqueueTask("stub://host/queued2", "/tmp/", NULL, NULL, NULL));
+    ASSERT_TRUE(manager.enqueueTask("stub://host/queued3", "/tmp/", NULL, NULL, NULL));
+
+    // an admitted task is counted as one file before it opens any.
+    manager.perform(NULL, NULL);
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(reported[0], "stub://host/queued1");
+    manager.perform(NULL, NULL);
+    EXPECT_EQ(reported.size(), 1u);
+
+    // verify is done, its file is free.
+    static_cast<StubTask*>(busy)->setFiles(1);
+    manager.perform(NULL, NULL);
+    ASSERT_EQ(reported.size(), 2u);
+    EXPECT_EQ(reported[1], "stub://host/queued2");
+    EXPECT_EQ(manager.queuedTasks(), 1u);
+
+    // stopped tasks holding nothing don't count.
+    manager.stopTask(busy);
+    static_cast<StubTask*>(busy)->setFiles(0);
+    manager.perform(NULL, NULL);
+    EXPECT_EQ(reported.size(), 3u);
+    EXPECT_EQ(manager.queuedTasks(), 0u);
+}
+
+TEST_F(DownloadManagerStateTest, ConnectionsPerHost)
+{
+    DownloadManager manager;
+    manager.setMaxConnectionsPerHost(2);
+    manager.setMaxConnectionsPerAddress(1);
+
+    // the budget sessions of http tasks take slots from.
+    Utility::HostLimiter& hosts = Utility::HostLimiter::hosts();
+    EXPECT_TRUE(hosts.acquire("busy.test"));
+    EXPECT_TRUE(hosts.acquire("busy.test"));
+    EXPECT_FALSE(hosts.acquire("busy.test"));
+    EXPECT_TRUE(hosts.acquire("other.test"));
+
+    Utility::HostLimiter& addresses = Utility::HostLimiter::addresses();
+    EXPECT_TRUE(addresses.acquire("192.0.2.1"));
+    EXPECT_FALSE(addresses.acquire("192.0.2.1"));
+
+    hosts.release("busy.test");
+    hosts.release("busy.test");
+    hosts.release("other.test");
+    addresses.release("192.0.2.1");
+
+    manager.setMaxConnectionsPerHost(-1);
+    EXPECT_EQ(hosts.maxPerHost(), -1);
+}
+
+TEST_F(DownloadManagerStateTest, SpeedLimits)
+{
+    DownloadManager manager;
+    addProtocol(manager);
+
+    // buckets made before and after the limit are both limited.
+    Utility::TokenBucket* before = Utility::HostBuckets::hosts().bucket("slow.test");
+    manager.setMaxHostSpeed(10000);
+    Utility::TokenBucket* after = Utility::HostBuckets::hosts().bucket("other.test");
+    EXPECT_EQ(before->rate(), 10000u);
+    EXPECT_EQ(after->rate(), 10000u);
+    EXPECT_EQ(Utility::HostBuckets::hosts().bucket("slow.test"), before);
+
+    TaskBase* task = manager.addTask("stub://host/limited", "/tmp/", NULL, NULL, NULL);
+    ASSERT_TRUE(task != NULL);
+    EXPECT_TRUE(manager.setMaxDownloadSpeed(task, 2048));
+    EXPECT_EQ(static_cast<StubTask*>(task)->maxSpeed(), 2048u);
+
+    StubProtocol protocol;
+    StubTask other(&protocol, "stub://host/other", "/tmp/", NULL, NULL, NULL);
+    EXPECT_FALSE(manager.setMaxDownloadSpeed(&other, 2048));
+    EXPECT_EQ(other.maxSpeed(), 0u);
+}
+
+TEST_F(DownloadManagerStateTest, FinishedTasks)
+{
+    const char path[] = "./manager.state";
+    {
+        DownloadManager manager;
+        fill(manager);
+        TaskBase* done = manager.addTask("stub://host/done", "/tmp/", "done.iso", NULL,
+                                         "done task");
+        ASSERT_TRUE(done != NULL);
+        static_cast<StubTask*>(done)->setState(TaskBase::TASK_FINISH);
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        ASSERT_TRUE(manager.save(out));
+    }
+
+    {
+        // the index lists it, it's never made.
+        DownloadManager manager;
+        addProtocol(manager);
+        ASSERT_TRUE(manager.open(path));
+        ASSERT_EQ(manager.storedTasks(), 4u);
+        EXPECT_EQ(manager.queuedTasks(), 2u);
+
+        size_t done = manager.storedTasks();
+        TaskSummary summary;
+        for (size_t i=0; i<manager.storedTasks(); ++i)
+        {
+            ASSERT_TRUE(manager.storedTask(i, summary));
+            if (strcmp(summary.uri, "stub://host/done") == 0)
+                done = i;
+        }
+        ASSERT_LT(done, manager.storedTasks());
+        ASSERT_TRUE(manager.storedTask(done, summary));
+        EXPECT_EQ(summary.state, TaskRecord::RS_FINISH);
+        EXPECT_TRUE(manager.startStoredTask(done) == NULL);
+        EXPECT_TRUE(manager.storedTask(done, summary));
+
+        std::stringstream stream;
+        ASSERT_TRUE(manager.save(stream));
+        StateSettings settings;
+        std::vector<TaskRecord> records = readRecords(stream, settings);
+        ASSERT_EQ(records.size(), 4u);
+        ASSERT_TRUE(findRecord(records, "stub://host/done") != NULL);
+        EXPECT_EQ(findRecord(records, "stub://host/done")->state, TaskRecord::RS_FINISH);
+        EXPECT_EQ(findRecord(records, "stub://host/done")->comment, "done task");
+
+        // removed, it's not saved again.
+        EXPECT_TRUE(manager.removeStoredTask(done));
+        EXPECT_FALSE(manager.storedTask(done, summary));
+        EXPECT_FALSE(manager.removeStoredTask(done));
+
+        std::stringstream again;
+        ASSERT_TRUE(manager.save(again));
+        records = readRecords(again, settings);
+        EXPECT_EQ(records.size(), 3u);
+        EXPECT_TRUE(findRecord(records, "stub://host/done") == NULL);
+    }
+
+    // load keeps it as a record too.
+    std::ifstream in(path, std::ios::binary);
+    DownloadManager manager;
+    addProtocol(manager);
+    manager.taskLoaded.connect(&report);
+    ASSERT_TRUE(manager.load(in));
+    ASSERT_EQ(reported.size(), 1u);
+    EXPECT_EQ(reported[0], "stub://host/stopped");
+
+    std::stringstream stream;
+    ASSERT_TRUE(manager.save(stream));
+    StateSettings settings;
+    std::vector<TaskRecord> records = readRecords(stream, settings);
+    ASSERT_EQ(records.size(), 4u);
+    ASSERT_TRUE(findRecord(records, "stub://host/done") != NULL);
+    EXPECT_EQ(findRecord(records, "stub://host/done")->state, TaskRecord::RS_FINISH);
+}
@@ -0,0 +1,284 @@
+#include "StateStream.h"
+#include "utility/Clock.h"
+#include "utility/Crc32c.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <fstream>
+#include <sstream>
+
+static TaskRecord makeRecord(size_t i)
+{
+    char buffer[64];
+    snprintf(buffer, sizeof(buffer), "http://example.com/file%lu.iso", (unsigned long)i);
+
+    TaskRecord record;
+    record.uri = buffer;
+    record.outputDir = "/tmp/downloads/";
+    record.options = "<Options><Connections>5</Connections></Options>";
+    record.priority = i % 3;
+    record.state = (i % 2 == 0) ? TaskRecord::RS_QUEUED : TaskRecord::RS_WAIT;
+    record.totalSize = i * 1024;
+    record.downloadSize = i * 512;
+    return record;
+}
+
+TEST(StateStreamTest, RoundTrip)
+{
+    std::stringstream stream;
+    StateSettings settings;
+    settings.maxConnections = 40;
+    settings.maxDownloadSpeed = 1024 * 1024;
+    settings.maxConnectionsPerHost = 6;
+    settings.maxConnectionsPerAddress = 2;
+    settings.maxHostSpeed = 300000;
+    {
+        StateWriter writer(stream);
+        ASSERT_EQ(writer.writeHeader(settings), true);
+        for (size_t i=0; i<10000; ++i)
+            ASSERT_EQ(writer.write(makeRecord(i)), true);
+        ASSERT_EQ(writer.finish(), true);
+    }
+
+    StateReader reader(stream, 4);
+    StateSettings loaded;
+    ASSERT_EQ(reader.readHeader(loaded), true);
+    EXPECT_EQ(loaded.maxConnections, 40);
+    EXPECT_EQ(loaded.maxActiveTasks, -1);
+    EXPECT_EQ(loaded.maxDownloadSpeed, 1024u * 1024u);
+    EXPECT_EQ(loaded.maxConnectionsPerHost, 6);
+    EXPECT_EQ(loaded.maxConnectionsPerAddress, 2);
+    EXPECT_EQ(loaded.maxHostSpeed, 300000u);
+
+    size_t count = 0;
+    std::vector<TaskRecord> records;
+    while (reader.read(records))
+    {
+        EXPECT_LE(records.size(), StateReader::batchSize);
+        for (size_t i=0; i<records.size(); ++i, ++count)
+        {
+            TaskRecord expect = makeRecord(count);
+            EXPECT_EQ(records[i].uri, expect.uri);
+            EXPECT_EQ(records[i].outputDir, expect.outputDir);
+            EXPECT_EQ(records[i].outputName, "");
+            EXPECT_EQ(records[i].options, expect.options);
+            EXPECT_EQ(records[i].priority, expect.priority);
+            EXPECT_EQ(records[i].state, expect.state);
+            EXPECT_EQ(records[i].totalSize, expect.totalSize);
+            EXPECT_EQ(records[i].downloadSize, expect.downloadSize);
+        }
+    }
+    EXPECT_EQ(count, 10000u);
+    EXPECT_EQ(reader.complete(), true);
+}
+
+static void put32(std::string& data, uint32_t v)
+{
+    for (int i=0; i<4; ++i)
+        data.push_back(char((v >> (i * 8)) & 0xff));
+}
+
+TEST(StateStreamTest, Version2Header)
+{
+    // header of 32 bytes and an end mark of no record.
+    std::string data("DMS1");
+    put32(data, 2);
+    put32(data, 40);
+    put32(data, 10);
+    put32(data, uint32_t(-1));
+    put32(data, 4096);
+    put32(data, 0);
+    put32(data, Utility::Crc32c::compute(data.data(), data.length()));
+    put32(data, 0xffffffff);
+    std::string end;
+    put32(end, 0);
+    put32(end, 0);
+    put32(end, Utility::Crc32c::compute(end.data(), end.length()));
+    data += end;
+
+    std::stringstream stream(data);
+    StateReader reader(stream, 1);
+    StateSettings settings;
+    ASSERT_EQ(reader.readHeader(settings), true);
+    EXPECT_EQ(settings.maxConnections, 40);
+    EXPECT_EQ(settings.maxActiveTasks, 10);
+    EXPECT_EQ(settings.maxOpenFiles, -1);
+    EXPECT_EQ(settings.maxDownloadSpeed, 4096u);
+    EXPECT_EQ(settings.maxConnectionsPerHost, -1);
+    EXPECT_EQ(settings.maxConnectionsPerAddress, -1);
+    EXPECT_EQ(settings.maxHostSpeed, 0u);
+
+    std::vector<TaskRecord> records;
+    EXPECT_EQ(reader.read(records), false);
+    EXPECT_EQ(reader.complete(), true);
+}
+
+TEST(StateStreamTest, Truncated)
+{
+    std::stringstream stream;
+    {
+        StateWriter writer(stream);
+        writer.writeHeader(StateSettings());
+        for (size_t i=0; i<3; ++i)
+            writer.write(makeRecord(i));
+    }
+
+    // cut in the middle of the last record.
+    std::string whole = stream.str();
+    std::stringstream torn(whole.substr(0, whole.length() - 10));
+
+    StateReader reader(torn, 2);
+    StateSettings settings;
+    ASSERT_EQ(reader.readHeader(settings), true);
+
+    std::vector<TaskRecord> records;
+    ASSERT_EQ(reader.read(records), true);
+    EXPECT_EQ(records.size(), 2u);
+    EXPECT_EQ(reader.read(records), false);
+    EXPECT_EQ(reader.complete(), false);
+}
+
+TEST(StateStreamTest, Corrupted)
+{
+    std::stringstream stream;
+    {
+        StateWriter writer(stream);
+        writer.writeHeader(StateSettings());
+        writer.write(makeRecord(1));
+        writer.finish();
+    }
+
+    std::string data = stream.str();
+    data[StateWriter::headerSize + 30] ^= 0x01;
+    std::stringstream bad(data);
+
+    StateReader reader(bad, 2);
+    StateSettings settings;
+    ASSERT_EQ(reader.readHeader(settings), true);
+
+    std::vector<TaskRecord> records;
+    EXPECT_EQ(reader.read(records), false);
+    EXPECT_EQ(reader.complete(), false);
+
+    std::stringstream empty;
+    StateReader none(empty, 1);
+    EXPECT_EQ(none.readHeader(settings), false);
+}
+
+/**
+ * Benchmark of a daemon restart: save and restore 100k tasks.
+ * It's not run by default, run it with --gtest_also_run_disabled_tests.
+ */
+TEST(StateStreamTest, DISABLED_HundredThousandTasks)
+{
+    const size_t tasks = 100000;
+
+    std::stringstream stream;
+    Utility::Clock::Ms begin = Utility::Clock::now();
+    {
+        StateWriter writer(stream);
+        writer.writeHeader(StateSettings());
+        for (size_t i=0; i<tasks; ++i)
+            writer.write(makeRecord(i));
+        ASSERT_EQ(writer.finish(), true);
+    }
+    Utility::Clock::Ms saved = Utility::Clock::now();
+
+    StateReader reader(stream);
+    StateSettings settings;
+    ASSERT_EQ(reader.readHeader(settings), true);
+    size_t count = 0;
+    std::vector<TaskRecord> records;
+    while (reader.read(records))
+        count += records.size();
+    Utility::Clock::Ms loaded = Utility::Clock::now();
+
+    EXPECT_EQ(count, tasks);
+    EXPECT_EQ(reader.complete(), true);
+
+    printf("%lu tasks, %lu bytes: save %lld ms, load %lld ms with %lu threads\n",
+           (unsigned long)tasks, (unsigned long)stream.str().length(),
+           (long long)(saved - begin), (long long)(loaded - saved),
+           (unsigned long)Utility::ThreadPool::processors());
+    EXPECT_LT(loaded - begin, 10000u);
+}
+
+TEST(StateStreamTest, Index)
+{
+    const char path[] = "./manager.state";
+    const size_t tasks = 100000;
+    {
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        StateWriter writer(out);
+        StateSettings settings;
+        settings.maxActiveTasks = 50;
+        writer.writeHeader(settings);
+        for (size_t i=0; i<tasks; ++i)
+            writer.write(makeRecord(i));
+        ASSERT_EQ(writer.finish(), true);
+    }
+
+    // older readers stop at the end mark.
+    {
+        std::ifstream in(path, std::ios::binary);
+        StateReader reader(in, 2);
+        StateSettings settings;
+        ASSERT_EQ(reader.readHeader(settings), true);
+        size_t count = 0;
+        std::vector<TaskRecord> records;
+        while (reader.read(records))
+            count += records.size();
+        EXPECT_EQ(count, tasks);
+        EXPECT_EQ(reader.complete(), true);
+    }
+
+    Utility::Clock::Ms begin = Utility::Clock::now();
+    StateIndex index;
+    StateSettings settings;
+    ASSERT_EQ(index.open(path, settings), true);
+    Utility::Clock::Ms opened = Utility::Clock::now();
+    printf("open index of %lu tasks: %lld ms\n",
+           (unsigned long)tasks, (long long)(opened - begin));
+
+    EXPECT_EQ(settings.maxActiveTasks, 50);
+    ASSERT_EQ(index.size(), tasks);
+
+    TaskSummary summary;
+    ASSERT_EQ(index.summary(12345, summary), true);
+    EXPECT_STREQ(summary.uri, "http://example.com/file12345.iso");
+    EXPECT_EQ(summary.totalSize, 12345u * 1024);
+    EXPECT_EQ(summary.downloadSize, 12345u * 512);
+    EXPECT_EQ(summary.state, TaskRecord::RS_WAIT);
+    EXPECT_EQ(index.summary(tasks, summary), false);
+
+    TaskRecord record;
+    ASSERT_EQ(index.record(tasks - 1, record), true);
+    EXPECT_EQ(record.uri, makeRecord(tasks - 1).uri);
+    EXPECT_EQ(record.options, makeRecord(tasks - 1).options);
+    EXPECT_EQ(index.record(tasks, record), false);
+
+    index.close();
+    remove(path);
+}
+
+TEST(StateStreamTest, NoIndex)
+{
+    const char path[] = "./manager.state";
+    {
+        // torn before the index.
+        std::ofstream out(path, std::ios::binary | std::ios::trunc);
+        StateWriter writer(out);
+        writer.writeHeader(StateSettings());
+        writer.write(makeRecord(1));
+    }
+
+    StateIndex index;
+    StateSettings settings;
+    EXPECT_EQ(index.open(path, settings), false);
+    EXPECT_EQ(index.isOpen(), false);
+
+    remove(path);
+    EXPECT_EQ(index.open(path, settings), false);
+}
@@ -277,3 +277,38 @@ TEST(BitMapTest, TestFindMaxEmpty)
     EXPECT_EQ(pos, 200);
     EXPECT_EQ(len, 31u);
 }
+
+TEST(BitMapTest, Test3000Size10Byte_setCovered)
+{
+    BitMap map(3000, 10);
+
+    // a block only partly in the range is not set.
+    map.setCovered(355, 990, true);
+    EXPECT_EQ(map.get(35), false);
+    EXPECT_EQ(map.get(36), true);
+    EXPECT_EQ(map.get(98), true);
+    EXPECT_EQ(map.get(99), false);
+
+    map.setCovered(2995, 3000, true);
+    EXPECT_EQ(map.get(299), false);
+    map.setCovered(2990, 3000, true);
+    EXPECT_EQ(map.get(299), true);
+
+    map.setCovered(5, 8, true);
+    EXPECT_EQ(map.find(true), 36u);
+}
+
+TEST(BitMapTest, Test300Size10Byte_merge)
+{
+    BitMap map(300, 10);
+    BitMap other(300, 10);
+
+    map.setRange(0, 5, true);
+    other.setRange(3, 10, true);
+    other.set(29, true);
+    map.merge(other);
+
+    EXPECT_EQ(map.find(false), 10u);
+    EXPECT_EQ(map.find(true, 10), 29u);
+    EXPECT_EQ(other.find(true), 3u);
+}
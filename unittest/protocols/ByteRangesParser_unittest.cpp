@@ -0,0 +1,114 @@
+#include "protocols/http/ByteRangesParser.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+#include <vector>
+
+class TestParser : public ByteRangesParser
+{
+public:
+    explicit TestParser(const std::string& boundary)
+        : ByteRangesParser(boundary)
+        {}
+
+    virtual bool part(size_t begin, size_t end)
+        {
+            begins.push_back(begin);
+            ends.push_back(end);
+            bodies.push_back("");
+            return true;
+        }
+
+    virtual bool data(const char* buffer, size_t len)
+        {
+            bodies.back().append(buffer, len);
+            return true;
+        }
+
+    std::vector<size_t> begins;
+    std::vector<size_t> ends;
+    std::vector<std::string> bodies;
+};
+
+static const char body[] =
+    "preamble\r\n"
+    "--SEP\r\n"
+    "Content-Type: text/plain\r\n"
+    "Content-Range: bytes 0-4/100\r\n"
+    "\r\n"
+    "hello\r\n"
+    "--SEP\r\n"
+    "content-range: bytes 50-59/100\r\n"
+    "\r\n"
+    "--SEP\r\n123\r\n"
+    "--SEP--\r\n";
+
+TEST(ByteRangesParserTest, WholeBody)
+{
+    TestParser parser("SEP");
+
+    EXPECT_EQ(parser.feed(body, sizeof(body) - 1), true);
+    EXPECT_EQ(parser.finished(), true);
+
+    ASSERT_EQ(parser.begins.size(), 2u);
+    EXPECT_EQ(parser.begins[0], 0u);
+    EXPECT_EQ(parser.ends[0], 4u);
+    EXPECT_EQ(parser.bodies[0], "hello");
+    EXPECT_EQ(parser.begins[1], 50u);
+    EXPECT_EQ(parser.ends[1], 59u);
+    // body may contain delimiter itself.
+    EXPECT_EQ(parser.bodies[1], "--SEP\r\n123");
+}
+
+TEST(ByteRangesParserTest, ByteByByte)
+{
+    TestParser parser("SEP");
+
+    for (size_t i=0; i<sizeof(body) - 1; ++i)
+    {
+        ASSERT_EQ(parser.feed(body + i, 1), true);
+    }
+    EXPECT_EQ(parser.finished(), true);
+
+    ASSERT_EQ(parser.bodies.size(), 2u);
+    EXPECT_EQ(parser.bodies[0], "hello");
+    EXPECT_EQ(parser.bodies[1], "--SEP\r\n123");
+}
+
+TEST(ByteRangesParserTest, NoContentRange)
+{
+    TestParser parser("SEP");
+    const char bad[] = "--SEP\r\nContent-Type: text/plain\r\n\r\nhello";
+
+    EXPECT_EQ(parser.feed(bad, sizeof(bad) - 1), false);
+    EXPECT_TRUE(parser.getError() != NULL);
+}
+
+TEST(ByteRangesParserTest, ParseBoundary)
+{
+    std::string boundary;
+
+    EXPECT_EQ(ByteRangesParser::parseBoundary("multipart/byteranges; boundary=3d6b6a416f9b5", boundary), true);
+    EXPECT_EQ(boundary, "3d6b6a416f9b5");
+    EXPECT_EQ(ByteRangesParser::parseBoundary("multipart/byteranges; boundary=\"a b\"", boundary), true);
+    EXPECT_EQ(boundary, "a b");
+    EXPECT_EQ(ByteRangesParser::parseBoundary("text/html; charset=utf-8", boundary), false);
+    EXPECT_EQ(ByteRangesParser::parseBoundary(NULL, boundary), false);
+}
+
+TEST(ByteRangesParserTest, ParseContentRange)
+{
+    size_t begin, end, total;
+
+    EXPECT_EQ(ByteRangesParser::parseContentRange(" bytes 500-999/1234\r\n", begin, end, total), true);
+    EXPECT_EQ(begin, 500u);
+    EXPECT_EQ(end, 999u);
+    EXPECT_EQ(total, 1234u);
+
+    EXPECT_EQ(ByteRangesParser::parseContentRange("bytes 0-0/*", begin, end, total), true);
+    EXPECT_EQ(total, 0u);
+
+    EXPECT_EQ(ByteRangesParser::parseContentRange("bytes 9-1/10", begin, end, total), false);
+    EXPECT_EQ(ByteRangesParser::parseContentRange("items 0-1/10", begin, end, total), false);
+}
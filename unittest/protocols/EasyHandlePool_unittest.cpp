@@ -0,0 +1,86 @@
+#include "protocols/http/EasyHandlePool.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+// pool is shared by all tests, they count from what it has done before.
+static void drain(EasyHandlePool& pool)
+{
+    pool.setMaxIdle(0);
+    pool.setMaxIdle(64);
+}
+
+TEST(EasyHandlePoolTest, Recycle)
+{
+    EasyHandlePool& pool = EasyHandlePool::instance();
+    drain(pool);
+    unsigned long owner = pool.newOwner();
+    unsigned long misses = pool.misses();
+    unsigned long hits = pool.hits();
+
+    bool kept = true;
+    EXPECT_TRUE(pool.get(owner, kept) == NULL);
+    EXPECT_EQ(pool.misses(), misses + 1);
+
+    CURL* handle = curl_easy_init();
+    curl_easy_setopt(handle, CURLOPT_URL, "http://localhost/");
+    pool.put(handle, owner);
+    EXPECT_EQ(pool.idle(), 1u);
+
+    // the same handle of another owner, reset.
+    CURL* ret = pool.get(pool.newOwner(), kept);
+    EXPECT_EQ(ret, handle);
+    EXPECT_FALSE(kept);
+    EXPECT_EQ(pool.hits(), hits + 1);
+    EXPECT_EQ(pool.idle(), 0u);
+
+    char* url = NULL;
+    curl_easy_getinfo(ret, CURLINFO_EFFECTIVE_URL, &url);
+    EXPECT_TRUE(url == NULL || url[0] == '\0');
+
+    pool.put(ret, owner);
+}
+
+TEST(EasyHandlePoolTest, KeepOwnerOptions)
+{
+    EasyHandlePool& pool = EasyHandlePool::instance();
+    drain(pool);
+    unsigned long owner = pool.newOwner();
+    unsigned long other = pool.newOwner();
+
+    CURL* mine = curl_easy_init();
+    CURL* theirs = curl_easy_init();
+    pool.put(mine, owner);
+    pool.put(theirs, other);
+
+    // handle of owner is taken before the newer one of other owner.
+    bool kept = false;
+    CURL* ret = pool.get(owner, kept);
+    EXPECT_EQ(ret, mine);
+    EXPECT_TRUE(kept);
+
+    ret = pool.get(owner, kept);
+    EXPECT_EQ(ret, theirs);
+    EXPECT_FALSE(kept);
+
+    pool.put(mine, owner);
+    pool.put(theirs, other);
+    drain(pool);
+}
+
+TEST(EasyHandlePoolTest, MaxIdle)
+{
+    EasyHandlePool& pool = EasyHandlePool::instance();
+    unsigned long owner = pool.newOwner();
+    pool.setMaxIdle(2);
+
+    pool.put(curl_easy_init(), owner);
+    pool.put(curl_easy_init(), owner);
+    pool.put(curl_easy_init(), owner);
+    EXPECT_EQ(pool.idle(), 2u);
+
+    pool.setMaxIdle(0);
+    EXPECT_EQ(pool.idle(), 0u);
+    pool.setMaxIdle(64);
+}
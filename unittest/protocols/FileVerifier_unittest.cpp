@@ -0,0 +1,110 @@
+#include "protocols/http/FileVerifier.h"
+#include "utility/Crc32c.h"
+#include "utility/Digest.h"
+#include "utility/File.h"
+#include "utility/ThreadPool.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+static const char path[] = "./verify.file";
+
+static std::string digestOf(const std::string& data)
+{
+    std::auto_ptr<Utility::Digest> digest(Utility::Digest::create("sha-256"));
+    digest->update(data.c_str(), data.length());
+    return digest->hexFinal();
+}
+
+static std::string makeFile()
+{
+    std::string data;
+    for (size_t i=0; i<300000; ++i)
+        data += char('a' + i % 26);
+
+    Utility::File out;
+    out.open(path, Utility::File::OF_Write | Utility::File::OF_Create | Utility::File::OF_Truncate);
+    out.write(data.c_str(), data.length());
+
+    return data;
+}
+
+TEST(FileVerifierTest, CrcAndDigest)
+{
+    std::string data = makeFile();
+
+    // small chunks, so it takes steps and chunk CRCs are combined.
+    FileVerifier verifier(10000);
+    ASSERT_EQ(verifier.open(path), true);
+    EXPECT_EQ(verifier.size(), data.length());
+    ASSERT_EQ(verifier.setDigest("SHA-256"), true);
+
+    Utility::ThreadPool pool(4);
+    int steps = 0;
+    while (verifier.step(pool))
+    {
+        ++steps;
+        EXPECT_EQ(verifier.goodSize(), verifier.position());
+    }
+    EXPECT_GT(steps, 1);
+    EXPECT_EQ(verifier.done(), true);
+
+    EXPECT_EQ(verifier.crc(), Utility::Crc32c::compute(data.c_str(), data.length()));
+    EXPECT_EQ(verifier.digest(), digestOf(data));
+    EXPECT_EQ(verifier.badPieces().size(), 0u);
+
+    remove(path);
+}
+
+TEST(FileVerifierTest, BadPieces)
+{
+    std::string data = makeFile();
+
+    std::vector<std::string> hashes;
+    for (size_t i=0; i<data.length(); i+=32768)
+        hashes.push_back(digestOf(data.substr(i, 32768)));
+    hashes[3][0] = (hashes[3][0] == '0') ? '1' : '0';
+    hashes[7][0] = (hashes[7][0] == '0') ? '1' : '0';
+
+    FileVerifier verifier(65536);
+    ASSERT_EQ(verifier.open(path), true);
+    EXPECT_EQ(verifier.setPieces("sha-256", 32768, std::vector<std::string>(3)), false);
+    EXPECT_EQ(verifier.setPieces("sha-3", 32768, hashes), false);
+    ASSERT_EQ(verifier.setPieces("sha-256", 32768, hashes), true);
+
+    Utility::ThreadPool pool(3);
+    while (verifier.step(pool))
+    {}
+
+    ASSERT_EQ(verifier.badPieces().size(), 2u);
+    EXPECT_EQ(verifier.badPieces()[0], 3u);
+    EXPECT_EQ(verifier.badPieces()[1], 7u);
+    EXPECT_EQ(verifier.goodSize(), 3u * 32768);
+
+    remove(path);
+}
+
+TEST(FileVerifierTest, EmptyAndMissing)
+{
+    {
+        Utility::File out;
+        out.open(path, Utility::File::OF_Write | Utility::File::OF_Create | Utility::File::OF_Truncate);
+    }
+
+    FileVerifier verifier;
+    ASSERT_EQ(verifier.open(path), true);
+    ASSERT_EQ(verifier.setDigest("sha-256"), true);
+
+    Utility::ThreadPool pool(2);
+    EXPECT_EQ(verifier.step(pool), false);
+    EXPECT_EQ(verifier.crc(), 0u);
+    EXPECT_EQ(verifier.digest(), digestOf(""));
+
+    remove(path);
+    EXPECT_EQ(verifier.open(path), false);
+}
@@ -2,6 +2,7 @@
 
 #include "protocols/http/HttpTask.h"
 #include "protocols/http/HttpSession.h"
+#include "protocols/http/EasyHandlePool.h"
 
 #include <gtest/gtest.h>
 
@@ -13,15 +14,34 @@ std::string testUri;
 HttpSession *ses = NULL;
 HttpConfigure conf;
 
-HttpTask::HttpTask() {}
-HttpTask::~HttpTask() {}
+HttpTask::HttpTask() : template_(NULL), handleOwner_(EasyHandlePool::instance().newOwner()), headers_(NULL) {}
+HttpTask::~HttpTask() { if (template_ != NULL) curl_easy_cleanup(template_); }
 const char* HttpTask::options() { return NULL; }
 bool HttpTask::fdSet(fd_set* /*read*/, fd_set* /*write*/, fd_set* /*exc*/, int* /*max*/) { return true; }
+long HttpTask::timeout() { return -1; }
 bool HttpTask::start() { return false; }
 bool HttpTask::stop() { return false; }
 size_t HttpTask::performDownload() { return 0; }
 size_t HttpTask::performUpload() { return 0; }
 const char* HttpTask::strerror(int error) { error = error; return NULL; }
+int HttpTask::connectionDemand() { return 1; }
+int HttpTask::openFiles() { return 0; }
+void HttpTask::setConnectionLimit(int /*limit*/) {}
+void HttpTask::setSpeedLimiter(Utility::TokenBucket* /*parent*/) {}
+void HttpTask::setSpeedShare(size_t /*bytesPerSecond*/) {}
+void HttpTask::setMaxDownloadSpeed(size_t /*bytesPerSecond*/) {}
+bool HttpTask::mayReceive(HttpSession* /*ses*/) { return true; }
+void HttpTask::consume(HttpSession* /*ses*/, size_t /*bytes*/) {}
+
+CURL* HttpTask::handleTemplate()
+{
+    if (template_ == NULL)
+    {
+        template_ = curl_easy_init();
+        HttpSession::setTaskOptions(*this, template_);
+    }
+    return template_;
+}
 
 void HttpTask::setInternalState(InternalState state)
 {
@@ -57,6 +77,16 @@ void HttpTask::sessionFinish(HttpSession* /*ses*/)
     file_.close();
 }
 
+bool HttpTask::checkSource(HttpSession* /*ses*/)
+{
+    return true;
+}
+
+void HttpTask::rejectMultiRange()
+{
+    printf("multi-range rejected\n");
+}
+
 bool HttpTask::writeFile(size_t pos, void* buffer, size_t size)
 {
     if (pos != 0)
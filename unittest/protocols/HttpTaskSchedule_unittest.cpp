@@ -0,0 +1,590 @@
+#include "protocols/http/HttpTask.h"
+#include "protocols/http/HttpSession.h"
+#include "lib/utility/HostLimiter.h"
+#include "lib/utility/Crc32c.h"
+
+#include <gtest/gtest.h>
+
+#include <signal.h>
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+// What every stubbed session is answered, tests set it before sessions are made.
+struct Reply
+{
+    long code;
+    double length;
+    std::string lastModified;
+};
+
+static Reply reply;
+
+// Sessions never connect, the task only sees their ranges and the reply.
+HttpSession::HttpSession(HttpTask& task, size_t pos, long length)
+    : task_(task),
+      handle_(curl_easy_init()),
+      pos_(pos),
+      length_(length),
+      multiRange_(false),
+      bodyStarted_(false),
+      skip_(0),
+      parser_(NULL),
+      startTime_(0),
+      address_(-1),
+      connectTo_(NULL),
+      source_(0),
+      lastModified_(reply.lastModified),
+      rangesRefused_(false)
+{
+    setRange();
+}
+
+HttpSession::HttpSession(HttpTask& task, const Ranges& ranges)
+    : task_(task),
+      handle_(curl_easy_init()),
+      pos_(ranges.front().pos),
+      length_(ranges.front().length),
+      ranges_(ranges.begin() + 1, ranges.end()),
+      multiRange_(ranges.size() > 1),
+      bodyStarted_(false),
+      skip_(0),
+      parser_(NULL),
+      startTime_(0),
+      address_(-1),
+      connectTo_(NULL),
+      source_(0),
+      lastModified_(reply.lastModified),
+      rangesRefused_(false)
+{
+    setRange();
+}
+
+HttpSession::~HttpSession()
+{
+    curl_easy_cleanup(handle_);
+}
+
+bool HttpSession::reset(const Ranges& ranges)
+{
+    pos_ = ranges.front().pos;
+    length_ = ranges.front().length;
+    ranges_.assign(ranges.begin() + 1, ranges.end());
+    multiRange_ = (ranges.size() > 1);
+    return setRange();
+}
+
+bool HttpSession::checkFinish()
+{
+    return length_ == 0 && ranges_.size() == 0;
+}
+
+// the reply comes in when task asks for it.
+long HttpSession::getResponseCode()
+{
+    lastModified_ = reply.lastModified;
+    return reply.code;
+}
+
+double HttpSession::contentLength() { return reply.length; }
+bool HttpSession::probeRange() { return true; }
+bool HttpSession::setTaskOptions(HttpTask& /*task*/, CURL* /*handle*/) { return true; }
+
+void HttpSession::restart(size_t pos, long length)
+{
+    pos_ = pos;
+    length_ = length;
+    ranges_.clear();
+    multiRange_ = false;
+}
+
+bool HttpSession::setAddress(int index, const std::string& /*connectTo*/)
+{
+    address_ = index;
+    return true;
+}
+
+bool HttpSession::setSource(int index, const std::string& /*uri*/)
+{
+    source_ = index;
+    return true;
+}
+
+bool HttpSession::setRange()
+{
+    rangeString_ = (length_ == UNKNOWN_LEN) ? "" : "ranged";
+    return true;
+}
+
+struct HttpTaskUnitTest
+{
+    static void setUri(HttpTask& task, const char* uri) { task.uri_ = uri; }
+    static HttpConfigure& config(HttpTask& task) { return task.config_; }
+    static std::vector<HttpSession*>& sessions(HttpTask& task) { return task.sessions_; }
+    static std::vector<HttpSession*>& finished(HttpTask& task) { return task.finishedSessions_; }
+    static bool deferred(HttpTask& task) { return task.deferred_; }
+
+    static void setAddresses(HttpTask& task, const char* first, const char* second)
+        {
+            task.metrics_.addresses.clear();
+            task.metrics_.addresses.push_back(AddressMetrics(first));
+            task.metrics_.addresses.push_back(AddressMetrics(second));
+        }
+    static size_t totalSize(HttpTask& task) { return task.totalSize_; }
+
+    /**
+     * Task past its first response, with the first session on the whole file.
+     */
+    static void download(HttpTask& task, size_t size, bool journal = false)
+        {
+            task.outputDir_ = "./";
+            task.outputName_ = "schedule.download";
+            task.config_.resumeJournal = journal;
+            if (journal)
+                ASSERT_TRUE(task.openFile());
+            task.handle_ = curl_multi_init();
+            task.totalSize_ = size;
+            task.setValidators("", reply.lastModified);
+
+            ASSERT_TRUE(task.acquireSource(0));
+            HttpSession* ses = new HttpSession(task, 0, long(size));
+            curl_multi_add_handle(task.handle_, ses->handle());
+            task.sessions_.push_back(ses);
+            task.startDownload(ses);
+        }
+
+    static void setDone(HttpTask& task, size_t begin, size_t end)
+        {
+            task.downloadBitmap_.setCovered(begin, end, true);
+        }
+
+    static bool write(HttpTask& task, size_t pos, std::vector<char>& data, size_t begin, size_t end)
+        {
+            return task.writeFile(pos + begin, &data[begin], end - begin);
+        }
+
+    static void checkpoint(HttpTask& task) { task.checkpoint(true); }
+    static RangeSet::Ranges holes(HttpTask& task) { return task.written_.missing(0, task.totalSize_); }
+    static bool readingCrcs(HttpTask& task) { return task.crcHasher_.started(); }
+    static bool crcsRead(HttpTask& task) { return task.crcHasher_.done(); }
+    static const ResumeJournal::Crcs& journalCrcs(HttpTask& task) { return task.journal_.crcs(); }
+
+    static void finish(HttpTask& task, HttpSession* ses) { task.sessionFinish(ses); }
+    static void sessionsDone(HttpTask& task)
+        {
+            task.hasSessionFinish();
+            task.clearSessions();
+        }
+    static CURLM* multi(HttpTask& task) { return task.handle_; }
+    static void fillHoles(HttpTask& task) { task.fillHoles(); }
+    static bool checkValidators(HttpTask& task, HttpSession* ses)
+        {
+            return task.checkValidators(ses);
+        }
+};
+
+typedef std::vector<HttpSession*> Sessions;
+
+class HttpTaskScheduleTest : public ::testing::Test
+{
+protected:
+    void SetUp()
+        {
+            reply.code = 206;
+            reply.length = -1;
+            reply.lastModified = "Mon, 19 Oct 2026 10:00:00 GMT";
+        }
+
+    void TearDown()
+        {
+            HttpTask::hostLimiter().setMaxPerHost(Utility::HostLimiter::noLimited);
+            HttpTask::addressLimiter().setMaxPerHost(Utility::HostLimiter::noLimited);
+            remove("./schedule.download");
+            remove("./schedule.download.journal");
+        }
+};
+
+// sessions are next to each other, cover the file, and start on block boundaries.
+static void expectCovered(Sessions& sessions, size_t size)
+{
+    size_t pos = 0;
+    for (size_t i=0; i<sessions.size(); ++i)
+    {
+        EXPECT_EQ(sessions[i]->pos(), pos);
+        EXPECT_EQ(sessions[i]->pos() % 512, 0u);
+        pos += sessions[i]->length();
+    }
+    EXPECT_EQ(pos, size);
+}
+
+TEST_F(HttpTaskScheduleTest, SplitToBlockAlignedSessions)
+{
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://split.test/file");
+    HttpTaskUnitTest::download(task, 1000000);
+
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    EXPECT_EQ(sessions.size(), 5u);
+    expectCovered(sessions, 1000000);
+    EXPECT_FALSE(HttpTaskUnitTest::deferred(task));
+}
+
+TEST_F(HttpTaskScheduleTest, SplitKeepsMinimumLength)
+{
+    // 20 blocks of 512 bytes at least, 30000 bytes has room for two sessions.
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://minimum.test/file");
+    HttpTaskUnitTest::download(task, 30000);
+
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    EXPECT_EQ(sessions.size(), 2u);
+    expectCovered(sessions, 30000);
+    for (size_t i=0; i<sessions.size(); ++i)
+        EXPECT_GE(sessions[i]->length(), 20 * 512);
+}
+
+TEST_F(HttpTaskScheduleTest, FillHolesSkipsDoneBlocks)
+{
+    HttpTask task;
+    HttpTaskUnitTest::config(task).sessionNumber = 3;
+    HttpTaskUnitTest::setUri(task, "http://holes.test/file");
+    HttpTaskUnitTest::download(task, 300 * 512);
+
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    ASSERT_EQ(sessions.size(), 3u);
+    HttpSession* middle = sessions[1];
+    size_t begin = middle->pos();
+    size_t end = begin + middle->length();
+
+    // middle session stops with 10 blocks done after its first 10.
+    HttpTaskUnitTest::setDone(task, begin + 10 * 512, begin + 20 * 512);
+    HttpTaskUnitTest::finish(task, middle);
+    HttpTaskUnitTest::fillHoles(task);
+
+    // one session may start, the short hole is asked with no longer hole after it.
+    ASSERT_EQ(sessions.size(), 3u);
+    HttpSession* ses = sessions.back();
+    EXPECT_EQ(ses->pos(), begin);
+    EXPECT_EQ(ses->length(), 10 * 512);
+    EXPECT_EQ(ses->ranges().size(), 0u);
+
+    // with a free session the long hole is asked too.
+    HttpTaskUnitTest::config(task).sessionNumber = 4;
+    HttpTaskUnitTest::fillHoles(task);
+    ASSERT_EQ(sessions.size(), 4u);
+    EXPECT_EQ(sessions.back()->pos(), begin + 20 * 512);
+    EXPECT_EQ(sessions.back()->pos() + sessions.back()->length(), end);
+}
+
+TEST_F(HttpTaskScheduleTest, RestartOnFullReply)
+{
+    HttpTask task;
+    HttpTaskUnitTest::config(task).sessionNumber = 3;
+    HttpTaskUnitTest::setUri(task, "http://restart.test/file");
+    HttpTaskUnitTest::download(task, 300 * 512);
+
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    ASSERT_EQ(sessions.size(), 3u);
+
+    // same file answered whole to a range, server doesn't support range.
+    HttpSession* ses = sessions[1];
+    reply.code = 200;
+    reply.length = 300 * 512;
+    EXPECT_TRUE(HttpTaskUnitTest::checkValidators(task, ses));
+
+    ASSERT_EQ(sessions.size(), 1u);
+    EXPECT_EQ(sessions[0], ses);
+    EXPECT_EQ(ses->pos(), 0u);
+    EXPECT_EQ(ses->length(), 300 * 512);
+    EXPECT_EQ(HttpTaskUnitTest::finished(task).size(), 2u);
+}
+
+// a failed session without mirrors ends the task with an error, not in a stuck one.
+TEST_F(HttpTaskScheduleTest, FailWithoutMirrors)
+{
+    HttpTask task;
+    HttpTaskUnitTest::config(task).sessionNumber = 1;
+    HttpTaskUnitTest::setUri(task, "http://fail.test/file");
+    HttpTaskUnitTest::download(task, 4 * 512);
+
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    ASSERT_EQ(sessions.size(), 1u);
+
+    // the handle has no url, curl fails it at once.
+    HttpSession* ses = sessions[0];
+    curl_easy_setopt(ses->handle(), CURLOPT_PRIVATE, ses);
+    int running = 1;
+    while (running > 0)
+        curl_multi_perform(HttpTaskUnitTest::multi(task), &running);
+
+    HttpTaskUnitTest::sessionsDone(task);
+    EXPECT_EQ(sessions.size(), 0u);
+    EXPECT_EQ(task.state(), TaskBase::TASK_ERROR);
+}
+
+TEST_F(HttpTaskScheduleTest, KeepWrittenOnFullReply)
+{
+    HttpTask task;
+    HttpTaskUnitTest::config(task).sessionNumber = 3;
+    HttpTaskUnitTest::setUri(task, "http://keep.test/file");
+    HttpTaskUnitTest::download(task, 300 * 512, true);
+
+    std::vector<char> data(300 * 512);
+    for (size_t i=0; i<data.size(); ++i)
+        data[i] = char(i * 13);
+    ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, data, 0, 50 * 512));
+    ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, data, 200 * 512, 210 * 512));
+
+    // same file answered whole, what's written is kept.
+    HttpSession* ses = HttpTaskUnitTest::sessions(task)[1];
+    reply.code = 200;
+    reply.length = 300 * 512;
+    EXPECT_TRUE(HttpTaskUnitTest::checkValidators(task, ses));
+    ASSERT_EQ(HttpTaskUnitTest::sessions(task).size(), 1u);
+    EXPECT_EQ(task.downloadSize(), 60u * 512);
+
+    // the whole stream writes only the holes.
+    ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, data, 0, 100 * 512 + 7));
+    ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, data, 100 * 512 + 7, 300 * 512));
+    EXPECT_EQ(task.downloadSize(), 300u * 512);
+
+    std::vector<char> file(data.size());
+    FILE* f = fopen("./schedule.download", "rb");
+    ASSERT_TRUE(f != NULL);
+    EXPECT_EQ(fread(&file[0], 1, file.size(), f), file.size());
+    fclose(f);
+    EXPECT_TRUE(file == data);
+}
+
+TEST_F(HttpTaskScheduleTest, KeepWrittenWithoutValidators)
+{
+    reply.lastModified = "";
+
+    HttpTask task;
+    HttpTaskUnitTest::config(task).sessionNumber = 3;
+    HttpTaskUnitTest::setUri(task, "http://novalidator.test/file");
+    HttpTaskUnitTest::download(task, 300 * 512, true);
+
+    std::vector<char> data(300 * 512, 'a');
+    ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, data, 0, 20 * 512));
+
+    // nothing to tell a change but the length, the same one keeps data.
+    HttpSession* ses = HttpTaskUnitTest::sessions(task)[2];
+    reply.code = 200;
+    reply.length = 300 * 512;
+    EXPECT_TRUE(HttpTaskUnitTest::checkValidators(task, ses));
+    EXPECT_EQ(task.downloadSize(), 20u * 512);
+    EXPECT_EQ(ses->pos(), 0u);
+    EXPECT_EQ(ses->length(), 300 * 512);
+}
+
+TEST_F(HttpTaskScheduleTest, RestartChangedFile)
+{
+    HttpTask task;
+    HttpTaskUnitTest::config(task).sessionNumber = 3;
+    HttpTaskUnitTest::setUri(task, "http://changed.test/file");
+    HttpTaskUnitTest::download(task, 300 * 512);
+
+    // a new file of another length, it's downloaded again and split.
+    HttpSession* ses = HttpTaskUnitTest::sessions(task)[2];
+    reply.code = 200;
+    reply.length = 400 * 512;
+    reply.lastModified = "Tue, 20 Oct 2026 10:00:00 GMT";
+    EXPECT_TRUE(HttpTaskUnitTest::checkValidators(task, ses));
+
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    EXPECT_EQ(HttpTaskUnitTest::totalSize(task), 400u * 512);
+    ASSERT_EQ(sessions.size(), 3u);
+    EXPECT_EQ(sessions[0], ses);
+    expectCovered(sessions, 400 * 512);
+}
+
+TEST_F(HttpTaskScheduleTest, DeferWhenHostIsBusy)
+{
+    HttpTask::hostLimiter().setMaxPerHost(2);
+
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://busy.test/file");
+    HttpTaskUnitTest::download(task, 1000000);
+
+    // split waits for a free connection of host.
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    EXPECT_EQ(sessions.size(), 2u);
+    EXPECT_TRUE(HttpTaskUnitTest::deferred(task));
+    expectCovered(sessions, 1000000);
+    EXPECT_FALSE(task.metrics().parallel);
+}
+
+TEST_F(HttpTaskScheduleTest, MirrorOfBusyHost)
+{
+    HttpTask::hostLimiter().setMaxPerHost(1);
+
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://origin.test/file");
+    task.addMirror("http://mirror.test/file");
+    HttpTaskUnitTest::download(task, 1000000);
+
+    // connection of origin is taken by the first session, the mirror takes one of its own.
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    ASSERT_EQ(sessions.size(), 2u);
+    EXPECT_EQ(sessions[0]->source(), 0);
+    EXPECT_EQ(sessions[1]->source(), 1);
+    EXPECT_TRUE(HttpTaskUnitTest::deferred(task));
+    EXPECT_EQ(HttpTask::hostLimiter().connections("origin.test"), 1);
+    EXPECT_EQ(HttpTask::hostLimiter().connections("mirror.test"), 1);
+}
+
+TEST_F(HttpTaskScheduleTest, ReadBackCrcsInBackground)
+{
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://crc.test/file");
+    HttpTaskUnitTest::download(task, 3 * 1024 * 1024, true);
+    size_t span = ResumeJournal::crcSpan;
+
+    // second half of check block 0 comes before its first half.
+    std::vector<char> data(span);
+    for (size_t i=0; i<data.size(); ++i)
+        data[i] = char(i * 7);
+    ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, data, span / 2, span));
+    ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, data, 0, span / 2));
+
+    // checkpoint doesn't wait for the block read back.
+    HttpTaskUnitTest::checkpoint(task);
+    EXPECT_TRUE(HttpTaskUnitTest::readingCrcs(task));
+    EXPECT_EQ(HttpTaskUnitTest::journalCrcs(task).count(0), 0u);
+
+    for (int i=0; i<1000 && !HttpTaskUnitTest::crcsRead(task); ++i)
+        usleep(1000);
+    ASSERT_TRUE(HttpTaskUnitTest::crcsRead(task));
+
+    // a later checkpoint saves its CRC.
+    HttpTaskUnitTest::checkpoint(task);
+    EXPECT_FALSE(HttpTaskUnitTest::readingCrcs(task));
+    ASSERT_EQ(HttpTaskUnitTest::journalCrcs(task).count(0), 1u);
+    EXPECT_EQ(HttpTaskUnitTest::journalCrcs(task).find(0)->second,
+              Utility::Crc32c::compute(&data[0], data.size()));
+}
+
+TEST_F(HttpTaskScheduleTest, DeferWhenAddressesAreBusy)
+{
+    HttpTask::addressLimiter().setMaxPerHost(1);
+
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://addresses.test/file");
+    HttpTaskUnitTest::setAddresses(task, "192.0.2.1", "192.0.2.2");
+    HttpTaskUnitTest::download(task, 1000000);
+
+    // first session isn't pinned, split takes one connection of each address.
+    Sessions& sessions = HttpTaskUnitTest::sessions(task);
+    ASSERT_EQ(sessions.size(), 3u);
+    EXPECT_EQ(sessions[1]->address() + sessions[2]->address(), 1);
+    EXPECT_TRUE(HttpTaskUnitTest::deferred(task));
+    EXPECT_EQ(HttpTask::addressLimiter().connections("192.0.2.1"), 1);
+    EXPECT_EQ(HttpTask::addressLimiter().connections("192.0.2.2"), 1);
+    expectCovered(sessions, 1000000);
+}
+
+// file of a task killed in a checkpoint, with what the journal doesn't claim lost.
+static void crashInCheckpoint(const std::vector<char>& data, size_t cut)
+{
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://crash.test/file");
+    HttpTaskUnitTest::download(task, data.size(), true);
+
+    std::vector<char> copy(data);
+    HttpTaskUnitTest::write(task, 0, copy, 0, 100 * 512);
+    HttpTaskUnitTest::checkpoint(task);
+    HttpTaskUnitTest::write(task, 0, copy, 150 * 512, 200 * 512);
+    HttpTaskUnitTest::write(task, 0, copy, 250 * 512, 260 * 512);
+
+    // the journal can't grow past cut bytes, the write is killed by SIGXFSZ there.
+    struct stat st;
+    if (stat("./schedule.download.journal", &st) != 0)
+        _exit(1);
+    struct rlimit limit;
+    limit.rlim_cur = limit.rlim_max = rlim_t(st.st_size) + cut;
+    setrlimit(RLIMIT_FSIZE, &limit);
+
+    HttpTaskUnitTest::checkpoint(task);
+    _exit(0);
+}
+
+TEST_F(HttpTaskScheduleTest, ResumeAfterCrashInCheckpoint)
+{
+    std::vector<char> data(300 * 512);
+    for (size_t i=0; i<data.size(); ++i)
+        data[i] = char(i * 31 + 7);
+
+    // the second checkpoint appends two ranges.
+    size_t records = 2 * ResumeJournal::recordSize;
+    for (size_t cut=0; cut<=records; ++cut)
+    {
+        remove("./schedule.download");
+        remove("./schedule.download.journal");
+
+        pid_t pid = fork();
+        ASSERT_NE(pid, -1);
+        if (pid == 0)
+            crashInCheckpoint(data, cut);
+
+        int status = 0;
+        ASSERT_EQ(waitpid(pid, &status, 0), pid);
+        if (cut < records)
+        {
+            ASSERT_TRUE(WIFSIGNALED(status));
+            EXPECT_EQ(WTERMSIG(status), SIGXFSZ);
+        }
+        else
+        {
+            ASSERT_TRUE(WIFEXITED(status));
+            EXPECT_EQ(WEXITSTATUS(status), 0);
+        }
+
+        // bytes the journal doesn't claim may not have reached the disk.
+        RangeSet journaled;
+        {
+            ResumeJournal journal;
+            ASSERT_TRUE(journal.open("./schedule.download.journal", data.size(), 512));
+            for (size_t i=0; i<journal.ranges().size(); ++i)
+                journaled.add(journal.ranges()[i].first, journal.ranges()[i].second);
+        }
+        RangeSet::Ranges lost = journaled.missing(0, data.size());
+        FILE* f = fopen("./schedule.download", "r+b");
+        ASSERT_TRUE(f != NULL);
+        for (size_t i=0; i<lost.size(); ++i)
+        {
+            std::vector<char> garbage(lost[i].second - lost[i].first, char(0xee));
+            fseek(f, long(lost[i].first), SEEK_SET);
+            fwrite(&garbage[0], 1, garbage.size(), f);
+        }
+        fclose(f);
+
+        HttpTask task;
+        HttpTaskUnitTest::setUri(task, "http://crash.test/file");
+        HttpTaskUnitTest::download(task, data.size(), true);
+
+        // only whole records are taken.
+        size_t kept = cut / ResumeJournal::recordSize;
+        EXPECT_EQ(task.downloadSize(),
+                  100u * 512 + (kept > 0 ? 50 * 512 : 0) + (kept > 1 ? 10 * 512 : 0));
+
+        RangeSet::Ranges holes = HttpTaskUnitTest::holes(task);
+        std::vector<char> copy(data);
+        for (size_t i=0; i<holes.size(); ++i)
+            ASSERT_TRUE(HttpTaskUnitTest::write(task, 0, copy, holes[i].first, holes[i].second));
+        EXPECT_EQ(task.downloadSize(), data.size());
+        HttpTaskUnitTest::checkpoint(task);
+
+        std::vector<char> file(data.size());
+        f = fopen("./schedule.download", "rb");
+        ASSERT_TRUE(f != NULL);
+        EXPECT_EQ(fread(&file[0], 1, file.size(), f), file.size());
+        fclose(f);
+        ASSERT_TRUE(file == data) << "cut at " << cut;
+    }
+}
@@ -22,8 +22,58 @@ struct HttpTaskUnitTest
             else
                 task.outputName_ = "";
         }
+    static bool verify(HttpTask& task) { return task.verify(); }
+    static void setTotalSize(HttpTask& task, size_t size) { task.totalSize_ = size; }
 };
 
+static void writeFile(const char* path, const std::string& data)
+{
+    FILE* file = fopen(path, "wb");
+    ASSERT_TRUE(file != NULL);
+    fwrite(data.data(), 1, data.length(), file);
+    fclose(file);
+}
+
+TEST(HttpTaskTest, VerifyNeedsSomethingToCompare)
+{
+    writeFile("./verify.download", std::string(1000, 'x'));
+
+    HttpTask task;
+    HttpTaskUnitTest::setUri(task, "http://localhost/verify");
+    HttpTaskUnitTest::setOutput(task, "./", "verify.download");
+    EXPECT_FALSE(HttpTaskUnitTest::verify(task));
+
+    // a different size tells the file is not the one.
+    HttpTaskUnitTest::setTotalSize(task, 999);
+    EXPECT_FALSE(HttpTaskUnitTest::verify(task));
+
+    HttpTaskUnitTest::setTotalSize(task, 1000);
+    EXPECT_TRUE(HttpTaskUnitTest::verify(task));
+
+    remove("./verify.download");
+}
+
+TEST(HttpTaskTest, PieceBlocksHaveMinimum)
+{
+    // 1000 bytes pieces share only 8 bytes with 512 bytes blocks, the whole piece is a block.
+    HttpTask task;
+    HttpTaskUnitTest::setTotalSize(task, 30000);
+    EXPECT_TRUE(task.loadPieces("sha-1", 1000, std::vector<std::string>(30, "")));
+    EXPECT_EQ(task.configure().bytesPerBlock, 1000);
+
+    // 3000 bytes pieces are cut to the smallest blocks over 512 bytes.
+    HttpTask cut;
+    HttpTaskUnitTest::setTotalSize(cut, 30000);
+    EXPECT_TRUE(cut.loadPieces("sha-1", 3000, std::vector<std::string>(10, "")));
+    EXPECT_EQ(cut.configure().bytesPerBlock, 600);
+
+    // pieces shorter than a block are not used.
+    HttpTask tiny;
+    HttpTaskUnitTest::setTotalSize(tiny, 30000);
+    EXPECT_FALSE(tiny.loadPieces("sha-1", 100, std::vector<std::string>(300, "")));
+    EXPECT_EQ(tiny.configure().bytesPerBlock, 512);
+}
+
 TEST(HttpTaskTest, Normal)
 {
     HttpTask task;
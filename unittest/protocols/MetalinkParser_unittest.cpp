@@ -0,0 +1,57 @@
+#include "protocols/http/MetalinkParser.h"
+
+#include <gtest/gtest.h>
+
+static const char meta4[] =
+    "<?xml version=\"1.0\" encoding=\"UTF-8\"?>\n"
+    "<metalink xmlns=\"urn:ietf:params:xml:ns:metalink\">\n"
+    "  <file name=\"../dir/example.iso\">\n"
+    "    <size>1048576</size>\n"
+    "    <hash type=\"md5\">0123</hash>\n"
+    "    <hash type=\"sha-256\">ABCDEF</hash>\n"
+    "    <pieces length=\"524288\" type=\"sha-256\">\n"
+    "      <hash>aa</hash>\n"
+    "      <hash>BB</hash>\n"
+    "    </pieces>\n"
+    "    <url priority=\"2\">http://b.example.com/example.iso</url>\n"
+    "    <url>http://c.example.com/example.iso</url>\n"
+    "    <url priority=\"1\">http://a.example.com/example.iso</url>\n"
+    "  </file>\n"
+    "  <file name=\"other\">\n"
+    "    <url>http://other.example.com/other</url>\n"
+    "  </file>\n"
+    "</metalink>\n";
+
+TEST(MetalinkParserTest, Parse)
+{
+    MetalinkParser parser;
+    ASSERT_EQ(parser.parse(meta4), true);
+
+    const Metalink& m = parser.metalink();
+    EXPECT_EQ(m.name, "example.iso");
+    EXPECT_EQ(m.size, 1048576u);
+    EXPECT_EQ(m.hashType, "sha-256");
+    EXPECT_EQ(m.hash, "abcdef");
+    EXPECT_EQ(m.pieceType, "sha-256");
+    EXPECT_EQ(m.pieceLength, 524288u);
+    ASSERT_EQ(m.pieces.size(), 2u);
+    EXPECT_EQ(m.pieces[0], "aa");
+    EXPECT_EQ(m.pieces[1], "bb");
+
+    // sorted by priority, only urls of first file.
+    ASSERT_EQ(m.uris.size(), 3u);
+    EXPECT_EQ(m.uris[0], "http://a.example.com/example.iso");
+    EXPECT_EQ(m.uris[1], "http://b.example.com/example.iso");
+    EXPECT_EQ(m.uris[2], "http://c.example.com/example.iso");
+}
+
+TEST(MetalinkParserTest, NoUrl)
+{
+    MetalinkParser parser;
+    const char text[] =
+        "<metalink xmlns=\"urn:ietf:params:xml:ns:metalink\">"
+        "<file name=\"a\"><size>10</size></file>"
+        "</metalink>";
+
+    EXPECT_EQ(parser.parse(text), false);
+}
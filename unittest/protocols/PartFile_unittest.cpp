@@ -0,0 +1,135 @@
+#include "protocols/http/PartFile.h"
+#include "utility/File.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+static const char path[] = "./bitmap.part";
+
+TEST(PartFileTest, SetAndReopen)
+{
+    remove(path);
+    {
+        PartFile part;
+        ASSERT_EQ(part.open(path, 10000, 512), true);
+        EXPECT_EQ(part.blocks(), 20u);
+        part.setValidators("\"abc\"", "Tue, 15 Nov 1994 12:45:26 GMT");
+
+        part.setRange(0, 2, true);
+        part.setRange(3, 19, true);
+        part.setRange(5, 6, false);
+        // last block, shorter than others.
+        part.setRange(19, 20, true);
+    }
+
+    PartFile part;
+    ASSERT_EQ(part.open(path, 0, 512), true);
+    EXPECT_EQ(part.totalSize(), 10000u);
+    EXPECT_EQ(part.etag(), "\"abc\"");
+    EXPECT_EQ(part.lastModified(), "Tue, 15 Nov 1994 12:45:26 GMT");
+
+    BitMap map(10000, 512);
+    map.setAll(false);
+    EXPECT_EQ(part.load(map), true);
+    EXPECT_EQ(map.get(0), true);
+    EXPECT_EQ(map.get(1), true);
+    EXPECT_EQ(map.get(2), false);
+    EXPECT_EQ(map.get(4), true);
+    EXPECT_EQ(map.get(5), false);
+    EXPECT_EQ(map.get(18), true);
+    EXPECT_EQ(map.get(19), true);
+
+    EXPECT_EQ(part.remove(), true);
+}
+
+TEST(PartFileTest, NoPartForUnknownSize)
+{
+    remove(path);
+
+    PartFile part;
+    EXPECT_EQ(part.open(path, 0, 512), false);
+    EXPECT_EQ(part.isOpen(), false);
+}
+
+TEST(PartFileTest, OtherFileStartsAgain)
+{
+    remove(path);
+    {
+        PartFile part;
+        ASSERT_EQ(part.open(path, 10000, 512), true);
+        part.setRange(0, 20, true);
+    }
+
+    PartFile part;
+    ASSERT_EQ(part.open(path, 10000, 1024), true);
+    EXPECT_EQ(part.blocks(), 10u);
+
+    BitMap map(10000, 1024);
+    map.setAll(false);
+    EXPECT_EQ(part.load(map), true);
+    EXPECT_EQ(map.get(0), false);
+
+    part.remove();
+}
+
+static void corrupt(size_t offset)
+{
+    FILE* f = fopen(path, "r+b");
+    ASSERT_TRUE(f != NULL);
+    fseek(f, long(offset), SEEK_SET);
+    fputc(0x5a, f);
+    fclose(f);
+}
+
+TEST(PartFileTest, BadHeaderStartsAgain)
+{
+    // total size, bytes per block and ETag are all under the CRC.
+    size_t offsets[] = { 8, 16, 24 };
+    for (size_t i=0; i<sizeof(offsets) / sizeof(offsets[0]); ++i)
+    {
+        remove(path);
+        {
+            PartFile part;
+            ASSERT_EQ(part.open(path, 10000, 512), true);
+            part.setValidators("\"abc\"", "");
+            part.setRange(0, 20, true);
+        }
+
+        corrupt(offsets[i]);
+
+        // nothing to take size from, garbage isn't mapped as progress.
+        PartFile unknown;
+        EXPECT_EQ(unknown.open(path, 0, 512), false);
+
+        PartFile part;
+        ASSERT_EQ(part.open(path, 10000, 512), true);
+        EXPECT_EQ(part.etag(), "");
+        BitMap map(10000, 512);
+        map.setAll(false);
+        EXPECT_EQ(part.load(map), true);
+        EXPECT_EQ(map.get(0), false);
+        part.remove();
+    }
+}
+
+TEST(PartFileTest, TruncatedStartsAgain)
+{
+    remove(path);
+    {
+        PartFile part;
+        ASSERT_EQ(part.open(path, 10000, 512), true);
+        part.setRange(0, 20, true);
+    }
+
+    Utility::File::resize(path, PartFile::headerSize - 10);
+
+    PartFile part;
+    EXPECT_EQ(part.open(path, 0, 512), false);
+    ASSERT_EQ(part.open(path, 10000, 512), true);
+    BitMap map(10000, 512);
+    map.setAll(false);
+    EXPECT_EQ(part.load(map), true);
+    EXPECT_EQ(map.get(0), false);
+    part.remove();
+}
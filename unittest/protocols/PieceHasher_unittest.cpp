@@ -0,0 +1,93 @@
+#include "protocols/http/PieceHasher.h"
+#include "utility/Digest.h"
+#include "utility/File.h"
+#include "utility/ThreadPool.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <memory>
+#include <string>
+
+static const char path[] = "./pieces.file";
+
+static std::string digestOf(const std::string& data)
+{
+    std::auto_ptr<Utility::Digest> digest(Utility::Digest::create("sha-256"));
+    digest->update(data.c_str(), data.length());
+    return digest->hexFinal();
+}
+
+TEST(PieceHasherTest, Pieces)
+{
+    std::string data;
+    for (size_t i=0; i<300000; ++i)
+        data += char('a' + i % 26);
+
+    {
+        Utility::File out;
+        ASSERT_EQ(out.open(path, Utility::File::OF_Write | Utility::File::OF_Create |
+                           Utility::File::OF_Truncate), true);
+        ASSERT_EQ(out.write(data.c_str(), data.length()), ssize_t(data.length()));
+    }
+
+    // last piece is shorter, and one is out of file.
+    PieceHasher::Pieces pieces;
+    for (size_t i=0; i<3; ++i)
+    {
+        size_t length = std::min(data.length() - i * 131072, size_t(131072));
+        pieces.push_back(PieceHasher::Piece(i, i * 131072, length));
+    }
+    pieces.push_back(PieceHasher::Piece(3, 400000, 100));
+
+    Utility::ThreadPool pool(4);
+    ASSERT_EQ(PieceHasher::hash(path, "sha-256", pieces, pool), true);
+    for (size_t i=0; i<3; ++i)
+        EXPECT_EQ(pieces[i].digest, digestOf(data.substr(i * 131072, 131072)));
+    EXPECT_EQ(pieces[3].digest, "");
+
+    EXPECT_EQ(PieceHasher::hash(path, "sha-3", pieces, pool), false);
+
+    remove(path);
+    EXPECT_EQ(PieceHasher::hash(path, "sha-256", pieces, pool), false);
+}
+
+TEST(PieceHasherTest, Background)
+{
+    std::string data(200000, 'z');
+    {
+        Utility::File out;
+        ASSERT_EQ(out.open(path, Utility::File::OF_Write | Utility::File::OF_Create |
+                           Utility::File::OF_Truncate), true);
+        ASSERT_EQ(out.write(data.c_str(), data.length()), ssize_t(data.length()));
+    }
+
+    PieceHasher::Pieces pieces;
+    pieces.push_back(PieceHasher::Piece(7, 0, 100000));
+    pieces.push_back(PieceHasher::Piece(8, 100000, 100000));
+
+    Utility::ThreadPool pool(2);
+    PieceHasher hasher;
+    EXPECT_EQ(hasher.started(), false);
+    EXPECT_EQ(hasher.done(), false);
+    ASSERT_EQ(hasher.start(path, "sha-256", pieces, pool), true);
+    EXPECT_EQ(hasher.started(), true);
+
+    PieceHasher::Pieces done;
+    hasher.take(done);
+    EXPECT_EQ(hasher.started(), false);
+    ASSERT_EQ(done.size(), 2u);
+    EXPECT_EQ(done[1].index, 8u);
+    EXPECT_EQ(done[0].digest, digestOf(data.substr(0, 100000)));
+    EXPECT_EQ(done[1].digest, digestOf(data.substr(100000)));
+
+    // dropped while hashing, it's waited for.
+    ASSERT_EQ(hasher.start(path, "sha-256", pieces, pool), true);
+    hasher.cancel();
+    EXPECT_EQ(hasher.started(), false);
+
+    EXPECT_EQ(hasher.start(path, "sha-3", pieces, pool), false);
+    remove(path);
+    EXPECT_EQ(hasher.start(path, "sha-256", pieces, pool), false);
+}
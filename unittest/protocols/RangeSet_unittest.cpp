@@ -0,0 +1,81 @@
+#include "protocols/http/RangeSet.h"
+
+#include <gtest/gtest.h>
+
+static void expectRange(const RangeSet& set, size_t index, size_t begin, size_t end)
+{
+    ASSERT_LT(index, set.ranges().size());
+    EXPECT_EQ(set.ranges()[index].first, begin);
+    EXPECT_EQ(set.ranges()[index].second, end);
+}
+
+TEST(RangeSetTest, AddMerges)
+{
+    RangeSet set;
+    set.add(100, 200);
+    set.add(300, 400);
+    EXPECT_EQ(set.ranges().size(), 2u);
+    EXPECT_EQ(set.prefix(), 0u);
+
+    // touching ranges become one.
+    RangeSet::Range merged = set.add(200, 300);
+    EXPECT_EQ(merged.first, 100u);
+    EXPECT_EQ(merged.second, 400u);
+    ASSERT_EQ(set.ranges().size(), 1u);
+
+    set.add(0, 50);
+    set.add(500, 600);
+    set.add(40, 120);
+    ASSERT_EQ(set.ranges().size(), 2u);
+    expectRange(set, 0, 0, 400);
+    expectRange(set, 1, 500, 600);
+    EXPECT_EQ(set.prefix(), 400u);
+    EXPECT_EQ(set.bytes(), 500u);
+
+    EXPECT_EQ(set.contains(10, 400), true);
+    EXPECT_EQ(set.contains(399, 501), false);
+    EXPECT_EQ(set.contains(500, 600), true);
+    EXPECT_EQ(set.contains(600, 601), false);
+}
+
+TEST(RangeSetTest, Remove)
+{
+    RangeSet set;
+    set.add(0, 1000);
+    set.add(2000, 3000);
+
+    set.remove(100, 200);
+    set.remove(900, 2100);
+    ASSERT_EQ(set.ranges().size(), 3u);
+    expectRange(set, 0, 0, 100);
+    expectRange(set, 1, 200, 900);
+    expectRange(set, 2, 2100, 3000);
+
+    set.remove(0, 5000);
+    EXPECT_EQ(set.empty(), true);
+}
+
+TEST(RangeSetTest, Missing)
+{
+    RangeSet set;
+    EXPECT_EQ(set.missing(10, 20).size(), 1u);
+
+    set.add(100, 200);
+    set.add(300, 400);
+
+    RangeSet::Ranges missing = set.missing(50, 350);
+    ASSERT_EQ(missing.size(), 2u);
+    EXPECT_EQ(missing[0], RangeSet::Range(50, 100));
+    EXPECT_EQ(missing[1], RangeSet::Range(200, 300));
+
+    missing = set.missing(150, 500);
+    ASSERT_EQ(missing.size(), 2u);
+    EXPECT_EQ(missing[0], RangeSet::Range(200, 300));
+    EXPECT_EQ(missing[1], RangeSet::Range(400, 500));
+
+    EXPECT_EQ(set.missing(100, 200).size(), 0u);
+    EXPECT_EQ(set.missing(310, 390).size(), 0u);
+    missing = set.missing(200, 300);
+    ASSERT_EQ(missing.size(), 1u);
+    EXPECT_EQ(missing[0], RangeSet::Range(200, 300));
+}
@@ -0,0 +1,237 @@
+#include "protocols/http/ResumeJournal.h"
+
+#include <gtest/gtest.h>
+
+#include <stdio.h>
+
+#include <string>
+#include <vector>
+
+static const char path[] = "./resume.journal";
+
+static ResumeJournal::Ranges make(size_t begin, size_t end)
+{
+    return ResumeJournal::Ranges(1, std::make_pair(begin, end));
+}
+
+static void expectRange(ResumeJournal& journal, size_t index, size_t begin, size_t end)
+{
+    ASSERT_LT(index, journal.ranges().size());
+    EXPECT_EQ(journal.ranges()[index].first, begin);
+    EXPECT_EQ(journal.ranges()[index].second, end);
+}
+
+TEST(ResumeJournalTest, AppendAndReplay)
+{
+    remove(path);
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        EXPECT_EQ(journal.ranges().size(), 0u);
+        EXPECT_EQ(journal.append(make(0, 1024)), true);
+        EXPECT_EQ(journal.setValidators("\"abc\"", "Tue, 15 Nov 1994 12:45:26 GMT"), true);
+        EXPECT_EQ(journal.append(make(4096, 10000)), true);
+    }
+
+    ResumeJournal journal;
+    ASSERT_EQ(journal.open(path, 0, 512), true);
+    EXPECT_EQ(journal.totalSize(), 10000u);
+    EXPECT_EQ(journal.etag(), "\"abc\"");
+    EXPECT_EQ(journal.lastModified(), "Tue, 15 Nov 1994 12:45:26 GMT");
+    EXPECT_EQ(journal.records(), 2u);
+    ASSERT_EQ(journal.ranges().size(), 2u);
+    expectRange(journal, 0, 0, 1024);
+    expectRange(journal, 1, 4096, 10000);
+
+    EXPECT_EQ(journal.remove(), true);
+}
+
+TEST(ResumeJournalTest, SetValidatorsRewrites)
+{
+    remove(path);
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        journal.append(make(0, 512));
+        journal.append(make(256, 1024));
+        journal.append(make(4096, 5000));
+
+        // the header comes with a new journal, not written over the old one.
+        EXPECT_EQ(journal.setValidators("\"abc\"", ""), true);
+        EXPECT_EQ(journal.records(), 2u);
+        EXPECT_EQ(Utility::File::exist("./resume.journal.tmp"), false);
+        journal.append(make(8192, 10000));
+    }
+
+    ResumeJournal journal;
+    ASSERT_EQ(journal.open(path, 10000, 512), true);
+    EXPECT_EQ(journal.etag(), "\"abc\"");
+    ASSERT_EQ(journal.ranges().size(), 3u);
+    expectRange(journal, 0, 0, 1024);
+    expectRange(journal, 1, 4096, 5000);
+    expectRange(journal, 2, 8192, 10000);
+
+    journal.remove();
+}
+
+TEST(ResumeJournalTest, NoJournalForUnknownSize)
+{
+    remove(path);
+
+    ResumeJournal journal;
+    EXPECT_EQ(journal.open(path, 0, 512), false);
+    EXPECT_EQ(journal.isOpen(), false);
+}
+
+TEST(ResumeJournalTest, TornRecordIsCut)
+{
+    remove(path);
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        journal.append(make(0, 512));
+        journal.append(make(512, 1024));
+    }
+
+    // crash in the middle of the last record.
+    Utility::File::resize(path, ResumeJournal::headerSize + ResumeJournal::recordSize + 7);
+
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        EXPECT_EQ(journal.records(), 1u);
+        journal.append(make(2048, 4096));
+    }
+
+    ResumeJournal journal;
+    ASSERT_EQ(journal.open(path, 10000, 512), true);
+    ASSERT_EQ(journal.ranges().size(), 2u);
+    expectRange(journal, 1, 2048, 4096);
+
+    journal.remove();
+}
+
+TEST(ResumeJournalTest, OtherFileStartsAgain)
+{
+    remove(path);
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        journal.append(make(0, 512));
+    }
+
+    ResumeJournal journal;
+    ASSERT_EQ(journal.open(path, 20000, 512), true);
+    EXPECT_EQ(journal.ranges().size(), 0u);
+    EXPECT_EQ(journal.totalSize(), 20000u);
+
+    journal.remove();
+}
+
+TEST(ResumeJournalTest, Compact)
+{
+    remove(path);
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        for (size_t i=0; i<10; ++i)
+            journal.append(make(i * 512, (i + 1) * 512));
+
+        EXPECT_EQ(journal.compact(make(0, 5120)), true);
+        EXPECT_EQ(journal.records(), 1u);
+        journal.append(make(8192, 10000));
+    }
+
+    ResumeJournal journal;
+    ASSERT_EQ(journal.open(path, 10000, 512), true);
+    ASSERT_EQ(journal.ranges().size(), 2u);
+    expectRange(journal, 0, 0, 5120);
+    expectRange(journal, 1, 8192, 10000);
+
+    journal.remove();
+}
+
+TEST(ResumeJournalTest, CrashAtAnyByte)
+{
+    remove(path);
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        for (size_t i=0; i<4; ++i)
+            journal.append(make(i * 1024, i * 1024 + 512));
+    }
+
+    std::vector<char> whole(ResumeJournal::headerSize + 4 * ResumeJournal::recordSize);
+    {
+        Utility::File in;
+        ASSERT_EQ(in.open(path, Utility::File::OF_Read), true);
+        ASSERT_EQ(in.read(&whole[0], whole.size()), ssize_t(whole.size()));
+    }
+
+    // process killed after any byte written, resume sees only whole records.
+    for (size_t len=0; len<=whole.size(); ++len)
+    {
+        {
+            Utility::File out;
+            ASSERT_EQ(out.open(path, Utility::File::OF_Write | Utility::File::OF_Create |
+                               Utility::File::OF_Truncate), true);
+            if (len > 0)
+                out.write(&whole[0], len);
+        }
+
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 10000, 512), true);
+        size_t records = (len < ResumeJournal::headerSize)
+            ? 0 : (len - ResumeJournal::headerSize) / ResumeJournal::recordSize;
+        ASSERT_EQ(journal.ranges().size(), records);
+        for (size_t i=0; i<records; ++i)
+            expectRange(journal, i, i * 1024, i * 1024 + 512);
+    }
+
+    remove(path);
+}
+
+TEST(ResumeJournalTest, BlockCrcs)
+{
+    remove(path);
+    size_t span;
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 3000000, 1000), true);
+        span = journal.crcBlockSize();
+        EXPECT_EQ(span, 1049000u);
+
+        ResumeJournal::Crcs crcs;
+        crcs[0] = 0x11111111;
+        crcs[2] = 0x22222222;
+        EXPECT_EQ(journal.append(make(0, span), crcs), true);
+
+        // block 2 downloaded again.
+        ResumeJournal::Crcs again;
+        again[2] = 0x33333333;
+        EXPECT_EQ(journal.append(make(2 * span, 3000000), again), true);
+    }
+
+    {
+        ResumeJournal journal;
+        ASSERT_EQ(journal.open(path, 3000000, 1000), true);
+        EXPECT_EQ(journal.records(), 5u);
+        ASSERT_EQ(journal.crcs().size(), 2u);
+        EXPECT_EQ(journal.crcs().find(0)->second, 0x11111111u);
+        EXPECT_EQ(journal.crcs().find(2)->second, 0x33333333u);
+
+        // block 0 is not all done any more, its CRC goes.
+        ResumeJournal::Ranges done;
+        done.push_back(std::make_pair(size_t(0), size_t(1000)));
+        done.push_back(std::make_pair(2 * span, size_t(3000000)));
+        EXPECT_EQ(journal.compact(done), true);
+        EXPECT_EQ(journal.records(), 3u);
+    }
+
+    ResumeJournal journal;
+    ASSERT_EQ(journal.open(path, 3000000, 1000), true);
+    ASSERT_EQ(journal.crcs().size(), 1u);
+    EXPECT_EQ(journal.crcs().find(2)->second, 0x33333333u);
+
+    journal.remove();
+}
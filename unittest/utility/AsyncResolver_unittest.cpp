@@ -0,0 +1,49 @@
+#include "utility/AsyncResolver.h"
+
+#include <gtest/gtest.h>
+
+#include <unistd.h>
+
+#include <string>
+#include <vector>
+
+using Utility::AsyncResolver;
+
+static bool waitDone(AsyncResolver& resolver)
+{
+    for (int i=0; i<500 && !resolver.done(); ++i)
+        usleep(10 * 1000);
+
+    return resolver.done();
+}
+
+TEST(AsyncResolverTest, NumericHost)
+{
+    AsyncResolver resolver;
+    EXPECT_FALSE(resolver.started());
+    ASSERT_TRUE(resolver.start("127.0.0.1"));
+    EXPECT_TRUE(resolver.started());
+    ASSERT_TRUE(waitDone(resolver));
+
+    std::vector<std::string> addresses;
+    std::string error;
+    ASSERT_TRUE(resolver.addresses(addresses, error));
+    ASSERT_EQ(addresses.size(), 1u);
+    EXPECT_EQ(addresses[0], "127.0.0.1");
+}
+
+TEST(AsyncResolverTest, CancelWhileRunning)
+{
+    // the thread frees a dropped lookup by itself.
+    for (int i=0; i<10; ++i)
+    {
+        AsyncResolver resolver;
+        ASSERT_TRUE(resolver.start("::1"));
+    }
+
+    AsyncResolver resolver;
+    std::vector<std::string> addresses;
+    std::string error;
+    EXPECT_FALSE(resolver.done());
+    EXPECT_FALSE(resolver.addresses(addresses, error));
+}
@@ -0,0 +1,63 @@
+#include "utility/Crc32c.h"
+
+#include <gtest/gtest.h>
+
+#include <string.h>
+
+#include <vector>
+
+using Utility::Crc32c;
+
+TEST(Crc32cTest, CheckValue)
+{
+    const char data[] = "123456789";
+
+    EXPECT_EQ(Crc32c::compute(data, strlen(data)), 0xE3069283u);
+    EXPECT_EQ(Crc32c::compute(data, 0), 0u);
+}
+
+TEST(Crc32cTest, Chain)
+{
+    const char data[] = "123456789";
+
+    uint32_t crc = Crc32c::update(0, data, 4);
+    EXPECT_EQ(Crc32c::update(crc, data + 4, 5), 0xE3069283u);
+}
+
+TEST(Crc32cTest, Combine)
+{
+    const char data[] = "123456789";
+
+    for (size_t i=0; i<=9; ++i)
+    {
+        uint32_t crc1 = Crc32c::compute(data, i);
+        uint32_t crc2 = Crc32c::compute(data + i, 9 - i);
+        EXPECT_EQ(Crc32c::combine(crc1, crc2, 9 - i), 0xE3069283u);
+    }
+}
+
+TEST(Crc32cTest, TableAndHardware)
+{
+    std::vector<unsigned char> data(4096 + 7);
+    uint32_t seed = 1;
+    for (size_t i=0; i<data.size(); ++i)
+    {
+        seed = seed * 1103515245 + 12345;
+        data[i] = (seed >> 16) & 0xff;
+    }
+
+    // every alignment and tail length.
+    for (size_t begin=0; begin<8; ++begin)
+    {
+        for (size_t len=0; len<64; ++len)
+        {
+            EXPECT_EQ(Crc32c::update(0x1234, &data[begin], len),
+                      Crc32c::updateTable(0x1234, &data[begin], len));
+        }
+        EXPECT_EQ(Crc32c::update(0, &data[begin], 4096),
+                  Crc32c::updateTable(0, &data[begin], 4096));
+    }
+
+    const char check[] = "123456789";
+    EXPECT_EQ(Crc32c::updateTable(0, check, strlen(check)), 0xE3069283u);
+}
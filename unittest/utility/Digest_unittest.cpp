@@ -0,0 +1,64 @@
+#include "utility/Digest.h"
+
+#include <gtest/gtest.h>
+
+#include <memory>
+#include <string>
+
+using Utility::Digest;
+
+static std::string digestOf(const char* type, const std::string& text)
+{
+    std::auto_ptr<Digest> digest(Digest::create(type));
+    if (digest.get() == NULL)
+        return "";
+
+    digest->update(text.c_str(), text.length());
+    return digest->hexFinal();
+}
+
+TEST(DigestTest, Sha1)
+{
+    EXPECT_EQ(digestOf("sha-1", ""), "da39a3ee5e6b4b0d3255bfef95601890afd80709");
+    EXPECT_EQ(digestOf("sha-1", "abc"), "a9993e364706816aba3e25717850c26c9cd0d89d");
+    EXPECT_EQ(digestOf("sha-1", "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq"),
+              "84983e441c3bd26ebaae4aa1f95129e5e54670f1");
+}
+
+TEST(DigestTest, Md5)
+{
+    EXPECT_EQ(digestOf("md5", ""), "d41d8cd98f00b204e9800998ecf8427e");
+    EXPECT_EQ(digestOf("md5", "abc"), "900150983cd24fb0d6963f7d28e17f72");
+    EXPECT_EQ(digestOf("MD5", "12345678901234567890123456789012345678901234567890123456789012345678901234567890"),
+              "57edf4a22be3c955ac49da2e2107b67a");
+}
+
+TEST(DigestTest, Sha256)
+{
+    EXPECT_EQ(digestOf("SHA-256", "abc"),
+              "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+TEST(DigestTest, Crc32c)
+{
+    EXPECT_EQ(digestOf("crc32c", ""), "00000000");
+    EXPECT_EQ(digestOf("CRC32C", "123456789"), "e3069283");
+}
+
+TEST(DigestTest, Unknown)
+{
+    EXPECT_EQ(Digest::create("sha-3") == NULL, true);
+    EXPECT_EQ(Digest::create("") == NULL, true);
+}
+
+TEST(DigestTest, Reuse)
+{
+    std::auto_ptr<Digest> digest(Digest::create("sha-1"));
+    digest->update("xyz", 3);
+    digest->hexFinal();
+
+    digest->init();
+    for (int i=0; i<3; ++i)
+        digest->update("abc" + i, 1);
+    EXPECT_EQ(digest->hexFinal(), "a9993e364706816aba3e25717850c26c9cd0d89d");
+}
@@ -0,0 +1,67 @@
+#include "utility/FairShare.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using Utility::FairShare;
+
+static std::vector<int> make(int a, int b, int c)
+{
+    std::vector<int> ret;
+    ret.push_back(a);
+    ret.push_back(b);
+    ret.push_back(c);
+    return ret;
+}
+
+static void expectShares(const std::vector<int>& shares, int a, int b, int c)
+{
+    ASSERT_EQ(shares.size(), 3u);
+    EXPECT_EQ(shares[0], a);
+    EXPECT_EQ(shares[1], b);
+    EXPECT_EQ(shares[2], c);
+}
+
+TEST(FairShareTest, NoLimited)
+{
+    std::vector<int> shares;
+    FairShare::allocate(make(1, 1, 1), make(50, 5, 0), FairShare::noLimited, shares);
+
+    expectShares(shares, 50, 5, 0);
+}
+
+TEST(FairShareTest, EnoughCapacity)
+{
+    std::vector<int> shares;
+    FairShare::allocate(make(1, 4, 1), make(5, 5, 5), 20, shares);
+
+    expectShares(shares, 5, 5, 5);
+}
+
+TEST(FairShareTest, BulkDoesNotStarveInteractive)
+{
+    std::vector<int> shares;
+    FairShare::allocate(make(1, 8, 8), make(50, 5, 5), 20, shares);
+
+    // small tasks get all they want, bulk task take the rest.
+    expectShares(shares, 10, 5, 5);
+}
+
+TEST(FairShareTest, ByWeight)
+{
+    std::vector<int> shares;
+    FairShare::allocate(make(1, 2, 1), make(50, 50, 50), 20, shares);
+
+    expectShares(shares, 5, 10, 5);
+}
+
+TEST(FairShareTest, EveryoneGetOne)
+{
+    std::vector<int> shares;
+    FairShare::allocate(make(1, 100, 1), make(50, 50, 50), 5, shares);
+
+    EXPECT_EQ(shares[0], 1);
+    EXPECT_EQ(shares[2], 1);
+    EXPECT_EQ(shares[0] + shares[1] + shares[2], 5);
+}
@@ -68,6 +68,24 @@ TEST(FileTest, SeekRead)
     ASSERT_EQ(f.isOpen(), false);
 }
 
+TEST(FileTest, ReadAt)
+{
+    File f;
+    f.open("./test.file", File::OF_Read);
+    ASSERT_EQ(f.isOpen(), true);
+
+    char buf[4] = {0};
+    ASSERT_EQ(f.readAt(buf, 1, 2), 1);
+    ASSERT_EQ(buf[0], '3');
+
+    // file position isn't moved.
+    ASSERT_EQ(f.read(buf, 3), 3);
+    buf[3] = '\0';
+    ASSERT_STREQ(buf, "123");
+
+    f.close();
+}
+
 TEST(FileTest, CheckEof)
 {
     File f;
@@ -113,3 +131,11 @@ TEST(FileTest, Remove)
     File f;
     ASSERT_EQ(f.open("./test.file", File::OF_Read), false);
 }
+
+TEST(FileTest, SyncDir)
+{
+    ASSERT_EQ(File::syncDir("./test.file"), true);
+    ASSERT_EQ(File::syncDir("test.file"), true);
+    ASSERT_EQ(File::syncDir("/tmp"), true);
+    ASSERT_EQ(File::syncDir("./no/such/dir/file"), false);
+}
@@ -0,0 +1,53 @@
+#include "utility/HostLimiter.h"
+
+#include <gtest/gtest.h>
+
+using Utility::HostLimiter;
+
+TEST(HostLimiterTest, NoLimited)
+{
+    HostLimiter limiter;
+
+    for (int i=0; i<10; ++i)
+    {
+        ASSERT_EQ(limiter.acquire("example.com"), true);
+    }
+    EXPECT_EQ(limiter.connections("example.com"), 10);
+
+    for (int i=0; i<10; ++i)
+    {
+        limiter.release("example.com");
+    }
+    EXPECT_EQ(limiter.connections("example.com"), 0);
+}
+
+TEST(HostLimiterTest, PerHost)
+{
+    HostLimiter limiter(2);
+
+    EXPECT_EQ(limiter.acquire("a.com"), true);
+    EXPECT_EQ(limiter.acquire("a.com"), true);
+    EXPECT_EQ(limiter.acquire("a.com"), false);
+
+    // other host has its own budget.
+    EXPECT_EQ(limiter.acquire("b.com"), true);
+
+    limiter.release("a.com");
+    EXPECT_EQ(limiter.acquire("a.com"), true);
+    EXPECT_EQ(limiter.connections("a.com"), 2);
+}
+
+TEST(HostLimiterTest, NewMaxAfterDrained)
+{
+    HostLimiter limiter(1);
+
+    EXPECT_EQ(limiter.acquire("a.com"), true);
+    limiter.setMaxPerHost(3);
+    EXPECT_EQ(limiter.acquire("a.com"), false);
+
+    limiter.release("a.com");
+    EXPECT_EQ(limiter.acquire("a.com"), true);
+    EXPECT_EQ(limiter.acquire("a.com"), true);
+    EXPECT_EQ(limiter.acquire("a.com"), true);
+    EXPECT_EQ(limiter.acquire("a.com"), false);
+}
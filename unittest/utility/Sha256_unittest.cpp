@@ -0,0 +1,51 @@
+#include "utility/Sha256.h"
+
+#include <gtest/gtest.h>
+
+#include <string>
+
+using Utility::Sha256;
+
+TEST(Sha256Test, Empty)
+{
+    Sha256 sha;
+
+    EXPECT_EQ(sha.hexFinal(), "e3b0c44298fc1c149afbf4c8996fb92427ae41e4649b934ca495991b7852b855");
+}
+
+TEST(Sha256Test, Abc)
+{
+    Sha256 sha;
+    sha.update("abc", 3);
+
+    EXPECT_EQ(sha.hexFinal(), "ba7816bf8f01cfea414140de5dae2223b00361a396177a9cb410ff61f20015ad");
+}
+
+TEST(Sha256Test, TwoBlocks)
+{
+    const std::string text = "abcdbcdecdefdefgefghfghighijhijkijkljklmklmnlmnomnopnopq";
+
+    Sha256 sha;
+    sha.update(text.c_str(), text.length());
+    EXPECT_EQ(sha.hexFinal(), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+
+    // same digest when fed byte by byte.
+    sha.init();
+    for (size_t i=0; i<text.length(); ++i)
+    {
+        sha.update(text.c_str() + i, 1);
+    }
+    EXPECT_EQ(sha.hexFinal(), "248d6a61d20638b8e5c026930c3e6039a33ce45964ff2167f6ecedd419db06c1");
+}
+
+TEST(Sha256Test, Million)
+{
+    std::string text(1000, 'a');
+
+    Sha256 sha;
+    for (int i=0; i<1000; ++i)
+    {
+        sha.update(text.c_str(), text.length());
+    }
+    EXPECT_EQ(sha.hexFinal(), "cdc76e5c9914fb9281a1c7e284d73e67f1809a48a497200e046d39ccc7112cd0");
+}
@@ -0,0 +1,86 @@
+#include "utility/ThreadPool.h"
+
+#include <gtest/gtest.h>
+
+#include <vector>
+
+using Utility::ThreadPool;
+
+class Square : public ThreadPool::Job
+{
+public:
+    explicit Square(std::vector<size_t>& out) : out_(out) {}
+
+    void run(size_t index)
+        {
+            out_[index] = index * index;
+        }
+
+private:
+    std::vector<size_t>& out_;
+};
+
+TEST(ThreadPoolTest, EveryIndexOnce)
+{
+    ThreadPool pool(4);
+    EXPECT_EQ(pool.threads(), 4u);
+
+    std::vector<size_t> out(1000, 0);
+    Square job(out);
+    pool.run(job, out.size());
+    for (size_t i=0; i<out.size(); ++i)
+        EXPECT_EQ(out[i], i * i);
+
+    // pool is reused for next job.
+    std::vector<size_t> again(10, 0);
+    Square job2(again);
+    pool.run(job2, again.size());
+    EXPECT_EQ(again[9], 81u);
+}
+
+TEST(ThreadPoolTest, CallerOnly)
+{
+    ThreadPool pool(1);
+    EXPECT_EQ(pool.threads(), 1u);
+
+    std::vector<size_t> out(3, 0);
+    Square job(out);
+    pool.run(job, out.size());
+    EXPECT_EQ(out[2], 4u);
+
+    pool.run(job, 0);
+}
+
+TEST(ThreadPoolTest, StartInBackground)
+{
+    ThreadPool pool(3);
+    EXPECT_FALSE(pool.busy());
+
+    std::vector<size_t> out(1000, 0);
+    Square job(out);
+    pool.start(job, out.size());
+    pool.wait(job);
+    EXPECT_TRUE(pool.done(job));
+    EXPECT_FALSE(pool.busy());
+    for (size_t i=0; i<out.size(); ++i)
+        EXPECT_EQ(out[i], i * i);
+
+    // run waits for a job started before.
+    std::vector<size_t> first(1000, 0);
+    std::vector<size_t> second(1000, 0);
+    Square job1(first);
+    Square job2(second);
+    pool.start(job1, first.size());
+    pool.run(job2, second.size());
+    EXPECT_TRUE(pool.done(job1));
+    EXPECT_EQ(first[999], 999u * 999u);
+    EXPECT_EQ(second[999], 999u * 999u);
+
+    // without workers it's done at once.
+    ThreadPool caller(1);
+    std::vector<size_t> here(3, 0);
+    Square job3(here);
+    caller.start(job3, here.size());
+    EXPECT_TRUE(caller.done(job3));
+    EXPECT_EQ(here[2], 4u);
+}
@@ -0,0 +1,76 @@
+#include "utility/TokenBucket.h"
+
+#include <gtest/gtest.h>
+
+using Utility::TokenBucket;
+
+TEST(TokenBucketTest, NoLimited)
+{
+    TokenBucket bucket;
+
+    EXPECT_EQ(bucket.limited(), false);
+    bucket.consume(1000000);
+    EXPECT_EQ(bucket.mayReceive(1), true);
+}
+
+TEST(TokenBucketTest, Rate)
+{
+    TokenBucket bucket(10000);
+    EXPECT_EQ(bucket.limited(), true);
+
+    // starts full, a tenth of a second.
+    EXPECT_EQ(bucket.mayReceive(1000), true);
+    EXPECT_EQ(bucket.tokens(), 1000);
+
+    // 10 ms give 100 bytes.
+    bucket.consume(1300);
+    EXPECT_EQ(bucket.mayReceive(1010), false);
+    EXPECT_EQ(bucket.tokens(), -200);
+    EXPECT_EQ(bucket.mayReceive(1030), false);
+    EXPECT_EQ(bucket.mayReceive(1031), true);
+}
+
+TEST(TokenBucketTest, NoBurstAfterIdle)
+{
+    TokenBucket bucket(10000);
+    bucket.mayReceive(1000);
+    bucket.mayReceive(100000);
+
+    // a tenth of a second at most.
+    EXPECT_EQ(bucket.tokens(), 1000);
+}
+
+TEST(TokenBucketTest, Chain)
+{
+    TokenBucket global(10000);
+    TokenBucket host(TokenBucket::noLimited, &global);
+    TokenBucket task(100000, &host);
+
+    EXPECT_EQ(task.mayReceive(1000), true);
+
+    // global has 1000 bytes only.
+    task.consume(1200);
+    EXPECT_EQ(global.tokens(), -200);
+    EXPECT_EQ(task.tokens(), 8800);
+    EXPECT_EQ(task.mayReceive(1015), false);
+
+    // change at runtime.
+    global.setRate(TokenBucket::noLimited);
+    EXPECT_EQ(task.mayReceive(1016), true);
+}
+
+TEST(TokenBucketTest, FullWhenLimited)
+{
+    TokenBucket bucket;
+    bucket.consume(5000);
+
+    // bytes taken while not limited aren't owed.
+    bucket.setRate(10000);
+    EXPECT_EQ(bucket.tokens(), 1000);
+    EXPECT_EQ(bucket.mayReceive(1000), true);
+
+    // a lower rate keeps what's left, up to its burst.
+    bucket.consume(900);
+    bucket.setRate(5000);
+    EXPECT_EQ(bucket.tokens(), 100);
+}